@@ -29,6 +29,8 @@
 #include "fty_mdns_sd.h"
 #include "../src/avahi_wrapper.h"
 
+#include <algorithm>
+
 void
 usage(){
     puts ("fty-mdns-sd [options] ...");
@@ -56,6 +58,24 @@ s_get (zconfig_t *config, const char* key, char*dfl) {
     return ret;
 }
 
+//  uid of this device, seeding the announce jitter: the machine id, else
+//  the host name
+static std::string
+s_device_uid ()
+{
+    char uid [256] = "";
+    FILE *file = fopen ("/etc/machine-id", "r");
+    if (file) {
+        if (!fgets (uid, sizeof (uid), file))
+            uid [0] = 0;
+        fclose (file);
+        uid [strcspn (uid, "\r\n")] = 0;
+    }
+    if (!uid [0])
+        gethostname (uid, sizeof (uid) - 1);
+    return uid;
+}
+
 int
 main (int argc, char *argv [])
 {
@@ -69,6 +89,33 @@ main (int argc, char *argv [])
     char* actor_name = (char*)"fty-mdns-sd";
     char* endpoint = (char*)"ipc://@/malamute";
     char* fty_info_command = (char*)"INFO";
+    char* coalesce_window = (char*)"0";
+    char* coalesce_max_delay = (char*)"0";
+    char* state_file = (char*)"/var/lib/fty/fty-mdns-sd/announce.zpl";
+    char* default_subtypes = (char*)"";
+    char* jitter = (char*)"0";
+    char* jitter_txt = (char*)"0";
+    std::string device_uid = s_device_uid ();
+    char* uid = (char*)device_uid.c_str ();
+    char* txt_budget = (char*)"0";
+    char* txt_priority = (char*)"";
+    char* txt_overflow = (char*)"move";
+    char* proxy_types = (char*)"";
+    char* proxy_type = (char*)"_https._tcp";
+    char* proxy_port = (char*)"443";
+    char* proxy_rate = (char*)"20";
+    char* proxy_burst = (char*)"10";
+    char* metrics_interval = (char*)"0";
+    char* discovery_types = (char*)"";
+    char* discovery_ttl = (char*)"120000";
+    char* discovery_mode = (char*)"browse";
+    char* discovery_resolve = (char*)"lazy";
+    char* discovery_resolvers = (char*)"8";
+    char* discovery_resolve_ttl = (char*)"120000";
+    char* discovery_resolve_wait = (char*)"2000";
+    char* publish_interfaces = (char*)"";
+    char* publish_protocol = (char*)"any";
+    char* publish_backend = (char*)"avahi";
 
     ManageFtyLog::setInstanceFtylog(actor_name);
 
@@ -118,6 +165,38 @@ main (int argc, char *argv [])
 
         fty_info_command = s_get (config, "fty-info/command", fty_info_command);
 
+        coalesce_window = s_get (config, "announce/coalesce_window", coalesce_window);
+        coalesce_max_delay = s_get (config, "announce/coalesce_max_delay", coalesce_max_delay);
+        state_file = s_get (config, "announce/state_file", state_file);
+        default_subtypes = s_get (config, "announce/subtypes", default_subtypes);
+        jitter = s_get (config, "announce/jitter", jitter);
+        jitter_txt = s_get (config, "announce/jitter_txt", jitter_txt);
+        uid = s_get (config, "announce/uid", uid);
+
+        txt_budget = s_get (config, "txt/budget", txt_budget);
+        txt_priority = s_get (config, "txt/priority", txt_priority);
+        txt_overflow = s_get (config, "txt/overflow", txt_overflow);
+
+        proxy_types = s_get (config, "proxy/types", proxy_types);
+        proxy_type = s_get (config, "proxy/type", proxy_type);
+        proxy_port = s_get (config, "proxy/port", proxy_port);
+        proxy_rate = s_get (config, "proxy/rate", proxy_rate);
+        proxy_burst = s_get (config, "proxy/burst", proxy_burst);
+
+        metrics_interval = s_get (config, "metrics/interval", metrics_interval);
+
+        discovery_types = s_get (config, "discovery/types", discovery_types);
+        discovery_ttl = s_get (config, "discovery/ttl", discovery_ttl);
+        discovery_mode = s_get (config, "discovery/mode", discovery_mode);
+        discovery_resolve = s_get (config, "discovery/resolve", discovery_resolve);
+        discovery_resolvers = s_get (config, "discovery/resolvers", discovery_resolvers);
+        discovery_resolve_ttl = s_get (config, "discovery/resolve_ttl", discovery_resolve_ttl);
+        discovery_resolve_wait = s_get (config, "discovery/resolve_wait", discovery_resolve_wait);
+
+        publish_interfaces = s_get (config, "publish/interfaces", publish_interfaces);
+        publish_protocol = s_get (config, "publish/protocol", publish_protocol);
+        publish_backend = s_get (config, "publish/backend", publish_backend);
+
         log_config = zconfig_get (config, "log/config", default_log_config);
     }
     else {
@@ -138,10 +217,50 @@ main (int argc, char *argv [])
     }
     zstr_sendx (server, "CONNECT", endpoint, NULL);
     zstr_sendx (server, "CONSUMER", "ANNOUNCE", ".*", NULL);
+    zstr_sendx (server, "PRODUCER", "DISCOVERY", NULL);
+    zstr_sendx (server, "SET-COALESCE", coalesce_window, coalesce_max_delay, NULL);
+    zstr_sendx (server, "SET-METRICS", metrics_interval, NULL);
+    zstr_sendx (server, "SET-DISCOVERY-TTL", discovery_ttl, NULL);
+    zstr_sendx (server, "SET-DISCOVERY-MODE", discovery_mode, NULL);
+    zstr_sendx (server, "SET-DISCOVERY-RESOLVE", discovery_resolve, discovery_resolvers, discovery_resolve_ttl,
+        discovery_resolve_wait, NULL);
+    if (!streq (discovery_types, "")) {
+        zmsg_t *browse = zmsg_new ();
+        zmsg_addstr (browse, "BROWSE");
+        char *types = strdup (discovery_types);
+        for (char *type = strtok (types, ", "); type; type = strtok (NULL, ", "))
+            zmsg_addstr (browse, type);
+        free (types);
+        zmsg_send (&browse, server);
+    }
+
+    //publishing backend: avahi-daemon, or the built-in responder (AVAHI, RESPONDER)
+    std::string backend = publish_backend;
+    std::transform (backend.begin (), backend.end (), backend.begin (), ::toupper);
+    zstr_sendx (server, "SET-PUBLISHER", backend.c_str (), NULL);
+
+    //publishing policy, the default one then per service key overrides
+    zstr_sendx (server, "SET-PUBLISH-POLICY", "*", publish_interfaces, publish_protocol, NULL);
+    zconfig_t *publish = config ? zconfig_locate (config, "publish") : NULL;
+    for (zconfig_t *item = publish ? zconfig_child (publish) : NULL; item; item = zconfig_next (item)) {
+        if (!zconfig_child (item))
+            continue;
+        zstr_sendx (server, "SET-PUBLISH-POLICY", zconfig_name (item),
+            zconfig_get (item, "interfaces", publish_interfaces),
+            zconfig_get (item, "protocol", publish_protocol), NULL);
+    }
 
-    ////do first announcement
-    zclock_sleep (5000);
+    zstr_sendx (server, "SET-DEFAULT-SUBTYPES", default_subtypes, NULL);
+    zstr_sendx (server, "SET-TXT-BUDGET", txt_budget, txt_priority, txt_overflow, NULL);
+    //spread the announcements of a fleet powered on together
+    zstr_sendx (server, "SET-JITTER", jitter, jitter_txt, uid, NULL);
+    //publish the last known announcement at once, if any
+    zstr_sendx (server, "SET-STATE-FILE", state_file, NULL);
+    //do first announcement, as soon as fty-info answers
     zstr_sendx (server, "DO-DEFAULT-ANNOUNCE", fty_info_command, NULL);
+    //managed devices, registered a few at a time once the agent publishes
+    zstr_sendx (server, "SET-PROXY-RATE", proxy_rate, proxy_burst, NULL);
+    zstr_sendx (server, "SET-PROXY", proxy_types, proxy_type, proxy_port, NULL);
 
     log_info ("fty_mdns_sd - started");
 
@@ -0,0 +1,381 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+
+/*
+ * File:   announce_bench.cc
+ *
+ * Benchmark of the ANNOUNCE path: synthetic INFO messages are sent on the
+ * ANNOUNCE stream of an in-process malamute broker to fty_mdns_sd_server,
+ * which publishes through the recording backend, so that no avahi-daemon
+ * is needed.
+ *
+ * For each TXT size, three scenarios are run on a fresh server:
+ *  - suppressed: the same INFO message flooded, it never reaches the publisher
+ *  - applied:    a different INFO message each time, flooded
+ *  - paced:      a different INFO message each time, at a fixed rate
+ * and the throughput (messages/s), the latency percentiles (from send to the
+ * publisher update, applied messages only) and the heap allocations per
+ * message (whole process: client, broker and server) are reported. Applied
+ * messages include the save of the state file, as in production: at once
+ * for a new definition, at most every few seconds for TXT changes alone.
+ *
+ * The exit code is 1 if a limit given on the command line is exceeded, so
+ * that the benchmark can gate a release.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "../src/fty_mdns_sd_classes.h"
+
+#define BENCH_ENDPOINT "inproc://fty-mdns-sd-announce-bench"
+#define BENCH_TIMEOUT  30000    // ms, to process a whole scenario
+
+static void
+usage ()
+{
+    puts ("fty-mdns-sd-announce-bench [options] ...");
+    puts ("  -n|--messages       messages per scenario [10000]");
+    puts ("  -r|--rate           messages/s of the paced scenario [500]");
+    puts ("  -k|--keys           comma separated TXT sizes, in keys [4,16,64]");
+    puts ("  -s|--state-file     state file of the benchmarked server [announce-bench.zpl]");
+    puts ("  --min-rate          fail if a flood scenario is slower (messages/s)");
+    puts ("  --max-p99           fail if a 99th percentile latency is higher (us)");
+    puts ("  --max-allocs        fail if a scenario allocates more per message");
+    puts ("  -v|--verbose        verbose output");
+    puts ("  -h|--help           this information");
+}
+
+typedef struct {
+    const char *scenario;
+    size_t keys;
+    size_t messages;
+    double rate;                // messages/s
+    int64_t p50, p99, max;      // us, -1 if not measured
+    double allocs;              // per message
+} s_result_t;
+
+//  INFO message with keys TXT entries, txtvers makes it unique
+static zmsg_t *
+s_info_msg (size_t keys, uint64_t txtvers)
+{
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, "INFO");
+    zmsg_addstr (msg, "IPC (12345678)");
+    zmsg_addstr (msg, "_https._tcp.");
+    zmsg_addstr (msg, "_powerservice._sub._https._tcp.");
+    zmsg_addstr (msg, "443");
+    zhash_t *infos = zhash_new ();
+    zhash_autofree (infos);
+    zhash_insert (infos, "uuid", (void *) "12345678-0000-0000-0000-000000000000");
+    zhash_insert (infos, "txtvers", (void *) std::to_string (txtvers).c_str ());
+    char key [32], value [64];
+    for (size_t i = 2; i < keys; i++) {
+        snprintf (key, sizeof (key), "key-%03zu", i);
+        snprintf (value, sizeof (value), "value of the TXT entry number %zu", i);
+        zhash_insert (infos, key, value);
+    }
+    zframe_t *frame = zhash_pack (infos);
+    zmsg_append (msg, &frame);
+    zhash_destroy (&infos);
+    return msg;
+}
+
+//  INFO messages handled so far, applied or suppressed
+static uint64_t
+s_handled (zactor_t *server)
+{
+    zstr_sendx (server, "GET-COUNTERS", NULL);
+    char *header = NULL, *applied = NULL, *suppressed = NULL, *coalesced = NULL;
+    zstr_recvx (server, &header, &applied, &suppressed, &coalesced, NULL);
+    uint64_t handled = 0;
+    if (header && streq (header, "COUNTERS") && applied && suppressed)
+        handled = strtoull (applied, NULL, 10) + strtoull (suppressed, NULL, 10);
+    zstr_free (&header);
+    zstr_free (&applied);
+    zstr_free (&suppressed);
+    zstr_free (&coalesced);
+    return handled;
+}
+
+static bool
+s_wait_handled (zactor_t *server, uint64_t expected)
+{
+    int64_t deadline = zclock_mono () + BENCH_TIMEOUT;
+    while (s_handled (server) < expected) {
+        if (zclock_mono () > deadline)
+            return false;
+        zclock_sleep (1);
+    }
+    return true;
+}
+
+//  zclock_usecs() of the UPDATE records of the publisher, in order
+static std::vector<int64_t>
+s_update_times (zactor_t *server)
+{
+    std::vector<int64_t> times;
+    zstr_sendx (server, "GET-RECORDS", NULL);
+    zmsg_t *reply = zmsg_recv (server);
+    if (!reply)
+        return times;
+    char *header = zmsg_popstr (reply);
+    while (zmsg_size (reply) >= 4) {
+        char *kind = zmsg_popstr (reply);
+        char *usec = zmsg_popstr (reply);
+        char *key = zmsg_popstr (reply);
+        zframe_t *txt = zmsg_pop (reply);
+        if (streq (kind, "UPDATE"))
+            times.push_back (strtoll (usec, NULL, 10));
+        zframe_destroy (&txt);
+        zstr_free (&key);
+        zstr_free (&usec);
+        zstr_free (&kind);
+    }
+    zstr_free (&header);
+    zmsg_destroy (&reply);
+    return times;
+}
+
+//  new server, connected and with its default service published
+static zactor_t *
+s_server_new (const char *name, const char *state_file)
+{
+    zhash_t *txt = zhash_new ();
+    zhash_insert (txt, "txtvers", (void *) "0");
+    announce_state_save (state_file, "IPC (12345678)", "_https._tcp.", "_powerservice._sub._https._tcp.", "443", txt, NULL);
+    zhash_destroy (&txt);
+
+    zactor_t *server = zactor_new (fty_mdns_sd_server, (void *) name);
+    zstr_sendx (server, "SET-PUBLISHER", "RECORDING", NULL);
+    zstr_sendx (server, "CONNECT", BENCH_ENDPOINT, NULL);
+    zstr_sendx (server, "CONSUMER", "ANNOUNCE", ".*", NULL);
+    zstr_sendx (server, "SET-STATE-FILE", state_file, NULL);
+    // pipe commands are handled in order: once this is answered, the
+    // stream subscription is in place
+    s_handled (server);
+    return server;
+}
+
+static int64_t
+s_percentile (const std::vector<int64_t> &sorted, double p)
+{
+    if (sorted.empty ())
+        return -1;
+    size_t index = size_t (p * double (sorted.size () - 1) + 0.5);
+    return sorted [std::min (index, sorted.size () - 1)];
+}
+
+static bool
+s_run (mlm_client_t *producer, const char *scenario, size_t keys, size_t messages, double pace,
+    const char *state_file, s_result_t *result)
+{
+    static int instance = 0;
+    std::string name = "fty-mdns-sd-bench-" + std::to_string (instance++);
+    zactor_t *server = s_server_new (name.c_str (), state_file);
+
+    bool unique = !streq (scenario, "suppressed");
+    // the first message is only a warm up, it reaches the publisher in any case
+    zmsg_t *msg = s_info_msg (keys, 1);
+    mlm_client_send (producer, "INFO", &msg);
+    bool ok = s_wait_handled (server, 1);
+
+    // built before the measure, only sending is timed
+    std::vector<zmsg_t *> batch;
+    batch.reserve (messages);
+    for (size_t i = 0; i < messages; i++)
+        batch.push_back (s_info_msg (keys, unique ? i + 2 : 1));
+    std::vector<int64_t> sent;
+    sent.reserve (messages);
+
+    uint64_t allocs = alloc_count ();
+    int64_t start = zclock_usecs ();
+    for (size_t i = 0; ok && i < messages; i++) {
+        if (pace > 0) {
+            int64_t due = start + int64_t (double (i) * 1000000.0 / pace);
+            while (zclock_usecs () < due)
+                zclock_sleep (int (std::max<int64_t> (0, (due - zclock_usecs ()) / 1000)));
+        }
+        sent.push_back (zclock_usecs ());
+        mlm_client_send (producer, "INFO", &batch [i]);
+    }
+    ok = ok && s_wait_handled (server, messages + 1);
+    int64_t elapsed = zclock_usecs () - start;
+    allocs = alloc_count () - allocs;
+    for (zmsg_t *left : batch)
+        zmsg_destroy (&left);
+
+    result->scenario = scenario;
+    result->keys = keys;
+    result->messages = messages;
+    result->rate = elapsed > 0 ? double (messages) * 1000000.0 / double (elapsed) : 0;
+    result->allocs = double (allocs) / double (messages);
+    result->p50 = result->p99 = result->max = -1;
+    if (ok && unique) {
+        // one UPDATE per applied message, after the warm up one
+        std::vector<int64_t> updates = s_update_times (server);
+        if (updates.size () == messages + 1) {
+            std::vector<int64_t> latencies;
+            latencies.reserve (messages);
+            for (size_t i = 0; i < messages; i++)
+                latencies.push_back (updates [i + 1] - sent [i]);
+            std::sort (latencies.begin (), latencies.end ());
+            result->p50 = s_percentile (latencies, 0.50);
+            result->p99 = s_percentile (latencies, 0.99);
+            result->max = latencies.back ();
+        }
+        else {
+            printf ("%s: %zu updates for %zu messages\n", scenario, updates.size (), messages + 1);
+            ok = false;
+        }
+    }
+    zactor_destroy (&server);
+    return ok;
+}
+
+int
+main (int argc, char *argv [])
+{
+    size_t messages = 10000;
+    double rate = 500;
+    const char *keys_list = "4,16,64";
+    const char *state_file = "announce-bench.zpl";
+    double min_rate = 0;
+    int64_t max_p99 = 0;
+    double max_allocs = 0;
+    bool verbose = false;
+
+    ManageFtyLog::setInstanceFtylog ("fty-mdns-sd-announce-bench");
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help") || streq (argv [argn], "-h")) {
+            usage ();
+            return 0;
+        }
+        else if (streq (argv [argn], "--verbose") || streq (argv [argn], "-v")) {
+            verbose = true;
+        }
+        else if ((streq (argv [argn], "--messages") || streq (argv [argn], "-n")) && param) {
+            messages = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--rate") || streq (argv [argn], "-r")) && param) {
+            rate = atof (param);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--keys") || streq (argv [argn], "-k")) && param) {
+            keys_list = param;
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--state-file") || streq (argv [argn], "-s")) && param) {
+            state_file = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--min-rate") && param) {
+            min_rate = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--max-p99") && param) {
+            max_p99 = strtoll (param, NULL, 10);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--max-allocs") && param) {
+            max_allocs = atof (param);
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (messages == 0 || rate <= 0) {
+        usage ();
+        return EXIT_FAILURE;
+    }
+    if (verbose)
+        ManageFtyLog::getInstanceFtylog ()->setVerboseMode ();
+
+    std::vector<size_t> sizes;
+    for (const char *cursor = keys_list; *cursor; ) {
+        char *end;
+        size_t keys = strtoul (cursor, &end, 10);
+        if (end == cursor) break;
+        sizes.push_back (std::max<size_t> (keys, 2));
+        cursor = *end == ',' ? end + 1 : end;
+    }
+
+    zactor_t *broker = zactor_new (mlm_server, (void *) "Malamute");
+    zstr_sendx (broker, "BIND", BENCH_ENDPOINT, NULL);
+    mlm_client_t *producer = mlm_client_new ();
+    int r = mlm_client_connect (producer, BENCH_ENDPOINT, 1000, "fty-mdns-sd-announce-bench");
+    if (r == 0)
+        r = mlm_client_set_producer (producer, "ANNOUNCE");
+    if (r != 0) {
+        printf ("Cannot connect to the malamute broker\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!alloc_counting ())
+        printf ("allocations are not counted in this build\n");
+    printf ("%-10s %5s %8s %12s %8s %8s %8s %10s\n",
+        "scenario", "keys", "messages", "messages/s", "p50(us)", "p99(us)", "max(us)", "allocs/msg");
+
+    bool failed = false;
+    // the paced scenario lasts at most about 2 s
+    size_t paced = std::min (messages, std::max<size_t> (1, size_t (rate * 2)));
+    for (size_t keys : sizes) {
+        struct { const char *scenario; size_t messages; double pace; } runs [] = {
+            { "suppressed", messages, 0 },
+            { "applied", messages, 0 },
+            { "paced", paced, rate },
+        };
+        for (const auto &run : runs) {
+            s_result_t result;
+            if (!s_run (producer, run.scenario, keys, run.messages, run.pace, state_file, &result)) {
+                printf ("%-10s %5zu: timeout after %d ms\n", run.scenario, keys, BENCH_TIMEOUT);
+                failed = true;
+                continue;
+            }
+            printf ("%-10s %5zu %8zu %12.0f %8" PRIi64 " %8" PRIi64 " %8" PRIi64 " %10.1f\n",
+                result.scenario, result.keys, result.messages, result.rate,
+                result.p50, result.p99, result.max, result.allocs);
+
+            if (min_rate > 0 && run.pace == 0 && result.rate < min_rate) {
+                printf ("  FAIL: %.0f messages/s, below %.0f\n", result.rate, min_rate);
+                failed = true;
+            }
+            if (max_p99 > 0 && result.p99 > max_p99) {
+                printf ("  FAIL: p99 %" PRIi64 " us, above %" PRIi64 "\n", result.p99, max_p99);
+                failed = true;
+            }
+            if (max_allocs > 0 && alloc_counting () && result.allocs > max_allocs) {
+                printf ("  FAIL: %.1f allocations/message, above %.1f\n", result.allocs, max_allocs);
+                failed = true;
+            }
+        }
+    }
+
+    mlm_client_destroy (&producer);
+    zactor_destroy (&broker);
+    remove (state_file);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
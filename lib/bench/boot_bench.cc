@@ -0,0 +1,231 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+
+/*
+ * File:   boot_bench.cc
+ *
+ * Time from the start of the agent to its default service established,
+ * without and with the state file of the last published announcement.
+ * Each run starts a fty_mdns_sd_server actor (recording backend: a service
+ * is established as soon as it is committed) connected to an in-process
+ * malamute broker, where a fake fty-info answers INFO requests after a
+ * delay, as it does while the whole system boots. Without the state file
+ * the service waits for that answer, with it the service is published at
+ * once and fty-info only brings the changes.
+ *
+ * The exit code is 1 if the state file does not shorten the median.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "../src/fty_mdns_sd_classes.h"
+
+#define BENCH_ENDPOINT "inproc://fty-mdns-sd-boot-bench"
+#define BENCH_STATE_FILE "boot-bench.zpl"
+#define BENCH_TIMEOUT 30000     // ms, per run
+
+static void
+usage ()
+{
+    puts ("fty-mdns-sd-boot-bench [options] ...");
+    puts ("  -n|--runs           agent starts of each kind [20]");
+    puts ("  -d|--info-delay     time fty-info takes to answer (ms) [500]");
+    puts ("  -h|--help           this information");
+}
+
+//  announcement fty-info answers, the state file holds an older one
+static zmsg_t *
+s_info_msg (const char *txtvers)
+{
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, "INFO");
+    zmsg_addstr (msg, "IPC (12345678)");
+    zmsg_addstr (msg, "_https._tcp.");
+    zmsg_addstr (msg, "_powerservice._sub._https._tcp.");
+    zmsg_addstr (msg, "443");
+    zhash_t *infos = zhash_new ();
+    zhash_insert (infos, "uuid", (void *) "12345678-0000-0000-0000-000000000000");
+    zhash_insert (infos, "txtvers", (void *) txtvers);
+    zframe_t *frame = zhash_pack (infos);
+    zmsg_append (msg, &frame);
+    zhash_destroy (&infos);
+    return msg;
+}
+
+//  fake fty-info agent answering INFO requests after args ms
+static void
+s_fty_info (zsock_t *pipe, void *args)
+{
+    int64_t delay = *(int64_t *) args;
+    mlm_client_t *client = mlm_client_new ();
+    int r = mlm_client_connect (client, BENCH_ENDPOINT, 1000, "fty-info");
+    assert (r == 0);
+    zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (client), NULL);
+    zsock_signal (pipe, 0);
+
+    while (!zsys_interrupted) {
+        void *which = zpoller_wait (poller, -1);
+        if (which != mlm_client_msgpipe (client))
+            break; // $TERM or interrupted
+        zmsg_t *request = mlm_client_recv (client);
+        char *command = zmsg_popstr (request);
+        char *uuid = zmsg_popstr (request);
+        if (command && uuid && streq (command, "INFO")) {
+            zclock_sleep (int (delay));
+            zmsg_t *reply = s_info_msg ("1.0.1");
+            zmsg_pushstr (reply, uuid);
+            mlm_client_sendto (client, mlm_client_sender (client), "info", NULL, 1000, &reply);
+        }
+        zstr_free (&uuid);
+        zstr_free (&command);
+        zmsg_destroy (&request);
+    }
+
+    zpoller_destroy (&poller);
+    mlm_client_destroy (&client);
+}
+
+//  zclock_usecs() of the first COMMIT of the default service, -1 if none
+static int64_t
+s_first_commit (zactor_t *agent)
+{
+    zstr_sendx (agent, "GET-RECORDS", NULL);
+    zmsg_t *reply = zmsg_recv (agent);
+    if (!reply)
+        return -1;
+    int64_t at = -1;
+    char *header = zmsg_popstr (reply);
+    while (zmsg_size (reply) >= 4) {
+        char *record_kind = zmsg_popstr (reply);
+        char *usec = zmsg_popstr (reply);
+        char *record_key = zmsg_popstr (reply);
+        zframe_t *txt = zmsg_pop (reply);
+        if (at < 0 && streq (record_kind, "COMMIT") && streq (record_key, DEFAULT_SERVICE_KEY))
+            at = strtoll (usec, NULL, 10);
+        zframe_destroy (&txt);
+        zstr_free (&record_key);
+        zstr_free (&usec);
+        zstr_free (&record_kind);
+    }
+    zstr_free (&header);
+    zmsg_destroy (&reply);
+    return at;
+}
+
+//  start an agent, return the time (us) until its default service is established, -1 on timeout
+static int64_t
+s_boot (bool cached)
+{
+    int64_t start = zclock_usecs ();
+    zactor_t *agent = zactor_new (fty_mdns_sd_server, (void *) "fty-mdns-sd-boot-bench");
+    zstr_sendx (agent, "SET-PUBLISHER", "RECORDING", NULL);
+    zstr_sendx (agent, "CONNECT", BENCH_ENDPOINT, NULL);
+    if (cached)
+        zstr_sendx (agent, "SET-STATE-FILE", BENCH_STATE_FILE, NULL);
+    zstr_sendx (agent, "DO-DEFAULT-ANNOUNCE", "INFO", NULL);
+
+    int64_t at = -1;
+    int64_t deadline = zclock_mono () + BENCH_TIMEOUT;
+    while ((at = s_first_commit (agent)) < 0 && zclock_mono () < deadline)
+        zclock_sleep (1);
+    zactor_destroy (&agent);
+    return at < 0 ? -1 : at - start;
+}
+
+int
+main (int argc, char *argv [])
+{
+    size_t runs = 20;
+    int64_t info_delay = 500;
+
+    ManageFtyLog::setInstanceFtylog ("fty-mdns-sd-boot-bench");
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help") || streq (argv [argn], "-h")) {
+            usage ();
+            return 0;
+        }
+        else if ((streq (argv [argn], "--runs") || streq (argv [argn], "-n")) && param) {
+            runs = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--info-delay") || streq (argv [argn], "-d")) && param) {
+            info_delay = strtoll (param, NULL, 10);
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (runs == 0 || info_delay < 0) {
+        usage ();
+        return EXIT_FAILURE;
+    }
+
+    zactor_t *broker = zactor_new (mlm_server, (void *) "Malamute");
+    zstr_sendx (broker, "BIND", BENCH_ENDPOINT, NULL);
+    zactor_t *fty_info = zactor_new (s_fty_info, &info_delay);
+
+    // last announcement published by a previous run, an older version than fty-info's
+    zhash_t *txt = zhash_new ();
+    zhash_insert (txt, "uuid", (void *) "12345678-0000-0000-0000-000000000000");
+    zhash_insert (txt, "txtvers", (void *) "1.0.0");
+    announce_state_save (BENCH_STATE_FILE, "IPC (12345678)", "_https._tcp.",
+        "_powerservice._sub._https._tcp.", "443", txt, NULL);
+    zhash_destroy (&txt);
+
+    printf ("%zu starts, fty-info answering after %" PRIi64 " ms\n", runs, info_delay);
+    printf ("%-12s | %10s %10s %10s\n", "state file", "min(ms)", "median(ms)", "max(ms)");
+
+    bool failed = false;
+    int64_t medians [2] = { 0, 0 };
+    const char *names [2] = { "without", "with" };
+    for (int cached = 0; cached < 2 && !failed; cached++) {
+        std::vector<int64_t> times;
+        for (size_t i = 0; i < runs; i++) {
+            int64_t usec = s_boot (cached);
+            if (usec < 0) {
+                printf ("%-12s: default service not established in time\n", names [cached]);
+                failed = true;
+                break;
+            }
+            times.push_back (usec);
+        }
+        if (failed)
+            break;
+        std::sort (times.begin (), times.end ());
+        medians [cached] = times [times.size () / 2];
+        printf ("%-12s | %10.1f %10.1f %10.1f\n", names [cached],
+            double (times.front ()) / 1000, double (medians [cached]) / 1000, double (times.back ()) / 1000);
+    }
+    if (!failed && medians [1] >= medians [0]) {
+        printf ("  FAIL: the state file does not shorten the time to ESTABLISHED\n");
+        failed = true;
+    }
+
+    remove (BENCH_STATE_FILE);
+    zactor_destroy (&fty_info);
+    zactor_destroy (&broker);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
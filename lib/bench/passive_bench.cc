@@ -0,0 +1,445 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+
+/*
+ * File:   passive_bench.cc
+ *
+ * Decoding rate of passive discovery (MdnsListener) on one core, over a
+ * corpus of mDNS packets in pcap format: either a capture given with
+ * --file (UDP port 5353, over Ethernet, Linux cooked or raw IP links), or
+ * one generated for a network of --services devices, each announcing an
+ * instance of _https._tcp with a subtype, an fty-info sized TXT set, A and
+ * AAAA records, next to browsers' queries and PTR answers listing many
+ * instances. --output keeps the generated corpus as a capture.
+ *
+ * Two rates are reported, in packets and megabytes per second:
+ *  - decode:   every record walked and its rdata decoded, nothing stored
+ *  - listener: packets fed to the listener, updating a DiscoveryCache;
+ *              the first pass fills the cache, the next ones only refresh
+ *              it, which is the steady state of a network
+ * and the heap allocations per packet of the steady passes.
+ *
+ * The exit code is 1 if a limit given on the command line is exceeded.
+ */
+
+#include <cinttypes>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src/fty_mdns_sd_classes.h"
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+
+#define BENCH_TYPE          "_https._tcp.local"
+// devices whose instances a browser's query and its answer list
+#define BENCH_QUERY_BATCH   16
+
+static void
+usage ()
+{
+    puts ("fty-mdns-sd-passive-bench [options] ...");
+    puts ("  -n|--services       devices of the generated corpus [2000]");
+    puts ("  -p|--passes         passes over the corpus [20]");
+    puts ("  -f|--file           pcap capture to read the corpus from, instead of generating it");
+    puts ("  -o|--output         write the generated corpus to this pcap file");
+    puts ("  --min-rate          fail if the listener is slower (packets/s)");
+    puts ("  --max-allocs        fail if the steady passes allocate more per packet");
+    puts ("  -h|--help           this information");
+}
+
+//  --------------------------------------------------------------------------
+//  pcap files: global header, then a record header and the frame of each packet
+
+template <typename T>
+static void
+s_append (std::string& out, T value)
+{
+    out.append ((const char *) &value, sizeof (value));
+}
+
+static void
+s_pcap_header (std::string& out)
+{
+    s_append (out, uint32_t (PCAP_MAGIC));
+    s_append (out, uint16_t (2));           // version 2.4
+    s_append (out, uint16_t (4));
+    s_append (out, int32_t (0));            // thiszone
+    s_append (out, uint32_t (0));           // sigfigs
+    s_append (out, uint32_t (65535));       // snaplen
+    s_append (out, uint32_t (LINKTYPE_ETHERNET));
+}
+
+//  mDNS payload in Ethernet, IPv4 and UDP headers, from 10.0.0.0/8 host
+//  source (checksums left out)
+static void
+s_pcap_packet (std::string& out, const uint8_t *payload, size_t size, uint32_t source, uint64_t usecs)
+{
+    uint8_t frame[14 + 20 + 8];
+    memset (frame, 0, sizeof (frame));
+    const uint8_t group_mac[6] = { 0x01, 0x00, 0x5e, 0x00, 0x00, 0xfb };
+    memcpy (frame, group_mac, 6);
+    frame[6] = 0x00; frame[7] = 0x0a; frame[8] = 0xf7;
+    frame[9] = uint8_t (source >> 16); frame[10] = uint8_t (source >> 8); frame[11] = uint8_t (source);
+    frame[12] = 0x08;                       // IPv4
+    uint8_t *ip = frame + 14;
+    size_t total = 20 + 8 + size;
+    ip[0] = 0x45;
+    ip[2] = uint8_t (total >> 8); ip[3] = uint8_t (total);
+    ip[8] = 255;                            // TTL
+    ip[9] = 17;                             // UDP
+    ip[12] = 10; ip[13] = uint8_t (source >> 16); ip[14] = uint8_t (source >> 8); ip[15] = uint8_t (source);
+    ip[16] = 224; ip[17] = 0; ip[18] = 0; ip[19] = 251;
+    uint8_t *udp = ip + 20;
+    udp[0] = udp[2] = MDNS_PORT >> 8;
+    udp[1] = udp[3] = MDNS_PORT & 0xff;
+    udp[4] = uint8_t ((8 + size) >> 8); udp[5] = uint8_t (8 + size);
+
+    s_append (out, uint32_t (usecs / 1000000));
+    s_append (out, uint32_t (usecs % 1000000));
+    s_append (out, uint32_t (sizeof (frame) + size));
+    s_append (out, uint32_t (sizeof (frame) + size));
+    out.append ((const char *) frame, sizeof (frame));
+    out.append ((const char *) payload, size);
+}
+
+static inline uint16_t
+s_be16 (const uint8_t *p)
+{
+    return uint16_t ((p[0] << 8) | p[1]);
+}
+
+/**
+ * Payloads of the UDP datagrams from or to port 5353 in a capture, other
+ * frames skipped. Return false if it is not a pcap file of a known link.
+ */
+static bool
+s_pcap_read (const std::string& file, std::vector<std::string>& packets)
+{
+    const uint8_t *data = (const uint8_t *) file.data ();
+    if (file.size () < 24)
+        return false;
+    uint32_t magic;
+    memcpy (&magic, data, 4);
+    bool swap = magic == __builtin_bswap32 (PCAP_MAGIC) || magic == __builtin_bswap32 (PCAP_MAGIC_NSEC);
+    if (!swap && magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+        return false;
+    auto u32 = [data, swap](size_t offset) {
+        uint32_t value;
+        memcpy (&value, data + offset, 4);
+        return swap ? __builtin_bswap32 (value) : value;
+    };
+    uint32_t link = u32 (20);
+    if (link != LINKTYPE_ETHERNET && link != LINKTYPE_RAW && link != LINKTYPE_LINUX_SLL)
+        return false;
+
+    for (size_t offset = 24; offset + 16 <= file.size (); ) {
+        size_t len = u32 (offset + 8);
+        offset += 16;
+        if (offset + len > file.size ())
+            break;
+        const uint8_t *frame = data + offset;
+        offset += len;
+
+        size_t l3 = 0;
+        uint16_t protocol = 0;
+        if (link == LINKTYPE_ETHERNET) {
+            if (len < 14)
+                continue;
+            protocol = s_be16 (frame + 12);
+            l3 = 14;
+            // VLAN tags
+            while (protocol == 0x8100 && len >= l3 + 4) {
+                protocol = s_be16 (frame + l3 + 2);
+                l3 += 4;
+            }
+        }
+        else
+        if (link == LINKTYPE_LINUX_SLL) {
+            if (len < 16)
+                continue;
+            protocol = s_be16 (frame + 14);
+            l3 = 16;
+        }
+        else {
+            if (len < 1)
+                continue;
+            protocol = (frame[0] >> 4) == 4 ? 0x0800 : 0x86dd;
+        }
+
+        size_t l4;
+        if (protocol == 0x0800) {
+            // IPv4, fragments skipped
+            if (len < l3 + 20 || frame[l3 + 9] != 17 || (s_be16 (frame + l3 + 6) & 0x3fff))
+                continue;
+            l4 = l3 + size_t (frame[l3] & 0x0f) * 4;
+        }
+        else
+        if (protocol == 0x86dd) {
+            // IPv6, without extension headers
+            if (len < l3 + 40 || frame[l3 + 6] != 17)
+                continue;
+            l4 = l3 + 40;
+        }
+        else
+            continue;
+        if (len < l4 + 8 || (s_be16 (frame + l4) != MDNS_PORT && s_be16 (frame + l4 + 2) != MDNS_PORT))
+            continue;
+        size_t udp = s_be16 (frame + l4 + 4);
+        if (udp < 8)
+            continue;
+        packets.push_back (std::string ((const char *) frame + l4 + 8, std::min (udp - 8, len - l4 - 8)));
+    }
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Generated corpus
+
+static std::string
+s_txt_wire ()
+{
+    const char *pairs[] = {
+        "txtvers=1.0.0", "uuid=12345678-9abc-def0-1234-56789abcdef0", "name=IPC 3000", "type=ipc",
+        "version=2.4.0-202010071503", "path=/api/v1/comm.cgi", "protocol-format=etn-rest",
+        "name-uri=/asset/rackcontroller-0", "vendor=Eaton", "manufacturer=Eaton", "product=IPC3000",
+        "serial=LA71042052", "part-number=IPC3000E-RC", "location=Rack A4", "parent-uri=/asset/rack-12",
+    };
+    std::string wire;
+    for (const char *pair : pairs) {
+        wire += char (strlen (pair));
+        wire += pair;
+    }
+    return wire;
+}
+
+static std::string
+s_instance (size_t device)
+{
+    char name[64];
+    snprintf (name, sizeof (name), "IPC 3000 (%08zx)." BENCH_TYPE, device * 2654435761u % 0xffffffffu);
+    return name;
+}
+
+//  capture of a network of services devices, each announcing itself, and
+//  browsers querying them by batches: query with known answers, then answer
+static std::string
+s_corpus (size_t services)
+{
+    std::string pcap;
+    s_pcap_header (pcap);
+    const std::string txt = s_txt_wire ();
+    uint8_t buffer[MDNS_MAX_PACKET];
+    uint64_t usecs = 1600000000ull * 1000000;
+    for (size_t i = 0; i < services; i++) {
+        std::string instance = s_instance (i);
+        std::string host = "ipc-" + std::to_string (i) + ".local";
+        uint32_t source = uint32_t (i + 1);
+        uint8_t v4[4] = { 10, uint8_t (source >> 16), uint8_t (source >> 8), uint8_t (source) };
+        uint8_t v6[16] = { 0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0x02, 0x0a, 0xf7, 0xff, 0xfe, v4[1], v4[2], v4[3] };
+        MdnsWriter writer (buffer, sizeof (buffer), 0, MDNS_FLAG_RESPONSE);
+        bool ok = writer.ptr (MdnsWriter::ANSWER, BENCH_TYPE, MDNS_TTL_OTHER, instance)
+            && writer.ptr (MdnsWriter::ANSWER, i % 2 ? "_ups._sub." BENCH_TYPE : "_powerservice._sub." BENCH_TYPE,
+                MDNS_TTL_OTHER, instance)
+            && writer.srv (MdnsWriter::ANSWER, instance, MDNS_TTL_HOST, true, 443, host)
+            && writer.txt (MdnsWriter::ANSWER, instance, MDNS_TTL_OTHER, true, txt)
+            && writer.address (MdnsWriter::ANSWER, host, MDNS_TTL_HOST, true, v4, 4)
+            && writer.address (MdnsWriter::ANSWER, host, MDNS_TTL_HOST, true, v6, 16);
+        assert (ok);
+        s_pcap_packet (pcap, writer.data (), writer.size (), source, usecs += 250);
+
+        if ((i + 1) % BENCH_QUERY_BATCH == 0) {
+            MdnsWriter query (buffer, sizeof (buffer), 0, 0);
+            ok = query.question (BENCH_TYPE, MDNS_TYPE_PTR);
+            for (size_t j = i + 1 - BENCH_QUERY_BATCH; j <= i; j++)
+                ok = ok && query.ptr (MdnsWriter::ANSWER, BENCH_TYPE, MDNS_TTL_OTHER, s_instance (j));
+            assert (ok);
+            s_pcap_packet (pcap, query.data (), query.size (), 0xffff00, usecs += 250);
+            MdnsWriter answer (buffer, sizeof (buffer), 0, MDNS_FLAG_RESPONSE);
+            for (size_t j = i + 1 - BENCH_QUERY_BATCH; j <= i; j++)
+                ok = ok && answer.ptr (MdnsWriter::ANSWER, BENCH_TYPE, MDNS_TTL_OTHER, s_instance (j));
+            assert (ok);
+            s_pcap_packet (pcap, answer.data (), answer.size (), source, usecs += 250);
+        }
+    }
+    return pcap;
+}
+
+//  every record of a packet through every decoder, nothing kept
+static size_t
+s_walk (const std::string& data, size_t& records)
+{
+    MdnsReader packet ((const uint8_t *) data.data (), data.size ());
+    if (!packet.valid ())
+        return 0;
+    size_t seen = 0;
+    MdnsName labels;
+    MdnsReader::Record record;
+    while (packet.next (record)) {
+        size_t target;
+        uint16_t port;
+        const uint8_t *address;
+        size_t len;
+        records++;
+        if (packet.labels (record.name, labels))
+            seen += labels.count;
+        if ((packet.ptr (record, target) || packet.srv (record, port, target)) && packet.labels (target, labels))
+            seen += labels.count;
+        if (packet.address (record, address, len))
+            seen += address[0];
+        packet.txt (record, [&seen](const char *, size_t len) { seen += len; });
+    }
+    return seen;
+}
+
+int
+main (int argc, char *argv [])
+{
+    size_t services = 2000;
+    size_t passes = 20;
+    const char *file = NULL;
+    const char *output = NULL;
+    double min_rate = 0;
+    double max_allocs = -1;
+
+    ManageFtyLog::setInstanceFtylog ("fty-mdns-sd-passive-bench");
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help") || streq (argv [argn], "-h")) {
+            usage ();
+            return 0;
+        }
+        else if ((streq (argv [argn], "--services") || streq (argv [argn], "-n")) && param) {
+            services = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--passes") || streq (argv [argn], "-p")) && param) {
+            passes = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--file") || streq (argv [argn], "-f")) && param) {
+            file = param;
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--output") || streq (argv [argn], "-o")) && param) {
+            output = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--min-rate") && param) {
+            min_rate = atof (param);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--max-allocs") && param) {
+            max_allocs = atof (param);
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (services == 0 || passes < 2) {
+        usage ();
+        return EXIT_FAILURE;
+    }
+
+    std::string pcap;
+    if (file) {
+        std::ifstream in (file, std::ios::binary);
+        std::stringstream content;
+        content << in.rdbuf ();
+        pcap = content.str ();
+    }
+    else {
+        pcap = s_corpus (services);
+        if (output) {
+            std::ofstream out (output, std::ios::binary);
+            out.write (pcap.data (), std::streamsize (pcap.size ()));
+        }
+    }
+    std::vector<std::string> corpus;
+    if (!s_pcap_read (pcap, corpus) || corpus.empty ()) {
+        printf ("%s: no mDNS packet in a pcap capture\n", file ? file : "corpus");
+        return EXIT_FAILURE;
+    }
+    size_t bytes = 0;
+    for (const auto& packet : corpus)
+        bytes += packet.size ();
+    printf ("corpus: %zu packets, %zu bytes (%s)\n", corpus.size (), bytes,
+        file ? file : (std::to_string (services) + " services generated").c_str ());
+
+    // decoding only
+    size_t records = 0, seen = 0;
+    int64_t start = zclock_usecs ();
+    for (size_t pass = 0; pass < passes; pass++)
+        for (const auto& packet : corpus)
+            seen += s_walk (packet, records);
+    double elapsed = double (zclock_usecs () - start) / 1e6;
+    double packets = double (corpus.size () * passes);
+    printf ("decode:   %10.0f packets/s %8.1f MB/s   (%zu records/pass, %zu)\n",
+        packets / elapsed, double (bytes * passes) / elapsed / 1e6, records / passes, seen);
+
+    // listener, a cold pass filling the cache, then steady ones
+    DiscoveryCache cache;
+    MdnsListener listener (NULL, &cache);
+    int64_t now = 1000000;
+    start = zclock_usecs ();
+    for (const auto& packet : corpus)
+        listener.feed ((const uint8_t *) packet.data (), packet.size (), 2, now);
+    double cold = double (zclock_usecs () - start) / 1e6;
+    uint64_t allocs = alloc_count ();
+    start = zclock_usecs ();
+    for (size_t pass = 1; pass < passes; pass++) {
+        now += 1000;
+        for (const auto& packet : corpus)
+            listener.feed ((const uint8_t *) packet.data (), packet.size (), 2, now);
+    }
+    elapsed = double (zclock_usecs () - start) / 1e6;
+    allocs = alloc_count () - allocs;
+    packets = double (corpus.size () * (passes - 1));
+    double rate = packets / elapsed;
+    double per_packet = double (allocs) / packets;
+    printf ("listener: %10.0f packets/s %8.1f MB/s   (first pass %.0f packets/s)\n",
+        rate, double (bytes * (passes - 1)) / elapsed / 1e6, double (corpus.size ()) / cold);
+    if (alloc_counting ())
+        printf ("          %.3f allocations/packet in steady state\n", per_packet);
+    const MdnsListener::Counters& counters = listener.counters ();
+    printf ("          %zu services cached, %" PRIu64 " malformed packets\n", cache.size (), counters.malformed);
+
+    bool failed = false;
+    if (!file && cache.size () != services) {
+        printf ("FAILED: %zu services cached, %zu announced\n", cache.size (), services);
+        failed = true;
+    }
+    if (min_rate > 0 && rate < min_rate) {
+        printf ("FAILED: listener rate %.0f packets/s < %.0f\n", rate, min_rate);
+        failed = true;
+    }
+    if (max_allocs >= 0 && alloc_counting () && per_packet > max_allocs) {
+        printf ("FAILED: %.3f allocations/packet > %.3f\n", per_packet, max_allocs);
+        failed = true;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
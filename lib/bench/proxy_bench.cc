@@ -0,0 +1,363 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+
+/*
+ * File:   proxy_bench.cc
+ *
+ * Benchmark of the proxy announcement of managed devices: synthetic assets
+ * are published on the ASSETS stream of an in-process malamute broker, as
+ * fty-asset does on REPUBLISH, and fty_mdns_sd_server announces each device
+ * through the recording backend, so that no avahi-daemon is needed.
+ *
+ * For each inventory size, two scenarios are run on a fresh server:
+ *  - staggered: commits released by the scheduler at --rate, --burst
+ *  - unlimited: every commit as soon as its asset is handled
+ * and reported are the registration time (first asset sent to last commit),
+ * the peak of commits within any second, the heap held by the server per
+ * 1000 devices once all are registered (glibc heap in use, records of the
+ * recording backend cleared) and the heap allocations per device.
+ *
+ * The exit code is 1 if the staggered peak goes over rate + burst, or if a
+ * limit given on the command line is exceeded.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <malloc.h>
+#include <string>
+#include <vector>
+
+#include "../src/fty_mdns_sd_classes.h"
+
+#define BENCH_ENDPOINT "inproc://fty-mdns-sd-proxy-bench"
+#define BENCH_TIMEOUT  30000    // ms, on top of the time the rate needs
+
+static void
+usage ()
+{
+    puts ("fty-mdns-sd-proxy-bench [options] ...");
+    puts ("  -n|--devices        comma separated inventory sizes [1000]");
+    puts ("  -r|--rate           commits/s of the staggered scenario [20]");
+    puts ("  -b|--burst          commits at once of the staggered scenario [10]");
+    puts ("  -s|--state-file     state file of the benchmarked server [proxy-bench.zpl]");
+    puts ("  --max-memory        fail if the server holds more per 1000 devices (KiB)");
+    puts ("  -v|--verbose        verbose output");
+    puts ("  -h|--help           this information");
+}
+
+typedef struct {
+    const char *scenario;
+    size_t devices;
+    int64_t elapsed;            // ms, first asset sent to last commit
+    size_t peak;                // commits within a second, at most
+    double memory;              // KiB per 1000 devices
+    double allocs;              // per device
+} s_result_t;
+
+//  heap in use by the process
+static size_t
+s_heap_used ()
+{
+#if defined (__GLIBC__) && __GLIBC_PREREQ (2, 33)
+    return mallinfo2 ().uordblks;
+#else
+    return size_t (mallinfo ().uordblks);
+#endif
+}
+
+//  asset of a managed device, as published by fty-asset
+static zmsg_t *
+s_asset_msg (size_t index)
+{
+    std::string name = (index % 2 ? "epdu-" : "ups-") + std::to_string (index);
+    std::string uuid = "12345678-0000-0000-0000-" + std::to_string (100000000000 + index);
+    std::string address = "10." + std::to_string (index / 65536 % 256) + "."
+        + std::to_string (index / 256 % 256) + "." + std::to_string (index % 256);
+    std::string serial = "LA" + std::to_string (71000000 + index);
+    zhash_t *aux = zhash_new ();
+    zhash_autofree (aux);
+    zhash_insert (aux, "type", (void *) "device");
+    zhash_insert (aux, "subtype", (void *) (index % 2 ? "epdu" : "ups"));
+    zhash_insert (aux, "status", (void *) "active");
+    zhash_insert (aux, "parent", (void *) "rack-12");
+    zhash_t *ext = zhash_new ();
+    zhash_autofree (ext);
+    zhash_insert (ext, "name", (void *) ((index % 2 ? "ePDU " : "UPS ") + std::to_string (index)).c_str ());
+    zhash_insert (ext, "uuid", (void *) uuid.c_str ());
+    zhash_insert (ext, "manufacturer", (void *) "Eaton");
+    zhash_insert (ext, "model", (void *) (index % 2 ? "EMAB03" : "9PX 6000i"));
+    zhash_insert (ext, "serial_no", (void *) serial.c_str ());
+    zhash_insert (ext, "ip.1", (void *) address.c_str ());
+    zmsg_t *msg = fty_proto_encode_asset (aux, name.c_str (), FTY_PROTO_ASSET_OP_CREATE, ext);
+    zhash_destroy (&aux);
+    zhash_destroy (&ext);
+    return msg;
+}
+
+//  proxied devices and the ones still queued, false if not answered
+static bool
+s_proxies (zactor_t *server, size_t *proxies, size_t *queued)
+{
+    zstr_sendx (server, "GET-PROXIES", NULL);
+    char *header = NULL, *count = NULL, *pending = NULL;
+    zstr_recvx (server, &header, &count, &pending, NULL);
+    bool ok = header && streq (header, "PROXIES") && count && pending;
+    if (ok) {
+        *proxies = strtoul (count, NULL, 10);
+        *queued = strtoul (pending, NULL, 10);
+    }
+    zstr_free (&header);
+    zstr_free (&count);
+    zstr_free (&pending);
+    return ok;
+}
+
+static bool
+s_wait_registered (zactor_t *server, size_t devices, int64_t timeout)
+{
+    int64_t deadline = zclock_mono () + timeout;
+    size_t proxies = 0, queued = 0;
+    while (!s_proxies (server, &proxies, &queued) || proxies < devices || queued > 0) {
+        if (zclock_mono () > deadline)
+            return false;
+        zclock_sleep (10);
+    }
+    return true;
+}
+
+//  zclock_usecs() of the COMMIT records of proxied devices, in order
+static std::vector<int64_t>
+s_commit_times (zactor_t *server)
+{
+    std::vector<int64_t> times;
+    zstr_sendx (server, "GET-RECORDS", NULL);
+    zmsg_t *reply = zmsg_recv (server);
+    if (!reply)
+        return times;
+    char *header = zmsg_popstr (reply);
+    while (zmsg_size (reply) >= 4) {
+        char *kind = zmsg_popstr (reply);
+        char *usec = zmsg_popstr (reply);
+        char *key = zmsg_popstr (reply);
+        zframe_t *txt = zmsg_pop (reply);
+        if (streq (kind, "COMMIT") && strncmp (key, "proxy/", 6) == 0)
+            times.push_back (strtoll (usec, NULL, 10));
+        zframe_destroy (&txt);
+        zstr_free (&key);
+        zstr_free (&usec);
+        zstr_free (&kind);
+    }
+    zstr_free (&header);
+    zmsg_destroy (&reply);
+    return times;
+}
+
+//  most commits within any second
+static size_t
+s_peak (const std::vector<int64_t> &times)
+{
+    size_t peak = 0;
+    size_t first = 0;
+    for (size_t last = 0; last < times.size (); last++) {
+        while (times [last] - times [first] >= 1000000)
+            first++;
+        peak = std::max (peak, last - first + 1);
+    }
+    return peak;
+}
+
+//  new server, connected, with its default service published and proxying
+//  the ups and epdu devices
+static zactor_t *
+s_server_new (const char *name, const char *state_file, double rate, size_t burst)
+{
+    zhash_t *txt = zhash_new ();
+    zhash_insert (txt, "txtvers", (void *) "0");
+    announce_state_save (state_file, "IPC (12345678)", "_https._tcp.", "_powerservice._sub._https._tcp.", "443", txt, NULL);
+    zhash_destroy (&txt);
+
+    zactor_t *server = zactor_new (fty_mdns_sd_server, (void *) name);
+    zstr_sendx (server, "SET-PUBLISHER", "RECORDING", NULL);
+    zstr_sendx (server, "CONNECT", BENCH_ENDPOINT, NULL);
+    zstr_sendx (server, "SET-STATE-FILE", state_file, NULL);
+    zstr_sendx (server, "SET-PROXY-RATE", std::to_string (rate).c_str (), std::to_string (burst).c_str (), NULL);
+    zstr_sendx (server, "SET-PROXY", "ups,epdu", "_https._tcp.", "443", NULL);
+    // pipe commands are handled in order: once this is answered, the
+    // stream subscription is in place
+    size_t proxies, queued;
+    s_proxies (server, &proxies, &queued);
+    return server;
+}
+
+static bool
+s_run (mlm_client_t *producer, const char *scenario, size_t devices, double rate, size_t burst,
+    const char *state_file, s_result_t *result)
+{
+    static int instance = 0;
+    std::string name = "fty-mdns-sd-bench-" + std::to_string (instance++);
+    zactor_t *server = s_server_new (name.c_str (), state_file, rate, burst);
+
+    // built before the measure, only sending is timed
+    std::vector<zmsg_t *> batch;
+    batch.reserve (devices);
+    for (size_t i = 0; i < devices; i++)
+        batch.push_back (s_asset_msg (i));
+
+    size_t heap = s_heap_used ();
+    uint64_t allocs = alloc_count ();
+    int64_t start = zclock_usecs ();
+    for (size_t i = 0; i < devices; i++)
+        mlm_client_send (producer, "ASSET", &batch [i]);
+    int64_t timeout = BENCH_TIMEOUT + (rate > 0 ? int64_t (double (devices) * 1000.0 / rate) : 0);
+    bool ok = s_wait_registered (server, devices, timeout);
+    allocs = alloc_count () - allocs;
+
+    std::vector<int64_t> commits = s_commit_times (server);
+    if (ok && commits.size () != devices) {
+        printf ("%s: %zu commits for %zu devices\n", scenario, commits.size (), devices);
+        ok = false;
+    }
+    // what is left is the state kept for the devices
+    zstr_sendx (server, "CLEAR-RECORDS", NULL);
+    size_t proxies, queued;
+    s_proxies (server, &proxies, &queued);
+    size_t held = s_heap_used ();
+
+    result->scenario = scenario;
+    result->devices = devices;
+    result->elapsed = commits.empty () ? -1 : (commits.back () - start) / 1000;
+    result->peak = s_peak (commits);
+    result->memory = held > heap ? double (held - heap) / 1024.0 * 1000.0 / double (devices) : 0;
+    result->allocs = double (allocs) / double (devices);
+    zactor_destroy (&server);
+    return ok;
+}
+
+int
+main (int argc, char *argv [])
+{
+    const char *devices_list = "1000";
+    double rate = 20;
+    size_t burst = 10;
+    const char *state_file = "proxy-bench.zpl";
+    double max_memory = 0;
+    bool verbose = false;
+
+    ManageFtyLog::setInstanceFtylog ("fty-mdns-sd-proxy-bench");
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help") || streq (argv [argn], "-h")) {
+            usage ();
+            return 0;
+        }
+        else if (streq (argv [argn], "--verbose") || streq (argv [argn], "-v")) {
+            verbose = true;
+        }
+        else if ((streq (argv [argn], "--devices") || streq (argv [argn], "-n")) && param) {
+            devices_list = param;
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--rate") || streq (argv [argn], "-r")) && param) {
+            rate = atof (param);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--burst") || streq (argv [argn], "-b")) && param) {
+            burst = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--state-file") || streq (argv [argn], "-s")) && param) {
+            state_file = param;
+            ++argn;
+        }
+        else if (streq (argv [argn], "--max-memory") && param) {
+            max_memory = atof (param);
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (rate <= 0 || burst == 0) {
+        usage ();
+        return EXIT_FAILURE;
+    }
+    if (verbose)
+        ManageFtyLog::getInstanceFtylog ()->setVerboseMode ();
+
+    std::vector<size_t> sizes;
+    for (const char *cursor = devices_list; *cursor; ) {
+        char *end;
+        size_t devices = strtoul (cursor, &end, 10);
+        if (end == cursor) break;
+        if (devices > 0)
+            sizes.push_back (devices);
+        cursor = *end == ',' ? end + 1 : end;
+    }
+
+    zactor_t *broker = zactor_new (mlm_server, (void *) "Malamute");
+    zstr_sendx (broker, "BIND", BENCH_ENDPOINT, NULL);
+    mlm_client_t *producer = mlm_client_new ();
+    int r = mlm_client_connect (producer, BENCH_ENDPOINT, 1000, "fty-mdns-sd-proxy-bench");
+    if (r == 0)
+        r = mlm_client_set_producer (producer, FTY_PROTO_STREAM_ASSETS);
+    if (r != 0) {
+        printf ("Cannot connect to the malamute broker\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!alloc_counting ())
+        printf ("allocations are not counted in this build\n");
+    printf ("rate %.0f commits/s, burst %zu\n", rate, burst);
+    printf ("%-10s %8s %12s %8s %12s %13s\n",
+        "scenario", "devices", "register(ms)", "peak/s", "KiB/1000dev", "allocs/device");
+
+    bool failed = false;
+    for (size_t devices : sizes) {
+        struct { const char *scenario; double rate; } runs [] = {
+            { "staggered", rate },
+            { "unlimited", 0 },
+        };
+        for (const auto &run : runs) {
+            s_result_t result;
+            if (!s_run (producer, run.scenario, devices, run.rate, burst, state_file, &result)) {
+                printf ("%-10s %8zu: not registered in time\n", run.scenario, devices);
+                failed = true;
+                continue;
+            }
+            printf ("%-10s %8zu %12" PRIi64 " %8zu %12.0f %13.1f\n",
+                result.scenario, result.devices, result.elapsed, result.peak, result.memory, result.allocs);
+
+            if (run.rate > 0 && double (result.peak) > run.rate + double (burst)) {
+                printf ("  FAIL: %zu commits within a second, above %.0f + %zu\n", result.peak, run.rate, burst);
+                failed = true;
+            }
+            if (max_memory > 0 && result.memory > max_memory) {
+                printf ("  FAIL: %.0f KiB per 1000 devices, above %.0f\n", result.memory, max_memory);
+                failed = true;
+            }
+        }
+    }
+
+    mlm_client_destroy (&producer);
+    zactor_destroy (&broker);
+    remove (state_file);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+
+/*
+ * File:   startup_sim.cc
+ *
+ * Simulation of a fleet powered on at once, e.g. a whole row after an
+ * outage: N agents (fty_mdns_sd_server actors on the recording backend, no
+ * avahi-daemon needed) start together, each with the announcement of its
+ * own state file and its own uid, first without jitter then with it. The
+ * first registrations of all agents are collected, and the peak per second
+ * (sliding window) and the time until the last one are reported.
+ *
+ * A second round replays a large TXT update (e.g. a new firmware version
+ * with its release notes) reaching every agent at the same moment.
+ *
+ * The exit code is 1 if the jitter does not lower the peak.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "../src/fty_mdns_sd_classes.h"
+
+#define SIM_TIMEOUT 30000   // ms, on top of the jitter
+
+static void
+usage ()
+{
+    puts ("fty-mdns-sd-startup-sim [options] ...");
+    puts ("  -n|--agents         agents powered on together [100]");
+    puts ("  -j|--jitter         max delay of the jittered run (ms) [5000]");
+    puts ("  -t|--txt-bytes      TXT size of a large update (bytes) [400]");
+    puts ("  -h|--help           this information");
+}
+
+typedef struct {
+    size_t peak;            // records within a second, at most
+    int64_t last;           // ms, from the start to the last record
+} s_result_t;
+
+//  zclock_usecs() of the first record of kind, -1 if none
+static int64_t
+s_first_record (zactor_t *agent, const char *kind, const char *key)
+{
+    zstr_sendx (agent, "GET-RECORDS", NULL);
+    zmsg_t *reply = zmsg_recv (agent);
+    if (!reply)
+        return -1;
+    int64_t at = -1;
+    char *header = zmsg_popstr (reply);
+    while (zmsg_size (reply) >= 4) {
+        char *record_kind = zmsg_popstr (reply);
+        char *usec = zmsg_popstr (reply);
+        char *record_key = zmsg_popstr (reply);
+        zframe_t *txt = zmsg_pop (reply);
+        if (at < 0 && streq (record_kind, kind) && streq (record_key, key))
+            at = strtoll (usec, NULL, 10);
+        zframe_destroy (&txt);
+        zstr_free (&record_key);
+        zstr_free (&usec);
+        zstr_free (&record_kind);
+    }
+    zstr_free (&header);
+    zmsg_destroy (&reply);
+    return at;
+}
+
+//  wait for a record of kind in every agent, summarize their times
+static bool
+s_collect (std::vector<zactor_t *> &agents, const char *kind, int64_t start, int64_t timeout, s_result_t *result)
+{
+    std::vector<int64_t> times (agents.size (), -1);
+    int64_t deadline = zclock_mono () + timeout;
+    size_t missing = agents.size ();
+    while (missing > 0 && zclock_mono () < deadline) {
+        missing = 0;
+        for (size_t i = 0; i < agents.size (); i++) {
+            if (times [i] < 0)
+                times [i] = s_first_record (agents [i], kind, DEFAULT_SERVICE_KEY);
+            if (times [i] < 0)
+                missing++;
+        }
+        if (missing > 0)
+            zclock_sleep (20);
+    }
+    if (missing > 0)
+        return false;
+    std::sort (times.begin (), times.end ());
+    size_t peak = 0, first = 0;
+    for (size_t last = 0; last < times.size (); last++) {
+        while (times [last] - times [first] >= 1000000)
+            first++;
+        peak = std::max (peak, last - first + 1);
+    }
+    result->peak = peak;
+    result->last = (times.back () - start) / 1000;
+    return true;
+}
+
+static bool
+s_run (size_t count, int64_t jitter, size_t txt_bytes, s_result_t *started, s_result_t *updated)
+{
+    // announcements of the agents, as kept by their last run
+    std::vector<zactor_t *> agents;
+    for (size_t i = 0; i < count; i++) {
+        std::string uid = "LA" + std::to_string (71042000 + i);
+        std::string state_file = "startup-sim-" + std::to_string (i) + ".zpl";
+        zhash_t *txt = zhash_new ();
+        zhash_insert (txt, "txtvers", (void *) "1.0.0");
+        zhash_insert (txt, "uuid", (void *) uid.c_str ());
+        announce_state_save (state_file.c_str (), ("IPC " + uid).c_str (), "_https._tcp.",
+            "_powerservice._sub._https._tcp.", "443", txt, NULL);
+        zhash_destroy (&txt);
+
+        std::string name = "fty-mdns-sd-sim-" + std::to_string (i);
+        zactor_t *agent = zactor_new (fty_mdns_sd_server, (void *) name.c_str ());
+        zstr_sendx (agent, "SET-PUBLISHER", "RECORDING", NULL);
+        zstr_sendx (agent, "SET-JITTER", std::to_string (jitter).c_str (), std::to_string (txt_bytes).c_str (),
+            uid.c_str (), NULL);
+        agents.push_back (agent);
+    }
+
+    // power on
+    int64_t start = zclock_usecs ();
+    for (size_t i = 0; i < count; i++)
+        zstr_sendx (agents [i], "SET-STATE-FILE", ("startup-sim-" + std::to_string (i) + ".zpl").c_str (), NULL);
+    bool ok = s_collect (agents, "COMMIT", start, SIM_TIMEOUT + jitter, started);
+
+    // the same large update everywhere
+    std::string notes = "notes=" + std::string (txt_bytes, 'n');
+    start = zclock_usecs ();
+    for (size_t i = 0; ok && i < count; i++) {
+        std::string uid = "LA" + std::to_string (71042000 + i);
+        zstr_sendx (agents [i], "UPDATE-SERVICE", DEFAULT_SERVICE_KEY, ("IPC " + uid).c_str (), "_https._tcp.",
+            "_powerservice._sub._https._tcp.", "443", "txtvers=1.0.1", ("uuid=" + uid).c_str (), notes.c_str (), NULL);
+    }
+    ok = ok && s_collect (agents, "UPDATE", start, SIM_TIMEOUT + jitter, updated);
+
+    for (size_t i = 0; i < count; i++) {
+        zactor_destroy (&agents [i]);
+        remove (("startup-sim-" + std::to_string (i) + ".zpl").c_str ());
+    }
+    return ok;
+}
+
+int
+main (int argc, char *argv [])
+{
+    size_t agents = 100;
+    int64_t jitter = 5000;
+    size_t txt_bytes = 400;
+
+    ManageFtyLog::setInstanceFtylog ("fty-mdns-sd-startup-sim");
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help") || streq (argv [argn], "-h")) {
+            usage ();
+            return 0;
+        }
+        else if ((streq (argv [argn], "--agents") || streq (argv [argn], "-n")) && param) {
+            agents = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--jitter") || streq (argv [argn], "-j")) && param) {
+            jitter = strtoll (param, NULL, 10);
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--txt-bytes") || streq (argv [argn], "-t")) && param) {
+            txt_bytes = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (agents < 2 || jitter <= 0 || txt_bytes == 0) {
+        usage ();
+        return EXIT_FAILURE;
+    }
+
+    printf ("%zu agents powered on together\n", agents);
+    printf ("%-10s %10s | %12s %10s | %12s %10s\n",
+        "run", "jitter(ms)", "start peak/s", "last(ms)", "update peak/s", "last(ms)");
+
+    bool failed = false;
+    s_result_t results [2][2];
+    int64_t jitters [2] = { 0, jitter };
+    const char *runs [2] = { "before", "after" };
+    for (int run = 0; run < 2; run++) {
+        if (!s_run (agents, jitters [run], txt_bytes, &results [run][0], &results [run][1])) {
+            printf ("%-10s: not every agent announced in time\n", runs [run]);
+            return EXIT_FAILURE;
+        }
+        printf ("%-10s %10" PRIi64 " | %12zu %10" PRIi64 " | %12zu %10" PRIi64 "\n",
+            runs [run], jitters [run], results [run][0].peak, results [run][0].last,
+            results [run][1].peak, results [run][1].last);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (results [1][i].peak >= results [0][i].peak) {
+            printf ("  FAIL: %s peak not lowered by the jitter\n", i ? "update" : "start");
+            failed = true;
+        }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
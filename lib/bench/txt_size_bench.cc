@@ -0,0 +1,235 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+
+/*
+ * File:   txt_size_bench.cc
+ *
+ * Size of the mDNS responses announcing the default service, with TXT sets
+ * modelled on fty-info INFO replies (minimal, typical and fully filled in
+ * asset), before and after the TXT budget: wire size of the TXT RDATA and
+ * of a whole response (PTR, SRV, TXT, A and AAAA records with name
+ * compression), for the primary instance and the secondary one holding the
+ * keys over the budget. The split cost is measured too.
+ *
+ * The exit code is 1 if a response is larger than --max-response, so that
+ * a budget can be checked against a link MTU.
+ */
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "../src/fty_mdns_sd_classes.h"
+
+#define BENCH_INSTANCE  "IPC 3000 (12345678)"
+#define BENCH_TYPE      "_https._tcp"
+#define BENCH_HOST      "ipc-3000-12345678"
+
+static void
+usage ()
+{
+    puts ("fty-mdns-sd-txt-size-bench [options] ...");
+    puts ("  -b|--budget         TXT budget in bytes [1200]");
+    puts ("  -p|--priority       comma separated keys kept first [txtvers,uuid,name,type,version,path,protocol-format]");
+    puts ("  -n|--iterations     splits measured per payload [10000]");
+    puts ("  --drop              drop the keys over the budget instead of moving them");
+    puts ("  --max-response      fail if a response is larger (bytes)");
+    puts ("  -h|--help           this information");
+}
+
+//  encoded size of a domain name: one length byte per label, then the root
+static size_t
+s_name_size (const std::string& name)
+{
+    size_t size = 1;
+    size_t start = 0;
+    while (start < name.size ()) {
+        size_t end = name.find ('.', start);
+        if (end == std::string::npos) end = name.size ();
+        size += 1 + end - start;
+        start = end + 1;
+    }
+    return size;
+}
+
+//  response to a PTR query of the type: PTR, then SRV, TXT, A and AAAA as
+//  additional records, names after the first one compressed
+static size_t
+s_response_size (const std::string& instance, size_t txt)
+{
+    const size_t header = 12, fixed = 10, pointer = 2;
+    size_t size = header;
+    size += s_name_size (BENCH_TYPE ".local") + fixed + 1 + instance.size () + pointer;   // PTR
+    size += pointer + fixed + 6 + 1 + strlen (BENCH_HOST) + pointer;                      // SRV
+    size += pointer + fixed + txt;                                                          // TXT
+    size += pointer + fixed + 4;                                                            // A
+    size += pointer + fixed + 16;                                                           // AAAA
+    return size;
+}
+
+typedef std::vector<std::pair<std::string, std::string>> s_payload_t;
+
+//  TXT set of an INFO reply, more keys and longer values as the asset is filled in
+static s_payload_t
+s_payload (int level)
+{
+    s_payload_t txt = {
+        { "txtvers", "1.0.0" },
+        { "uuid", "12345678-9abc-def0-1234-56789abcdef0" },
+        { "name", "IPC 3000" },
+        { "type", "ipc" },
+        { "version", "2.4.0-202010071503" },
+        { "path", "/api/v1/comm.cgi" },
+        { "protocol-format", "etn-rest" },
+    };
+    if (level < 1)
+        return txt;
+    s_payload_t typical = {
+        { "name-uri", "/asset/rackcontroller-0" },
+        { "vendor", "Eaton" },
+        { "manufacturer", "Eaton" },
+        { "product", "IPC3000" },
+        { "serial", "LA71042052" },
+        { "part-number", "IPC3000E-RC" },
+        { "location", "Rack A4" },
+        { "parent-uri", "/asset/rack-12" },
+        { "hostname", BENCH_HOST },
+        { "ip.1", "10.130.38.17" },
+        { "ip.2", "fe80::20a:f7ff:fe8c:d3a1" },
+    };
+    txt.insert (txt.end (), typical.begin (), typical.end ());
+    if (level < 2)
+        return txt;
+    s_payload_t full = {
+        { "location-uri", "/asset/datacenter-1/room-2/row-b/rack-12" },
+        { "description", "Rack controller of the B row, room 2, powering the storage cluster and its network gear" },
+        { "contact", "Facility operations, +1 555 0100, facility-ops@example.com" },
+        { "installDate", "2020-10-07" },
+        { "maintenanceDate", "2021-04-07" },
+        { "ip.3", "192.168.1.10" },
+        { "ip.4", "2001:db8:85a3::8a2e:370:7334" },
+        { "mac.1", "00:0a:f7:8c:d3:a1" },
+        { "mac.2", "00:0a:f7:8c:d3:a2" },
+        { "firmware", "ipc3000-fw-2.4.0-202010071503-release-signed" },
+        { "uptime", "8534125" },
+        { "license", "accepted" },
+        { "timezone", "Europe/Prague" },
+    };
+    txt.insert (txt.end (), full.begin (), full.end ());
+    // asset extended attributes, as many as the user filled in
+    for (int i = 0; i < 24; i++)
+        txt.push_back ({ "ext.custom_" + std::to_string (i), "value of the user defined attribute " + std::to_string (i) });
+    return txt;
+}
+
+int
+main (int argc, char *argv [])
+{
+    const char *budget_bytes = "1200";
+    const char *priority = "txtvers,uuid,name,type,version,path,protocol-format";
+    size_t iterations = 10000;
+    bool drop = false;
+    size_t max_response = 0;
+
+    ManageFtyLog::setInstanceFtylog ("fty-mdns-sd-txt-size-bench");
+
+    int argn;
+    for (argn = 1; argn < argc; argn++) {
+        char *param = NULL;
+        if (argn < argc - 1) param = argv [argn+1];
+
+        if (streq (argv [argn], "--help") || streq (argv [argn], "-h")) {
+            usage ();
+            return 0;
+        }
+        else if ((streq (argv [argn], "--budget") || streq (argv [argn], "-b")) && param) {
+            budget_bytes = param;
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--priority") || streq (argv [argn], "-p")) && param) {
+            priority = param;
+            ++argn;
+        }
+        else if ((streq (argv [argn], "--iterations") || streq (argv [argn], "-n")) && param) {
+            iterations = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else if (streq (argv [argn], "--drop")) {
+            drop = true;
+        }
+        else if (streq (argv [argn], "--max-response") && param) {
+            max_response = strtoul (param, NULL, 10);
+            ++argn;
+        }
+        else {
+            printf ("Unknown option: %s\n", argv [argn]);
+            return EXIT_FAILURE;
+        }
+    }
+    TxtBudget budget;
+    budget.overflow = !drop;
+    if (!TxtBudget::parse (budget_bytes, priority, budget) || iterations == 0) {
+        usage ();
+        return EXIT_FAILURE;
+    }
+
+    printf ("budget %zu bytes, keys over it %s\n", budget.bytes, drop ? "dropped" : "moved");
+    printf ("%-8s %5s | %8s %9s | %8s %9s | %8s %9s | %5s %7s | %8s\n",
+        "payload", "keys", "txt", "response", "txt", "response", "more txt", "response", "moved", "dropped", "split(ns)");
+
+    bool failed = false;
+    const char *names[] = { "minimal", "typical", "full" };
+    for (int level = 0; level < 3; level++) {
+        zhash_t *map = zhash_new ();
+        zhash_autofree (map);
+        for (const auto &entry : s_payload (level))
+            zhash_update (map, entry.first.c_str (), (void *) entry.second.c_str ());
+        zframe_t *frame = zhash_pack (map);
+        TxtFrame txt (frame);
+
+        size_t before = TxtBudget::wireSize (txt);
+        map_string_t primary, secondary;
+        size_t dropped = 0;
+        int64_t start = zclock_usecs ();
+        for (size_t i = 0; i < iterations; i++)
+            dropped = budget.split (txt, primary, secondary);
+        double split_ns = (zclock_usecs () - start) * 1000.0 / iterations;
+        if (budget.fits (txt)) {
+            // published as is
+            primary.clear ();
+            secondary.clear ();
+        }
+
+        size_t responses[3] = { s_response_size (BENCH_INSTANCE, before), 0, 0 };
+        size_t primary_txt = primary.empty () ? before : TxtBudget::wireSize (primary);
+        responses[1] = s_response_size (BENCH_INSTANCE, primary_txt);
+        size_t more_txt = secondary.empty () ? 0 : TxtBudget::wireSize (secondary);
+        if (more_txt)
+            responses[2] = s_response_size (BENCH_INSTANCE TXT_MORE_NAME, more_txt);
+
+        printf ("%-8s %5zu | %8zu %9zu | %8zu %9zu | %8zu %9zu | %5zu %7zu | %8.0f\n",
+            names[level], txt.size (), before, responses[0], primary_txt, responses[1],
+            more_txt, responses[2], secondary.size (), dropped, split_ns);
+
+        if (max_response > 0 && (responses[1] > max_response || responses[2] > max_response)) {
+            printf ("  FAIL: response above %zu bytes\n", max_response);
+            failed = true;
+        }
+        zframe_destroy (&frame);
+        zhash_destroy (&map);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
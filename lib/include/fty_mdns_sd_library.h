@@ -28,6 +28,7 @@
 #include <czmq.h>
 #include <malamute.h>
 #include <fty_log.h>
+#include <fty_proto.h>
 
 //  FTY_MDNS_SD version macros for compile-time API detection
 #define FTY_MDNS_SD_VERSION_MAJOR 1
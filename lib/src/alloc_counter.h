@@ -0,0 +1,40 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   alloc_counter.h
+ *
+ * Heap allocation counter for selftests and benchmarks. Allocations are
+ * only counted when the executable brings its own malloc interposer (see
+ * tests/alloc_counter.cc); elsewhere these weak defaults report nothing.
+ */
+
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdint>
+
+// malloc, calloc and realloc calls so far, in all threads
+uint64_t alloc_count ();
+
+// true if allocations are really counted
+bool alloc_counting ();
+
+#endif
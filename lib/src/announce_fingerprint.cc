@@ -0,0 +1,201 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   announce_fingerprint.cc
+ *
+ */
+
+#include "announce_fingerprint.h"
+
+#include <cinttypes>
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+//  FNV-1a of a string followed by a 0 separator, so "ab"+"c" != "a"+"bc"
+static uint64_t
+s_fnv (uint64_t hash, const char *s)
+{
+    if (s) {
+        for (; *s; s++) {
+            hash ^= (unsigned char) *s;
+            hash *= FNV_PRIME;
+        }
+    }
+    return hash * FNV_PRIME;
+}
+
+static uint64_t
+s_fnv (uint64_t hash, std::string_view s)
+{
+    for (char c : s) {
+        hash ^= (unsigned char) c;
+        hash *= FNV_PRIME;
+    }
+    return hash * FNV_PRIME;
+}
+
+//  splitmix64 finalizer, spreads entry hashes before they are summed
+static uint64_t
+s_mix (uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t
+s_definition (const char *name, const char *type, const char *stype, const char *port)
+{
+    uint64_t hash = FNV_OFFSET;
+    hash = s_fnv (hash, name);
+    hash = s_fnv (hash, type);
+    hash = s_fnv (hash, stype);
+    hash = s_fnv (hash, port);
+    return hash;
+}
+
+static uint64_t
+s_definition (std::string_view name, std::string_view type, std::string_view stype, std::string_view port)
+{
+    uint64_t hash = FNV_OFFSET;
+    hash = s_fnv (hash, name);
+    hash = s_fnv (hash, type);
+    hash = s_fnv (hash, stype);
+    hash = s_fnv (hash, port);
+    return hash;
+}
+
+static uint64_t
+s_entry (const char *key, const char *value)
+{
+    return s_mix (s_fnv (s_fnv (FNV_OFFSET, key), value));
+}
+
+uint64_t announce_fingerprint (
+    const char *name,
+    const char *type,
+    const char *stype,
+    const char *port,
+    zhash_t *txt)
+{
+    uint64_t entries = 0;
+    uint64_t count = 0;
+    if (txt) {
+        for (char *value = (char *) zhash_first (txt); value; value = (char *) zhash_next (txt)) {
+            entries += s_entry (zhash_cursor (txt), value);
+            count++;
+        }
+    }
+    return s_definition (name, type, stype, port) ^ s_mix (entries + count);
+}
+
+uint64_t announce_fingerprint (
+    const char *name,
+    const char *type,
+    const char *stype,
+    const char *port,
+    const map_string_t &txt)
+{
+    uint64_t entries = 0;
+    for (const auto &it : txt)
+        entries += s_entry (it.first.c_str (), it.second.c_str ());
+    return s_definition (name, type, stype, port) ^ s_mix (entries + txt.size ());
+}
+
+uint64_t announce_fingerprint (
+    std::string_view name,
+    std::string_view type,
+    std::string_view stype,
+    std::string_view port,
+    const TxtFrame &txt)
+{
+    uint64_t entries = 0;
+    for (const auto &entry : txt)
+        entries += s_mix (s_fnv (s_fnv (FNV_OFFSET, entry.key), entry.value));
+    return s_definition (name, type, stype, port) ^ s_mix (entries + txt.size ());
+}
+
+uint64_t announce_fingerprint (uint64_t fingerprint, std::string_view field)
+{
+    return s_mix (s_fnv (fingerprint, field));
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void announce_fingerprint_test (bool verbose)
+{
+    printf (" * Announce fingerprint test\n");
+
+    zhash_t *a = zhash_new ();
+    zhash_insert (a, "uuid", (void *) "12345678");
+    zhash_insert (a, "txtvers", (void *) "1.0.0");
+    zhash_insert (a, "hostname", (void *) "ipc");
+
+    // same content inserted in another order
+    zhash_t *b = zhash_new ();
+    zhash_insert (b, "hostname", (void *) "ipc");
+    zhash_insert (b, "txtvers", (void *) "1.0.0");
+    zhash_insert (b, "uuid", (void *) "12345678");
+
+    map_string_t m = { { "uuid", "12345678" }, { "txtvers", "1.0.0" }, { "hostname", "ipc" } };
+
+    uint64_t fa = announce_fingerprint ("IPC", "_https._tcp.", "_powerservice", "443", a);
+    uint64_t fb = announce_fingerprint ("IPC", "_https._tcp.", "_powerservice", "443", b);
+    uint64_t fm = announce_fingerprint ("IPC", "_https._tcp.", "_powerservice", "443", m);
+    assert (fa == fb);
+    assert (fa == fm);
+
+    // any change of the definition or of the TXT set changes the fingerprint
+    assert (fa != announce_fingerprint ("IPC", "_https._tcp.", "_powerservice", "80", a));
+    assert (fa != announce_fingerprint ("IPC2", "_https._tcp.", "_powerservice", "443", a));
+    assert (announce_fingerprint ("ab", "c", "", "", a) != announce_fingerprint ("a", "bc", "", "", a));
+    zhash_update (b, "txtvers", (void *) "1.0.1");
+    assert (fa != announce_fingerprint ("IPC", "_https._tcp.", "_powerservice", "443", b));
+    zhash_update (b, "txtvers", (void *) "1.0.0");
+    zhash_insert (b, "extra", (void *) "");
+    assert (fa != announce_fingerprint ("IPC", "_https._tcp.", "_powerservice", "443", b));
+    // key/value boundary is part of the hash
+    map_string_t m1 = { { "ab", "c" } };
+    map_string_t m2 = { { "a", "bc" } };
+    assert (announce_fingerprint (NULL, NULL, NULL, NULL, m1) != announce_fingerprint (NULL, NULL, NULL, NULL, m2));
+
+    // a packed frame gives the same fingerprint as its zhash
+    zframe_t *frame = zhash_pack (a);
+    assert (fa == announce_fingerprint ("IPC", "_https._tcp.", "_powerservice", "443", TxtFrame (frame)));
+    zframe_destroy (&frame);
+
+    // extended fingerprints differ by the extra field and its position
+    assert (announce_fingerprint (fa, "ups-1.local") != fa);
+    assert (announce_fingerprint (fa, "ups-1.local") != announce_fingerprint (fa, "ups-2.local"));
+    assert (announce_fingerprint (announce_fingerprint (fa, "a"), "b")
+         != announce_fingerprint (announce_fingerprint (fa, "b"), "a"));
+
+    if (verbose)
+        printf ("   fingerprint %016" PRIx64 "\n", fa);
+
+    zhash_destroy (&a);
+    zhash_destroy (&b);
+
+    printf (" * Announce fingerprint test: OK\n");
+}
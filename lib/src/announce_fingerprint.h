@@ -0,0 +1,70 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   announce_fingerprint.h
+ *
+ * 64 bits fingerprint of an announcement (service definition + TXT set),
+ * used to drop periodic ANNOUNCE messages that carry nothing new.
+ */
+
+#ifndef ANNOUNCE_FINGERPRINT_H
+#define ANNOUNCE_FINGERPRINT_H
+
+#include <cstdint>
+#include <string_view>
+#include <czmq.h>
+
+#include "mdns_publisher.h"
+
+/**
+ * The TXT set is canonicalised by combining per-entry hashes with a
+ * commutative operation, so the insertion order of the hash table does
+ * not matter and no sorted copy is needed. NULL strings hash as empty.
+ */
+uint64_t announce_fingerprint (
+    const char *name,
+    const char *type,
+    const char *stype,
+    const char *port,
+    zhash_t *txt);
+
+uint64_t announce_fingerprint (
+    const char *name,
+    const char *type,
+    const char *stype,
+    const char *port,
+    const map_string_t &txt);
+
+// fields viewed in place in a message, see MsgView
+uint64_t announce_fingerprint (
+    std::string_view name,
+    std::string_view type,
+    std::string_view stype,
+    std::string_view port,
+    const TxtFrame &txt);
+
+// fingerprint extended with one more field, e.g. the host of a proxied device
+uint64_t announce_fingerprint (uint64_t fingerprint, std::string_view field);
+
+//  Self test of this class.
+void announce_fingerprint_test (bool verbose);
+
+#endif
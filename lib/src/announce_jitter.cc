@@ -0,0 +1,102 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   announce_jitter.cc
+ *
+ */
+
+#include "announce_jitter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+AnnounceJitter::AnnounceJitter(int64_t max_ms, const std::string& uid)
+{
+    configure(max_ms, uid);
+}
+
+void AnnounceJitter::configure(int64_t max_ms, const std::string& uid)
+{
+    _max = std::max(max_ms, int64_t(0));
+    // FNV-1a of the uid
+    _state = 0xcbf29ce484222325ULL;
+    for (char c : uid) {
+        _state ^= (unsigned char) c;
+        _state *= 0x100000001b3ULL;
+    }
+}
+
+int64_t AnnounceJitter::next()
+{
+    if (_max <= 0)
+        return 0;
+    // splitmix64: close uids (serial numbers) still give unrelated delays
+    uint64_t x = (_state += 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return int64_t(x % uint64_t(_max + 1));
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void announce_jitter_test (bool verbose)
+{
+    printf (" * Announce jitter test\n");
+
+    AnnounceJitter off;
+    assert (!off.enabled () && off.next () == 0);
+
+    // same uid, same delays; another uid, other ones
+    AnnounceJitter a (5000, "4c4c4544-0051-3010-8052-b4c04f4e3732");
+    AnnounceJitter b (5000, "4c4c4544-0051-3010-8052-b4c04f4e3732");
+    AnnounceJitter c (5000, "4c4c4544-0051-3010-8052-b4c04f4e3733");
+    bool differ = false;
+    for (int i = 0; i < 100; i++) {
+        int64_t delay = a.next ();
+        assert (delay >= 0 && delay <= 5000);
+        assert (delay == b.next ());
+        differ |= delay != c.next ();
+    }
+    assert (differ);
+    a.configure (5000, "4c4c4544-0051-3010-8052-b4c04f4e3732");
+    b.configure (5000, "4c4c4544-0051-3010-8052-b4c04f4e3732");
+    assert (a.next () == b.next ());
+
+    // a fleet of consecutive serial numbers spreads evenly: 1000 agents
+    // over 10 s, no second gets more than twice its share
+    {
+        std::vector<int> per_second (11, 0);
+        for (int i = 0; i < 1000; i++) {
+            AnnounceJitter agent (10000, "LA" + std::to_string (71042000 + i));
+            per_second [agent.next () / 1000]++;
+        }
+        int peak = *std::max_element (per_second.begin (), per_second.begin () + 10);
+        assert (peak <= 200);
+        if (verbose)
+            printf ("   1000 agents over 10 s, at most %d starts in a second\n", peak);
+    }
+
+    printf (" * Announce jitter test: OK\n");
+}
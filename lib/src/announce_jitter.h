@@ -0,0 +1,59 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   announce_jitter.h
+ *
+ * Random delays spreading the announcements of appliances powered on
+ * together, e.g. a whole row after a power outage: without them, every
+ * agent probes and announces in the same second. Delays are drawn from a
+ * generator seeded with a uid of the device (its machine id), so that
+ * devices get different delays while each one is reproducible, which also
+ * keeps fleet simulations deterministic.
+ */
+
+#ifndef ANNOUNCE_JITTER_H
+#define ANNOUNCE_JITTER_H
+
+#include <cstdint>
+#include <string>
+
+class AnnounceJitter {
+public:
+    AnnounceJitter(int64_t max_ms = 0, const std::string& uid = "");
+
+    // delays in [0, max_ms], the sequence starts again from uid
+    void configure(int64_t max_ms, const std::string& uid);
+
+    bool enabled() const { return _max > 0; }
+    int64_t max() const { return _max; }
+
+    // next delay (ms), 0 if disabled
+    int64_t next();
+
+private:
+    int64_t _max = 0;
+    uint64_t _state = 0;
+};
+
+//  Self test of this class.
+void announce_jitter_test (bool verbose);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   announce_metrics.cc
+ *
+ */
+
+#include "announce_metrics.h"
+
+#include <cinttypes>
+#include <algorithm>
+#include <string>
+
+void LatencyHistogram::record(int64_t usec)
+{
+    if (usec < 0) usec = 0;
+    int i = usec ? 64 - __builtin_clzll(uint64_t(usec)) : 0;
+    if (i >= BUCKETS) i = BUCKETS - 1;
+    _buckets[i]++;
+    if (!_count || usec < _min) _min = usec;
+    if (usec > _max) _max = usec;
+    _count++;
+    _sum += usec;
+}
+
+int64_t LatencyHistogram::percentile(double p) const
+{
+    if (!_count) return 0;
+    uint64_t rank = uint64_t(p / 100.0 * double(_count) + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += _buckets[i];
+        if (seen >= rank)
+            return std::min(i ? (int64_t(1) << i) - 1 : 0, _max);
+    }
+    return _max;
+}
+
+static void
+s_put (zhash_t *hash, const std::string& name, uint64_t value)
+{
+    zhash_update (hash, name.c_str (), (void *) std::to_string (value).c_str ());
+}
+
+static void
+s_put (zhash_t *hash, const std::string& name, const LatencyHistogram& h)
+{
+    s_put (hash, name + ".count", h.count ());
+    s_put (hash, name + ".sum", uint64_t (h.sum ()));
+    s_put (hash, name + ".min", uint64_t (h.min ()));
+    s_put (hash, name + ".max", uint64_t (h.max ()));
+    s_put (hash, name + ".p50", uint64_t (h.percentile (50)));
+    s_put (hash, name + ".p99", uint64_t (h.percentile (99)));
+}
+
+zhash_t *AnnounceMetrics::snapshot() const
+{
+    zhash_t *hash = zhash_new ();
+    zhash_autofree (hash);
+    s_put (hash, "announce_received", announce_received);
+    s_put (hash, "updates_applied", updates_applied);
+    s_put (hash, "updates_suppressed", updates_suppressed);
+    s_put (hash, "updates_coalesced", updates_coalesced);
+    s_put (hash, "collisions", collisions);
+    s_put (hash, "client_reconnects", client_reconnects);
+    s_put (hash, "info_requests", info_requests);
+    s_put (hash, "txt_keys_moved", txt_keys_moved);
+    s_put (hash, "txt_keys_dropped", txt_keys_dropped);
+    s_put (hash, "updates_jittered", updates_jittered);
+    s_put (hash, "commit_latency", commit_latency);
+    s_put (hash, "info_rtt", info_rtt);
+    s_put (hash, "recovery", recovery);
+    return hash;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void announce_metrics_test (bool verbose)
+{
+    printf (" * Announce metrics test\n");
+
+    LatencyHistogram h;
+    assert (h.count () == 0 && h.percentile (50) == 0);
+    h.record (0);
+    h.record (1);
+    h.record (1000);    // bucket 10: [512, 1024)
+    h.record (1500);    // bucket 11
+    h.record (-5);      // clamped to 0
+    assert (h.count () == 5);
+    assert (h.sum () == 2501);
+    assert (h.min () == 0);
+    assert (h.max () == 1500);
+    assert (h.bucket (0) == 2);
+    assert (h.bucket (1) == 1);
+    assert (h.bucket (10) == 1);
+    assert (h.bucket (11) == 1);
+    assert (h.percentile (50) == 1);
+    assert (h.percentile (80) == 1023);
+    assert (h.percentile (100) == 1500);
+    h.record (INT64_MAX);
+    assert (h.bucket (LatencyHistogram::BUCKETS - 1) == 1);
+
+    AnnounceMetrics metrics;
+    metrics.updates_applied = 3;
+    metrics.commit_latency.record (2000);
+    zhash_t *snapshot = metrics.snapshot ();
+    assert (streq ((char *) zhash_lookup (snapshot, "updates_applied"), "3"));
+    assert (streq ((char *) zhash_lookup (snapshot, "commit_latency.count"), "1"));
+    assert (streq ((char *) zhash_lookup (snapshot, "commit_latency.max"), "2000"));
+    assert (streq ((char *) zhash_lookup (snapshot, "info_rtt.p99"), "0"));
+    zhash_destroy (&snapshot);
+
+    // recording cost
+    {
+        const int count = 1000000;
+        LatencyHistogram bench;
+        int64_t start = zclock_usecs ();
+        for (int i = 0; i < count; i++)
+            bench.record (i & 0xffff);
+        int64_t elapsed = zclock_usecs () - start;
+        assert (bench.count () == uint64_t (count));
+        if (verbose)
+            printf ("   %d histogram records in %" PRIi64 " us (%.1f ns/record)\n",
+                count, elapsed, elapsed * 1000.0 / count);
+    }
+
+    printf (" * Announce metrics test: OK\n");
+}
@@ -0,0 +1,87 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   announce_metrics.h
+ *
+ * Counters and latency histograms of the announce pipeline. Recording is a
+ * few integer operations, so it is done inline on every event; reading is
+ * done on STATS requests and periodic METRICS publication only.
+ */
+
+#ifndef ANNOUNCE_METRICS_H
+#define ANNOUNCE_METRICS_H
+
+#include <cstdint>
+#include <czmq.h>
+
+/**
+ * Histogram of durations in microseconds, with power of two buckets:
+ * bucket i counts the values in [2^(i-1), 2^i), bucket 0 the zeros.
+ */
+class LatencyHistogram {
+public:
+    static const int BUCKETS = 40;  // up to 2^39 us, about 6 days
+
+    void record(int64_t usec);
+
+    uint64_t count() const { return _count; }
+    int64_t sum() const { return _sum; }
+    int64_t min() const { return _count ? _min : 0; }
+    int64_t max() const { return _max; }
+    uint64_t bucket(int i) const { return _buckets[i]; }
+
+    // upper bound of the bucket holding the given percentile (0-100)
+    int64_t percentile(double p) const;
+
+private:
+    uint64_t _count = 0;
+    int64_t _sum = 0;
+    int64_t _min = 0;
+    int64_t _max = 0;
+    uint64_t _buckets[BUCKETS] = {};
+};
+
+struct AnnounceMetrics {
+    uint64_t announce_received = 0;   // ANNOUNCE stream messages
+    uint64_t updates_applied = 0;     // pushed to the publisher
+    uint64_t updates_suppressed = 0;  // identical to the published one
+    uint64_t updates_coalesced = 0;   // pending update replaced by a later one
+    uint64_t collisions = 0;          // service name collisions
+    uint64_t client_reconnects = 0;   // avahi client back to running after a loss
+    uint64_t info_requests = 0;       // fty-info INFO requests sent
+    uint64_t txt_keys_moved = 0;      // TXT keys over the budget, to the secondary instance
+    uint64_t txt_keys_dropped = 0;    // TXT keys over the budget, not published
+    uint64_t updates_jittered = 0;    // first registration or large updates delayed by the jitter
+    LatencyHistogram commit_latency;  // entry group commit to ESTABLISHED
+    LatencyHistogram info_rtt;        // fty-info request to reply
+    LatencyHistogram recovery;        // avahi client running again to all services ESTABLISHED
+
+    /**
+     * Flat view of all values: counters by name, histograms as
+     * <name>.count/.sum/.min/.max/.p50/.p99 (us). Caller destroys the hash.
+     */
+    zhash_t *snapshot() const;
+};
+
+//  Self test of this class.
+void announce_metrics_test (bool verbose);
+
+#endif
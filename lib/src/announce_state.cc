@@ -0,0 +1,179 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   announce_state.cc
+ *
+ */
+
+#include "announce_state.h"
+
+#include <cinttypes>
+#include <string>
+#include <fty_log.h>
+
+#define SELFTEST_DIR_RW "selftest-rw"
+
+int
+announce_state_load (const char *path, char **name, char **type, char **stype, char **port, zhash_t **txt,
+    char **published)
+{
+    if (!path || !zsys_file_exists (path))
+        return -1;
+    zconfig_t *config = zconfig_load (path);
+    if (!config) {
+        log_warning ("Cannot load announce state file %s", path);
+        return -1;
+    }
+    const char *values[4] = {
+        zconfig_get (config, "service/name", NULL),
+        zconfig_get (config, "service/type", NULL),
+        zconfig_get (config, "service/subtype", NULL),
+        zconfig_get (config, "service/port", NULL) };
+    zconfig_t *txt_config = zconfig_locate (config, "txt");
+    if (!values[0] || !values[1] || !values[2] || !values[3] || !txt_config) {
+        log_warning ("Incomplete announce state file %s, ignored", path);
+        zconfig_destroy (&config);
+        return -1;
+    }
+    *name  = strdup (values[0]);
+    *type  = strdup (values[1]);
+    *stype = strdup (values[2]);
+    *port  = strdup (values[3]);
+    const char *chosen = zconfig_get (config, "service/published", NULL);
+    *published = chosen ? strdup (chosen) : NULL;
+    *txt = zhash_new ();
+    zhash_autofree (*txt);
+    for (zconfig_t *item = zconfig_child (txt_config); item; item = zconfig_next (item)) {
+        const char *key = zconfig_get (item, "key", NULL);
+        if (key)
+            zhash_update (*txt, key, (void *) zconfig_get (item, "value", ""));
+    }
+    zconfig_destroy (&config);
+    return 0;
+}
+
+int
+announce_state_save (const char *path, const char *name, const char *type, const char *stype, const char *port, zhash_t *txt,
+    const char *published)
+{
+    if (!path || !name || !type || !stype || !port || !txt)
+        return -1;
+    zconfig_t *config = zconfig_new ("root", NULL);
+    zconfig_put (config, "service/name", name);
+    zconfig_put (config, "service/type", type);
+    zconfig_put (config, "service/subtype", stype);
+    zconfig_put (config, "service/port", port);
+    if (published)
+        zconfig_put (config, "service/published", published);
+    // TXT keys may hold any printable character, zconfig names may not:
+    // entries are numbered, the key is a value
+    zconfig_t *txt_config = zconfig_new ("txt", config);
+    int index = 0;
+    for (char *value = (char *) zhash_first (txt); value; value = (char *) zhash_next (txt)) {
+        zconfig_t *item = zconfig_new (std::to_string (++index).c_str (), txt_config);
+        zconfig_put (item, "key", zhash_cursor (txt));
+        zconfig_put (item, "value", value);
+    }
+
+    std::string tmp = std::string (path) + ".tmp";
+    int rv = zconfig_save (config, tmp.c_str ());
+    if (rv == 0 && rename (tmp.c_str (), path) != 0)
+        rv = -1;
+    if (rv != 0) {
+        log_error ("Cannot save announce state file %s", path);
+        remove (tmp.c_str ());
+    }
+    zconfig_destroy (&config);
+    return rv;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+announce_state_test (bool verbose)
+{
+    printf (" * Announce state test\n");
+
+    const char *path = SELFTEST_DIR_RW "/announce-state-test.zpl";
+    remove (path);
+
+    char *name = NULL, *type = NULL, *stype = NULL, *port = NULL, *published = NULL;
+    zhash_t *txt = NULL;
+    assert (announce_state_load (path, &name, &type, &stype, &port, &txt, &published) == -1);
+    assert (!name && !txt);
+
+    zhash_t *saved = zhash_new ();
+    zhash_insert (saved, "txtvers", (void *) "1.0.0");
+    zhash_insert (saved, "uuid", (void *) "12345678-0000-0000-0000-000000000000");
+    zhash_insert (saved, "path", (void *) "/etn/v1/comm/");
+    zhash_insert (saved, "empty", (void *) "");
+    // printable, but not a zconfig name
+    zhash_insert (saved, "rack: 4", (void *) "row b");
+    assert (announce_state_save (path, "IPC (12345678)", "_https._tcp.",
+        "_powerservice._sub._https._tcp.", "443", saved, NULL) == 0);
+    assert (!zsys_file_exists (SELFTEST_DIR_RW "/announce-state-test.zpl.tmp"));
+
+    int64_t start = zclock_usecs ();
+    assert (announce_state_load (path, &name, &type, &stype, &port, &txt, &published) == 0);
+    int64_t elapsed = zclock_usecs () - start;
+    assert (streq (name, "IPC (12345678)"));
+    assert (streq (type, "_https._tcp."));
+    assert (streq (stype, "_powerservice._sub._https._tcp."));
+    assert (streq (port, "443"));
+    assert (zhash_size (txt) == 5);
+    assert (streq ((char *) zhash_lookup (txt, "path"), "/etn/v1/comm/"));
+    assert (streq ((char *) zhash_lookup (txt, "empty"), ""));
+    assert (streq ((char *) zhash_lookup (txt, "rack: 4"), "row b"));
+    assert (published == NULL);
+    if (verbose)
+        printf ("   state loaded in %" PRIi64 " us\n", elapsed);
+
+    zstr_free (&name);
+    zstr_free (&type);
+    zstr_free (&stype);
+    zstr_free (&port);
+    zhash_destroy (&txt);
+
+    // name chosen after collisions
+    assert (announce_state_save (path, "IPC (12345678)", "_https._tcp.",
+        "_powerservice._sub._https._tcp.", "443", saved, "IPC (12345678) #2") == 0);
+    assert (announce_state_load (path, &name, &type, &stype, &port, &txt, &published) == 0);
+    assert (streq (name, "IPC (12345678)"));
+    assert (published && streq (published, "IPC (12345678) #2"));
+    zstr_free (&name);
+    zstr_free (&type);
+    zstr_free (&stype);
+    zstr_free (&port);
+    zstr_free (&published);
+    zhash_destroy (&txt);
+    zhash_destroy (&saved);
+
+    // incomplete file is ignored
+    zconfig_t *broken = zconfig_new ("root", NULL);
+    zconfig_put (broken, "service/name", "IPC (12345678)");
+    zconfig_save (broken, path);
+    zconfig_destroy (&broken);
+    assert (announce_state_load (path, &name, &type, &stype, &port, &txt, &published) == -1);
+    remove (path);
+
+    printf (" * Announce state test: OK\n");
+}
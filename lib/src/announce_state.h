@@ -0,0 +1,84 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   announce_state.h
+ *
+ * On-disk copy of the last published default announcement, so that it can
+ * be published again right after a restart, before fty-info answers.
+ * The file is in zconfig format:
+ *
+ *  service
+ *      name = IPC (12345678)
+ *      type = _https._tcp.
+ *      subtype = _powerservice._sub._https._tcp.
+ *      port = 443
+ *      published = IPC (12345678) #2   (optional, see below)
+ *  txt
+ *      1
+ *          key = txtvers
+ *          value = 1.0.0
+ *      ...
+ *
+ * TXT keys are stored as values, they may hold characters (space, ':')
+ * that zconfig does not accept in names.
+ *
+ * published is the name the service was last established under, when
+ * collisions made it differ from the requested name: after a restart it is
+ * registered again at once, without renaming through the taken ones.
+ */
+
+#ifndef ANNOUNCE_STATE_H
+#define ANNOUNCE_STATE_H
+
+#include <czmq.h>
+
+/**
+ * Load the announcement saved in path. On success return 0, the caller
+ * owns the strings and the (autofree) hash. Return -1 if the file does not
+ * exist or is incomplete, nothing is allocated then. published is set to
+ * NULL when the file has none.
+ */
+int announce_state_load (
+    const char *path,
+    char **name,
+    char **type,
+    char **stype,
+    char **port,
+    zhash_t **txt,
+    char **published);
+
+/**
+ * Save the announcement to path, atomically (written aside then renamed).
+ * published may be NULL. Return 0 or -1.
+ */
+int announce_state_save (
+    const char *path,
+    const char *name,
+    const char *type,
+    const char *stype,
+    const char *port,
+    zhash_t *txt,
+    const char *published);
+
+//  Self test of this class.
+void announce_state_test (bool verbose);
+
+#endif
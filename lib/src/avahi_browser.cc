@@ -0,0 +1,474 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   avahi_browser.cc
+ *
+ */
+
+#include "avahi_browser.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <avahi-common/address.h>
+#include <avahi-common/error.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+#include <fty_log.h>
+
+#include "avahi_wrapper.h"
+#include "avahi_zloop_poll.h"
+
+#define SUBTYPE_SEPARATOR "._sub."
+
+AvahiBrowser::AvahiBrowser(const AvahiPoll *poll, DiscoveryCache *cache) :
+    _poll(poll),
+    _cache(cache)
+{
+    assert(_cache);
+    _pool.setStarter([this](const std::string& key) { return resolve(key); });
+}
+
+AvahiBrowser::~AvahiBrowser()
+{
+    stop();
+    for (Browse* b : _browsers) delete b;
+}
+
+std::string AvahiBrowser::baseType(const std::string& type)
+{
+    size_t pos = type.find(SUBTYPE_SEPARATOR);
+    if (pos == std::string::npos)
+        return DiscoveryCache::normalize(type);
+    return DiscoveryCache::normalize(type.substr(pos + strlen(SUBTYPE_SEPARATOR)));
+}
+
+bool AvahiBrowser::parseResolveMode(const std::string& value, ResolveMode& mode)
+{
+    if (value == "lazy")
+        mode = LAZY;
+    else if (value == "eager")
+        mode = EAGER;
+    else
+        return false;
+    return true;
+}
+
+bool AvahiBrowser::running() const
+{
+    return _client && avahi_client_get_state(_client) == AVAHI_CLIENT_S_RUNNING;
+}
+
+void AvahiBrowser::addType(const std::string& type)
+{
+    std::string value = DiscoveryCache::normalize(type);
+    if (value.empty() || !_types.insert(value).second)
+        return;
+    Browse* b = new Browse();
+    b->owner = this;
+    b->type = baseType(value);
+    if (b->type != value)
+        b->subtype = value;
+    _browsers.push_back(b);
+    if (running())
+        browse(b);
+}
+
+int AvahiBrowser::start()
+{
+    int error = 0;
+    if (!_poll) {
+        log_error("No poll api given, cannot create avahi client");
+        return AVAHI_ERR_FAILURE;
+    }
+    if (_client)
+        return 0;
+    _client = avahi_client_new(_poll, AvahiClientFlags(0), AvahiBrowser::clientCallback, this, &error);
+    if (!_client) {
+        log_error("Failed to create avahi browsing client: %s", avahi_strerror(error));
+        return error;
+    }
+    armSweep();
+    return 0;
+}
+
+void AvahiBrowser::stop()
+{
+    freeResolvers();
+    freeBrowsers();
+    if (_sweep) _poll->timeout_free(_sweep);
+    _sweep = nullptr;
+    if (_client) avahi_client_free(_client);
+    _client = nullptr;
+    _browsed.clear();
+    _refreshing.clear();
+}
+
+void AvahiBrowser::freeBrowsers()
+{
+    for (Browse* b : _browsers) {
+        if (b->browser) avahi_service_browser_free(b->browser);
+        b->browser = nullptr;
+    }
+}
+
+void AvahiBrowser::freeResolvers()
+{
+    for (Resolve* r : _resolvers) {
+        if (r->resolver) avahi_service_resolver_free(r->resolver);
+        delete r;
+    }
+    _resolvers.clear();
+    _pool.reset();
+}
+
+void AvahiBrowser::browse(Browse* b)
+{
+    if (b->browser) return;
+    const std::string& type = b->subtype.empty() ? b->type : b->subtype;
+    b->browser = avahi_service_browser_new(_client, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+        type.c_str(), nullptr, AvahiLookupFlags(0), AvahiBrowser::browseCallback, b);
+    if (!b->browser)
+        log_error("Failed to browse %s: %s", type.c_str(), avahi_strerror(avahi_client_errno(_client)));
+    else
+        log_debug("Browsing %s", type.c_str());
+}
+
+bool AvahiBrowser::resolve(const std::string& key)
+{
+    const DiscoveredService* entry = _cache->find(key);
+    if (!entry || !running())
+        return false;
+    Resolve* r = new Resolve();
+    r->owner = this;
+    r->key = key;
+    r->resolver = avahi_service_resolver_new(_client, entry->ifindex, entry->protocol, entry->name.c_str(),
+        entry->type.c_str(), entry->domain.c_str(), AVAHI_PROTO_UNSPEC, AvahiLookupFlags(0),
+        AvahiBrowser::resolveCallback, r);
+    if (!r->resolver) {
+        log_error("Failed to resolve service '%s': %s", key.c_str(), avahi_strerror(avahi_client_errno(_client)));
+        delete r;
+        return false;
+    }
+    _resolvers.insert(r);
+    return true;
+}
+
+bool AvahiBrowser::demand(const std::string& key, int64_t now)
+{
+    return running() && _cache->find(key) && _pool.request(key, now) != ResolverPool::HIT;
+}
+
+void AvahiBrowser::armSweep()
+{
+    // entries are checked a few times per TTL period
+    unsigned period = unsigned(std::max<int64_t>(1000, _cache->ttl() / 4));
+    struct timeval tv;
+    avahi_elapse_time(&tv, period, 0);
+    if (_sweep)
+        _poll->timeout_update(_sweep, &tv);
+    else
+        _sweep = _poll->timeout_new(_poll, &tv, AvahiBrowser::sweepCallback, this);
+}
+
+void AvahiBrowser::sweep(int64_t now)
+{
+    for (const auto &key : _cache->expiring(now)) {
+        if (_refreshing.count(key) || !running()) {
+            log_debug("Discovered service '%s' expired", key.c_str());
+            _refreshing.erase(key);
+            _browsed.erase(key);
+            _pool.forget(key);
+            _cache->remove(key);
+            continue;
+        }
+        _cache->touch(key, now + _cache->ttl());
+        // still browsed: avahi-daemon reports its removal, consumers get it resolved again
+        if (_mode == LAZY && _browsed.count(key))
+            continue;
+        // second chance: ask the network again before dropping it
+        _refreshing.insert(key);
+        _pool.forget(key);
+        _pool.request(key, now);
+    }
+}
+
+void AvahiBrowser::onClientRunning()
+{
+    for (Browse* b : _browsers)
+        browse(b);
+}
+
+void AvahiBrowser::onFound(Resolve* r, AvahiIfIndex interface, AvahiProtocol protocol,
+    const char *name, const char *type, const char *domain, const char *host_name,
+    const AvahiAddress *address, uint16_t port, AvahiStringList *txt)
+{
+    DiscoveredService service;
+    service.name = name;
+    service.type = type;
+    service.domain = domain ? domain : "";
+    service.host = host_name ? host_name : "";
+    service.port = port;
+    service.ifindex = interface;
+    service.protocol = protocol;
+    if (address) {
+        char a[AVAHI_ADDRESS_STR_MAX];
+        avahi_address_snprint(a, sizeof(a), address);
+        service.address = a;
+    }
+    for (AvahiStringList *l = txt; l; l = avahi_string_list_get_next(l)) {
+        char *key = nullptr, *value = nullptr;
+        if (avahi_string_list_get_pair(l, &key, &value, nullptr) == 0) {
+            service.txt[key] = value ? value : "";
+            avahi_free(key);
+            avahi_free(value);
+        }
+    }
+    int64_t now = zclock_mono();
+    const DiscoveredService* entry = _cache->upsert(service, now);
+    _refreshing.erase(r->key);
+    _pool.finished(r->key, true, now);
+    log_debug("Resolved service '%s' on %s:%u", entry->key().c_str(), service.host.c_str(), port);
+    if (_resolved)
+        _resolved(r->key);
+}
+
+void AvahiBrowser::clientCallback(AvahiClient* client, AvahiClientState state, void *userdata)
+{
+    AvahiBrowser* self = (AvahiBrowser*) userdata;
+    if (!self) return;
+    // the callback may be called from avahi_client_new(), before it returns
+    self->_client = client;
+    switch (state) {
+        case AVAHI_CLIENT_S_RUNNING:
+            log_debug("Browsing client running");
+            self->onClientRunning();
+            break;
+        case AVAHI_CLIENT_FAILURE:
+            log_error("Browsing client failure: %s", avahi_strerror(avahi_client_errno(client)));
+            self->freeResolvers();
+            self->freeBrowsers();
+            break;
+        default:
+            break;
+    }
+}
+
+void AvahiBrowser::browseCallback(AvahiServiceBrowser *b, AvahiIfIndex interface, AvahiProtocol protocol,
+    AvahiBrowserEvent event, const char *name, const char *type, const char *domain,
+    AvahiLookupResultFlags flags, void *userdata)
+{
+    Browse* browse = (Browse*) userdata;
+    AvahiBrowser* self = browse->owner;
+    switch (event) {
+        case AVAHI_BROWSER_NEW: {
+            // stored unresolved, subtype browsers report the subtype of the base type
+            DiscoveredService service;
+            service.name = name;
+            service.type = browse->type;
+            service.domain = domain ? domain : "";
+            service.ifindex = interface;
+            service.protocol = protocol;
+            service.resolved = false;
+            if (!browse->subtype.empty())
+                service.subtypes.insert(browse->subtype);
+            int64_t now = zclock_mono();
+            std::string key = self->_cache->upsert(service, now)->key();
+            self->_browsed.insert(key);
+            if (self->_mode == EAGER || !browse->subtype.empty())
+                self->_pool.request(key, now);
+            break;
+        }
+        case AVAHI_BROWSER_REMOVE: {
+            std::string key = DiscoveredService::key(name, browse->type, domain ? domain : "");
+            if (browse->subtype.empty()) {
+                log_debug("Service '%s' removed", key.c_str());
+                self->_refreshing.erase(key);
+                self->_pool.forget(key);
+                self->_cache->remove(key);
+            }
+            else
+                self->_cache->removeSubtype(key, browse->subtype);
+            // resolved again before being dropped, if not browsed anymore
+            self->_browsed.erase(key);
+            break;
+        }
+        case AVAHI_BROWSER_FAILURE:
+            log_error("Browsing %s failed: %s", browse->type.c_str(),
+                avahi_strerror(avahi_client_errno(avahi_service_browser_get_client(b))));
+            break;
+        case AVAHI_BROWSER_ALL_FOR_NOW:
+        case AVAHI_BROWSER_CACHE_EXHAUSTED:
+            break;
+    }
+    (void) type; (void) flags;
+}
+
+void AvahiBrowser::resolveCallback(AvahiServiceResolver *r, AvahiIfIndex interface, AvahiProtocol protocol,
+    AvahiResolverEvent event, const char *name, const char *type, const char *domain,
+    const char *host_name, const AvahiAddress *a, uint16_t port, AvahiStringList *txt,
+    AvahiLookupResultFlags flags, void *userdata)
+{
+    Resolve* resolve = (Resolve*) userdata;
+    AvahiBrowser* self = resolve->owner;
+    // one shot resolver, its pool slot is given to the next one
+    self->_resolvers.erase(resolve);
+    if (event == AVAHI_RESOLVER_FOUND)
+        self->onFound(resolve, interface, protocol, name, type, domain, host_name, a, port, txt);
+    else {
+        const std::string& key = resolve->key;
+        log_warning("Failed to resolve service '%s': %s", key.c_str(),
+            avahi_strerror(avahi_client_errno(avahi_service_resolver_get_client(r))));
+        // an expired entry which does not answer anymore is gone
+        if (self->_refreshing.erase(key)) {
+            self->_browsed.erase(key);
+            self->_cache->remove(key);
+        }
+        self->_pool.finished(key, false, zclock_mono());
+        if (self->_resolved)
+            self->_resolved(key);
+    }
+    avahi_service_resolver_free(r);
+    delete resolve;
+    (void) flags;
+}
+
+void AvahiBrowser::sweepCallback(AvahiTimeout *t, void *userdata)
+{
+    AvahiBrowser* self = (AvahiBrowser*) userdata;
+    self->sweep(zclock_mono());
+    self->armSweep();
+    (void) t;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+typedef struct {
+    DiscoveryCache *cache;
+    const char *key;
+} s_browse_probe_t;
+
+static int
+s_test_found_cb(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id;
+    s_browse_probe_t *probe = (s_browse_probe_t*) arg;
+    const DiscoveredService *found = probe->cache->find(probe->key);
+    return (found && found->resolved && !found->subtypes.empty()) ? -1 : 0;
+}
+
+static int
+s_test_timeout_cb(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id; (void) arg;
+    return -1;
+}
+
+void avahi_browser_test (bool verbose)
+{
+    printf (" * Avahi browser test\n");
+
+    assert(AvahiBrowser::baseType("_https._tcp.") == "_https._tcp");
+    assert(AvahiBrowser::baseType("_powerservice._sub._https._tcp") == "_https._tcp");
+    AvahiBrowser::ResolveMode mode = AvahiBrowser::EAGER;
+    assert(AvahiBrowser::parseResolveMode("lazy", mode) && mode == AvahiBrowser::LAZY);
+    assert(AvahiBrowser::parseResolveMode("eager", mode) && mode == AvahiBrowser::EAGER);
+    assert(!AvahiBrowser::parseResolveMode("never", mode) && mode == AvahiBrowser::EAGER);
+
+    //  without a client, types are only recorded and nothing expires early
+    {
+        DiscoveryCache cache(1000);
+        AvahiBrowser browser(nullptr, &cache);
+        browser.addType("_https._tcp");
+        browser.addType("_https._tcp.");
+        browser.addType("_powerservice._sub._https._tcp");
+        assert(browser.types().size() == 2);
+        assert(!browser.running());
+        assert(browser.start() != 0);
+
+        DiscoveredService s;
+        s.name = "IPC (1234)";
+        s.type = "_https._tcp";
+        s.port = 443;
+        cache.upsert(s, 0);
+        // nothing can be resolved without a client
+        assert(!browser.demand(s.key(), 0));
+        assert(browser.resolvers().queued() == 0 && browser.resolvers().stats().misses == 0);
+        browser.sweep(500);
+        assert(cache.size() == 1);
+        // not running, cannot be resolved again, dropped at once
+        browser.sweep(1000);
+        assert(cache.size() == 0);
+    }
+
+    //  browse a service published by ourselves
+    //  this part needs avahi-daemon running
+    {
+        zloop_t *loop = zloop_new();
+        AvahiZloopPoll *poll = new AvahiZloopPoll(loop);
+        DiscoveryCache cache(60000);
+        AvahiBrowser *browser = new AvahiBrowser(poll->get(), &cache);
+        AvahiWrapper *publisher = new AvahiWrapper(poll->get());
+
+        char name[64];
+        snprintf(name, sizeof(name), "fty-mdns-sd browse %d", (int) getpid());
+        std::string key = DiscoveredService::key(name, "_fty-selftest._tcp", "local");
+        publisher->setService(DEFAULT_SERVICE_KEY, name, "_fty-selftest._tcp",
+            "_probe._sub._fty-selftest._tcp", "4242");
+        map_string_t txt = { { "txtvers", "1.0.0" } };
+        publisher->setTxtRecords(DEFAULT_SERVICE_KEY, txt);
+        browser->addType("_fty-selftest._tcp");
+        browser->addType("_probe._sub._fty-selftest._tcp");
+        std::vector<std::string> resolved;
+        browser->setResolvedListener([&resolved](const std::string& k) { resolved.push_back(k); });
+
+        if (publisher->start() == 0 && browser->start() == 0) {
+            s_browse_probe_t probe = { &cache, key.c_str() };
+            int64_t start = zclock_mono();
+            zloop_timer(loop, 10, 0, s_test_found_cb, &probe);
+            zloop_timer(loop, 5000, 1, s_test_timeout_cb, NULL);
+            zloop_start(loop);
+
+            const DiscoveredService *found = cache.find(key);
+            assert(found);
+            assert(found->port == 4242);
+            assert(found->txt.at("txtvers") == "1.0.0");
+            assert(cache.bySubtype("_probe._sub._fty-selftest._tcp").size() == 1);
+            assert(std::find(resolved.begin(), resolved.end(), key) != resolved.end());
+            // the subtype matched, resolved once, a consumer asking now gets the result
+            uint64_t hits = browser->resolvers().stats().hits;
+            assert(!browser->demand(key, zclock_mono()));
+            assert(browser->resolvers().stats().hits == hits + 1);
+            if (verbose)
+                printf ("   own service discovered after %" PRIi64 " ms\n", zclock_mono() - start);
+        }
+        else
+            printf ("   avahi-daemon not available, browsing part skipped\n");
+
+        delete browser;
+        delete publisher;
+        delete poll;
+        zloop_destroy(&loop);
+    }
+
+    printf (" * Avahi browser test: OK\n");
+}
@@ -0,0 +1,160 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   avahi_browser.h
+ *
+ * DNS-SD discovery engine: browses service types (and subtypes) through
+ * its own avahi client and keeps the instances in a DiscoveryCache. Browsed
+ * instances are stored unresolved; in lazy mode they are resolved only when
+ * a consumer asks for them or a browsed subtype matches, in eager mode all
+ * of them, always through a ResolverPool bounding the running resolvers.
+ * Entries reaching their TTL are resolved again (lazy mode: only the ones
+ * not browsed anymore), and dropped if they do not answer within one more
+ * TTL period.
+ */
+
+#ifndef AVAHI_BROWSER_H
+#define AVAHI_BROWSER_H
+
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <avahi-client/client.h>
+#include <avahi-client/lookup.h>
+#include <avahi-common/watch.h>
+
+#include "discovery_cache.h"
+#include "resolver_pool.h"
+
+class AvahiBrowser {
+public:
+    enum ResolveMode { LAZY, EAGER };
+
+    AvahiBrowser(const AvahiPoll *poll, DiscoveryCache *cache);
+    ~AvahiBrowser();
+
+    AvahiBrowser(const AvahiBrowser&) = delete;
+    AvahiBrowser& operator=(const AvahiBrowser&) = delete;
+
+    /**
+     * Browse a service type, e.g. "_https._tcp", or a subtype,
+     * e.g. "_powerservice._sub._https._tcp". Can be called while running.
+     */
+    void addType(const std::string& type);
+    const std::set<std::string>& types() const { return _types; }
+
+    /**
+     * Create the avahi client, browsing starts once it is running.
+     * Return 0 or an avahi error code.
+     */
+    int start();
+    void stop();
+    bool running() const;
+
+    /**
+     * Re-resolve entries whose TTL is over, drop the ones already given
+     * a second chance. Called periodically while running.
+     */
+    void sweep(int64_t now);
+
+    void setResolveMode(ResolveMode mode) { _mode = mode; }
+    ResolveMode resolveMode() const { return _mode; }
+    // lazy or eager, false if unknown
+    static bool parseResolveMode(const std::string& value, ResolveMode& mode);
+
+    // maximum of running avahi resolvers, time (ms) a resolution is reused
+    void configureResolvers(size_t maxInFlight, int64_t resultTtl) { _pool.configure(maxInFlight, resultTtl); }
+    const ResolverPool& resolvers() const { return _pool; }
+
+    /**
+     * A consumer asks for an instance: resolve it unless its last result is
+     * still fresh. The cached entry is served meanwhile, as is. Return true
+     * if a resolution is pending, reported to the resolved listener.
+     */
+    bool demand(const std::string& key, int64_t now);
+
+    // called when the resolution of an instance is over, found or not
+    typedef std::function<void(const std::string& key)> resolved_t;
+    void setResolvedListener(resolved_t listener) { _resolved = listener; }
+
+    size_t pendingResolvers() const { return _resolvers.size(); }
+
+    // "_a._sub._b._tcp" -> "_b._tcp", a plain type is returned as is
+    static std::string baseType(const std::string& type);
+
+protected:
+    struct Browse {
+        AvahiBrowser* owner;
+        std::string type;       // base type
+        std::string subtype;    // empty for a base type browser
+        AvahiServiceBrowser* browser = nullptr;
+    };
+
+    struct Resolve {
+        AvahiBrowser* owner;
+        std::string key;        // cache key of the instance
+        AvahiServiceResolver* resolver = nullptr;
+    };
+
+    void browse(Browse* browse);
+    // starter of the resolver pool
+    bool resolve(const std::string& key);
+    void freeBrowsers();
+    void freeResolvers();
+    void armSweep();
+
+    void onClientRunning();
+    void onFound(Resolve* resolve, AvahiIfIndex interface, AvahiProtocol protocol,
+        const char *name, const char *type, const char *domain, const char *host_name,
+        const AvahiAddress *address, uint16_t port, AvahiStringList *txt);
+
+    static void clientCallback(AvahiClient* client, AvahiClientState state, void *userdata);
+    static void browseCallback(AvahiServiceBrowser *b, AvahiIfIndex interface, AvahiProtocol protocol,
+        AvahiBrowserEvent event, const char *name, const char *type, const char *domain,
+        AvahiLookupResultFlags flags, void *userdata);
+    static void resolveCallback(AvahiServiceResolver *r, AvahiIfIndex interface, AvahiProtocol protocol,
+        AvahiResolverEvent event, const char *name, const char *type, const char *domain,
+        const char *host_name, const AvahiAddress *a, uint16_t port, AvahiStringList *txt,
+        AvahiLookupResultFlags flags, void *userdata);
+    static void sweepCallback(AvahiTimeout *t, void *userdata);
+
+    const AvahiPoll* _poll;
+    DiscoveryCache* _cache;
+    AvahiClient* _client = nullptr;
+    AvahiTimeout* _sweep = nullptr;
+    std::set<std::string> _types;
+    std::vector<Browse*> _browsers;
+    std::set<Resolve*> _resolvers;
+    ResolverPool _pool;
+    ResolveMode _mode = LAZY;
+    resolved_t _resolved;
+    // instances reported by a browser and not removed since
+    std::set<std::string> _browsed;
+    // expired entries being resolved again
+    std::set<std::string> _refreshing;
+};
+
+//  Self test of this class.
+void avahi_browser_test (bool verbose);
+
+#endif
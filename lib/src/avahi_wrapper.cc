@@ -25,14 +25,33 @@
  */
 
 #include "avahi_wrapper.h"
+#include <algorithm>
+#include <cinttypes>
 #include <czmq.h>
+#include <avahi-common/timeval.h>
+
+#include "alloc_counter.h"
+#include "avahi_zloop_poll.h"
+
+// alternative names tried after collisions before giving up on a service
+#define MAX_RENAMES 16
+
+// delay between two attempts to create the avahi client (no D-Bus), ms
+#define RETRY_MIN 1000
+#define RETRY_MAX 30000
+
+AvahiWrapper::AvahiWrapper(const AvahiPoll *poll) :
+    _poll(poll)
+{
+}
 
 AvahiWrapper::~AvahiWrapper()
 {
     // Free all resources.
     stop();
-    if (_txtRecords) avahi_string_list_free(_txtRecords);
-    if (_serviceName) avahi_free(_serviceName);
+    for (auto &it : _services)
+        delete it.second;
+    _services.clear();
 }
 
 std::string
@@ -43,51 +62,165 @@ AvahiWrapper::getServiceName(const std::string &service_name,const std::string &
     return buffer.str();
 }
 
-void AvahiWrapper::setServiceDefinition(
+AvahiWrapper::Service* AvahiWrapper::findService(const std::string& key) const
+{
+    auto it = _services.find(key);
+    return it == _services.end() ? nullptr : it->second;
+}
+
+void AvahiWrapper::setService(
+    const std::string& key,
     const std::string& service_name,
     const std::string& service_type,
     const std::string& service_stype,
     const std::string& port)
 {
-    _serviceName = avahi_strdup( service_name.c_str());
-    _serviceDefinition[SERVICE_TYPE_KEY]    = std::string(service_type);
-    _serviceDefinition[SERVICE_SUBTYPE_KEY] = std::string(service_stype);
-    _serviceDefinition[SERVICE_PORT_KEY]    = std::string(port);
+    Service* service = findService(key);
+    if (!service) {
+        service = new Service();
+        service->owner = this;
+        service->key = key;
+        resolvePolicy(service);
+        _services[key] = service;
+    }
+    // subtypes alone are diffed by update(), without a new commit if only added
+    service->subtypes = ServiceSubtypes::parse(service_stype, service_type);
+    service->definition[SERVICE_SUBTYPE_KEY] = service->subtypes.toString();
+    if (service->requested == service_name
+     && service->definition[SERVICE_TYPE_KEY] == service_type
+     && service->definition[SERVICE_PORT_KEY] == port) {
+        return;
+    }
+    if (service->requested != service_name) {
+        service->requested = service_name;
+        service->name = service_name;
+        service->renames = 0;
+    }
+    service->definition[SERVICE_TYPE_KEY]    = service_type;
+    service->definition[SERVICE_PORT_KEY]    = port;
+    service->dirty = true;
 }
 
-void AvahiWrapper::clearTxtRecords()
+void AvahiWrapper::setPublishedName(const std::string& key, const std::string& name)
 {
-    if (_txtRecords) avahi_string_list_free(_txtRecords);
-    _txtRecords = NULL;
+    Service* service = findService(key);
+    if (!service || name.empty() || service->name == name)
+        return;
+    log_info("Service '%s' published as '%s'", service->requested.c_str(), name.c_str());
+    service->name = name;
+    service->dirty = true;
 }
 
-void AvahiWrapper::setTxtRecord(const char* key, const char*value)
+void AvahiWrapper::setServiceHost(const std::string& key, const std::string& host, const std::string& address)
 {
-    std::string _key = std::string(key);
-    std::string _value = std::string(value);
-    _txtRecords = avahi_string_list_add(_txtRecords, (_key + "=" + _value).c_str());
-    log_info("avahi_string_list_add(TXT %s)",(_key + "=" + _value).c_str());
+    Service* service = findService(key);
+    if (!service || (service->host == host && service->address == address))
+        return;
+    service->host = host;
+    service->address = host.empty() ? "" : address;
+    service->dirty = true;
+}
 
+/**
+ * Resolve the policy of a service to interface indices and protocol,
+ * return true if they changed.
+ */
+bool AvahiWrapper::resolvePolicy(Service* service)
+{
+    auto it = _policies.find(service->key);
+    const PublishPolicy& policy = it != _policies.end() ? it->second : _defaultPolicy;
+    std::vector<int> interfaces = policy.all() ? std::vector<int>{ AVAHI_IF_UNSPEC } : policy.resolve();
+    AvahiProtocol protocol = policy.protocol == PublishPolicy::IPV4 ? AVAHI_PROTO_INET
+        : policy.protocol == PublishPolicy::IPV6 ? AVAHI_PROTO_INET6 : AVAHI_PROTO_UNSPEC;
+    if (interfaces == service->interfaces && protocol == service->protocol)
+        return false;
+    log_info("Service '%s' published on %s (%zu interfaces)",
+        service->key.c_str(), policy.toString().c_str(), policy.all() ? 0 : interfaces.size());
+    service->interfaces = interfaces;
+    service->protocol = protocol;
+    return true;
 }
 
-void AvahiWrapper::setTxtRecords(map_string_t &map)
+//  registered services whose resolved policy changed are registered again
+void AvahiWrapper::applyPolicies()
 {
-    clearTxtRecords ();
-    for (auto it: map) {
-        setTxtRecord (it.first.c_str (), it.second.c_str ());
+    for (auto &it : _services) {
+        Service* service = it.second;
+        if (!resolvePolicy(service))
+            continue;
+        service->dirty = true;
+        if (service->group)
+            registerService(service);
     }
 }
 
-void AvahiWrapper::setTxtRecords(zhash_t *map)
+void AvahiWrapper::setDefaultPolicy(const PublishPolicy& policy)
+{
+    _defaultPolicy = policy;
+    applyPolicies();
+}
+
+void AvahiWrapper::setPolicy(const std::string& key, const PublishPolicy& policy)
+{
+    _policies[key] = policy;
+    applyPolicies();
+}
+
+void AvahiWrapper::refreshInterfaces()
+{
+    applyPolicies();
+}
+
+void AvahiWrapper::setTxtRecords(const std::string& key, map_string_t &map)
+{
+    Service* service = findService(key);
+    if (!service) {
+        log_warning("setTxtRecords: unknown service '%s'", key.c_str());
+        return;
+    }
+    service->txt.reset ();
+    for (const auto &it : map)
+        service->txt.add (it.first, it.second);
+}
+
+void AvahiWrapper::setTxtRecords(const std::string& key, zhash_t *map)
 {
     if (!map) return;
-    clearTxtRecords ();
-    char *value = (char *) zhash_first (map);
-    while (value) {
-        const char *key = (char *) zhash_cursor (map);
-        setTxtRecord (key, value);
-        value = (char *) zhash_next (map);
+    Service* service = findService(key);
+    if (!service) {
+        log_warning("setTxtRecords: unknown service '%s'", key.c_str());
+        return;
     }
+    service->txt.assign (map);
+}
+
+void AvahiWrapper::setTxtRecords(const std::string& key, const TxtFrame& txt)
+{
+    Service* service = findService(key);
+    if (!service) {
+        log_warning("setTxtRecords: unknown service '%s'", key.c_str());
+        return;
+    }
+    service->txt.assign (txt);
+}
+
+void AvahiWrapper::removeService(const std::string& key)
+{
+    Service* service = findService(key);
+    if (!service) return;
+    if (service->group) {
+        avahi_entry_group_reset(service->group);
+        avahi_entry_group_free(service->group);
+    }
+    _services.erase(key);
+    delete service;
+    log_info("Service '%s' removed", key.c_str());
+    recovered(key);
+}
+
+bool AvahiWrapper::hasService(const std::string& key) const
+{
+    return findService(key) != nullptr;
 }
 
 void AvahiWrapper::setHostName(const std::string& name)
@@ -96,132 +229,328 @@ void AvahiWrapper::setHostName(const std::string& name)
 }
 
 int AvahiWrapper::start()
+{
+    if (!_poll) {
+        log_error("No poll api given, cannot create avahi client");
+        return AVAHI_ERR_FAILURE;
+    }
+    if (_client)
+        return 0;
+    return connect();
+}
+
+/**
+ * Create the client. It does not fail when avahi-daemon is not there, it
+ * waits for it instead. Without D-Bus it cannot even be created, this is
+ * tried again later, with a growing delay.
+ */
+int AvahiWrapper::connect()
 {
     int error = 0;
-    /* Allocate main loop object */
-    if (!(_simplePoll = avahi_simple_poll_new())) {
-        log_error( "Failed to create simple poll object.");
+    _client = avahi_client_new(_poll, AVAHI_CLIENT_NO_FAIL, AvahiWrapper::clientCallback, this, &error);
+    if (_client) {
+        _retryDelay = 0;
+        return 0;
     }
-    _client = avahi_client_new(avahi_simple_poll_get(_simplePoll), AvahiClientFlags(0), AvahiWrapper::clientCallback, this, &error);
+    _retryDelay = _retryDelay ? std::min(_retryDelay * 2, RETRY_MAX) : RETRY_MIN;
+    log_error("Failed to create avahi client: %s, next try in %d ms", avahi_strerror(error), _retryDelay);
+    struct timeval tv;
+    avahi_elapse_time(&tv, _retryDelay, 0);
+    if (_retry)
+        _poll->timeout_update(_retry, &tv);
+    else
+        _retry = _poll->timeout_new(_poll, &tv, AvahiWrapper::retryCallback, this);
     return error;
 }
 
+void AvahiWrapper::retryCallback(AvahiTimeout* timeout, void* userdata)
+{
+    AvahiWrapper* wrapper = (AvahiWrapper*) userdata;
+    if (!wrapper->_client)
+        wrapper->connect();
+}
+
 void AvahiWrapper::stop()
 {
-    if (_group) {
-        avahi_entry_group_reset( _group );
-        avahi_entry_group_free( _group );
+    for (auto &it : _services) {
+        Service* service = it.second;
+        if (service->group) {
+            avahi_entry_group_reset( service->group );
+            avahi_entry_group_free( service->group );
+        }
+        service->group = nullptr;
+        service->dirty = true;
     }
+    if (_retry) _poll->timeout_free(_retry);
+    _retry = nullptr;
+    _retryDelay = 0;
     if (_client) avahi_client_free(_client);
-    if (_simplePoll) avahi_simple_poll_free(_simplePoll);
-    _group = nullptr;
     _client = nullptr;
-    _simplePoll=nullptr;
 }
 
 void AvahiWrapper::printError(const std::string& msg, const char* errorNo)
 {
     log_error("avahi error %s %s", msg.c_str(), errorNo);
-    avahi_simple_poll_quit(_simplePoll);
 }
 
-AvahiEntryGroup* AvahiWrapper::create_service(AvahiClient* client,char* serviceName,map_string_t &serviceDefinition,AvahiStringList *txtRecords)
+/**
+ * Move to the next alternative name after a collision. Return false once
+ * MAX_RENAMES names were tried, the service is then left unregistered
+ * until its definition changes or the client runs again.
+ */
+bool AvahiWrapper::rename(Service* service)
+{
+    if (service->renames >= MAX_RENAMES) {
+        log_error("Service '%s': %d names collided, not registered",
+            service->requested.c_str(), service->renames);
+        return false;
+    }
+    char *n = avahi_alternative_service_name(service->name.c_str());
+    log_warning("Service name collision, renaming service from:%s to:%s", service->name.c_str(), n);
+    service->name = n;
+    avahi_free(n);
+    service->renames++;
+    return true;
+}
+
+/**
+ * Add one subtype of the service on one interface.
+ */
+int AvahiWrapper::addSubtype(AvahiEntryGroup* group, Service* service, int interface, const std::string& subtype)
+{
+    log_info("Adding subtype: %s,%s,%s",
+            service->name.c_str(),
+            service->definition[SERVICE_TYPE_KEY].c_str(),
+            subtype.c_str());
+    int rv = avahi_entry_group_add_service_subtype(group,
+            interface,
+            service->protocol,
+            AvahiPublishFlags(0),
+            service->name.c_str(),
+            service->definition[SERVICE_TYPE_KEY].c_str(),
+            nullptr,
+            subtype.c_str());
+    if (rv < 0) {
+        log_error("Failed to add subtype: %s, %s" ,
+                subtype.c_str(),
+                avahi_strerror(rv));
+    }
+    return rv;
+}
+
+/**
+ * Add the service and all its subtypes on each interface of its policy,
+ * preceded by the address of the proxied host if any, return the first error.
+ */
+int AvahiWrapper::addEntries(AvahiEntryGroup* group, Service* service)
+{
+    map_string_t &serviceDefinition = service->definition;
+    int port = std::stoi(serviceDefinition[SERVICE_PORT_KEY].c_str());
+    AvahiAddress address;
+    if (!service->host.empty() && !avahi_address_parse(service->address.c_str(), AVAHI_PROTO_UNSPEC, &address)) {
+        log_error("Invalid address '%s' of host %s", service->address.c_str(), service->host.c_str());
+        return AVAHI_ERR_INVALID_ADDRESS;
+    }
+    for (int interface : service->interfaces) {
+        int rv;
+        if (!service->host.empty()) {
+            // reverse records would collide between devices sharing an address
+            rv = avahi_entry_group_add_address(group,
+                interface,
+                service->protocol,
+                AVAHI_PUBLISH_NO_REVERSE,
+                service->host.c_str(),
+                &address);
+            if (rv < 0)
+                return rv;
+        }
+        rv = avahi_entry_group_add_service_strlst(group,
+            interface,
+            service->protocol,
+            AvahiPublishFlags(0),
+            service->name.c_str(),
+            serviceDefinition[SERVICE_TYPE_KEY].c_str(),
+            nullptr,
+            service->host.empty() ? nullptr : service->host.c_str(),
+            port,
+            service->txt.list());
+        if (rv < 0)
+            return rv;
+        for (const auto& subtype : service->subtypes.names) {
+            rv = addSubtype(group, service, interface, subtype);
+            if (rv < 0)
+                return rv;
+        }
+    }
+    return 0;
+}
+
+AvahiEntryGroup* AvahiWrapper::create_service(AvahiClient* client, Service* service)
 {
-    AvahiEntryGroup *group;
+    AvahiEntryGroup *group = service->group;
     assert(client);
     int rv;
-    group = avahi_entry_group_new(client, AvahiWrapper::groupCallback, this);
+    if (!group)
+        group = avahi_entry_group_new(client, AvahiWrapper::groupCallback, service);
     if(!group){
-        log_error("avahi_entry_group_new() failed", avahi_strerror(avahi_client_errno(client)));
+        log_error("avahi_entry_group_new() failed: %s", avahi_strerror(avahi_client_errno(client)));
         //throw NullPointerException("Cannot create service group");
         return nullptr;
     }
-    // The group is empty (either because it was just created
+    service->group = group;
+    map_string_t &serviceDefinition = service->definition;
+    // The group is empty (either because it was just created or reset)
     if (avahi_entry_group_is_empty(group)) {
         log_info("Adding service: %s,%s,%d," ,
-                serviceName,
+                service->name.c_str(),
                 serviceDefinition[SERVICE_TYPE_KEY].c_str(),
                 std::stoi(serviceDefinition[SERVICE_PORT_KEY].c_str()));
-        rv = avahi_entry_group_add_service_strlst(group,
-            AVAHI_IF_UNSPEC,
-            AVAHI_PROTO_UNSPEC,
-            AvahiPublishFlags(0),
-            serviceName,
-            serviceDefinition[SERVICE_TYPE_KEY].c_str(),
-            nullptr,
-            nullptr,
-            std::stoi(serviceDefinition[SERVICE_PORT_KEY].c_str()),
-            txtRecords);
-        if (rv== AVAHI_ERR_COLLISION) {
-            char *n = avahi_alternative_service_name(serviceName);
-            log_error( "Service name collision, renaming service from:%s to:%s" ,serviceName,n );
-            avahi_free(_serviceName);
-            serviceName = n;
+        if (service->interfaces.empty()) {
+            // none of the interfaces of its policy is there (yet)
+            log_warning("Service '%s': no interface to publish on", service->key.c_str());
+            return group;
+        }
+        // name already registered on this host: next alternative, in place
+        while ((rv = addEntries(group, service)) == AVAHI_ERR_COLLISION) {
             avahi_entry_group_reset(group);
-            return create_service(client,serviceName,serviceDefinition,txtRecords); //potential deadlock :(
+            if (_observer)
+                _observer->onCollision(service->key);
+            if (!rename(service))
+                return group;
         }
-        // Add subtype
-        log_info("Adding subtype: %s,%s,%s",
-                serviceName,
-                serviceDefinition[SERVICE_TYPE_KEY].c_str(),
-                serviceDefinition[SERVICE_SUBTYPE_KEY].c_str());
-        rv = avahi_entry_group_add_service_subtype(group,
-                AVAHI_IF_UNSPEC,
-                AVAHI_PROTO_UNSPEC,
-                AvahiPublishFlags(0),
-                serviceName,
-                serviceDefinition[SERVICE_TYPE_KEY].c_str(),
-                nullptr,
-                serviceDefinition[SERVICE_SUBTYPE_KEY].c_str());
         if (rv<0){
-            log_error("Failed to add subtype: %s, %s" ,
-                    serviceDefinition[SERVICE_SUBTYPE_KEY].c_str(),
+            log_error("Failed to add service: %s, %s" ,
+                    service->name.c_str(),
                     avahi_strerror(rv));
-            throw std::runtime_error("AFailed to add subtype:");
+            throw std::runtime_error("Failed to add service");
         }
         // Tell the server to register the service.
+        service->commitUsec = zclock_usecs();
         rv = avahi_entry_group_commit(group);
         if (rv<0){
             log_error("Failed to commit entry group: %s" ,
                     avahi_strerror(rv));
             throw std::runtime_error("Registering Avahi services failed");
         }
+        service->dirty = false;
+        service->registered = service->subtypes;
         log_info( "Service added" );
     }
     return group;
 }
 
-void AvahiWrapper::update()
+void AvahiWrapper::registerService(Service* service)
 {
-    if (_group == NULL) {
-        log_warning ("Update called but service doesnt exist yet!");
+    // services are registered when the client reaches the running state
+    if (!_client || avahi_client_get_state(_client) != AVAHI_CLIENT_S_RUNNING)
         return;
+    try {
+        // only this service group is reset, the others are left untouched
+        if (service->group) avahi_entry_group_reset(service->group);
+        create_service(_client, service);
+    }
+    catch (std::exception& e) {
+        log_error( "registerService(%s) exception: %s" , service->key.c_str(), e.what() );
     }
+}
 
-    int rv = avahi_entry_group_update_service_txt_strlst(
-        _group,
-        AVAHI_IF_UNSPEC,
-        AVAHI_PROTO_UNSPEC,
-        AvahiPublishFlags(0),
-        _serviceName,
-        _serviceDefinition[SERVICE_TYPE_KEY].c_str(),
-        nullptr, //domain
-        _txtRecords);
+void AvahiWrapper::update(const std::string& key)
+{
+    Service* service = findService(key);
+    if (!service) {
+        log_warning ("Update called for unknown service '%s'", key.c_str());
+        return;
+    }
+    if (service->group == NULL || service->dirty
+     || !service->registered.missingFrom(service->subtypes).empty()) {
+        // new, redefined or a subtype withdrawn: entries cannot be removed
+        // one by one, the group of this service is registered again
+        registerService(service);
+        return;
+    }
+    std::vector<std::string> added = service->subtypes.missingFrom(service->registered);
+    if (!added.empty()) {
+        // new subtypes join the committed group and are announced as is
+        for (int interface : service->interfaces) {
+            for (const auto& subtype : added) {
+                if (addSubtype(service->group, service, interface, subtype) < 0) {
+                    registerService(service);
+                    return;
+                }
+            }
+        }
+        service->registered = service->subtypes;
+    }
 
-    if (rv < 0) {
-        log_error("Failed to update service: %s", avahi_strerror (rv));
+    // only on the interfaces of its policy
+    for (int interface : service->interfaces) {
+        int rv = avahi_entry_group_update_service_txt_strlst(
+            service->group,
+            interface,
+            service->protocol,
+            AvahiPublishFlags(0),
+            service->name.c_str(),
+            service->definition[SERVICE_TYPE_KEY].c_str(),
+            nullptr, //domain
+            service->txt.list());
+
+        if (rv < 0) {
+            log_error("Failed to update service: %s", avahi_strerror (rv));
+        }
     }
 }
 
 void AvahiWrapper::onClientRunning(AvahiClient* client)
 {
-    try {
-        assert(client);
-        _group = create_service(client,_serviceName,_serviceDefinition,_txtRecords);
+    assert(client);
+    for (auto &it : _services) {
+        try {
+            create_service(client, it.second);
+        }
+        catch (std::exception& e) {
+            log_error( "onClientRunning exception: %s" , e.what() );
+        }
+        // not committed: no interface, no name left or failed, it will not be established
+        if (!it.second->commitUsec)
+            recovered(it.first);
     }
-    catch (std::exception& e) {
-        log_error( "onClientRunning exception: %s" , e.what() );
+}
+
+/**
+ * Client lost, usually avahi-daemon stopped or restarted: the entry groups
+ * are gone with it. A new client waits for the daemon, then every service
+ * is registered again from memory, under the name it had.
+ */
+void AvahiWrapper::onClientFailure(AvahiClient* client)
+{
+    for (auto &it : _services) {
+        // freed by avahi_client_free()
+        it.second->group = nullptr;
+        it.second->dirty = true;
+        it.second->commitUsec = 0;
     }
+    _recovering.clear();
+    avahi_client_free(client);
+    _client = nullptr;
+    connect();
+}
+
+void AvahiWrapper::onEstablished(Service* service)
+{
+    if (_observer && service->commitUsec)
+        _observer->onEstablished(service->key, service->name, zclock_usecs() - service->commitUsec);
+    service->commitUsec = 0;
+    service->renames = 0;
+    recovered(service->key);
+}
+
+void AvahiWrapper::recovered(const std::string& key)
+{
+    if (!_recovering.erase(key) || !_recovering.empty())
+        return;
+    log_info("All services established again after %" PRIi64 " us", zclock_usecs() - _runningUsec);
+    if (_observer)
+        _observer->onRecovered(zclock_usecs() - _runningUsec);
 }
 
 void AvahiWrapper::clientCallback(AvahiClient* client, AvahiClientState state, void *userdata)
@@ -236,21 +565,34 @@ void AvahiWrapper::clientCallback(AvahiClient* client, AvahiClientState state, v
                     /* The server has startup successfully and registered its host
                      * name on the network, so create our services */
                     //createServices(client);
+                    if (clientWrapper->_wasRunning) {
+                        log_info("avahi-daemon is back, registering %zu services again",
+                            clientWrapper->_services.size());
+                        clientWrapper->_runningUsec = zclock_usecs();
+                        clientWrapper->_recovering.clear();
+                        for (auto &it : clientWrapper->_services)
+                            clientWrapper->_recovering.insert(it.first);
+                        if (clientWrapper->_observer)
+                            clientWrapper->_observer->onReconnect();
+                    }
+                    clientWrapper->_wasRunning = true;
                     clientWrapper->onClientRunning(client);
                     break;
 
                 case AVAHI_CLIENT_S_REGISTERING:
                     log_debug("AVAHI_CLIENT_S_REGISTERING");
-                    if (clientWrapper->_group) avahi_entry_group_reset(clientWrapper->_group);
+                    for (auto &it : clientWrapper->_services)
+                        if (it.second->group) avahi_entry_group_reset(it.second->group);
                     break;
                 case AVAHI_CLIENT_FAILURE:
-                    log_error("AVAHI_CLIENT_FAILURE :%", avahi_strerror(avahi_client_errno(client)));
+                    log_error("AVAHI_CLIENT_FAILURE :%s", avahi_strerror(avahi_client_errno(client)));
+                    clientWrapper->onClientFailure(client);
                     break;
                 case AVAHI_CLIENT_S_COLLISION:
                     log_warning("AVAHI_CLIENT_S_COLLISION");
                     break;
                 case AVAHI_CLIENT_CONNECTING:
-                    log_debug("AVAHI_CLIENT_CONNECTING");
+                    log_info("AVAHI_CLIENT_CONNECTING: waiting for avahi-daemon");
                     break;
                 default:
                     break;
@@ -266,19 +608,29 @@ void AvahiWrapper::groupCallback(AvahiEntryGroup* group, AvahiEntryGroupState st
 {
     try {
         if (userdata != nullptr) {
-            AvahiWrapper* clientWrapper = (AvahiWrapper*) userdata;
+            Service* service = (Service*) userdata;
 
             switch (state) {
                 case AVAHI_ENTRY_GROUP_ESTABLISHED:
                     // The entry group has been established successfully.
-                    std::cout << "Service:'" << clientWrapper->_serviceName << "' successfully established." << std::endl;
+                    log_info("Service:'%s' successfully established.", service->name.c_str());
+                    service->owner->onEstablished(service);
                     break;
                 case AVAHI_ENTRY_GROUP_COLLISION:
-                    //TODO
-                    //clientWrapper->serviceCollision(avahi_entry_group_get_client(group));
+                    // name taken by another host while probing: register the
+                    // group again under the next alternative
+                    if (service->owner->_observer)
+                        service->owner->_observer->onCollision(service->key);
+                    if (service->owner->rename(service)) {
+                        service->dirty = true;
+                        service->owner->registerService(service);
+                    }
+                    else
+                        service->owner->recovered(service->key);
                     break;
                 case AVAHI_ENTRY_GROUP_FAILURE:
-                    clientWrapper->printError("Failed to commit entry group: ", avahi_strerror(avahi_client_errno(avahi_entry_group_get_client(group))));
+                    service->owner->printError("Failed to commit entry group: ", avahi_strerror(avahi_client_errno(avahi_entry_group_get_client(group))));
+                    service->owner->recovered(service->key);
                     break;
 
                 case AVAHI_ENTRY_GROUP_UNCOMMITED:
@@ -292,6 +644,53 @@ void AvahiWrapper::groupCallback(AvahiEntryGroup* group, AvahiEntryGroupState st
     }
 }
 
+//  names the services were established under
+class s_test_observer_t : public MdnsPublisher::Observer {
+public:
+    void onEstablished(const std::string& key, const std::string& name, int64_t) override { established[key] = name; }
+    void onCollision(const std::string&) override { collisions++; }
+    void onReconnect() override { reconnects++; }
+    void onRecovered(int64_t latency_us) override { recovery = latency_us; }
+
+    map_string_t established;
+    int collisions = 0;
+    int reconnects = 0;
+    int64_t recovery = -1;
+};
+
+typedef struct {
+    s_test_observer_t *observer;
+    const char *key;
+} s_test_wait_t;
+
+static int
+s_test_established_cb(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id;
+    s_test_wait_t *wait = (s_test_wait_t*) arg;
+    return wait->observer->established.count(wait->key) ? -1 : 0;
+}
+
+static int
+s_test_timeout_cb(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id; (void) arg;
+    return -1;
+}
+
+//  run loop until key is established or timeout (ms) elapsed
+static bool
+s_test_wait_established(zloop_t *loop, s_test_observer_t *observer, const char *key, int timeout_ms = 5000)
+{
+    s_test_wait_t wait = { observer, key };
+    int poll = zloop_timer(loop, 10, 0, s_test_established_cb, &wait);
+    int timeout = zloop_timer(loop, timeout_ms, 1, s_test_timeout_cb, NULL);
+    zloop_start(loop);
+    zloop_timer_end(loop, poll);
+    zloop_timer_end(loop, timeout);
+    return observer->established.count(key) != 0;
+}
+
 void avahi_wrapper_test (bool verbose) {
     printf (" * Avahi wrapper test\n");
 
@@ -299,5 +698,132 @@ void avahi_wrapper_test (bool verbose) {
         AvahiWrapper aw;
     }
 
+    // registry without avahi client: services are only recorded
+    {
+        AvahiWrapper aw;
+        map_string_t txt = { { "txtvers", "1.0.0" } };
+        aw.setService("https", "IPC (12345678)", "_https._tcp.", "_powerservice._sub._https._tcp.", "443");
+        aw.setService("mqtt", "IPC (12345678)", "_mqtt._tcp.", "_powerservice._sub._mqtt._tcp.", "1883");
+        aw.setTxtRecords("https", txt);
+        aw.setTxtRecords("unknown", txt);
+        aw.update("https");
+        assert(aw.hasService("https"));
+        assert(aw.hasService("mqtt"));
+        assert(!aw.hasService("unknown"));
+        aw.removeService("mqtt");
+        assert(!aw.hasService("mqtt"));
+        assert(aw.hasService("https"));
+    }
+
+    // steady state TXT updates are rebuilt in the service arena, without allocation
+    {
+        AvahiWrapper aw;
+        aw.setService("https", "IPC (12345678)", "_https._tcp.", "_powerservice._sub._https._tcp.", "443");
+        zhash_t *map = zhash_new ();
+        zhash_insert (map, "txtvers", (void *) "1.0.0");
+        zhash_insert (map, "uuid", (void *) "12345678");
+        zframe_t *first = zhash_pack (map);
+        zhash_update (map, "txtvers", (void *) "1.0.1");
+        zframe_t *second = zhash_pack (map);
+        const std::string key = "https";
+        aw.setTxtRecords(key, TxtFrame (first));
+
+        uint64_t allocs = alloc_count ();
+        for (int i = 0; i < 1000; i++)
+            aw.setTxtRecords(key, TxtFrame (i % 2 ? first : second));
+        allocs = alloc_count () - allocs;
+        if (alloc_counting ())
+            assert (allocs == 0);
+        zframe_destroy (&second);
+        zframe_destroy (&first);
+        zhash_destroy (&map);
+    }
+
+    //  same name registered twice on this host: the second one is renamed
+    //  this part needs avahi-daemon running
+    {
+        zloop_t *loop = zloop_new();
+        AvahiZloopPoll *poll = new AvahiZloopPoll(loop);
+        s_test_observer_t observer;
+        AvahiWrapper *first = new AvahiWrapper(poll->get());
+        AvahiWrapper *second = new AvahiWrapper(poll->get());
+        first->setObserver(&observer);
+        second->setObserver(&observer);
+
+        char name[64];
+        snprintf(name, sizeof(name), "fty-mdns-sd collision %d", (int) getpid());
+        map_string_t txt = { { "txtvers", "1.0.0" } };
+        first->setService("first", name, "_fty-selftest._tcp", "_probe._sub._fty-selftest._tcp", "4242");
+        first->setTxtRecords("first", txt);
+        second->setService("second", name, "_fty-selftest._tcp", "_probe._sub._fty-selftest._tcp", "4243");
+        second->setTxtRecords("second", txt);
+
+        if (first->start() == 0 && s_test_wait_established(loop, &observer, "first")) {
+            int64_t start = zclock_mono();
+            assert(second->start() == 0);
+            assert(s_test_wait_established(loop, &observer, "second"));
+            assert(observer.established["first"] == name);
+            assert(observer.established["second"] == std::string(name) + " #2");
+            assert(observer.collisions == 1);
+            if (verbose)
+                printf ("   renamed and established after %" PRIi64 " ms\n", zclock_mono() - start);
+
+            // the chosen name is registered at once by a new publisher
+            delete second;
+            observer.established.erase("second");
+            second = new AvahiWrapper(poll->get());
+            second->setObserver(&observer);
+            second->setService("second", name, "_fty-selftest._tcp", "_probe._sub._fty-selftest._tcp", "4243");
+            second->setPublishedName("second", std::string(name) + " #2");
+            assert(second->start() == 0);
+            assert(s_test_wait_established(loop, &observer, "second"));
+            assert(observer.established["second"] == std::string(name) + " #2");
+        }
+        else
+            printf ("   avahi-daemon not available, collision part skipped\n");
+
+        delete second;
+        delete first;
+        delete poll;
+        zloop_destroy(&loop);
+    }
+
+    //  avahi-daemon restarted under our feet, when the command doing it is given
+    //  e.g. FTY_MDNS_SD_TEST_DAEMON_RESTART="systemctl restart avahi-daemon"
+    const char *restart = getenv("FTY_MDNS_SD_TEST_DAEMON_RESTART");
+    if (restart) {
+        zloop_t *loop = zloop_new();
+        AvahiZloopPoll *poll = new AvahiZloopPoll(loop);
+        s_test_observer_t observer;
+        AvahiWrapper *aw = new AvahiWrapper(poll->get());
+        aw->setObserver(&observer);
+        char name[64];
+        snprintf(name, sizeof(name), "fty-mdns-sd restart %d", (int) getpid());
+        aw->setService("https", name, "_fty-selftest._tcp", "_probe._sub._fty-selftest._tcp", "4242");
+        aw->setService("mqtt", name, "_fty-selftest-mqtt._tcp", "_probe._sub._fty-selftest-mqtt._tcp", "4243");
+        // never established: no interface to publish on, recovery does not wait for it
+        PublishPolicy nowhere;
+        assert(PublishPolicy::parse("fty-selftest-none0", "", nowhere));
+        aw->setPolicy("nowhere", nowhere);
+        aw->setService("nowhere", name, "_fty-selftest-none._tcp", "", "4244");
+        assert(aw->start() == 0);
+        assert(s_test_wait_established(loop, &observer, "https"));
+        assert(s_test_wait_established(loop, &observer, "mqtt"));
+
+        observer.established.clear();
+        int64_t start = zclock_mono();
+        assert(system(restart) == 0);
+        assert(s_test_wait_established(loop, &observer, "https", 60000));
+        assert(s_test_wait_established(loop, &observer, "mqtt", 60000));
+        assert(observer.reconnects == 1);
+        assert(observer.recovery >= 0);
+        printf ("   services back %" PRIi64 " ms after the restart command, "
+            "%" PRIi64 " us after the daemon\n", zclock_mono() - start, observer.recovery);
+
+        delete aw;
+        delete poll;
+        zloop_destroy(&loop);
+    }
+
     printf (" * Avahi wrapper test: OK\n");
 }
@@ -30,74 +30,119 @@
 #include <sstream>
 #include <cstddef>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 #include <avahi-client/client.h>
 #include <avahi-client/publish.h>
 #include <avahi-common/alternative.h>
-#include <avahi-common/simple-watch.h>
+#include <avahi-common/watch.h>
 #include <avahi-common/malloc.h>
 #include <avahi-common/error.h>
 
 #include "fty_mdns_sd_classes.h"
+#include "mdns_publisher.h"
+#include "txt_arena.h"
 
-#define SERVICE_NAME_KEY      "name"
-#define SERVICE_TYPE_KEY      "type"
-#define SERVICE_SUBTYPE_KEY   "subType"
-#define SERVICE_PORT_KEY      "port"
-
-typedef std::map<std::string, std::string> map_string_t;
-
-void avahi_wrapper_test (bool verbose);
-
-class AvahiWrapper {
+class AvahiWrapper : public MdnsPublisher {
 protected:
     //friend class AvahiGroupWrapper;
 
     /**
-     * All class variable for the service.
+     * All class variable for one service, each service has its own group.
      */
-    map_string_t _serviceDefinition;
-    char* _serviceName = nullptr;
-    AvahiStringList* _txtRecords = nullptr;
+    struct Service {
+        AvahiWrapper* owner;
+        std::string key;
+        std::string requested;  // name given by setService()
+        std::string name;       // name registered, an alternative after collisions
+        int renames = 0;        // alternatives tried since the last establishment
+        std::vector<int> interfaces;    // resolved policy, AVAHI_IF_UNSPEC alone for all
+        AvahiProtocol protocol = AVAHI_PROTO_UNSPEC;
+        map_string_t definition;
+        std::string host;       // proxied device, empty for this host
+        std::string address;    // of host, published in the group
+        ServiceSubtypes subtypes;       // wanted, from the definition
+        ServiceSubtypes registered;     // in the group, diffed on update
+        TxtArena txt;           // TXT records, rebuilt in place on update
+        AvahiEntryGroup* group = nullptr;
+        bool dirty = true;      // definition changed since last commit
+        int64_t commitUsec = 0; // zclock_usecs() of the last commit
+    };
+    std::unordered_map<std::string, Service*> _services;
 
     std::string getServiceName(const std::string &service_name,const std::string &uuid);
-    AvahiEntryGroup* create_service(AvahiClient* client,char* serviceName,map_string_t &serviceDefinition,AvahiStringList *txtRecords);
+    AvahiEntryGroup* create_service(AvahiClient* client, Service* service);
+    void registerService(Service* service);
+    Service* findService(const std::string& key) const;
+    bool rename(Service* service);
+    int addEntries(AvahiEntryGroup* group, Service* service);
+    int addSubtype(AvahiEntryGroup* group, Service* service, int interface, const std::string& subtype);
+    bool resolvePolicy(Service* service);
+    void applyPolicies();
+
+    PublishPolicy _defaultPolicy;
+    std::map<std::string, PublishPolicy> _policies;     // own policies, by service key
 
     /**
      * All class variable to handle the avahi client object.
+     * The poll api is owned by the caller (see AvahiZloopPoll).
      */
-    AvahiSimplePoll* _simplePoll = nullptr;
+    const AvahiPoll* _poll = nullptr;
     AvahiClient* _client = nullptr;
-    AvahiEntryGroup* _group = nullptr;
+    bool _wasRunning = false;   // client reached the running state before
+    AvahiTimeout* _retry = nullptr;     // next client creation, after a failure
+    int _retryDelay = 0;        // ms, doubled on each failed creation
+    int64_t _runningUsec = 0;   // zclock_usecs() the client ran again after a loss
+    // services not yet established again since then, nor failed for good
+    std::set<std::string> _recovering;
+    void recovered(const std::string& key);
 
 public:
 
-    ~AvahiWrapper();
+    explicit AvahiWrapper(const AvahiPoll *poll = nullptr);
+    ~AvahiWrapper() override;
 
-    void setServiceDefinition(
+    void setService(
+        const std::string& key,
         const std::string& service_name,
         const std::string& service_type,
         const std::string& service_stype,
-        const std::string& port);
+        const std::string& port) override;
 
-    void clearTxtRecords();
-    void setTxtRecord(const char* key, const char*value);
-    void setTxtRecords(map_string_t &map);
-    void setTxtRecords(zhash_t *map);
+    void setPublishedName(const std::string& key, const std::string& name) override;
+    void setServiceHost(const std::string& key, const std::string& host, const std::string& address) override;
+
+    void setDefaultPolicy(const PublishPolicy& policy) override;
+    void setPolicy(const std::string& key, const PublishPolicy& policy) override;
+    void refreshInterfaces() override;
+
+    void setTxtRecords(const std::string& key, map_string_t &map) override;
+    void setTxtRecords(const std::string& key, zhash_t *map) override;
+    void setTxtRecords(const std::string& key, const TxtFrame& txt) override;
+
+    void removeService(const std::string& key) override;
+    bool hasService(const std::string& key) const override;
 
     void setHostName(const std::string& name);
 
     void printError(const std::string& msg, const char* errorNo);
 
-    int start();
+    int start() override;
 
-    void stop();
+    void stop() override;
 
-    void update();
+    void update(const std::string& key) override;
 
 protected:
 
+    int connect();
     void onClientRunning(AvahiClient* client);
+    void onClientFailure(AvahiClient* client);
+    void onEstablished(Service* service);
+
+    static void retryCallback(AvahiTimeout* timeout, void* userdata);
 
     static void clientCallback(AvahiClient* client, AvahiClientState state, void *userdata);
 
@@ -0,0 +1,453 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   avahi_zloop_poll.cc
+ *
+ */
+
+#include "avahi_zloop_poll.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include <avahi-client/client.h>
+#include <avahi-client/publish.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/error.h>
+#include <fty_log.h>
+
+struct AvahiWatch {
+    AvahiZloopPoll *owner;
+    int fd;
+    AvahiWatchEvent events;
+    AvahiWatchCallback callback;
+    void *userdata;
+    bool dead;
+};
+
+struct AvahiTimeout {
+    AvahiZloopPoll *owner;
+    int timer_id;   // -1 when disarmed
+    AvahiTimeoutCallback callback;
+    void *userdata;
+};
+
+static short
+s_to_zmq_events(int events)
+{
+    short rv = 0;
+    if (events & AVAHI_WATCH_IN)  rv |= ZMQ_POLLIN;
+    if (events & AVAHI_WATCH_OUT) rv |= ZMQ_POLLOUT;
+    return rv;
+}
+
+static AvahiWatchEvent
+s_from_zmq_events(short revents)
+{
+    int rv = 0;
+    if (revents & ZMQ_POLLIN)  rv |= AVAHI_WATCH_IN;
+    if (revents & ZMQ_POLLOUT) rv |= AVAHI_WATCH_OUT;
+    // libzmq reports POLLHUP and POLLERR of a fd as ZMQ_POLLERR
+    if (revents & ZMQ_POLLERR) rv |= AVAHI_WATCH_ERR | AVAHI_WATCH_HUP;
+    return AvahiWatchEvent(rv);
+}
+
+AvahiZloopPoll::AvahiZloopPoll(zloop_t *loop) :
+    _loop(loop)
+{
+    assert(loop);
+    _api.userdata         = this;
+    _api.watch_new        = AvahiZloopPoll::watchNew;
+    _api.watch_update     = AvahiZloopPoll::watchUpdate;
+    _api.watch_get_events = AvahiZloopPoll::watchGetEvents;
+    _api.watch_free       = AvahiZloopPoll::watchFree;
+    _api.timeout_new      = AvahiZloopPoll::timeoutNew;
+    _api.timeout_update   = AvahiZloopPoll::timeoutUpdate;
+    _api.timeout_free     = AvahiZloopPoll::timeoutFree;
+}
+
+AvahiZloopPoll::~AvahiZloopPoll()
+{
+    // avahi objects must have been freed before, release what is left anyway
+    for (auto &it : _watches) {
+        zmq_pollitem_t item = { NULL, it.first, 0, 0 };
+        zloop_poller_end(_loop, &item);
+        for (AvahiWatch *w : it.second) delete w;
+    }
+    for (auto &it : _timers) {
+        zloop_timer_end(_loop, it.first);
+        delete it.second;
+    }
+    _dispatching = 0;
+    purge();
+}
+
+void AvahiZloopPoll::purge()
+{
+    if (_dispatching) return;
+    for (AvahiWatch *w : _graveyard) delete w;
+    _graveyard.clear();
+}
+
+void AvahiZloopPoll::rearm(int fd)
+{
+    zmq_pollitem_t item = { NULL, fd, 0, 0 };
+    zloop_poller_end(_loop, &item);
+
+    auto it = _watches.find(fd);
+    if (it == _watches.end()) return;
+
+    for (AvahiWatch *w : it->second)
+        item.events |= s_to_zmq_events(w->events);
+    if (it->second.empty()) {
+        _watches.erase(it);
+        return;
+    }
+    if (item.events == 0) return;
+
+    if (zloop_poller(_loop, &item, AvahiZloopPoll::onFdEvent, this) == -1) {
+        log_error("avahi poll: cannot register fd %d in zloop", fd);
+        return;
+    }
+    // errors/hangups are reported to avahi, never drop the poller silently
+    zloop_poller_set_tolerant(_loop, &item);
+}
+
+void AvahiZloopPoll::armTimeout(AvahiTimeout *t, const struct timeval *tv)
+{
+    disarmTimeout(t);
+    if (!tv) return;
+
+    // avahi gives an absolute time, zloop wants a relative delay
+    AvahiUsec left = -avahi_age(tv);
+    size_t delay = left > 0 ? size_t((left + 999) / 1000) : 0;
+    t->timer_id = zloop_timer(_loop, delay, 1, AvahiZloopPoll::onTimer, this);
+    if (t->timer_id == -1) {
+        log_error("avahi poll: cannot register timer in zloop");
+        return;
+    }
+    _timers[t->timer_id] = t;
+}
+
+void AvahiZloopPoll::disarmTimeout(AvahiTimeout *t)
+{
+    if (t->timer_id == -1) return;
+    zloop_timer_end(_loop, t->timer_id);
+    _timers.erase(t->timer_id);
+    t->timer_id = -1;
+}
+
+AvahiWatch* AvahiZloopPoll::watchNew(const AvahiPoll *api, int fd, AvahiWatchEvent event, AvahiWatchCallback callback, void *userdata)
+{
+    AvahiZloopPoll *self = (AvahiZloopPoll*) api->userdata;
+    AvahiWatch *w = new AvahiWatch { self, fd, event, callback, userdata, false };
+    self->_watches[fd].push_back(w);
+    self->rearm(fd);
+    return w;
+}
+
+void AvahiZloopPoll::watchUpdate(AvahiWatch *w, AvahiWatchEvent event)
+{
+    if (w->events == event) return;
+    w->events = event;
+    w->owner->rearm(w->fd);
+}
+
+AvahiWatchEvent AvahiZloopPoll::watchGetEvents(AvahiWatch *w)
+{
+    // revents are given to the callback directly, nothing pending here
+    (void) w;
+    return AvahiWatchEvent(0);
+}
+
+void AvahiZloopPoll::watchFree(AvahiWatch *w)
+{
+    AvahiZloopPoll *self = w->owner;
+    auto &list = self->_watches[w->fd];
+    list.erase(std::remove(list.begin(), list.end(), w), list.end());
+    self->rearm(w->fd);
+
+    w->dead = true;
+    self->_graveyard.push_back(w);
+    self->purge();
+}
+
+AvahiTimeout* AvahiZloopPoll::timeoutNew(const AvahiPoll *api, const struct timeval *tv, AvahiTimeoutCallback callback, void *userdata)
+{
+    AvahiZloopPoll *self = (AvahiZloopPoll*) api->userdata;
+    AvahiTimeout *t = new AvahiTimeout { self, -1, callback, userdata };
+    self->armTimeout(t, tv);
+    return t;
+}
+
+void AvahiZloopPoll::timeoutUpdate(AvahiTimeout *t, const struct timeval *tv)
+{
+    t->owner->armTimeout(t, tv);
+}
+
+void AvahiZloopPoll::timeoutFree(AvahiTimeout *t)
+{
+    // the zloop handler looks timers up by id, so deleting now is safe
+    t->owner->disarmTimeout(t);
+    delete t;
+}
+
+int AvahiZloopPoll::onFdEvent(zloop_t *loop, zmq_pollitem_t *item, void *arg)
+{
+    (void) loop;
+    AvahiZloopPoll *self = (AvahiZloopPoll*) arg;
+    auto it = self->_watches.find(item->fd);
+    if (it == self->_watches.end()) return 0;
+
+    AvahiWatchEvent revents = s_from_zmq_events(item->revents);
+    // callbacks may add or free watches, work on a snapshot
+    std::vector<AvahiWatch*> snapshot = it->second;
+    self->_dispatching++;
+    for (AvahiWatch *w : snapshot) {
+        if (w->dead) continue;
+        int match = revents & (w->events | AVAHI_WATCH_ERR | AVAHI_WATCH_HUP);
+        if (match) w->callback(w, w->fd, AvahiWatchEvent(match), w->userdata);
+    }
+    self->_dispatching--;
+    self->purge();
+    return 0;
+}
+
+int AvahiZloopPoll::onTimer(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop;
+    AvahiZloopPoll *self = (AvahiZloopPoll*) arg;
+    auto it = self->_timers.find(timer_id);
+    if (it == self->_timers.end()) return 0;   // freed or rearmed meanwhile
+
+    AvahiTimeout *t = it->second;
+    // one shot timer, zloop forgets it after this call
+    self->_timers.erase(it);
+    t->timer_id = -1;
+    t->callback(t, t->userdata);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+typedef struct {
+    int64_t armed_us;
+    int64_t fired_us;
+    int count;
+} s_probe_t;
+
+static void
+s_test_watch_cb(AvahiWatch *w, int fd, AvahiWatchEvent event, void *userdata)
+{
+    s_probe_t *probe = (s_probe_t*) userdata;
+    char c;
+    if ((event & AVAHI_WATCH_IN) && read(fd, &c, 1) == 1) {
+        probe->fired_us = zclock_usecs();
+        probe->count++;
+    }
+    (void) w;
+}
+
+static void
+s_test_timeout_cb(AvahiTimeout *t, void *userdata)
+{
+    s_probe_t *probe = (s_probe_t*) userdata;
+    probe->fired_us = zclock_usecs();
+    probe->count++;
+    (void) t;
+}
+
+typedef struct {
+    int fds[2];
+    s_probe_t probe;
+} s_pipe_probe_t;
+
+static int
+s_test_write_cb(zloop_t *loop, int timer_id, void *arg)
+{
+    s_pipe_probe_t *pp = (s_pipe_probe_t*) arg;
+    pp->probe.armed_us = zclock_usecs();
+    int rv = (int) write(pp->fds[1], "x", 1);
+    assert(rv == 1);
+    (void) loop; (void) timer_id;
+    return 0;
+}
+
+static int
+s_test_stop_cb(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id; (void) arg;
+    return -1;
+}
+
+typedef struct {
+    AvahiEntryGroup *group;
+    int64_t commit_us;
+    int64_t registering_us;
+    int64_t established_us;
+    bool done;
+} s_group_probe_t;
+
+static void
+s_test_group_cb(AvahiEntryGroup *group, AvahiEntryGroupState state, void *userdata)
+{
+    s_group_probe_t *probe = (s_group_probe_t*) userdata;
+    switch (state) {
+        case AVAHI_ENTRY_GROUP_REGISTERING:
+            probe->registering_us = zclock_usecs();
+            break;
+        case AVAHI_ENTRY_GROUP_ESTABLISHED:
+            probe->established_us = zclock_usecs();
+            probe->done = true;
+            break;
+        case AVAHI_ENTRY_GROUP_COLLISION:
+        case AVAHI_ENTRY_GROUP_FAILURE:
+            probe->done = true;
+            break;
+        default:
+            break;
+    }
+    (void) group;
+}
+
+static void
+s_test_client_cb(AvahiClient *client, AvahiClientState state, void *userdata)
+{
+    s_group_probe_t *probe = (s_group_probe_t*) userdata;
+    if (state != AVAHI_CLIENT_S_RUNNING || probe->group) return;
+
+    probe->group = avahi_entry_group_new(client, s_test_group_cb, probe);
+    assert(probe->group);
+    char name[64];
+    snprintf(name, sizeof(name), "fty-mdns-sd selftest %d", (int) getpid());
+    int rv = avahi_entry_group_add_service(probe->group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+        AvahiPublishFlags(0), name, "_fty-selftest._tcp", nullptr, nullptr, 4242, NULL);
+    assert(rv == 0);
+    probe->commit_us = zclock_usecs();
+    rv = avahi_entry_group_commit(probe->group);
+    assert(rv == 0);
+}
+
+static int
+s_test_group_done_cb(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id;
+    s_group_probe_t *probe = (s_group_probe_t*) arg;
+    return probe->done ? -1 : 0;
+}
+
+void avahi_zloop_poll_test (bool verbose)
+{
+    printf (" * Avahi zloop poll test\n");
+
+    //  watch: a fd becoming readable is dispatched right away
+    {
+        zloop_t *loop = zloop_new();
+        AvahiZloopPoll poll(loop);
+        const AvahiPoll *api = poll.get();
+
+        s_pipe_probe_t pp = { { -1, -1 }, { 0, 0, 0 } };
+        s_probe_t *probe = &pp.probe;
+        int rv = pipe(pp.fds);
+        assert(rv == 0);
+
+        AvahiWatch *w = api->watch_new(api, pp.fds[0], AVAHI_WATCH_IN, s_test_watch_cb, probe);
+        // a second watch on the same fd must not steal the first one
+        AvahiWatch *w2 = api->watch_new(api, pp.fds[0], AvahiWatchEvent(0), s_test_watch_cb, probe);
+        zloop_timer(loop, 10, 1, s_test_write_cb, &pp);
+        zloop_timer(loop, 100, 1, s_test_stop_cb, NULL);
+        zloop_start(loop);
+
+        assert(probe->count == 1);
+        int64_t latency = probe->fired_us - probe->armed_us;
+        if (verbose)
+            printf ("   watch latency: %" PRIi64 " us\n", latency);
+        // an upper bound would fail on loaded machines, or under valgrind
+        assert(latency >= 0);
+
+        api->watch_free(w2);
+        api->watch_free(w);
+        close(pp.fds[0]);
+        close(pp.fds[1]);
+        zloop_destroy(&loop);
+    }
+
+    //  timeout: fires once at the requested time, can be disabled and rearmed
+    {
+        zloop_t *loop = zloop_new();
+        AvahiZloopPoll poll(loop);
+        const AvahiPoll *api = poll.get();
+
+        s_probe_t probe = { 0, 0, 0 };
+        s_probe_t never = { 0, 0, 0 };
+        struct timeval tv;
+
+        probe.armed_us = zclock_usecs();
+        AvahiTimeout *t = api->timeout_new(api, avahi_elapse_time(&tv, 20, 0), s_test_timeout_cb, &probe);
+        AvahiTimeout *t2 = api->timeout_new(api, avahi_elapse_time(&tv, 10, 0), s_test_timeout_cb, &never);
+        api->timeout_update(t2, NULL);
+        AvahiTimeout *t3 = api->timeout_new(api, avahi_elapse_time(&tv, 15, 0), s_test_timeout_cb, &never);
+        api->timeout_free(t3);
+
+        zloop_timer(loop, 100, 1, s_test_stop_cb, NULL);
+        zloop_start(loop);
+
+        assert(probe.count == 1);
+        assert(never.count == 0);
+        int64_t elapsed = probe.fired_us - probe.armed_us;
+        if (verbose)
+            printf ("   timeout of 20 ms fired after %" PRIi64 " us\n", elapsed);
+        assert(elapsed >= 19000);
+
+        api->timeout_free(t);
+        api->timeout_free(t2);
+        zloop_destroy(&loop);
+    }
+
+    //  entry group: state transitions are observed from the zloop
+    //  this part needs avahi-daemon running
+    {
+        zloop_t *loop = zloop_new();
+        AvahiZloopPoll *poll = new AvahiZloopPoll(loop);
+        s_group_probe_t probe = { NULL, 0, 0, 0, false };
+        int error = 0;
+        AvahiClient *client = avahi_client_new(poll->get(), AvahiClientFlags(0), s_test_client_cb, &probe, &error);
+        if (client) {
+            zloop_timer(loop, 10, 0, s_test_group_done_cb, &probe);
+            zloop_timer(loop, 5000, 1, s_test_stop_cb, NULL);
+            zloop_start(loop);
+
+            assert(probe.established_us != 0);
+            if (verbose)
+                printf ("   entry group REGISTERING after %" PRIi64 " us, ESTABLISHED after %" PRIi64 " us\n",
+                    probe.registering_us - probe.commit_us, probe.established_us - probe.commit_us);
+            if (probe.group) avahi_entry_group_free(probe.group);
+            avahi_client_free(client);
+        }
+        else
+            printf ("   avahi-daemon not available (%s), entry group part skipped\n", avahi_strerror(error));
+        delete poll;
+        zloop_destroy(&loop);
+    }
+
+    printf (" * Avahi zloop poll test: OK\n");
+}
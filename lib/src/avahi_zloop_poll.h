@@ -0,0 +1,85 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   avahi_zloop_poll.h
+ *
+ * AvahiPoll implementation on top of a czmq zloop: the avahi client D-Bus
+ * watches and timeouts are registered directly in the actor loop, so avahi
+ * events are dispatched in the same thread as malamute messages.
+ */
+
+#ifndef AVAHI_ZLOOP_POLL_H
+#define AVAHI_ZLOOP_POLL_H
+
+#include <map>
+#include <vector>
+
+#include <czmq.h>
+#include <avahi-common/watch.h>
+
+class AvahiZloopPoll {
+public:
+    explicit AvahiZloopPoll(zloop_t *loop);
+    ~AvahiZloopPoll();
+
+    AvahiZloopPoll(const AvahiZloopPoll&) = delete;
+    AvahiZloopPoll& operator=(const AvahiZloopPoll&) = delete;
+
+    // poll api to give to avahi_client_new()
+    const AvahiPoll* get() const { return &_api; }
+
+    zloop_t* loop() const { return _loop; }
+
+private:
+    // avahi api entry points
+    static AvahiWatch* watchNew(const AvahiPoll *api, int fd, AvahiWatchEvent event, AvahiWatchCallback callback, void *userdata);
+    static void watchUpdate(AvahiWatch *w, AvahiWatchEvent event);
+    static AvahiWatchEvent watchGetEvents(AvahiWatch *w);
+    static void watchFree(AvahiWatch *w);
+    static AvahiTimeout* timeoutNew(const AvahiPoll *api, const struct timeval *tv, AvahiTimeoutCallback callback, void *userdata);
+    static void timeoutUpdate(AvahiTimeout *t, const struct timeval *tv);
+    static void timeoutFree(AvahiTimeout *t);
+
+    // zloop handlers
+    static int onFdEvent(zloop_t *loop, zmq_pollitem_t *item, void *arg);
+    static int onTimer(zloop_t *loop, int timer_id, void *arg);
+
+    // (re)register the zloop poller of a fd with the union of its watch events
+    void rearm(int fd);
+    void armTimeout(AvahiTimeout *t, const struct timeval *tv);
+    void disarmTimeout(AvahiTimeout *t);
+    void purge();
+
+    AvahiPoll _api;
+    zloop_t *_loop;
+    // zloop_poller_end() removes every poller of a fd, so watches sharing a
+    // fd (D-Bus read and write watches) are multiplexed on one poller
+    std::map<int, std::vector<AvahiWatch*>> _watches;
+    std::map<int, AvahiTimeout*> _timers;
+    // watches freed while dispatching, deleted once the dispatch is over
+    std::vector<AvahiWatch*> _graveyard;
+    int _dispatching = 0;
+};
+
+//  Self test of this class.
+void avahi_zloop_poll_test (bool verbose);
+
+#endif
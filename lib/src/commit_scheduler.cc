@@ -0,0 +1,179 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   commit_scheduler.cc
+ *
+ */
+
+#include "commit_scheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+
+CommitScheduler::CommitScheduler(double rate, size_t burst)
+{
+    configure(rate, burst);
+}
+
+void CommitScheduler::configure(double rate, size_t burst)
+{
+    _rate = rate > 0 ? rate : 0;
+    _burst = burst > 0 ? burst : 1;
+    _tokens = double(_burst);
+    _refilled = -1;
+}
+
+void CommitScheduler::refill(int64_t now_ms) const
+{
+    if (_refilled >= 0 && now_ms > _refilled)
+        _tokens = std::min(double(_burst), _tokens + double(now_ms - _refilled) * _rate / 1000.0);
+    if (now_ms > _refilled)
+        _refilled = now_ms;
+}
+
+void CommitScheduler::schedule(const std::string& key)
+{
+    if (_pending.insert(key).second)
+        _queue.push_back(key);
+}
+
+void CommitScheduler::cancel(const std::string& key)
+{
+    _pending.erase(key);
+    if (_pending.empty())
+        _queue.clear();
+}
+
+size_t CommitScheduler::take(int64_t now_ms, std::vector<std::string>& due)
+{
+    refill(now_ms);
+    size_t taken = 0;
+    while (!_queue.empty() && (_rate == 0 || _tokens >= 1)) {
+        std::string key = std::move(_queue.front());
+        _queue.pop_front();
+        if (!_pending.erase(key))
+            continue;   // cancelled
+        due.push_back(std::move(key));
+        _tokens -= 1;
+        taken++;
+    }
+    return taken;
+}
+
+int64_t CommitScheduler::nextDelay(int64_t now_ms) const
+{
+    if (_pending.empty())
+        return -1;
+    if (_rate == 0)
+        return 0;
+    refill(now_ms);
+    if (_tokens >= 1)
+        return 0;
+    return int64_t(std::ceil((1 - _tokens) * 1000.0 / _rate));
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void commit_scheduler_test (bool verbose)
+{
+    printf (" * Commit scheduler test\n");
+
+    std::vector<std::string> due;
+
+    // burst first, then one commit every 1000 / rate ms
+    {
+        CommitScheduler scheduler (10, 3);
+        assert (scheduler.nextDelay (0) == -1);
+        for (int i = 0; i < 6; i++)
+            scheduler.schedule ("proxy/ups-" + std::to_string (i));
+        scheduler.schedule ("proxy/ups-0");     // already queued
+        assert (scheduler.pending () == 6);
+
+        assert (scheduler.take (1000, due) == 3);
+        assert (due.size () == 3 && due[0] == "proxy/ups-0" && due[2] == "proxy/ups-2");
+        assert (scheduler.nextDelay (1000) == 100);
+        assert (scheduler.take (1050, due) == 0);
+        assert (scheduler.nextDelay (1050) == 50);
+        assert (scheduler.take (1100, due) == 1);
+        assert (due.back () == "proxy/ups-3");
+
+        // cancelled keys are skipped and cost nothing
+        scheduler.cancel ("proxy/ups-4");
+        assert (scheduler.pending () == 1);
+        assert (scheduler.take (1200, due) == 1);
+        assert (due.back () == "proxy/ups-5");
+        assert (scheduler.nextDelay (1200) == -1);
+
+        // tokens pile up to burst only
+        due.clear ();
+        for (int i = 0; i < 5; i++)
+            scheduler.schedule ("proxy/epdu-" + std::to_string (i));
+        assert (scheduler.take (60000, due) == 3);
+    }
+
+    // no limit: everything at once
+    {
+        CommitScheduler scheduler (0, 1);
+        due.clear ();
+        for (int i = 0; i < 100; i++)
+            scheduler.schedule ("proxy/" + std::to_string (i));
+        assert (scheduler.nextDelay (0) == 0);
+        assert (scheduler.take (0, due) == 100);
+        assert (scheduler.pending () == 0);
+    }
+
+    // a key scheduled again after a cancel is released once, at its first place
+    {
+        CommitScheduler scheduler (1, 1);
+        due.clear ();
+        scheduler.schedule ("a");
+        scheduler.schedule ("b");
+        scheduler.cancel ("a");
+        scheduler.schedule ("a");
+        assert (scheduler.take (0, due) == 1 && due[0] == "a");
+        assert (scheduler.take (1000, due) == 1 && due[1] == "b");
+        assert (scheduler.take (5000, due) == 0);
+    }
+
+    // 1000 devices at 20 commits per second: spread over ~50 s
+    {
+        CommitScheduler scheduler (20, 10);
+        for (int i = 0; i < 1000; i++)
+            scheduler.schedule ("proxy/" + std::to_string (i));
+        int64_t now = 0;
+        size_t peak = 0;
+        while (scheduler.pending ()) {
+            due.clear ();
+            peak = std::max (peak, scheduler.take (now, due));
+            now += std::max (scheduler.nextDelay (now), int64_t (1));
+        }
+        assert (peak == 10);
+        assert (now >= 49000 && now <= 51000);
+        if (verbose)
+            printf ("   1000 commits released over %" PRIi64 " ms, at most %zu at once\n", now, peak);
+    }
+
+    printf (" * Commit scheduler test: OK\n");
+}
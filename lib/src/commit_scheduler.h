@@ -0,0 +1,82 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   commit_scheduler.h
+ *
+ * Staggers the commits of proxied services: each commit makes avahi-daemon
+ * probe and announce a service, so a thousand devices showing up at once
+ * would flood the link with a thousand probes. Keys are queued once in
+ * arrival order and released by a token bucket: burst commits at once,
+ * then rate commits per second.
+ */
+
+#ifndef COMMIT_SCHEDULER_H
+#define COMMIT_SCHEDULER_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class CommitScheduler {
+public:
+    /**
+     * rate: commits per second, 0 for no limit; burst: commits released
+     * at once after an idle period (at least 1).
+     */
+    CommitScheduler(double rate = 20, size_t burst = 10);
+
+    void configure(double rate, size_t burst);
+    double rate() const { return _rate; }
+    size_t burst() const { return _burst; }
+
+    // queue key for a commit, a key already queued keeps its place
+    void schedule(const std::string& key);
+    // forget a queued key
+    void cancel(const std::string& key);
+
+    /**
+     * Move the keys allowed at now_ms to due, oldest first,
+     * return how many were moved.
+     */
+    size_t take(int64_t now_ms, std::vector<std::string>& due);
+
+    // ms until the next key can be taken, 0 if now, -1 if none is queued
+    int64_t nextDelay(int64_t now_ms) const;
+
+    size_t pending() const { return _pending.size(); }
+
+private:
+    void refill(int64_t now_ms) const;
+
+    double _rate;
+    size_t _burst;
+    mutable double _tokens;
+    mutable int64_t _refilled = -1;   // ms of the last refill, -1 before the first one
+    std::deque<std::string> _queue;   // may hold cancelled keys, skipped by take()
+    std::unordered_set<std::string> _pending;
+};
+
+//  Self test of this class.
+void commit_scheduler_test (bool verbose);
+
+#endif
@@ -0,0 +1,480 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   discovery_cache.cc
+ *
+ */
+
+#include "discovery_cache.h"
+
+#include <cinttypes>
+#include <fty_log.h>
+
+std::string DiscoveredService::key(const std::string& name, const std::string& type, const std::string& domain)
+{
+    // DNS-SD full name, dots and backslashes of the instance name escaped
+    std::string rv;
+    rv.reserve(name.size() + type.size() + domain.size() + 8);
+    for (char c : name) {
+        if (c == '.' || c == '\\') rv += '\\';
+        rv += c;
+    }
+    rv += '.';
+    rv += DiscoveryCache::normalize(type);
+    rv += '.';
+    rv += DiscoveryCache::normalize(domain.empty() ? std::string("local") : domain);
+    return rv;
+}
+
+std::string DiscoveredService::key() const
+{
+    return key(name, type, domain);
+}
+
+DiscoveryCache::DiscoveryCache(int64_t ttl) :
+    _ttl(ttl)
+{
+}
+
+DiscoveryCache::~DiscoveryCache()
+{
+    clear();
+}
+
+std::string DiscoveryCache::normalize(const std::string& name)
+{
+    size_t n = name.size();
+    while (n > 0 && name[n - 1] == '.') n--;
+    return name.substr(0, n);
+}
+
+void DiscoveryCache::clear()
+{
+    for (auto &it : _byKey) delete it.second;
+    _byKey.clear();
+    _byType.clear();
+    _bySubtype.clear();
+    _byHost.clear();
+    _byExpiry.clear();
+}
+
+void DiscoveryCache::indexAdd(index_t& index, const std::string& value, const std::string& key)
+{
+    if (value.empty()) return;
+    index[value].insert(key);
+}
+
+void DiscoveryCache::indexRemove(index_t& index, const std::string& value, const std::string& key)
+{
+    auto it = index.find(value);
+    if (it == index.end()) return;
+    it->second.erase(key);
+    if (it->second.empty()) index.erase(it);
+}
+
+DiscoveryCache::result_t DiscoveryCache::lookup(const index_t& index, const std::string& value) const
+{
+    result_t rv;
+    auto it = index.find(value);
+    if (it == index.end()) return rv;
+    rv.reserve(it->second.size());
+    for (const auto &key : it->second)
+        rv.push_back(_byKey.at(key));
+    return rv;
+}
+
+void DiscoveryCache::setExpiry(DiscoveredService* service, int64_t expires)
+{
+    const std::string key = service->key();
+    auto range = _byExpiry.equal_range(service->expires);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == key) {
+            _byExpiry.erase(it);
+            break;
+        }
+    }
+    service->expires = expires;
+    _byExpiry.emplace(expires, key);
+}
+
+void DiscoveryCache::unlink(DiscoveredService* service)
+{
+    const std::string key = service->key();
+    indexRemove(_byType, service->type, key);
+    indexRemove(_byHost, service->host, key);
+    for (const auto &subtype : service->subtypes)
+        indexRemove(_bySubtype, subtype, key);
+    auto range = _byExpiry.equal_range(service->expires);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == key) {
+            _byExpiry.erase(it);
+            break;
+        }
+    }
+}
+
+const char* DiscoveryCache::changeName(Change change)
+{
+    switch (change) {
+        case ADDED:   return "ADDED";
+        case UPDATED: return "UPDATED";
+        case REMOVED: return "REMOVED";
+    }
+    return "UNKNOWN";
+}
+
+void DiscoveryCache::notify(Change change, const DiscoveredService& service)
+{
+    if (_listener) _listener(change, service);
+}
+
+// return true if the subtype is new for this entry
+bool DiscoveryCache::tag(DiscoveredService* service, const std::string& subtype)
+{
+    std::string value = normalize(subtype);
+    if (!service->subtypes.insert(value).second)
+        return false;
+    indexAdd(_bySubtype, value, service->key());
+    return true;
+}
+
+const DiscoveredService* DiscoveryCache::upsert(const DiscoveredService& service, int64_t now)
+{
+    DiscoveredService normalized = service;
+    normalized.type = normalize(service.type);
+    normalized.domain = normalize(service.domain.empty() ? std::string("local") : service.domain);
+    normalized.host = normalize(service.host);
+    const std::string key = normalized.key();
+
+    auto it = _byKey.find(key);
+    DiscoveredService* entry;
+    if (it == _byKey.end()) {
+        entry = new DiscoveredService(normalized);
+        entry->subtypes.clear();
+        _byKey[key] = entry;
+        indexAdd(_byType, entry->type, key);
+        indexAdd(_byHost, entry->host, key);
+        entry->expires = now + _ttl;
+        _byExpiry.emplace(entry->expires, key);
+        for (const auto &subtype : normalized.subtypes)
+            tag(entry, subtype);
+        notify(ADDED, *entry);
+        return entry;
+    }
+
+    entry = it->second;
+    if (!normalized.resolved) {
+        // browsed again, what was resolved before stays
+        bool changed = false;
+        if (!entry->resolved) {
+            entry->ifindex = normalized.ifindex;
+            entry->protocol = normalized.protocol;
+        }
+        for (const auto &subtype : normalized.subtypes)
+            changed = tag(entry, subtype) || changed;
+        setExpiry(entry, now + _ttl);
+        if (changed)
+            notify(UPDATED, *entry);
+        return entry;
+    }
+    bool changed = !entry->resolved
+        || entry->host != normalized.host
+        || entry->address != normalized.address
+        || entry->port != normalized.port
+        || entry->txt != normalized.txt;
+    if (entry->host != normalized.host) {
+        indexRemove(_byHost, entry->host, key);
+        indexAdd(_byHost, normalized.host, key);
+    }
+    entry->host = std::move(normalized.host);
+    entry->address = std::move(normalized.address);
+    entry->port = normalized.port;
+    entry->ifindex = normalized.ifindex;
+    entry->protocol = normalized.protocol;
+    entry->txt = std::move(normalized.txt);
+    entry->resolved = true;
+    for (const auto &subtype : normalized.subtypes)
+        changed = tag(entry, subtype) || changed;
+    setExpiry(entry, now + _ttl);
+    if (changed)
+        notify(UPDATED, *entry);
+    return entry;
+}
+
+bool DiscoveryCache::addSubtype(const std::string& key, const std::string& subtype)
+{
+    auto it = _byKey.find(key);
+    if (it == _byKey.end()) return false;
+    if (tag(it->second, subtype))
+        notify(UPDATED, *it->second);
+    return true;
+}
+
+bool DiscoveryCache::removeSubtype(const std::string& key, const std::string& subtype)
+{
+    auto it = _byKey.find(key);
+    if (it == _byKey.end()) return false;
+    std::string value = normalize(subtype);
+    if (it->second->subtypes.erase(value)) {
+        indexRemove(_bySubtype, value, key);
+        notify(UPDATED, *it->second);
+    }
+    return true;
+}
+
+bool DiscoveryCache::remove(const std::string& key)
+{
+    auto it = _byKey.find(key);
+    if (it == _byKey.end()) return false;
+    DiscoveredService* entry = it->second;
+    unlink(entry);
+    _byKey.erase(it);
+    notify(REMOVED, *entry);
+    delete entry;
+    return true;
+}
+
+std::vector<std::string> DiscoveryCache::expiring(int64_t now) const
+{
+    std::vector<std::string> rv;
+    for (auto it = _byExpiry.begin(); it != _byExpiry.end() && it->first <= now; ++it)
+        rv.push_back(it->second);
+    return rv;
+}
+
+std::vector<std::string> DiscoveryCache::expire(int64_t now)
+{
+    std::vector<std::string> rv = expiring(now);
+    for (const auto &key : rv)
+        remove(key);
+    return rv;
+}
+
+bool DiscoveryCache::touch(const std::string& key, int64_t expires)
+{
+    auto it = _byKey.find(key);
+    if (it == _byKey.end()) return false;
+    setExpiry(it->second, expires);
+    return true;
+}
+
+const DiscoveredService* DiscoveryCache::find(const std::string& key) const
+{
+    auto it = _byKey.find(key);
+    return it == _byKey.end() ? nullptr : it->second;
+}
+
+const DiscoveredService* DiscoveryCache::find(const std::string& name, const std::string& type, const std::string& domain) const
+{
+    return find(DiscoveredService::key(name, type, domain));
+}
+
+DiscoveryCache::result_t DiscoveryCache::byType(const std::string& type) const
+{
+    return lookup(_byType, normalize(type));
+}
+
+DiscoveryCache::result_t DiscoveryCache::bySubtype(const std::string& subtype) const
+{
+    return lookup(_bySubtype, normalize(subtype));
+}
+
+DiscoveryCache::result_t DiscoveryCache::byHost(const std::string& host) const
+{
+    return lookup(_byHost, normalize(host));
+}
+
+DiscoveryCache::result_t DiscoveryCache::all() const
+{
+    std::map<std::string, const DiscoveredService*> sorted(_byKey.begin(), _byKey.end());
+    result_t rv;
+    rv.reserve(sorted.size());
+    for (const auto &it : sorted)
+        rv.push_back(it.second);
+    return rv;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+static DiscoveredService
+s_test_service(const char *name, const char *type, const char *host, uint16_t port)
+{
+    DiscoveredService s;
+    s.name = name;
+    s.type = type;
+    s.domain = "local";
+    s.host = host;
+    s.port = port;
+    s.txt["txtvers"] = "1.0.0";
+    return s;
+}
+
+void discovery_cache_test (bool verbose)
+{
+    printf (" * Discovery cache test\n");
+
+    DiscoveryCache cache(1000);
+    int64_t now = 10000;
+
+    // insert, trailing dots do not matter
+    DiscoveredService ipc1 = s_test_service("IPC (1234)", "_https._tcp.", "ipc1.local.", 443);
+    ipc1.subtypes.insert("_powerservice._sub._https._tcp.");
+    cache.upsert(ipc1, now);
+    cache.upsert(s_test_service("IPC (5678)", "_https._tcp", "ipc2.local", 443), now + 10);
+    cache.upsert(s_test_service("IPC (1234)", "_mqtt._tcp", "ipc1.local", 1883), now + 20);
+    assert(cache.size() == 3);
+
+    const DiscoveredService *found = cache.find("IPC (1234)", "_https._tcp", "local.");
+    assert(found);
+    assert(found->port == 443);
+    assert(found->host == "ipc1.local");
+    assert(found->key() == "IPC (1234)._https._tcp.local");
+    // dots of the instance name are escaped in the key
+    assert(DiscoveredService::key("a.b", "_x._tcp", "local") == "a\\.b._x._tcp.local");
+
+    assert(cache.byType("_https._tcp").size() == 2);
+    assert(cache.byType("_mqtt._tcp.").size() == 1);
+    assert(cache.byType("_snmp._udp").empty());
+    assert(cache.byHost("ipc1.local").size() == 2);
+    assert(cache.bySubtype("_powerservice._sub._https._tcp").size() == 1);
+
+    // refresh keeps known subtypes, moves host index
+    DiscoveredService moved = s_test_service("IPC (1234)", "_https._tcp", "ipc3.local", 8443);
+    cache.upsert(moved, now + 500);
+    found = cache.find("IPC (1234)._https._tcp.local");
+    assert(found->port == 8443);
+    assert(found->subtypes.size() == 1);
+    assert(cache.byHost("ipc1.local").size() == 1);
+    assert(cache.byHost("ipc3.local").size() == 1);
+
+    cache.addSubtype(found->key(), "_ups._sub._https._tcp");
+    assert(cache.bySubtype("_ups._sub._https._tcp").size() == 1);
+    cache.removeSubtype(found->key(), "_ups._sub._https._tcp");
+    assert(cache.bySubtype("_ups._sub._https._tcp").empty());
+
+    // results sorted by key
+    DiscoveryCache::result_t https = cache.byType("_https._tcp");
+    assert(https[0]->name == "IPC (1234)");
+    assert(https[1]->name == "IPC (5678)");
+
+    // ttl driven expiry, the refreshed entry survives
+    assert(cache.expiring(now + 1010).size() == 1);
+    std::vector<std::string> expired = cache.expire(now + 1020);
+    assert(expired.size() == 2);
+    assert(cache.size() == 1);
+    assert(cache.find("IPC (1234)._https._tcp.local"));
+    assert(cache.byType("_mqtt._tcp").empty());
+    assert(cache.byHost("ipc2.local").empty());
+
+    cache.touch("IPC (1234)._https._tcp.local", now + 5000);
+    assert(cache.expire(now + 4000).empty());
+    assert(cache.remove("IPC (1234)._https._tcp.local"));
+    assert(!cache.remove("IPC (1234)._https._tcp.local"));
+    assert(cache.size() == 0);
+    assert(cache.bySubtype("_powerservice._sub._https._tcp").empty());
+
+    // change notifications
+    {
+        DiscoveryCache watched(1000);
+        std::vector<std::string> changes;
+        watched.setListener([&changes](DiscoveryCache::Change change, const DiscoveredService& s) {
+            changes.push_back(std::string(DiscoveryCache::changeName(change)) + " " + s.name);
+        });
+        DiscoveredService s = s_test_service("IPC (1)", "_https._tcp", "ipc1.local", 443);
+        watched.upsert(s, now);
+        watched.upsert(s, now + 10);         // refresh only
+        s.txt["txtvers"] = "1.0.1";
+        watched.upsert(s, now + 20);
+        watched.addSubtype(s.key(), "_ups._sub._https._tcp");
+        watched.addSubtype(s.key(), "_ups._sub._https._tcp");
+        watched.expire(now + 5000);
+        assert(changes.size() == 4);
+        assert(changes[0] == "ADDED IPC (1)");
+        assert(changes[1] == "UPDATED IPC (1)");
+        assert(changes[2] == "UPDATED IPC (1)");
+        assert(changes[3] == "REMOVED IPC (1)");
+    }
+
+    // browsed before resolved
+    {
+        DiscoveryCache lazy(1000);
+        std::vector<std::string> changes;
+        lazy.setListener([&changes](DiscoveryCache::Change change, const DiscoveredService& s) {
+            changes.push_back(std::string(DiscoveryCache::changeName(change)) + (s.resolved ? " resolved" : " browsed"));
+        });
+        DiscoveredService browsed;
+        browsed.name = "IPC (2)";
+        browsed.type = "_https._tcp";
+        browsed.ifindex = 2;
+        browsed.resolved = false;
+        lazy.upsert(browsed, now);
+        lazy.upsert(browsed, now + 10);      // refresh only
+        const DiscoveredService *entry = lazy.find(browsed.key());
+        assert(entry && !entry->resolved && entry->host.empty());
+        assert(entry->expires == now + 1010);
+
+        DiscoveredService resolved = s_test_service("IPC (2)", "_https._tcp", "ipc2.local", 443);
+        lazy.upsert(resolved, now + 20);
+        assert(entry->resolved && entry->port == 443);
+        assert(lazy.byHost("ipc2.local").size() == 1);
+        // browsed again, with a subtype: the resolved content stays
+        browsed.subtypes.insert("_ups._sub._https._tcp");
+        lazy.upsert(browsed, now + 30);
+        lazy.upsert(browsed, now + 40);
+        assert(entry->resolved && entry->host == "ipc2.local" && entry->port == 443);
+        assert(lazy.bySubtype("_ups._sub._https._tcp").size() == 1);
+        assert(entry->expires == now + 1040);
+        // the same resolution again is no change
+        lazy.upsert(resolved, now + 50);
+        assert(changes.size() == 3);
+        assert(changes[0] == "ADDED browsed");
+        assert(changes[1] == "UPDATED resolved");
+        assert(changes[2] == "UPDATED resolved");
+    }
+
+    // lookups against a large cache
+    {
+        const int count = 5000;
+        DiscoveryCache big(60000);
+        char name[64], host[64];
+        for (int i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "device %d", i);
+            snprintf(host, sizeof(host), "host%d.local", i / 2);
+            big.upsert(s_test_service(name, i % 2 ? "_https._tcp" : "_snmp._udp", host, 443), now);
+        }
+        assert(big.size() == count);
+        int64_t start = zclock_usecs();
+        int hits = 0;
+        for (int i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "device %d", i);
+            if (big.find(name, i % 2 ? "_https._tcp" : "_snmp._udp", "local")) hits++;
+        }
+        int64_t elapsed = zclock_usecs() - start;
+        assert(hits == count);
+        assert(big.byHost("host42.local").size() == 2);
+        if (verbose)
+            printf ("   %d instance lookups in %" PRIi64 " us (%.0f ns/lookup)\n",
+                count, elapsed, elapsed * 1000.0 / count);
+    }
+
+    printf (" * Discovery cache test: OK\n");
+}
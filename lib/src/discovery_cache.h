@@ -0,0 +1,154 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   discovery_cache.h
+ *
+ * In-memory cache of the services discovered by DNS-SD browsing.
+ * Entries are indexed by instance (name, type, domain), type, subtype and
+ * host, so that lookups never go to the network. Each entry has an expiry
+ * time, refreshed whenever the service is resolved again.
+ */
+
+#ifndef DISCOVERY_CACHE_H
+#define DISCOVERY_CACHE_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mdns_publisher.h"
+
+struct DiscoveredService {
+    std::string name;           // instance name
+    std::string type;           // service type, e.g. _https._tcp
+    std::string domain;         // e.g. local
+    std::string host;           // target host name
+    std::string address;        // textual address
+    uint16_t port = 0;
+    int ifindex = -1;
+    int protocol = -1;
+    std::set<std::string> subtypes;     // e.g. _powerservice._sub._https._tcp
+    map_string_t txt;
+    int64_t expires = 0;        // zclock_mono() time, ms
+    bool resolved = true;       // false: only browsed, host, address, port and TXT unknown yet
+
+    // unique key of the instance
+    std::string key() const;
+    static std::string key(const std::string& name, const std::string& type, const std::string& domain);
+};
+
+class DiscoveryCache {
+public:
+    typedef std::vector<const DiscoveredService*> result_t;
+
+    enum Change { ADDED, UPDATED, REMOVED };
+    // called on every effective change, REMOVED gets the last known state
+    typedef std::function<void(Change, const DiscoveredService&)> listener_t;
+
+    explicit DiscoveryCache(int64_t ttl = 120000);
+    ~DiscoveryCache();
+
+    DiscoveryCache(const DiscoveryCache&) = delete;
+    DiscoveryCache& operator=(const DiscoveryCache&) = delete;
+
+    int64_t ttl() const { return _ttl; }
+    void setTtl(int64_t ttl) { _ttl = ttl; }
+
+    void setListener(listener_t listener) { _listener = listener; }
+    static const char* changeName(Change change);
+
+    /**
+     * Add or refresh a resolved service, expiry is set to now + ttl.
+     * Subtypes of the new entry are merged with the known ones.
+     * A refresh without any new content is not reported as UPDATED.
+     * An unresolved service only adds its subtypes to a known entry.
+     * Return the cached entry.
+     */
+    const DiscoveredService* upsert(const DiscoveredService& service, int64_t now);
+
+    /**
+     * Tag an instance with a subtype, return false if the instance is unknown.
+     */
+    bool addSubtype(const std::string& key, const std::string& subtype);
+    bool removeSubtype(const std::string& key, const std::string& subtype);
+
+    bool remove(const std::string& key);
+
+    /**
+     * Remove entries expired at time now, return their keys.
+     */
+    std::vector<std::string> expire(int64_t now);
+
+    /**
+     * Keys of the entries expiring at or before now, oldest first.
+     */
+    std::vector<std::string> expiring(int64_t now) const;
+
+    /**
+     * Push back the expiry of an entry (e.g. while it is being re-resolved).
+     */
+    bool touch(const std::string& key, int64_t expires);
+
+    // O(1) average lookup
+    const DiscoveredService* find(const std::string& key) const;
+    const DiscoveredService* find(const std::string& name, const std::string& type, const std::string& domain) const;
+
+    // results are sorted by instance key, so that pagination is stable
+    result_t byType(const std::string& type) const;
+    result_t bySubtype(const std::string& subtype) const;
+    result_t byHost(const std::string& host) const;
+    result_t all() const;
+
+    size_t size() const { return _byKey.size(); }
+    // forget everything, without notification
+    void clear();
+
+    // trailing dots are not significant in DNS-SD names
+    static std::string normalize(const std::string& name);
+
+private:
+    typedef std::unordered_map<std::string, std::set<std::string>> index_t;
+
+    void indexAdd(index_t& index, const std::string& value, const std::string& key);
+    void indexRemove(index_t& index, const std::string& value, const std::string& key);
+    result_t lookup(const index_t& index, const std::string& value) const;
+    void unlink(DiscoveredService* service);
+    void setExpiry(DiscoveredService* service, int64_t expires);
+    bool tag(DiscoveredService* service, const std::string& subtype);
+    void notify(Change change, const DiscoveredService& service);
+
+    int64_t _ttl;
+    std::unordered_map<std::string, DiscoveredService*> _byKey;
+    index_t _byType;
+    index_t _bySubtype;
+    index_t _byHost;
+    std::multimap<int64_t, std::string> _byExpiry;
+    listener_t _listener;
+};
+
+//  Self test of this class.
+void discovery_cache_test (bool verbose);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   discovery_journal.cc
+ *
+ */
+
+#include "discovery_journal.h"
+
+#include <cinttypes>
+#include <czmq.h>
+
+DiscoveryJournal::DiscoveryJournal(size_t capacity) :
+    _capacity(capacity ? capacity : 1)
+{
+}
+
+uint64_t DiscoveryJournal::record(DiscoveryCache::Change change, const DiscoveredService& service)
+{
+    if (_entries.size() == _capacity)
+        _entries.pop_front();
+    _entries.push_back(Entry{ ++_seq, change, service });
+    return _seq;
+}
+
+bool DiscoveryJournal::since(uint64_t seq, std::vector<const Entry*>& changes) const
+{
+    changes.clear();
+    if (seq > _seq)
+        return false;
+    if (seq == _seq)
+        return true;
+    // entries hold consecutive sequence numbers
+    if (_entries.empty() || _entries.front().seq > seq + 1)
+        return false;
+    size_t first = size_t(seq + 1 - _entries.front().seq);
+    changes.reserve(_entries.size() - first);
+    for (size_t i = first; i < _entries.size(); i++)
+        changes.push_back(&_entries[i]);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void discovery_journal_test (bool verbose)
+{
+    printf (" * Discovery journal test\n");
+
+    DiscoveryJournal journal(4);
+    std::vector<const DiscoveryJournal::Entry*> changes;
+    assert(journal.seq() == 0);
+    assert(journal.since(0, changes) && changes.empty());
+
+    DiscoveredService s;
+    s.name = "IPC (1)";
+    s.type = "_https._tcp";
+    for (int i = 0; i < 6; i++) {
+        s.port = uint16_t(i);
+        uint64_t seq = journal.record(i ? DiscoveryCache::UPDATED : DiscoveryCache::ADDED, s);
+        assert(seq == uint64_t(i + 1));
+    }
+    assert(journal.seq() == 6);
+    assert(journal.size() == 4);
+
+    // 3..6 are kept
+    assert(journal.since(2, changes));
+    assert(changes.size() == 4);
+    assert(changes[0]->seq == 3);
+    assert(changes[0]->service.port == 2);
+    assert(journal.since(5, changes));
+    assert(changes.size() == 1 && changes[0]->seq == 6);
+    assert(journal.since(6, changes) && changes.empty());
+    // too old or in the future: snapshot needed
+    assert(!journal.since(1, changes));
+    assert(!journal.since(7, changes));
+
+    if (verbose)
+        printf ("   %zu of %" PRIu64 " changes kept\n", journal.size(), journal.seq());
+
+    printf (" * Discovery journal test: OK\n");
+}
@@ -0,0 +1,75 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   discovery_journal.h
+ *
+ * Sequence numbered log of the last changes of the discovery cache.
+ * Every change gets the next sequence number; a consumer which missed some
+ * deltas asks for the ones after its last sequence, and falls back to a
+ * full snapshot when they are no longer kept.
+ */
+
+#ifndef DISCOVERY_JOURNAL_H
+#define DISCOVERY_JOURNAL_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "discovery_cache.h"
+
+class DiscoveryJournal {
+public:
+    struct Entry {
+        uint64_t seq;
+        DiscoveryCache::Change change;
+        DiscoveredService service;  // state after the change, last known one for REMOVED
+    };
+
+    explicit DiscoveryJournal(size_t capacity = 1024);
+
+    /**
+     * Append a change, the oldest entry is dropped when full.
+     * Return its sequence number, the first one is 1.
+     */
+    uint64_t record(DiscoveryCache::Change change, const DiscoveredService& service);
+
+    // sequence number of the last change, 0 if none
+    uint64_t seq() const { return _seq; }
+    size_t size() const { return _entries.size(); }
+    size_t capacity() const { return _capacity; }
+
+    /**
+     * Changes after seq, oldest first. Return false if some of them were
+     * dropped already (or seq is in the future): a snapshot is needed.
+     */
+    bool since(uint64_t seq, std::vector<const Entry*>& changes) const;
+
+private:
+    size_t _capacity;
+    uint64_t _seq = 0;
+    std::deque<Entry> _entries;
+};
+
+//  Self test of this class.
+void discovery_journal_test (bool verbose);
+
+#endif
@@ -26,6 +26,30 @@
 #include "../include/fty_mdns_sd.h"
 
 //  Internal API
+#include "alloc_counter.h"
+#include "txt_frame.h"
+#include "txt_arena.h"
+#include "txt_budget.h"
+#include "msg_view.h"
+#include "publish_policy.h"
+#include "service_subtypes.h"
+#include "link_monitor.h"
+#include "mdns_publisher.h"
+#include "announce_fingerprint.h"
+#include "announce_state.h"
+#include "announce_metrics.h"
+#include "commit_scheduler.h"
+#include "announce_jitter.h"
 #include "avahi_wrapper.h"
+#include "recording_publisher.h"
+#include "mdns_message.h"
+#include "mdns_socket.h"
+#include "mdns_responder.h"
+#include "avahi_zloop_poll.h"
+#include "discovery_cache.h"
+#include "discovery_journal.h"
+#include "resolver_pool.h"
+#include "avahi_browser.h"
+#include "mdns_listener.h"
 
 #endif
@@ -28,26 +28,223 @@
 
 #include "fty_mdns_sd_classes.h"
 
-#define TIMEOUT_MS 5000   //wait at least 5 seconds
+#include <algorithm>
+#include <cinttypes>
+#include <cstdarg>
+
+#define SELFTEST_DIR_RW "selftest-rw"
+
+#define INFO_RETRY_MIN 1000    // ms, first fty-info reply timeout
+#define INFO_RETRY_MAX 30000   // ms, the timeout doubles on each retry up to this
+
+#define STATE_SAVE_DELAY 10000  // ms, TXT only updates of the default service are saved this late at most
+
+#define LIST_LIMIT_DEFAULT 100   // services per LIST-SERVICES reply by default
+#define LIST_LIMIT_MAX     1000  // and at most
+
+#define RESOLVE_WAIT_DEFAULT 2000   // ms, GET-SERVICE of an unresolved instance waits this at most
 
 //  Structure of our class
 struct _fty_mdns_sd_server_t {
     char *name;              // actor name
     mlm_client_t *client;    // malamute client
     char *fty_info_command;
-    AvahiWrapper *service;   // service mDNS-SD
+    char *info_uuid;         // pending fty-info request, NULL if none
+    int info_timer;          // retry timer of the pending request, -1 if none
+    int info_retry;          // ms, current retry delay
+    char *state_file;        // last published default announcement, NULL if not kept
+    int state_timer;         // delayed save of state_file, -1 if none is pending
+    zloop_t *loop;           // actor loop, also drives avahi
+    AvahiZloopPoll *avahi_poll; // avahi poll api on top of loop
+    MdnsPublisher *service;  // service mDNS-SD publisher backend
+    bool started;            // service registered by the backend
 
     //default service announcement definition
     char *srv_name;
     char *srv_type;
-    char *srv_stype;
+    char *srv_stype;         // canonical subtype list, see ServiceSubtypes
+    char *srv_extra_stypes;  // configured subtypes, added to the ones of fty-info
     char *srv_port;
+    char *published_name;    // name established after collisions, NULL if srv_name
     //TXT attributes
     zhash_t *map_txt;
-};
+    TxtBudget *txt_budget;   // size of the TXT records of each service
+
+    //published services, key -> s_service_t
+    zhash_t *services;
+
+    AnnounceMetrics *metrics;    // counters and latencies of the announce pipeline
+    MdnsPublisher::Observer *observer;   // publisher events into metrics and state
+    int64_t info_sent;           // zclock_usecs() of the pending fty-info request
+    char *endpoint;              // malamute endpoint, for the metrics client
+    mlm_client_t *metrics_client;    // METRICS producer, NULL if not published
+    int metrics_timer;           // publication timer, -1 if none
+    int metrics_interval;        // ms
 
+    int coalesce_window;     // ms, 0 means apply immediately
+    int coalesce_max_delay;  // ms, cap counted from the first pending message
+
+    AnnounceJitter *jitter;  // random delays of the first registration and of large TXT updates
+    size_t jitter_txt_bytes; // TXT updates this large on the wire are delayed, 0 for none
+    int start_timer;         // jittered first registration, -1 if not armed
+    bool start_jittered;     // first registration delayed already
+
+    DiscoveryCache *discovered;  // services found by browsing
+    AvahiBrowser *browser;   // DNS-SD discovery engine
+    MdnsListener *listener;  // passive discovery, NULL until a type is browsed passively
+    bool discovery_browse;   // BROWSE types are browsed and resolved through avahi-daemon
+    bool discovery_passive;  // ... and/or read from the mDNS traffic
+    DiscoveryJournal *journal;   // last changes of discovered, by sequence number
+    zlist_t *waiting_gets;   // GET-SERVICE requests held until their instance is resolved, s_waiting_get_t
+    int resolve_wait;        // ms, at most, 0 replies at once with the unresolved instance
+    bool discovery_producer; // changes are published on the producer stream
+
+    LinkMonitor *links;      // link notifications, open once a policy names interfaces
+    zmq_pollitem_t links_item;   // poller of links
+
+    //devices of the ASSETS stream announced on their behalf
+    char *proxy_types;       // comma separated asset subtypes, NULL if none is proxied
+    char *proxy_srv_type;    // service type and port they are announced with
+    char *proxy_srv_port;
+    zhash_t *proxies;        // service key -> asset subtype
+    CommitScheduler *proxy_commits;  // staggers their commits
+    int proxy_timer;         // next release of proxy_commits, -1 if none
+};
 typedef struct _fty_mdns_sd_server_t fty_mdns_sd_server_t;
 
+//  Announcement of one service: definition and TXT set
+typedef struct {
+    char *name;
+    char *type;
+    char *stype;
+    char *port;
+    zframe_t *txt;           // TXT set packed by zhash_pack(), read in place
+    char *host;              // proxied device and its address, NULL for this host
+    char *address;
+} s_announce_t;
+
+//  Announcement viewed in place in the message it came in, see MsgView
+typedef struct {
+    std::string_view name;
+    std::string_view type;
+    std::string_view stype;
+    std::string_view port;
+    zframe_t *txt;           // not owned
+    std::string_view host;   // proxied device and its address, empty for this host
+    std::string_view address;
+} s_announce_view_t;
+
+//  State of one published service
+typedef struct {
+    fty_mdns_sd_server_t *server;
+    char *key;
+    uint64_t fingerprint;    // published announcement, 0 if none
+
+    //pending update, latest wins, flushed by coalesce_timer
+    int coalesce_timer;      // zloop timer id, -1 if not armed
+    int64_t pending_since;   // zclock_mono() of the first pending message
+    int64_t pending_until;   // zclock_mono() the jitter of a large update ends
+    s_announce_t pending;    // pending.txt is NULL if nothing is pending
+    uint64_t pending_fingerprint;
+} s_service_t;
+
+static void
+s_announce_clear (s_announce_t *announce)
+{
+    zstr_free (&announce->name);
+    zstr_free (&announce->type);
+    zstr_free (&announce->stype);
+    zstr_free (&announce->port);
+    zframe_destroy (&announce->txt);
+    zstr_free (&announce->host);
+    zstr_free (&announce->address);
+}
+
+//  copy the viewed announcement src into dst, e.g. to keep it pending
+static void
+s_announce_copy (s_announce_t *dst, const s_announce_view_t *src)
+{
+    s_announce_clear (dst);
+    dst->name  = strndup (src->name.data (), src->name.size ());
+    dst->type  = strndup (src->type.data (), src->type.size ());
+    dst->stype = strndup (src->stype.data (), src->stype.size ());
+    dst->port  = strndup (src->port.data (), src->port.size ());
+    dst->txt   = zframe_dup (src->txt);
+    if (!src->host.empty ()) {
+        dst->host    = strndup (src->host.data (), src->host.size ());
+        dst->address = strndup (src->address.data (), src->address.size ());
+    }
+}
+
+//  view of a complete owned announcement
+static s_announce_view_t
+s_announce_view_of (const s_announce_t *announce)
+{
+    return { announce->name, announce->type, announce->stype, announce->port, announce->txt,
+        announce->host ? announce->host : "", announce->address ? announce->address : "" };
+}
+
+static void
+s_drop_pending (s_service_t *service)
+{
+    if (service->coalesce_timer != -1)
+        zloop_timer_end (service->server->loop, service->coalesce_timer);
+    service->coalesce_timer = -1;
+    s_announce_clear (&service->pending);
+}
+
+//free service state, zhash destructor
+static void
+s_service_destroy (void *arg)
+{
+    s_service_t *service = (s_service_t *) arg;
+    s_drop_pending (service);
+    zstr_free (&service->key);
+    free (service);
+}
+
+//  GET-SERVICE request held while its instance is being resolved
+typedef struct {
+    fty_mdns_sd_server_t *server;
+    char *sender;            // mailbox and subject the reply goes to
+    char *subject;
+    char *uuid;
+    char *key;               // instance asked for
+    int timer;               // resolve_wait timer, -1 once fired
+} s_waiting_get_t;
+
+static void
+s_waiting_get_destroy (s_waiting_get_t **waiting_p)
+{
+    s_waiting_get_t *waiting = *waiting_p;
+    if (!waiting)
+        return;
+    if (waiting->timer != -1)
+        zloop_timer_end (waiting->server->loop, waiting->timer);
+    zstr_free (&waiting->sender);
+    zstr_free (&waiting->subject);
+    zstr_free (&waiting->uuid);
+    zstr_free (&waiting->key);
+    free (waiting);
+    *waiting_p = NULL;
+}
+
+//  get state of service key, create it if needed
+static s_service_t *
+s_service_require (fty_mdns_sd_server_t *self, const char *key)
+{
+    s_service_t *service = (s_service_t *) zhash_lookup (self->services, key);
+    if (!service) {
+        service = (s_service_t *) zmalloc (sizeof (s_service_t));
+        service->server = self;
+        service->key = strdup (key);
+        service->coalesce_timer = -1;
+        zhash_insert (self->services, key, service);
+        zhash_freefn (self->services, key, s_service_destroy);
+    }
+    return service;
+}
+
 //free dynamic item
 static void s_destroy_txt(void *arg)
 {
@@ -55,68 +252,259 @@ static void s_destroy_txt(void *arg)
     zstr_free(&value);
 }
 
+//  set one TXT value of the default service, an unchanged value is not
+//  copied again
+static void
+s_set_txt_value(fty_mdns_sd_server_t *self, const char *key, std::string_view value)
+{
+    const char *current = (const char *) zhash_lookup (self->map_txt, key);
+    if (current && value == current) return;
+    char *_value = strndup (value.data (), value.size ());
+    zhash_update (self->map_txt, key, _value);
+    zhash_freefn (self->map_txt, key, s_destroy_txt);
+}
+
 static void
 s_set_txt_record(fty_mdns_sd_server_t *self,const char *key,const char *value)
 {
     if(value==NULL) return;
     log_debug ("s_set_txt_record(%s,%s)",key,value);
-    char *_value = strdup(value);
-    int rv=zhash_insert(self->map_txt,key,_value);
-    if(rv==-1)
-        zhash_update(self->map_txt,key,_value);
-    zhash_freefn(self->map_txt,key,s_destroy_txt);
+    s_set_txt_value (self, key, value);
+}
+
+//  drop the default TXT keys missing from the new set, if there are any
+template <typename Contains>
+static void
+s_prune_txt(fty_mdns_sd_server_t *self, size_t count, Contains contains)
+{
+    if (zhash_size (self->map_txt) <= count) return;
+    zlist_t *keys = zhash_keys (self->map_txt);
+    for (char *key = (char *) zlist_first (keys); key; key = (char *) zlist_next (keys)) {
+        if (!contains (key))
+            zhash_delete (self->map_txt, key);
+    }
+    zlist_destroy (&keys);
 }
 
+//  the default TXT map is updated in place, so that an announcement changing
+//  a few values does not rebuild it
 static void
 s_set_txt_records(fty_mdns_sd_server_t *self, zhash_t * map_txt)
 {
     if(map_txt==NULL) return;
-    if(self->map_txt!=NULL)
-        zhash_destroy (&self->map_txt);
-    self->map_txt = zhash_dup(map_txt);
+    for (char *value = (char *) zhash_first (map_txt); value; value = (char *) zhash_next (map_txt))
+        s_set_txt_value (self, zhash_cursor (map_txt), value);
+    s_prune_txt (self, zhash_size (map_txt), [map_txt](const char *key) {
+        return zhash_lookup (map_txt, key) != NULL;
+    });
 }
 
 static void
-s_set_srv_name(fty_mdns_sd_server_t *self,const char *value)
+s_set_txt_frame(fty_mdns_sd_server_t *self, zframe_t *frame)
 {
-    if(value==NULL) return;
+    TxtFrame txt (frame);
+    if (!txt.valid ()) return;
+    char key [256];     // zhash_pack() keys are at most 255 bytes
+    for (const auto &entry : txt) {
+        memcpy (key, entry.key.data (), entry.key.size ());
+        key [entry.key.size ()] = 0;
+        s_set_txt_value (self, key, entry.value);
+    }
+    s_prune_txt (self, txt.size (), [&txt](const char *key) {
+        std::string_view value;
+        return txt.find (key, value);
+    });
+}
+
+//  replace the string *field by a copy of value, only if it changed;
+//  return true if it did
+static bool
+s_set_field (char **field, std::string_view value)
+{
+    if (*field && value == *field)
+        return false;
     //delete previous dyn value
-    zstr_free (&self->srv_name);
-    char *_value = strdup(value);
-    self->srv_name = _value;
+    zstr_free (field);
+    *field = strndup (value.data (), value.size ());
+    return true;
+}
 
+static bool
+s_set_srv_name(fty_mdns_sd_server_t *self, std::string_view value)
+{
+    bool had_name = (self->srv_name != NULL);
+    if (!s_set_field (&self->srv_name, value))
+        return false;
+    // a name chosen after collisions only stands for the requested one
+    if (had_name)
+        zstr_free (&self->published_name);
+    return true;
+}
+
+static bool
+s_set_srv_port(fty_mdns_sd_server_t *self, std::string_view value)
+{
+    return s_set_field (&self->srv_port, value);
+}
+
+static bool
+s_set_srv_type(fty_mdns_sd_server_t *self, std::string_view value)
+{
+    return s_set_field (&self->srv_type, value);
+}
+
+//  canonical subtype list of an announcement of key: sorted, without
+//  duplicates, with the configured subtypes for the default service;
+//  storage holds it unless stype is canonical already
+static std::string_view
+s_subtypes (fty_mdns_sd_server_t *self, const char *key, std::string_view type, std::string_view stype,
+    std::string &storage)
+{
+    bool extra = self->srv_extra_stypes && streq (key, DEFAULT_SERVICE_KEY);
+    // usual case, one subtype in full: used as is
+    if (!extra && stype.find_first_of (", ") == std::string_view::npos
+    && (stype.empty () || stype.find ("._sub.") != std::string_view::npos))
+        return stype;
+    ServiceSubtypes subtypes = ServiceSubtypes::parse (std::string (stype), std::string (type));
+    if (extra)
+        subtypes.merge (ServiceSubtypes::parse (self->srv_extra_stypes, std::string (type)));
+    storage = subtypes.toString ();
+    return storage;
 }
 
+static bool
+s_set_srv_stype(fty_mdns_sd_server_t *self, std::string_view value)
+{
+    std::string storage;
+    return s_set_field (&self->srv_stype,
+        s_subtypes (self, DEFAULT_SERVICE_KEY, self->srv_type ? self->srv_type : "", value, storage));
+}
+
+//  --------------------------------------------------------------------------
+//  Publisher events into the metrics
+
+static void s_state_save (fty_mdns_sd_server_t *self);
+
+//  the default service established under another name than the requested
+//  one is saved, so that this name is registered again after a restart
 static void
-s_set_srv_port(fty_mdns_sd_server_t *self,const char *value)
+s_set_published_name (fty_mdns_sd_server_t *self, const std::string& name)
 {
-    if(value==NULL) return;
-    //delete previous dyn value
-    zstr_free (&self->srv_port);
-    char *_value = strdup(value);
-    self->srv_port = _value;
+    const char *published = (self->srv_name && name == self->srv_name) ? NULL : name.c_str ();
+    if (published == self->published_name
+    || (published && self->published_name && streq (published, self->published_name)))
+        return;
+    zstr_free (&self->published_name);
+    if (published) {
+        log_info ("%s:\tDefault service published as '%s'", self->name, published);
+        self->published_name = strdup (published);
+    }
+    s_state_save (self);
+}
+
+class s_publisher_observer_t : public MdnsPublisher::Observer {
+public:
+    explicit s_publisher_observer_t (fty_mdns_sd_server_t *server) : _server (server) {}
+
+    void onEstablished (const std::string& key, const std::string& name, int64_t latency_us) override
+    {
+        _server->metrics->commit_latency.record (latency_us);
+        if (key == DEFAULT_SERVICE_KEY)
+            s_set_published_name (_server, name);
+    }
+    void onCollision (const std::string& key) override
+    {
+        _server->metrics->collisions++;
+    }
+    void onReconnect () override
+    {
+        _server->metrics->client_reconnects++;
+    }
+    void onRecovered (int64_t latency_us) override
+    {
+        _server->metrics->recovery.record (latency_us);
+    }
+
+private:
+    fty_mdns_sd_server_t *_server;
+};
+
+//  --------------------------------------------------------------------------
+//  Create the publisher backend given by name (AVAHI or RECORDING)
+
+static MdnsPublisher *
+s_publisher_new (fty_mdns_sd_server_t *self, const char *backend)
+{
+    MdnsPublisher *publisher = NULL;
+    if (!backend || streq (backend, "AVAHI"))
+        publisher = new AvahiWrapper (self->avahi_poll->get ());
+    else
+    if (streq (backend, "RECORDING"))
+        publisher = new RecordingPublisher ();
+    else
+    if (streq (backend, "RESPONDER"))
+        publisher = new MdnsResponder (self->loop);
+    if (publisher) {
+        publisher->setObserver (self->observer);
+        return publisher;
+    }
+    log_error ("%s:\tUnknown publisher backend '%s'", self->name, backend);
+    return NULL;
 }
 
+//  append a discovered service as two frames,
+//  packed definition (key, name, type, domain, host, address, port, subtypes, resolved) and packed TXT
 static void
-s_set_srv_type(fty_mdns_sd_server_t *self,const char *value)
+s_pack_discovered (zmsg_t *msg, const DiscoveredService *service)
 {
-    if(value==NULL) return;
-    //delete previous dyn value
-    zstr_free (&self->srv_type);
-    char *_value = strdup(value);
-    self->srv_type = _value;
+    std::string subtypes;
+    for (const auto &subtype : service->subtypes) {
+        if (!subtypes.empty ()) subtypes += ",";
+        subtypes += subtype;
+    }
+    zhash_t *definition = zhash_new ();
+    zhash_autofree (definition);
+    zhash_insert (definition, "key", (void *) service->key ().c_str ());
+    zhash_insert (definition, "name", (void *) service->name.c_str ());
+    zhash_insert (definition, "type", (void *) service->type.c_str ());
+    zhash_insert (definition, "domain", (void *) service->domain.c_str ());
+    zhash_insert (definition, "host", (void *) service->host.c_str ());
+    zhash_insert (definition, "address", (void *) service->address.c_str ());
+    zhash_insert (definition, "port", (void *) std::to_string (service->port).c_str ());
+    zhash_insert (definition, "subtypes", (void *) subtypes.c_str ());
+    zhash_insert (definition, "resolved", (void *) (service->resolved ? "1" : "0"));
+    zframe_t *frame = zhash_pack (definition);
+    zmsg_append (msg, &frame);
+    zhash_destroy (&definition);
+
+    zhash_t *txt = zhash_new ();
+    for (const auto &it : service->txt)
+        zhash_insert (txt, it.first.c_str (), (void *) it.second.c_str ());
+    frame = zhash_pack (txt);
+    zmsg_append (msg, &frame);
+    zhash_destroy (&txt);
 }
 
+//  publish a change of the discovery cache, journal listener
 static void
-s_set_srv_stype(fty_mdns_sd_server_t *self,const char *value)
+s_discovery_changed (fty_mdns_sd_server_t *self, DiscoveryCache::Change change, const DiscoveredService& service)
 {
-    if(value==NULL) return;
-    //delete previous dyn value
-    zstr_free (&self->srv_stype);
-    char *_value = strdup(value);
-    self->srv_stype = _value;
+    uint64_t seq = self->journal->record (change, service);
+    if (!self->discovery_producer)
+        return;
+    const char *subject = DiscoveryCache::changeName (change);
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, subject);
+    zmsg_addstr (msg, std::to_string (seq).c_str ());
+    s_pack_discovered (msg, &service);
+    if (mlm_client_send (self->client, subject, &msg) != 0)
+        log_error ("%s:\tFailed to publish %s of %s", self->name, subject, service.key ().c_str ());
+    zmsg_destroy (&msg);
 }
 
+static void
+s_resolved (fty_mdns_sd_server_t *self, const std::string& key);
+
 //  --------------------------------------------------------------------------
 //  Create a new fty_mdns_sd_server
 fty_mdns_sd_server_t *
@@ -132,8 +520,35 @@ fty_mdns_sd_server_new (const char* name)
     }
     self->name    = strdup (name);
     self->client  = mlm_client_new();
-    self->service = new AvahiWrapper(); // service mDNS-SD
+    self->loop    = zloop_new();
+    self->avahi_poll = new AvahiZloopPoll(self->loop);
+    self->metrics = new AnnounceMetrics();
+    self->observer = new s_publisher_observer_t (self);
+    self->metrics_timer = -1;
+    self->service = s_publisher_new (self, "AVAHI"); // service mDNS-SD
     self->map_txt = zhash_new();
+    self->txt_budget = new TxtBudget();
+    self->services = zhash_new();
+    self->info_timer = -1;
+    self->state_timer = -1;
+    self->discovered = new DiscoveryCache();
+    self->browser = new AvahiBrowser(self->avahi_poll->get(), self->discovered);
+    self->discovery_browse = true;
+    self->journal = new DiscoveryJournal();
+    self->waiting_gets = zlist_new();
+    self->resolve_wait = RESOLVE_WAIT_DEFAULT;
+    self->proxies = zhash_new();
+    zhash_autofree (self->proxies);
+    self->proxy_commits = new CommitScheduler();
+    self->proxy_timer = -1;
+    self->jitter = new AnnounceJitter();
+    self->start_timer = -1;
+    self->discovered->setListener ([self](DiscoveryCache::Change change, const DiscoveredService& service) {
+        s_discovery_changed (self, change, service);
+    });
+    self->browser->setResolvedListener ([self](const std::string& key) {
+        s_resolved (self, key);
+    });
 
     //do minimal initialization
     s_set_txt_record(self,"uuid",
@@ -150,16 +565,57 @@ fty_mdns_sd_server_destroy (fty_mdns_sd_server_t **self_p)
     assert (self_p);
     if (*self_p) {
         fty_mdns_sd_server_t *self = *self_p;
+        // a delayed save is done now, while the announcement is still there
+        if (self->state_timer != -1)
+            s_state_save (self);
         //  Free class properties here
         zstr_free (&self->name);
         zstr_free (&self->srv_name);
         zstr_free (&self->srv_type);
         zstr_free (&self->srv_stype);
+        zstr_free (&self->srv_extra_stypes);
         zstr_free (&self->srv_port);
+        zstr_free (&self->published_name);
         zstr_free (&self->fty_info_command);
+        zstr_free (&self->info_uuid);
+        zstr_free (&self->state_file);
+        zstr_free (&self->endpoint);
+        zstr_free (&self->proxy_types);
+        zstr_free (&self->proxy_srv_type);
+        zstr_free (&self->proxy_srv_port);
+        if (self->proxy_timer != -1)
+            zloop_timer_end (self->loop, self->proxy_timer);
+        if (self->start_timer != -1)
+            zloop_timer_end (self->loop, self->start_timer);
+        if (self->metrics_timer != -1)
+            zloop_timer_end (self->loop, self->metrics_timer);
+        mlm_client_destroy (&self->metrics_client);
+        if (self->info_timer != -1)
+            zloop_timer_end (self->loop, self->info_timer);
+        while (zlist_size (self->waiting_gets)) {
+            s_waiting_get_t *waiting = (s_waiting_get_t *) zlist_pop (self->waiting_gets);
+            s_waiting_get_destroy (&waiting);
+        }
+        zlist_destroy (&self->waiting_gets);
+        // before the loop, pending timers are ended there
+        zhash_destroy (&self->services);
+        zhash_destroy (&self->proxies);
         mlm_client_destroy (&self->client);
         zhash_destroy (&self->map_txt);
+        // avahi client releases its watches through the poll api
         delete self->service;
+        delete self->observer;
+        delete self->metrics;
+        delete self->txt_budget;
+        delete self->browser;
+        delete self->listener;
+        delete self->discovered;
+        delete self->links;
+        delete self->journal;
+        delete self->proxy_commits;
+        delete self->jitter;
+        delete self->avahi_poll;
+        zloop_destroy (&self->loop);
         //  Free object itself
         free (self);
         *self_p = NULL;
@@ -167,321 +623,2322 @@ fty_mdns_sd_server_destroy (fty_mdns_sd_server_t **self_p)
 }
 
 //  --------------------------------------------------------------------------
-//  get info from fty-info agent
+//  keep the published default announcement for the next start
 
-static int
-s_poll_fty_info(fty_mdns_sd_server_t *self)
+static void
+s_state_save (fty_mdns_sd_server_t *self)
 {
-    assert (self);
-
-    zmsg_t *send = zmsg_new ();
-    zmsg_addstr (send, self->fty_info_command);
-    zuuid_t *uuid = zuuid_new ();
-    zmsg_addstr (send, zuuid_str_canonical (uuid));
-    log_debug ("requesting fty-info ..");
-    if(mlm_client_sendto(self->client,"fty-info","info", NULL, 1000, &send)!=0)
-    {
-        log_error("info: client->sendto (address = '%s') failed.", "fty-info");
-        zmsg_destroy(&send);
-        zuuid_destroy(&uuid);
-        return -2;
-    }
-    zmsg_destroy(&send);
-
-    zpoller_t* poller = zpoller_new(mlm_client_msgpipe(self->client), NULL);
-    zmsg_t *resp = (poller && zpoller_wait(poller, 5000)) ? mlm_client_recv(self->client) : NULL;
-    zpoller_destroy(&poller);
-    if (!resp)
-    {
-        log_error ("info: client->recv (timeout = '5') returned NULL");
-        zuuid_destroy(&uuid);
-        return -3;
-    }
-
-    char *zuuid_or_error = zmsg_popstr (resp);
-    assert(strneq (zuuid_or_error, "ERROR"));
-    //TODO : check UUID if you think it is important
-    zstr_free(&zuuid_or_error);
-
-    zuuid_destroy(&uuid);
-
-    char *cmd = zmsg_popstr (resp);
-    if(!cmd || strneq (cmd, "INFO")) {
-        log_error ("%s: not received INFO command (%s)", __func__, cmd);
-        zstr_free (&cmd);
-        zmsg_destroy(&resp);
-        return -4;
-    }
-    char *srv_name  = zmsg_popstr (resp);
-    char *srv_type  = zmsg_popstr (resp);
-    char *srv_stype = zmsg_popstr (resp);
-    char *srv_port  = zmsg_popstr (resp);
-
-    s_set_srv_name(self,srv_name);
-    s_set_srv_type(self,srv_type);
-    s_set_srv_stype(self,srv_stype);
-    s_set_srv_port(self,srv_port);
-
-    zframe_t *frame_infos = zmsg_next (resp);
-    zhash_t *infos = zhash_unpack(frame_infos);
-    s_set_txt_records(self,infos);
-
-    zhash_destroy(&infos);
-    zframe_destroy(&frame_infos);
-    zstr_free (&cmd);
-    zstr_free (&srv_name);
-    zstr_free (&srv_type);
-    zstr_free (&srv_stype);
-    zstr_free (&srv_port);
-    zmsg_destroy(&resp);
-    zmsg_destroy(&send);
+    if (self->state_timer != -1)
+        zloop_timer_end (self->loop, self->state_timer);
+    self->state_timer = -1;
+    if (!self->state_file)
+        return;
+    if (announce_state_save (self->state_file,
+            self->srv_name, self->srv_type, self->srv_stype, self->srv_port, self->map_txt,
+            self->published_name) == 0)
+        log_debug ("fty-mdns-sd-server: announcement saved to %s", self->state_file);
+}
 
+static int
+s_state_save_delayed (zloop_t *loop, int timer_id, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    self->state_timer = -1;    // one shot timer, already gone
+    s_state_save (self);
     return 0;
 }
 
-//  --------------------------------------------------------------------------
-//  process pipe message
-//  return true means continue, false means TERM
-bool static
-s_handle_pipe(fty_mdns_sd_server_t* self, zmsg_t **message_p)
+//  TXT updates may come every few seconds: they are saved once per
+//  STATE_SAVE_DELAY at most, a restart only misses the last ones until
+//  fty-info answers
+static void
+s_state_save_later (fty_mdns_sd_server_t *self)
 {
-    if (! message_p || ! *message_p) return true;
-    zmsg_t *message = *message_p;
+    if (self->state_file && self->state_timer == -1)
+        self->state_timer = zloop_timer (self->loop, STATE_SAVE_DELAY, 1, s_state_save_delayed, self);
+}
 
-    char *command = zmsg_popstr (message);
-    if (!command) {
-        zmsg_destroy (message_p);
-        log_warning ("Empty command.");
-        return true;
-    }
-    if (streq(command, "$TERM")) {
-        log_info ("Got $TERM");
-        zmsg_destroy (message_p);
-        zstr_free (&command);
-        return false;
+//  TXT records of service key within the budget, the keys beyond it are
+//  published by the secondary instance <key>/more, or dropped
+static void
+s_set_txt_budgeted (fty_mdns_sd_server_t *self, const char *key,
+    std::string_view name, std::string_view type, std::string_view port, zframe_t *txt)
+{
+    TxtFrame frame (txt);
+    std::string more = std::string (key) + TXT_MORE_SUFFIX;
+    if (self->txt_budget->fits (frame)) {
+        // usual case, the frame is used as is
+        self->service->setTxtRecords (key, frame);
+        if (self->service->hasService (more))
+            self->service->removeService (more);
+        return;
     }
-    else
-    if (streq (command, "CONNECT")) {
-        char *endpoint = zmsg_popstr (message);
-        if (!endpoint)
-            log_error ("%s:\tMissing endpoint", self->name);
-        assert (endpoint);
-        int r = mlm_client_connect (self->client, endpoint, 5000, self->name);
-        if (r == -1)
-            log_error ("%s:\tConnection to endpoint '%s' failed", self->name, endpoint);
-        log_debug("fty-mdns-sd-server: CONNECT %s/%s",endpoint,self->name);
-        zstr_free (&endpoint);
+    map_string_t primary, secondary;
+    size_t dropped = self->txt_budget->split (frame, primary, secondary);
+    self->metrics->txt_keys_moved += secondary.size ();
+    self->metrics->txt_keys_dropped += dropped;
+    log_warning ("%s:\tTXT of %s is %zu bytes, budget %zu: %zu keys moved, %zu dropped",
+        self->name, key, TxtBudget::wireSize (frame), self->txt_budget->bytes, secondary.size (), dropped);
+    self->service->setTxtRecords (key, primary);
+    if (secondary.empty ()) {
+        if (self->service->hasService (more))
+            self->service->removeService (more);
+        return;
     }
-    else
-    if (streq (command, "CONSUMER")) {
-        char *stream = zmsg_popstr (message);
-        char *pattern = zmsg_popstr (message);
-        if (stream && pattern) {
-            log_debug("fty-mdns-sd-server: CONSUMER [%s,%s]",
-                    stream,pattern) ;
-            int r = mlm_client_set_consumer (self->client, stream, pattern);
-            if (r == -1) {
-                log_error ("%s:\tSet consumer to '%s' with pattern '%s' failed", self->name, stream, pattern);
-            }
-        } else {
-            log_error ("%s:\tMissing params in CONSUMER command", self->name);
+    // same type and port, no subtype: not found by subtype browses
+    self->service->setService (more, std::string (name) + TXT_MORE_NAME, std::string (type), "", std::string (port));
+    self->service->setTxtRecords (more, secondary);
+    self->service->update (more);
+}
+
+static void s_proxy_arm (fty_mdns_sd_server_t *self);
+
+static int
+s_start_jittered (zloop_t *loop, int timer_id, void *arg);
+
+//  register the default service as currently defined, with the ones added
+//  before; the first time, after the start jitter
+static void
+s_start_default (fty_mdns_sd_server_t *self)
+{
+    if (self->jitter->enabled () && !self->start_jittered) {
+        if (self->start_timer == -1) {
+            int64_t delay = self->jitter->next ();
+            log_info ("%s:\tFirst announcement in %" PRIi64 " ms", self->name, delay);
+            self->metrics->updates_jittered++;
+            self->start_timer = zloop_timer (self->loop, size_t (delay), 1, s_start_jittered, self);
         }
-        zstr_free (&stream);
-        zstr_free (&pattern);
-    }
-    else
-    if (streq (command, "SET-DEFAULT-SERVICE")) {
-         //set new ones
-        char *name  = zmsg_popstr (message);
-        char *type  = zmsg_popstr (message);
-        char *stype = zmsg_popstr (message);
-        char *port  = zmsg_popstr (message);
-        log_debug("fty-mdns-sd-server: SET-DEFAULT-SERVICE [%s,%s,%s,%s]",
-            name,type,stype,port) ;
-        s_set_srv_name(self,name);
-        s_set_srv_type(self,type);
-        s_set_srv_stype(self,stype);
-        s_set_srv_port(self,port);
-        zstr_free(&name);
-        zstr_free(&type);
-        zstr_free(&stype);
-        zstr_free(&port);
-    }
-    else
-    if (streq (command, "SET-DEFAULT-TXT")) {
-        char *key   = zmsg_popstr (message);
-        char *value = zmsg_popstr (message);
-        log_debug("fty-mdns-sd-server: SET-DEFAULT-TXT %s=%s",
-            key,value) ;
-         s_set_txt_record(self,key,value);
-        zstr_free(&key);
-        zstr_free(&value);
+        // registered as defined when the timer fires
+        return;
     }
-    else
-    if (streq (command, "DO-DEFAULT-ANNOUNCE")) {
-        //free previous value
-        zstr_free (&self->fty_info_command);
-        //get info from fty-info
-        self->fty_info_command = zmsg_popstr (message);
-        log_debug("fty-mdns-sd-server: DO-DEFAULT-ANNOUNCE %s",
-                self->fty_info_command);
-        int rv = -1;
-        int tries = 3;
-        while (tries-- >= 0) {
-            rv=s_poll_fty_info(self);
-            if (rv == 0)
-                break;
-            // Wait 5 seconds before retrying
-            if (tries == 0)
-                zclock_sleep (5000);
-        }
-        // sanity check, this should trigger a service abort then restart
-        // in the worst case, if we did not succeeded after 3 tries
-        assert(rv==0);
-        self->service->setServiceDefinition(
-            self->srv_name,
-            self->srv_type,
-            self->srv_stype,
-            self->srv_port);
-        //set all txt properties
-        self->service->setTxtRecords (self->map_txt);
-        self->service->start();
+    self->service->setService(
+        DEFAULT_SERVICE_KEY,
+        self->srv_name,
+        self->srv_type,
+        self->srv_stype,
+        self->srv_port);
+    if (self->published_name)
+        self->service->setPublishedName (DEFAULT_SERVICE_KEY, self->published_name);
+    //set all txt properties
+    zframe_t *txt = zhash_pack (self->map_txt);
+    s_set_txt_budgeted (self, DEFAULT_SERVICE_KEY, self->srv_name, self->srv_type, self->srv_port, txt);
+    zframe_destroy (&txt);
+    self->started = (self->service->start() == 0);
+    if (self->started) {
+        s_service_require (self, DEFAULT_SERVICE_KEY)->fingerprint = announce_fingerprint (
+            self->srv_name, self->srv_type, self->srv_stype, self->srv_port, self->map_txt);
+        // proxied devices queued meanwhile
+        s_proxy_arm (self);
     }
-    else
-        log_warning ("%s:\tUnkown API command=%s, ignoring",
-                self->name, command);
-    zstr_free (&command);
-    zmsg_destroy (&message);
-    return true;
 }
-//  --------------------------------------------------------------------------
-//  process message from ANNOUNCE stream
-void static
-s_handle_stream(fty_mdns_sd_server_t* self, zmsg_t **message_p)
-{
-    zmsg_t *message = *message_p;
-    char *cmd = zmsg_popstr (message);
 
-    if (cmd) {
-        if (streq (cmd, "INFO")) {
-            // this suppose to be an update, service must be created already
-            char *srv_name = zmsg_popstr (message);
-            char *srv_type  = zmsg_popstr (message);
-            char *srv_stype = zmsg_popstr (message);
-            char *srv_port  = zmsg_popstr (message);
-
-            log_debug("fty-mdns-sd-server: new ANNOUNCEMENT from %s", srv_name);
-
-            zframe_t *infosframe = zmsg_pop (message);
-            zhash_t *infos = zhash_unpack (infosframe);
-            if (srv_name && srv_type && srv_stype && srv_port && infos) {
-                s_set_srv_name (self, srv_name);
-                s_set_srv_type (self, srv_type);
-                s_set_srv_stype (self, srv_stype);
-                s_set_srv_port (self, srv_port);
-                self->service->setTxtRecords (infos);
-                self->service->update ();
-            } else {
-                log_error ("Malformed IPC message received");
-            }
-            zhash_destroy (&infos);
-            zframe_destroy (&infosframe);
-            zstr_free(&srv_type);
-            zstr_free(&srv_stype);
-            zstr_free(&srv_port);
-            zstr_free (&srv_name);
-        }
-        else {
-            log_error ("Unknown command %s", cmd);
-        }
-        zstr_free (&cmd);
-    }
-    zmsg_destroy (message_p);
+static int
+s_start_jittered (zloop_t *loop, int timer_id, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    self->start_timer = -1;    // one shot timer, already gone
+    self->start_jittered = true;
+    s_start_default (self);
+    if (self->started)
+        s_state_save (self);
+    return 0;
 }
 
 //  --------------------------------------------------------------------------
-//  process message from MAILBOX
+//  push an announcement to the publisher
 
-void static
-s_handle_mailbox(fty_mdns_sd_server_t* self,zmsg_t **message_p)
+static void
+s_apply_announce (fty_mdns_sd_server_t *self, s_service_t *service,
+    const s_announce_view_t *announce, uint64_t fingerprint)
 {
-    //nothing to do for now
-    zmsg_destroy (message_p);
+    bool defined = false;    // definition of the default service changed
+    if (streq (service->key, DEFAULT_SERVICE_KEY)) {
+        defined |= s_set_srv_name (self, announce->name);
+        defined |= s_set_srv_type (self, announce->type);
+        defined |= s_set_srv_stype (self, announce->stype);
+        defined |= s_set_srv_port (self, announce->port);
+    }
+    // only this service is touched, the other ones are left as is
+    self->service->setService (service->key, std::string (announce->name),
+        std::string (announce->type), std::string (announce->stype), std::string (announce->port));
+    self->service->setServiceHost (service->key, std::string (announce->host), std::string (announce->address));
+    // TXT records are built straight from the frame, if within the budget
+    s_set_txt_budgeted (self, service->key, announce->name, announce->type, announce->port, announce->txt);
+    self->service->update (service->key);
+    service->fingerprint = fingerprint;
+    self->metrics->updates_applied++;
+    if (streq (service->key, DEFAULT_SERVICE_KEY)) {
+        s_set_txt_frame (self, announce->txt);
+        if (defined)
+            s_state_save (self);
+        else
+            s_state_save_later (self);
+    }
 }
 
-//  --------------------------------------------------------------------------
-//  Create a new fty_mdns_sd_server
+static int
+s_flush_pending (zloop_t *loop, int timer_id, void *arg)
+{
+    s_service_t *service = (s_service_t *) arg;
+    service->coalesce_timer = -1;  // one shot timer, already gone
+    if (service->pending.txt) {
+        log_debug ("fty-mdns-sd-server: flush pending ANNOUNCEMENT of %s", service->key);
+        s_announce_view_t pending = s_announce_view_of (&service->pending);
+        s_apply_announce (service->server, service, &pending, service->pending_fingerprint);
+    }
+    s_drop_pending (service);
+    return 0;
+}
 
-void
-fty_mdns_sd_server (zsock_t *pipe, void *args)
+//  process an announcement of service key, viewed in the message it came
+//  in: nothing is copied unless it is kept pending
+static void
+s_announce (fty_mdns_sd_server_t *self, const char *key, const s_announce_view_t *viewed)
 {
-    char*name=(char*) args;
-    fty_mdns_sd_server_t *self = fty_mdns_sd_server_new(name);
-    assert (self);
+    s_service_t *service = s_service_require (self, key);
+    // same subtypes in another order are the same announcement
+    std::string storage;
+    s_announce_view_t canonical = *viewed;
+    canonical.stype = s_subtypes (self, key, viewed->type, viewed->stype, storage);
+    const s_announce_view_t *announce = &canonical;
+    uint64_t fingerprint = announce_fingerprint (
+        announce->name, announce->type, announce->stype, announce->port, TxtFrame (announce->txt));
+    // the same large update may reach a whole fleet at once (e.g. after an
+    // upgrade): it goes out after the jitter
+    bool large = self->started && self->jitter->enabled () && self->jitter_txt_bytes > 0
+        && TxtBudget::wireSize (TxtFrame (announce->txt)) >= self->jitter_txt_bytes;
 
-    zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (self->client), NULL);
-    assert (poller);
+    if ((self->coalesce_window <= 0 && !large) || !self->started) {
+        if (self->started && fingerprint == service->fingerprint) {
+            // periodic re-publication of the same data, nothing to do
+            self->metrics->updates_suppressed++;
+            log_debug ("fty-mdns-sd-server: ANNOUNCEMENT of %s unchanged, suppressed", key);
+        }
+        else
+            s_apply_announce (self, service, announce, fingerprint);
+    }
+    else {
+        bool had_pending = (service->pending.txt != NULL);
+        if (had_pending)
+            self->metrics->updates_coalesced++;
+        if (fingerprint == service->fingerprint) {
+            // latest state is the published one, forget what was pending
+            self->metrics->updates_suppressed++;
+            s_drop_pending (service);
+        }
+        else {
+            int64_t now = zclock_mono ();
+            if (!had_pending)
+                service->pending_since = service->pending_until = now;
+            if (large && service->pending_until <= service->pending_since) {
+                service->pending_until = now + self->jitter->next ();
+                self->metrics->updates_jittered++;
+            }
+            s_drop_pending (service);
+            s_announce_copy (&service->pending, announce);
+            service->pending_fingerprint = fingerprint;
+
+            // debounce on the window, but never beyond max delay, nor
+            // before the end of the jitter
+            int64_t delay = service->pending_since + self->coalesce_max_delay - now;
+            if (delay > self->coalesce_window)
+                delay = self->coalesce_window;
+            if (delay < service->pending_until - now)
+                delay = service->pending_until - now;
+            if (delay < 0)
+                delay = 0;
+            service->coalesce_timer = zloop_timer (self->loop, size_t (delay), 1, s_flush_pending, service);
+        }
+    }
+}
+
+//  withdraw service key
+static void
+s_remove_service (fty_mdns_sd_server_t *self, const char *key)
+{
+    if (streq (key, DEFAULT_SERVICE_KEY)) {
+        log_warning ("%s:\tDefault service cannot be removed", self->name);
+        return;
+    }
+    self->service->removeService (key);
+    self->service->removeService (std::string (key) + TXT_MORE_SUFFIX);
+    self->proxy_commits->cancel (key);
+    zhash_delete (self->proxies, key);
+    zhash_delete (self->services, key);
+}
+
+//  view name, type, subtype, port and TXT fields of a message, from field
+//  first on; return false if a field is missing or the TXT set is malformed
+static bool
+s_announce_view (const MsgView &fields, size_t first, s_announce_view_t *announce)
+{
+    if (!fields.has (first + 5))
+        return false;
+    announce->name  = fields.str (first);
+    announce->type  = fields.str (first + 1);
+    announce->stype = fields.str (first + 2);
+    announce->port  = fields.str (first + 3);
+    // kept packed, it is only decoded if the announcement is applied
+    announce->txt   = fields.frame (first + 4);
+    return TxtFrame (announce->txt).valid ();
+}
+
+//  pack the "key=value" TXT fields of a pipe message, from field first on
+static zframe_t *
+s_pack_txt_pairs (const MsgView &fields, size_t first)
+{
+    zhash_t *txt = zhash_new ();
+    zhash_autofree (txt);
+    char pair [512];
+    for (size_t i = first; i < fields.size (); i++) {
+        if (!fields.cstr (i, pair, sizeof (pair)))
+            continue;
+        char *eq = strchr (pair, '=');
+        if (eq) {
+            *eq = 0;
+            zhash_update (txt, pair, eq + 1);
+        }
+    }
+    zframe_t *frame = zhash_pack (txt);
+    zhash_destroy (&txt);
+    return frame;
+}
+
+//  --------------------------------------------------------------------------
+//  Proxied devices: the devices of the ASSETS stream are announced on their
+//  behalf, each one as service "proxy/<asset name>" pointing to its own host
+//  name and address. An announcement is kept pending until CommitScheduler
+//  releases it, so that an inventory showing up at once (agent start,
+//  REPUBLISH) is probed a few devices at a time.
+
+#define PROXY_PREFIX "proxy/"
+
+static int
+s_proxy_release (zloop_t *loop, int timer_id, void *arg);
+
+//  arm the release timer for the next queued device, if not armed yet
+static void
+s_proxy_arm (fty_mdns_sd_server_t *self)
+{
+    // nothing goes out before the publisher runs
+    if (self->proxy_timer != -1 || !self->started)
+        return;
+    int64_t delay = self->proxy_commits->nextDelay (zclock_mono ());
+    if (delay < 0)
+        return;
+    self->proxy_timer = zloop_timer (self->loop, size_t (delay), 1, s_proxy_release, self);
+}
+
+static int
+s_proxy_release (zloop_t *loop, int timer_id, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    self->proxy_timer = -1;    // one shot timer, already gone
+    std::vector<std::string> due;
+    self->proxy_commits->take (zclock_mono (), due);
+    for (const auto &key : due) {
+        s_service_t *service = (s_service_t *) zhash_lookup (self->services, key.c_str ());
+        if (!service || !service->pending.txt)
+            continue;
+        s_announce_view_t pending = s_announce_view_of (&service->pending);
+        s_apply_announce (self, service, &pending, service->pending_fingerprint);
+        s_drop_pending (service);
+    }
+    s_proxy_arm (self);
+    return 0;
+}
+
+//  queue the announcement of a proxied device, unless it is the published one
+static void
+s_proxy_announce (fty_mdns_sd_server_t *self, const char *key, const s_announce_view_t *viewed)
+{
+    s_service_t *service = s_service_require (self, key);
+    std::string storage;
+    s_announce_view_t announce = *viewed;
+    announce.stype = s_subtypes (self, key, viewed->type, viewed->stype, storage);
+    uint64_t fingerprint = announce_fingerprint (
+        announce.name, announce.type, announce.stype, announce.port, TxtFrame (announce.txt));
+    fingerprint = announce_fingerprint (announce_fingerprint (fingerprint, announce.host), announce.address);
+
+    if (service->pending.txt)
+        self->metrics->updates_coalesced++;
+    if (fingerprint == service->fingerprint) {
+        self->metrics->updates_suppressed++;
+        s_drop_pending (service);
+        self->proxy_commits->cancel (key);
+        return;
+    }
+    s_announce_copy (&service->pending, &announce);
+    service->pending_fingerprint = fingerprint;
+    self->proxy_commits->schedule (key);
+    s_proxy_arm (self);
+}
+
+//  true if list, comma separated, holds item
+static bool
+s_list_has (const char *list, std::string_view item)
+{
+    if (!list || item.empty ())
+        return false;
+    std::string_view rest (list);
+    while (!rest.empty ()) {
+        size_t comma = rest.find (',');
+        if (rest.substr (0, comma) == item)
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        rest.remove_prefix (comma + 1);
+    }
+    return false;
+}
+
+//  mDNS host name of a device: its asset name, lower case, letters, digits
+//  and '-' only, in .local
+static std::string
+s_proxy_host (const char *asset)
+{
+    std::string host;
+    for (const char *c = asset; *c; c++)
+        host += isalnum ((unsigned char) *c) ? char (tolower ((unsigned char) *c)) : '-';
+    return host + ".local";
+}
+
+//  announce, update or withdraw the device of an ASSETS message
+static void
+s_handle_asset (fty_mdns_sd_server_t *self, fty_proto_t *asset)
+{
+    const char *name = fty_proto_name (asset);
+    const char *operation = fty_proto_operation (asset);
+    if (!name || !*name || !operation)
+        return;
+    std::string key = std::string (PROXY_PREFIX) + name;
+    const char *subtype = fty_proto_aux_string (asset, "subtype", "");
+    const char *address = fty_proto_ext_string (asset, "ip.1", "");
+    bool wanted = self->proxy_srv_type
+        && !streq (operation, FTY_PROTO_ASSET_OP_DELETE)
+        && !streq (operation, FTY_PROTO_ASSET_OP_RETIRE)
+        && streq (fty_proto_aux_string (asset, "status", "active"), "active")
+        && s_list_has (self->proxy_types, subtype)
+        && *address;
+    if (!wanted) {
+        // not (or no longer) proxied: gone, retired, filtered out or unreachable
+        if (zhash_lookup (self->proxies, key.c_str ())) {
+            log_debug ("fty-mdns-sd-server: proxy of %s withdrawn (%s)", name, operation);
+            s_remove_service (self, key.c_str ());
+        }
+        return;
+    }
+
+    zhash_t *txt = zhash_new ();
+    zhash_insert (txt, "txtvers", (void *) "1.0.0");
+    zhash_insert (txt, "asset", (void *) name);
+    zhash_insert (txt, "type", (void *) subtype);
+    const char *ext_keys [][2] = {
+        { "uuid", "uuid" }, { "name", "name" }, { "manufacturer", "manufacturer" },
+        { "model", "model" }, { "serial_no", "serial" } };
+    for (const auto &ext : ext_keys) {
+        const char *value = fty_proto_ext_string (asset, ext[0], NULL);
+        if (value && *value)
+            zhash_insert (txt, ext[1], (void *) value);
+    }
+    zframe_t *frame = zhash_pack (txt);
+    zhash_destroy (&txt);
+
+    std::string host = s_proxy_host (name);
+    s_announce_view_t announce = {
+        fty_proto_ext_string (asset, "name", name), self->proxy_srv_type, subtype, self->proxy_srv_port,
+        frame, host, address };
+    log_debug ("fty-mdns-sd-server: proxy of %s (%s) at %s", name, operation, address);
+    zhash_update (self->proxies, key.c_str (), (void *) subtype);
+    s_proxy_announce (self, key.c_str (), &announce);
+    zframe_destroy (&frame);
+}
+
+//  message of the ASSETS stream
+static void
+s_handle_assets (fty_mdns_sd_server_t *self, zmsg_t **message_p)
+{
+    fty_proto_t *asset = fty_proto_decode (message_p);
+    if (asset && fty_proto_id (asset) == FTY_PROTO_ASSET)
+        s_handle_asset (self, asset);
+    else
+        log_warning ("%s:\tUnexpected message on %s", self->name, FTY_PROTO_STREAM_ASSETS);
+    fty_proto_destroy (&asset);
+}
+
+//  proxied asset subtypes changed: withdraw the devices no longer listed,
+//  then ask fty-asset to publish the inventory again
+static void
+s_set_proxy (fty_mdns_sd_server_t *self, const char *types, const char *srv_type, const char *srv_port)
+{
+    zstr_free (&self->proxy_types);
+    zstr_free (&self->proxy_srv_type);
+    zstr_free (&self->proxy_srv_port);
+    if (types && *types && srv_type && *srv_type && srv_port) {
+        self->proxy_types = strdup (types);
+        self->proxy_srv_type = strdup (srv_type);
+        self->proxy_srv_port = strdup (srv_port);
+    }
+    std::vector<std::string> withdrawn;
+    for (char *subtype = (char *) zhash_first (self->proxies); subtype; subtype = (char *) zhash_next (self->proxies)) {
+        if (!self->proxy_srv_type || !s_list_has (self->proxy_types, subtype))
+            withdrawn.push_back (zhash_cursor (self->proxies));
+    }
+    for (const auto &key : withdrawn)
+        s_remove_service (self, key.c_str ());
+    if (!self->proxy_srv_type)
+        return;
+    if (!mlm_client_connected (self->client)) {
+        log_error ("%s:\tNot connected, no assets to proxy", self->name);
+        return;
+    }
+    int r = mlm_client_set_consumer (self->client, FTY_PROTO_STREAM_ASSETS, ".*");
+    if (r == 0)
+        r = mlm_client_sendtox (self->client, "asset-agent", "REPUBLISH", "$all", NULL);
+    if (r != 0)
+        log_error ("%s:\tCannot get the assets to proxy from %s", self->name, FTY_PROTO_STREAM_ASSETS);
+}
+
+//  --------------------------------------------------------------------------
+//  fty-info bootstrap: INFO is requested on the mailbox and the reply is
+//  handled in the loop like any other message. Without a reply the request
+//  is sent again with a new UUID, waiting twice longer each time.
+
+static int
+s_info_retry (zloop_t *loop, int timer_id, void *arg);
+
+static void
+s_info_request (fty_mdns_sd_server_t *self)
+{
+    zuuid_t *uuid = zuuid_new ();
+    zstr_free (&self->info_uuid);
+    self->info_uuid = strdup (zuuid_str_canonical (uuid));
+    zuuid_destroy (&uuid);
+
+    zmsg_t *send = zmsg_new ();
+    zmsg_addstr (send, self->fty_info_command);
+    zmsg_addstr (send, self->info_uuid);
+    self->metrics->info_requests++;
+    self->info_sent = zclock_usecs ();
+    log_debug ("requesting fty-info (%s), next try in %d ms", self->info_uuid, self->info_retry);
+    if (mlm_client_sendto (self->client, "fty-info", "info", NULL, 1000, &send) != 0)
+        log_error ("info: client->sendto (address = '%s') failed.", "fty-info");
+    zmsg_destroy (&send);
+
+    self->info_timer = zloop_timer (self->loop, size_t (self->info_retry), 1, s_info_retry, self);
+}
+
+static int
+s_info_retry (zloop_t *loop, int timer_id, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    self->info_timer = -1;  // one shot timer, already gone
+    log_warning ("%s:\tNo reply from fty-info after %d ms, retrying", self->name, self->info_retry);
+    self->info_retry = std::min (self->info_retry * 2, INFO_RETRY_MAX);
+    s_info_request (self);
+    return 0;
+}
+
+static void
+s_info_start (fty_mdns_sd_server_t *self)
+{
+    if (self->info_timer != -1)
+        zloop_timer_end (self->loop, self->info_timer);
+    self->info_timer = -1;
+    self->info_retry = INFO_RETRY_MIN;
+    s_info_request (self);
+}
+
+//  INFO reply of the pending request: uuid/INFO/name/type/subtype/port/txt
+static void
+s_handle_info_reply (fty_mdns_sd_server_t *self, const MsgView &fields)
+{
+    s_announce_view_t announce;
+    if (!fields.is (1, "INFO") || !s_announce_view (fields, 2, &announce)) {
+        // keep waiting, the retry timer is still armed
+        log_error ("%s:\tInvalid reply from fty-info (%.*s)", self->name,
+            int (fields.str (1).size ()), fields.str (1).data ());
+        return;
+    }
+    zstr_free (&self->info_uuid);
+    self->metrics->info_rtt.record (zclock_usecs () - self->info_sent);
+    if (self->info_timer != -1)
+        zloop_timer_end (self->loop, self->info_timer);
+    self->info_timer = -1;
+    log_info ("%s:\tGot INFO from fty-info", self->name);
+
+    if (self->started) {
+        // already published, only what changed is applied
+        s_announce (self, DEFAULT_SERVICE_KEY, &announce);
+        return;
+    }
+    s_set_srv_name (self, announce.name);
+    s_set_srv_type (self, announce.type);
+    s_set_srv_stype (self, announce.stype);
+    s_set_srv_port (self, announce.port);
+    s_set_txt_frame (self, announce.txt);
+
+    s_start_default (self);
+    if (self->started)
+        s_state_save (self);
+}
+
+//  interfaces came, went or were renamed: policies are resolved again
+
+static int
+s_links_changed (zloop_t *loop, zmq_pollitem_t *item, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    if (self->links->drain ()) {
+        log_debug ("fty-mdns-sd-server: links changed");
+        self->service->refreshInterfaces ();
+        if (self->listener)
+            self->listener->refreshInterfaces ();
+    }
+    return 0;
+}
+
+//  start watching links, once
+static void
+s_watch_links (fty_mdns_sd_server_t *self)
+{
+    if (self->links)
+        return;
+    self->links = new LinkMonitor ();
+    if (self->links->open () != 0) {
+        log_warning ("%s:\tInterfaces are only resolved at startup", self->name);
+        return;
+    }
+    self->links_item = { NULL, self->links->fd (), ZMQ_POLLIN, 0 };
+    zloop_poller (self->loop, &self->links_item, s_links_changed, self);
+}
+
+//  end of SIMULATE-DAEMON-RESTART, one shot timer
+
+static int
+s_daemon_back (zloop_t *loop, int timer_id, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    RecordingPublisher *recorder = dynamic_cast<RecordingPublisher *> (self->service);
+    if (recorder)
+        recorder->daemonBack ();
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  metrics of the announce pipeline and of the discovery resolvers, caller destroys the hash
+
+static zhash_t *
+s_metrics_snapshot (fty_mdns_sd_server_t *self)
+{
+    zhash_t *snapshot = self->metrics->snapshot ();
+    const ResolverPool &resolvers = self->browser->resolvers ();
+    const ResolverPool::Stats &stats = resolvers.stats ();
+    zhash_update (snapshot, "resolver_queue_depth", (void *) std::to_string (resolvers.queued ()).c_str ());
+    zhash_update (snapshot, "resolver_queue_max", (void *) std::to_string (stats.queueMax).c_str ());
+    zhash_update (snapshot, "resolver_in_flight", (void *) std::to_string (resolvers.inFlight ()).c_str ());
+    zhash_update (snapshot, "resolver_hits", (void *) std::to_string (stats.hits).c_str ());
+    zhash_update (snapshot, "resolver_misses", (void *) std::to_string (stats.misses).c_str ());
+    zhash_update (snapshot, "resolver_joined", (void *) std::to_string (stats.joined).c_str ());
+    zhash_update (snapshot, "resolver_hit_ratio", (void *) std::to_string (resolvers.hitRatio ()).c_str ());
+    zhash_update (snapshot, "resolver_completed", (void *) std::to_string (stats.completed).c_str ());
+    zhash_update (snapshot, "resolver_failed", (void *) std::to_string (stats.failed).c_str ());
+    return snapshot;
+}
+
+//  --------------------------------------------------------------------------
+//  publish all metrics on the METRICS stream
+
+static int
+s_publish_metrics (zloop_t *loop, int timer_id, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    zhash_t *snapshot = s_metrics_snapshot (self);
+    uint64_t now = uint64_t (zclock_time () / 1000);
+    // valid until the next publication is surely there
+    uint32_t ttl = uint32_t (2 * self->metrics_interval / 1000 + 1);
+    for (char *value = (char *) zhash_first (snapshot); value; value = (char *) zhash_next (snapshot)) {
+        std::string type = std::string ("mdns-sd.") + zhash_cursor (snapshot);
+        // histogram fields are durations, counters have no unit
+        const char *unit = strchr (zhash_cursor (snapshot), '.') && !strstr (zhash_cursor (snapshot), ".count") ? "us" : "";
+        zmsg_t *msg = fty_proto_encode_metric (NULL, now, ttl, type.c_str (), self->name, value, unit);
+        std::string subject = type + "@" + self->name;
+        if (mlm_client_send (self->metrics_client, subject.c_str (), &msg) != 0)
+            log_warning ("%s:\tFailed to publish metric %s", self->name, subject.c_str ());
+        zmsg_destroy (&msg);
+    }
+    zhash_destroy (&snapshot);
+    return 0;
+}
+
+static void
+s_set_metrics (fty_mdns_sd_server_t *self, int interval)
+{
+    if (self->metrics_timer != -1)
+        zloop_timer_end (self->loop, self->metrics_timer);
+    self->metrics_timer = -1;
+    self->metrics_interval = interval;
+    if (interval <= 0)
+        return;
+    if (!self->metrics_client) {
+        if (!self->endpoint) {
+            log_error ("%s:\tNot connected, cannot publish metrics", self->name);
+            return;
+        }
+        // a malamute client produces on one stream only
+        std::string address = std::string (self->name) + "-metrics";
+        self->metrics_client = mlm_client_new ();
+        if (mlm_client_connect (self->metrics_client, self->endpoint, 5000, address.c_str ()) != 0
+        ||  mlm_client_set_producer (self->metrics_client, FTY_PROTO_STREAM_METRICS) != 0) {
+            log_error ("%s:\tCannot produce on %s", self->name, FTY_PROTO_STREAM_METRICS);
+            mlm_client_destroy (&self->metrics_client);
+            return;
+        }
+    }
+    self->metrics_timer = zloop_timer (self->loop, size_t (interval), 0, s_publish_metrics, self);
+}
+
+//  --------------------------------------------------------------------------
+//  process pipe message
+//  return true means continue, false means TERM
+bool static
+s_handle_pipe(fty_mdns_sd_server_t* self, zsock_t *pipe, zmsg_t **message_p)
+{
+    if (! message_p || ! *message_p) return true;
+    zmsg_t *message = *message_p;
+
+    char *command = zmsg_popstr (message);
+    if (!command) {
+        zmsg_destroy (message_p);
+        log_warning ("Empty command.");
+        return true;
+    }
+    if (streq(command, "$TERM")) {
+        log_info ("Got $TERM");
+        zmsg_destroy (message_p);
+        zstr_free (&command);
+        return false;
+    }
+    else
+    if (streq (command, "CONNECT")) {
+        char *endpoint = zmsg_popstr (message);
+        if (!endpoint)
+            log_error ("%s:\tMissing endpoint", self->name);
+        assert (endpoint);
+        int r = mlm_client_connect (self->client, endpoint, 5000, self->name);
+        zstr_free (&self->endpoint);
+        self->endpoint = strdup (endpoint);
+        if (r == -1)
+            log_error ("%s:\tConnection to endpoint '%s' failed", self->name, endpoint);
+        log_debug("fty-mdns-sd-server: CONNECT %s/%s",endpoint,self->name);
+        zstr_free (&endpoint);
+    }
+    else
+    if (streq (command, "CONSUMER")) {
+        char *stream = zmsg_popstr (message);
+        char *pattern = zmsg_popstr (message);
+        if (stream && pattern) {
+            log_debug("fty-mdns-sd-server: CONSUMER [%s,%s]",
+                    stream,pattern) ;
+            int r = mlm_client_set_consumer (self->client, stream, pattern);
+            if (r == -1) {
+                log_error ("%s:\tSet consumer to '%s' with pattern '%s' failed", self->name, stream, pattern);
+            }
+        } else {
+            log_error ("%s:\tMissing params in CONSUMER command", self->name);
+        }
+        zstr_free (&stream);
+        zstr_free (&pattern);
+    }
+    else
+    if (streq (command, "PRODUCER")) {
+        // stream of the discovery changes
+        char *stream = zmsg_popstr (message);
+        if (stream) {
+            log_debug("fty-mdns-sd-server: PRODUCER [%s]", stream);
+            int r = mlm_client_set_producer (self->client, stream);
+            if (r == -1)
+                log_error ("%s:\tSet producer to '%s' failed", self->name, stream);
+            self->discovery_producer = (r == 0);
+        } else {
+            log_error ("%s:\tMissing params in PRODUCER command", self->name);
+        }
+        zstr_free (&stream);
+    }
+    else
+    if (streq (command, "SET-DEFAULT-SERVICE")) {
+         //set new ones
+        char *name  = zmsg_popstr (message);
+        char *type  = zmsg_popstr (message);
+        char *stype = zmsg_popstr (message);
+        char *port  = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-DEFAULT-SERVICE [%s,%s,%s,%s]",
+            name,type,stype,port) ;
+        if (name && type && stype && port) {
+            s_set_srv_name(self,name);
+            s_set_srv_type(self,type);
+            s_set_srv_stype(self,stype);
+            s_set_srv_port(self,port);
+        }
+        else
+            log_error ("%s:\tMissing params in SET-DEFAULT-SERVICE command", self->name);
+        zstr_free(&name);
+        zstr_free(&type);
+        zstr_free(&stype);
+        zstr_free(&port);
+    }
+    else
+    if (streq (command, "SET-DEFAULT-SUBTYPES")) {
+        // comma separated, merged into the subtypes of the next announcements
+        char *subtypes = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-DEFAULT-SUBTYPES %s", subtypes);
+        zstr_free (&self->srv_extra_stypes);
+        if (subtypes && *subtypes)
+            self->srv_extra_stypes = subtypes;
+        else
+            zstr_free (&subtypes);
+    }
+    else
+    if (streq (command, "SET-DEFAULT-TXT")) {
+        char *key   = zmsg_popstr (message);
+        char *value = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-DEFAULT-TXT %s=%s",
+            key,value) ;
+         s_set_txt_record(self,key,value);
+        zstr_free(&key);
+        zstr_free(&value);
+    }
+    else
+    if (streq (command, "ADD-SERVICE") || streq (command, "UPDATE-SERVICE")) {
+        // key/name/type/subtype/port[/txtkey=value...], viewed in place
+        MsgView fields (message);
+        char key [256];
+        const char *service = fields.cstr (0, key, sizeof (key));
+        log_debug("fty-mdns-sd-server: %s %s", command, service);
+        if (service && fields.has (5)) {
+            s_announce_view_t announce = {
+                fields.str (1), fields.str (2), fields.str (3), fields.str (4), s_pack_txt_pairs (fields, 5), "", "" };
+            s_announce (self, service, &announce);
+            zframe_destroy (&announce.txt);
+        }
+        else
+            log_error ("%s:\tMissing params in %s command", self->name, command);
+    }
+    else
+    if (streq (command, "REMOVE-SERVICE")) {
+        char *key = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: REMOVE-SERVICE %s", key);
+        if (key)
+            s_remove_service (self, key);
+        else
+            log_error ("%s:\tMissing params in REMOVE-SERVICE command", self->name);
+        zstr_free (&key);
+    }
+    else
+    if (streq (command, "SET-PUBLISHER")) {
+        char *backend = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-PUBLISHER %s", backend);
+        if (self->started) {
+            log_error ("%s:\tService already announced, cannot change publisher", self->name);
+        }
+        else {
+            MdnsPublisher *publisher = s_publisher_new (self, backend);
+            if (publisher) {
+                delete self->service;
+                self->service = publisher;
+            }
+        }
+        zstr_free (&backend);
+    }
+    else
+    if (streq (command, "GET-RECORDS")) {
+        // only available with the RECORDING publisher, empty reply otherwise
+        zmsg_t *reply = zmsg_new ();
+        RecordingPublisher *recorder = dynamic_cast<RecordingPublisher *> (self->service);
+        if (recorder)
+            recorder->pack (reply);
+        zmsg_pushstr (reply, "RECORDS");
+        zmsg_send (&reply, pipe);
+    }
+    else
+    if (streq (command, "CLEAR-RECORDS")) {
+        // only available with the RECORDING publisher
+        RecordingPublisher *recorder = dynamic_cast<RecordingPublisher *> (self->service);
+        if (recorder)
+            recorder->clear ();
+    }
+    else
+    if (streq (command, "SIMULATE-DAEMON-RESTART")) {
+        // only available with the RECORDING publisher: the daemon is gone
+        // for the given time (ms), then services are registered again
+        char *downtime = zmsg_popstr (message);
+        RecordingPublisher *recorder = dynamic_cast<RecordingPublisher *> (self->service);
+        if (recorder) {
+            log_debug("fty-mdns-sd-server: SIMULATE-DAEMON-RESTART %s", downtime);
+            recorder->daemonLost ();
+            zloop_timer (self->loop, downtime ? std::max (1, atoi (downtime)) : 1, 1, s_daemon_back, self);
+        }
+        zstr_free (&downtime);
+    }
+    else
+    if (streq (command, "GET-COUNTERS")) {
+        zstr_sendx (pipe, "COUNTERS",
+            std::to_string (self->metrics->updates_applied).c_str (),
+            std::to_string (self->metrics->updates_suppressed).c_str (),
+            std::to_string (self->metrics->updates_coalesced).c_str (),
+            NULL);
+    }
+    else
+    if (streq (command, "SET-STATE-FILE")) {
+        zstr_free (&self->state_file);
+        self->state_file = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-STATE-FILE %s", self->state_file);
+        s_announce_t announce = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+        zhash_t *txt = NULL;
+        char *published = NULL;
+        if (!self->started && announce_state_load (self->state_file,
+                &announce.name, &announce.type, &announce.stype, &announce.port, &txt, &published) == 0) {
+            // publish the last known announcement now, fty-info data is applied as a diff
+            log_info ("%s:\tPublishing last known announcement from %s", self->name, self->state_file);
+            s_set_srv_name (self, announce.name);
+            s_set_srv_type (self, announce.type);
+            s_set_srv_stype (self, announce.stype);
+            s_set_srv_port (self, announce.port);
+            s_set_txt_records (self, txt);
+            // no new probing round through the names already found taken
+            zstr_free (&self->published_name);
+            self->published_name = published;
+            published = NULL;
+            s_start_default (self);
+        }
+        zstr_free (&published);
+        zhash_destroy (&txt);
+        s_announce_clear (&announce);
+    }
+    else
+    if (streq (command, "SET-METRICS")) {
+        char *interval = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-METRICS %s", interval);
+        if (interval)
+            s_set_metrics (self, atoi (interval));
+        else
+            log_error ("%s:\tMissing params in SET-METRICS command", self->name);
+        zstr_free (&interval);
+    }
+    else
+    if (streq (command, "SET-COALESCE")) {
+        char *window = zmsg_popstr (message);
+        char *max_delay = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-COALESCE %s %s", window, max_delay);
+        if (window && max_delay) {
+            self->coalesce_window = atoi (window);
+            self->coalesce_max_delay = atoi (max_delay);
+            if (self->coalesce_max_delay < self->coalesce_window)
+                self->coalesce_max_delay = self->coalesce_window;
+        }
+        else
+            log_error ("%s:\tMissing params in SET-COALESCE command", self->name);
+        zstr_free (&window);
+        zstr_free (&max_delay);
+    }
+    else
+    if (streq (command, "SET-JITTER")) {
+        // max delay (ms, 0 = off), TXT size of a large update (bytes), device uid
+        char *max_delay = zmsg_popstr (message);
+        char *txt_bytes = zmsg_popstr (message);
+        char *uid = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-JITTER %s %s %s", max_delay, txt_bytes, uid);
+        if (max_delay && atoi (max_delay) >= 0) {
+            // without uid, the actor name keeps the delays reproducible
+            self->jitter->configure (atoi (max_delay), uid && *uid ? uid : self->name);
+            self->jitter_txt_bytes = txt_bytes ? size_t (atoi (txt_bytes)) : 0;
+        }
+        else
+            log_error ("%s:\tInvalid params in SET-JITTER command", self->name);
+        zstr_free (&max_delay);
+        zstr_free (&txt_bytes);
+        zstr_free (&uid);
+    }
+    else
+    if (streq (command, "SET-PUBLISH-POLICY")) {
+        // key (* for the default policy), comma separated interfaces, protocol
+        char *key = zmsg_popstr (message);
+        char *interfaces = zmsg_popstr (message);
+        char *protocol = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-PUBLISH-POLICY %s %s %s", key, interfaces, protocol);
+        PublishPolicy policy;
+        if (self->service && key && PublishPolicy::parse (interfaces ? interfaces : "", protocol ? protocol : "", policy)) {
+            if (!policy.all ())
+                s_watch_links (self);
+            if (streq (key, "*"))
+                self->service->setDefaultPolicy (policy);
+            else {
+                // the secondary instance goes where the service goes
+                self->service->setPolicy (key, policy);
+                self->service->setPolicy (std::string (key) + TXT_MORE_SUFFIX, policy);
+            }
+        }
+        else
+            log_error ("%s:\tInvalid params in SET-PUBLISH-POLICY command", self->name);
+        zstr_free (&key);
+        zstr_free (&interfaces);
+        zstr_free (&protocol);
+    }
+    else
+    if (streq (command, "SET-TXT-BUDGET")) {
+        // bytes (0 = no limit), keys by priority, move|drop
+        char *bytes = zmsg_popstr (message);
+        char *priority = zmsg_popstr (message);
+        char *overflow = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-TXT-BUDGET %s %s %s", bytes, priority, overflow);
+        TxtBudget budget;
+        budget.overflow = !overflow || !streq (overflow, "drop");
+        if (bytes && TxtBudget::parse (bytes, priority ? priority : "", budget))
+            *self->txt_budget = budget;
+        else
+            log_error ("%s:\tInvalid params in SET-TXT-BUDGET command", self->name);
+        zstr_free (&bytes);
+        zstr_free (&priority);
+        zstr_free (&overflow);
+    }
+    else
+    if (streq (command, "SET-PROXY")) {
+        // comma separated asset subtypes (empty for none), service type, port
+        char *types = zmsg_popstr (message);
+        char *type = zmsg_popstr (message);
+        char *port = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-PROXY %s %s %s", types, type, port);
+        s_set_proxy (self, types, type, port);
+        zstr_free (&types);
+        zstr_free (&type);
+        zstr_free (&port);
+    }
+    else
+    if (streq (command, "SET-PROXY-RATE")) {
+        // commits per second (0 = no limit), burst
+        char *rate = zmsg_popstr (message);
+        char *burst = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-PROXY-RATE %s %s", rate, burst);
+        if (rate && burst && atof (rate) >= 0 && atoi (burst) > 0)
+            self->proxy_commits->configure (atof (rate), size_t (atoi (burst)));
+        else
+            log_error ("%s:\tInvalid params in SET-PROXY-RATE command", self->name);
+        zstr_free (&rate);
+        zstr_free (&burst);
+    }
+    else
+    if (streq (command, "GET-PROXIES")) {
+        // proxied devices, still waiting for their commit
+        zstr_sendx (pipe, "PROXIES",
+            std::to_string (zhash_size (self->proxies)).c_str (),
+            std::to_string (self->proxy_commits->pending ()).c_str (),
+            NULL);
+    }
+    else
+    if (streq (command, "SET-DISCOVERY-TTL")) {
+        char *ttl = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-DISCOVERY-TTL %s", ttl);
+        if (ttl && atoi (ttl) > 0)
+            self->discovered->setTtl (atoi (ttl));
+        else
+            log_error ("%s:\tInvalid params in SET-DISCOVERY-TTL command", self->name);
+        zstr_free (&ttl);
+    }
+    else
+    if (streq (command, "ADD-DISCOVERED")) {
+        // static entry, as if resolved from the network
+        DiscoveredService service;
+        char *field[7] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+        for (int i = 0; i < 7; i++)
+            field[i] = zmsg_popstr (message);
+        if (field[6]) {
+            service.name    = field[0];
+            service.type    = field[1];
+            service.domain  = field[2];
+            service.host    = field[3];
+            service.address = field[4];
+            service.port    = uint16_t (atoi (field[5]));
+            char *subtype = field[6];
+            for (char *token = strtok (subtype, ","); token; token = strtok (NULL, ","))
+                service.subtypes.insert (token);
+            char *pair;
+            while ((pair = zmsg_popstr (message))) {
+                char *eq = strchr (pair, '=');
+                if (eq) {
+                    *eq = 0;
+                    service.txt[pair] = eq + 1;
+                }
+                zstr_free (&pair);
+            }
+            log_debug("fty-mdns-sd-server: ADD-DISCOVERED %s", service.key ().c_str ());
+            self->discovered->upsert (service, zclock_mono ());
+        }
+        else
+            log_error ("%s:\tMissing params in ADD-DISCOVERED command", self->name);
+        for (int i = 0; i < 7; i++)
+            zstr_free (&field[i]);
+    }
+    else
+    if (streq (command, "REMOVE-DISCOVERED")) {
+        char *key = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: REMOVE-DISCOVERED %s", key);
+        if (key)
+            self->discovered->remove (key);
+        else
+            log_error ("%s:\tMissing params in REMOVE-DISCOVERED command", self->name);
+        zstr_free (&key);
+    }
+    else
+    if (streq (command, "SET-DISCOVERY-RESOLVE")) {
+        // lazy|eager/max_in_flight/result_ttl[/wait], resolution of the browsed instances
+        char *mode = zmsg_popstr (message);
+        char *max_in_flight = zmsg_popstr (message);
+        char *result_ttl = zmsg_popstr (message);
+        char *wait = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-DISCOVERY-RESOLVE %s/%s/%s/%s", mode, max_in_flight, result_ttl, wait);
+        AvahiBrowser::ResolveMode resolve_mode;
+        if (mode && max_in_flight && result_ttl && AvahiBrowser::parseResolveMode (mode, resolve_mode)
+            && atoi (max_in_flight) > 0 && atoi (result_ttl) >= 0 && (!wait || atoi (wait) >= 0)) {
+            self->browser->setResolveMode (resolve_mode);
+            self->browser->configureResolvers (size_t (atoi (max_in_flight)), atoi (result_ttl));
+            if (wait)
+                self->resolve_wait = atoi (wait);
+        }
+        else
+            log_error ("%s:\tInvalid params in SET-DISCOVERY-RESOLVE command", self->name);
+        zstr_free (&mode);
+        zstr_free (&max_in_flight);
+        zstr_free (&result_ttl);
+        zstr_free (&wait);
+    }
+    else
+    if (streq (command, "SET-DISCOVERY-MODE")) {
+        // browse (avahi-daemon), passive (mDNS traffic) or both, before BROWSE
+        char *mode = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: SET-DISCOVERY-MODE %s", mode);
+        if (mode && (streq (mode, "browse") || streq (mode, "passive") || streq (mode, "both"))) {
+            self->discovery_browse = !streq (mode, "passive");
+            self->discovery_passive = !streq (mode, "browse");
+        }
+        else
+            log_error ("%s:\tInvalid params in SET-DISCOVERY-MODE command", self->name);
+        zstr_free (&mode);
+    }
+    else
+    if (streq (command, "BROWSE")) {
+        // browse all given types and subtypes, start discovery if needed
+        if (self->discovery_passive && !self->listener) {
+            // without avahi browsing, expired entries are only dropped
+            MdnsListener::Options options;
+            options.expire = !self->discovery_browse;
+            self->listener = new MdnsListener (self->loop, self->discovered, options);
+        }
+        char *type;
+        while ((type = zmsg_popstr (message))) {
+            log_debug("fty-mdns-sd-server: BROWSE %s", type);
+            if (self->discovery_browse)
+                self->browser->addType (type);
+            if (self->listener)
+                self->listener->addType (type);
+            zstr_free (&type);
+        }
+        if (!self->browser->types ().empty ())
+            self->browser->start ();
+        if (self->listener && !self->listener->types ().empty () && !self->listener->running ()) {
+            if (self->listener->start () == 0)
+                s_watch_links (self);
+        }
+    }
+    else
+    if (streq (command, "DO-DEFAULT-ANNOUNCE")) {
+        //free previous value
+        zstr_free (&self->fty_info_command);
+        //get info from fty-info, the announcement is done on reply
+        self->fty_info_command = zmsg_popstr (message);
+        log_debug("fty-mdns-sd-server: DO-DEFAULT-ANNOUNCE %s",
+                self->fty_info_command);
+        if (self->fty_info_command)
+            s_info_start (self);
+        else
+            log_error ("%s:\tMissing params in DO-DEFAULT-ANNOUNCE command", self->name);
+    }
+    else
+        log_warning ("%s:\tUnkown API command=%s, ignoring",
+                self->name, command);
+    zstr_free (&command);
+    zmsg_destroy (&message);
+    return true;
+}
+//  --------------------------------------------------------------------------
+//  process message from ANNOUNCE stream
+void static
+s_handle_stream(fty_mdns_sd_server_t* self, zmsg_t **message_p)
+{
+    // fields are read in place, the message is destroyed once handled
+    MsgView fields (*message_p);
+    std::string_view cmd = fields.str (0);
+    self->metrics->announce_received++;
+    char key [256];         // service keys are hash keys, at most 255 bytes
+
+    if (fields.has (1)) {
+        if (cmd == "INFO") {
+            // this suppose to be an update, service must be created already
+            log_debug("fty-mdns-sd-server: new ANNOUNCEMENT");
+            s_announce_view_t announce;
+            if (s_announce_view (fields, 1, &announce))
+                s_announce (self, DEFAULT_SERVICE_KEY, &announce);
+            else
+                log_error ("Malformed IPC message received");
+        }
+        else
+        if (cmd == "SERVICE-ADD" || cmd == "SERVICE-UPDATE") {
+            const char *service = fields.cstr (1, key, sizeof (key));
+            log_debug("fty-mdns-sd-server: %.*s %s", int (cmd.size ()), cmd.data (), service);
+            s_announce_view_t announce;
+            if (service && s_announce_view (fields, 2, &announce))
+                s_announce (self, service, &announce);
+            else
+                log_error ("Malformed %.*s message received", int (cmd.size ()), cmd.data ());
+        }
+        else
+        if (cmd == "SERVICE-REMOVE") {
+            const char *service = fields.cstr (1, key, sizeof (key));
+            log_debug("fty-mdns-sd-server: %.*s %s", int (cmd.size ()), cmd.data (), service);
+            if (service)
+                s_remove_service (self, service);
+            else
+                log_error ("Malformed %.*s message received", int (cmd.size ()), cmd.data ());
+        }
+        else {
+            log_error ("Unknown command %.*s", int (cmd.size ()), cmd.data ());
+        }
+    }
+    zmsg_destroy (message_p);
+}
+
+//  --------------------------------------------------------------------------
+//  process message from MAILBOX
+
+//  LIST-SERVICES/uuid/TYPE|SUBTYPE|HOST|ALL/value[/offset[/limit]]
+//  reply uuid/SERVICES/total/offset/count/(definition/txt)*count
+static zmsg_t *
+s_list_services (fty_mdns_sd_server_t *self, zmsg_t *request)
+{
+    char *filter = zmsg_popstr (request);
+    char *value  = zmsg_popstr (request);
+    char *offset_s = zmsg_popstr (request);
+    char *limit_s  = zmsg_popstr (request);
+    zmsg_t *reply = zmsg_new ();
+
+    DiscoveryCache::result_t result;
+    bool valid = filter && value;
+    if (!valid)
+        ;
+    else if (streq (filter, "TYPE"))
+        result = self->discovered->byType (value);
+    else if (streq (filter, "SUBTYPE"))
+        result = self->discovered->bySubtype (value);
+    else if (streq (filter, "HOST"))
+        result = self->discovered->byHost (value);
+    else if (streq (filter, "ALL"))
+        result = self->discovered->all ();
+    else
+        valid = false;
+
+    if (valid) {
+        // results are sorted by instance key, pages stay stable between requests
+        size_t offset = offset_s ? size_t (std::max (0, atoi (offset_s))) : 0;
+        size_t limit = limit_s ? size_t (std::max (0, atoi (limit_s))) : LIST_LIMIT_DEFAULT;
+        if (limit == 0 || limit > LIST_LIMIT_MAX)
+            limit = LIST_LIMIT_MAX;
+        if (offset > result.size ())
+            offset = result.size ();
+        size_t count = std::min (limit, result.size () - offset);
+
+        zmsg_addstr (reply, "SERVICES");
+        zmsg_addstr (reply, std::to_string (result.size ()).c_str ());
+        zmsg_addstr (reply, std::to_string (offset).c_str ());
+        zmsg_addstr (reply, std::to_string (count).c_str ());
+        for (size_t i = offset; i < offset + count; i++)
+            s_pack_discovered (reply, result[i]);
+        // the page is served as cached, its instances get resolved for the next request
+        int64_t now = zclock_mono ();
+        for (size_t i = offset; i < offset + count; i++)
+            self->browser->demand (result[i]->key (), now);
+    }
+    else {
+        log_warning ("%s:\tInvalid LIST-SERVICES request (%s, %s)", self->name, filter, value);
+        zmsg_addstr (reply, "ERROR");
+        zmsg_addstr (reply, "BAD-REQUEST");
+    }
+    zstr_free (&filter);
+    zstr_free (&value);
+    zstr_free (&offset_s);
+    zstr_free (&limit_s);
+    return reply;
+}
+
+//  send reply to the mailbox request uuid of sender, a single multipart message
+static void
+s_mailbox_reply (fty_mdns_sd_server_t *self, const char *sender, const char *subject,
+    const char *uuid, const char *command, zmsg_t **reply_p)
+{
+    zmsg_pushstr (*reply_p, uuid);
+    int r = mlm_client_sendto (self->client, sender, subject, NULL, 1000, reply_p);
+    if (r != 0)
+        log_error ("%s:\tFailed to reply %s to %s", self->name, command, sender);
+    zmsg_destroy (reply_p);
+}
+
+//  reply SERVICE/definition/txt of a cached instance, NOT-FOUND if none
+static zmsg_t *
+s_service_reply (const DiscoveredService *service)
+{
+    zmsg_t *reply = zmsg_new ();
+    if (service) {
+        zmsg_addstr (reply, "SERVICE");
+        s_pack_discovered (reply, service);
+    }
+    else {
+        zmsg_addstr (reply, "ERROR");
+        zmsg_addstr (reply, "NOT-FOUND");
+    }
+    return reply;
+}
+
+//  reply a held GET-SERVICE with its instance as cached now, and forget it
+static void
+s_waiting_get_reply (fty_mdns_sd_server_t *self, s_waiting_get_t *waiting)
+{
+    zmsg_t *reply = s_service_reply (self->discovered->find (waiting->key));
+    s_mailbox_reply (self, waiting->sender, waiting->subject, waiting->uuid, "GET-SERVICE", &reply);
+    zlist_remove (self->waiting_gets, waiting);
+    s_waiting_get_destroy (&waiting);
+}
+
+//  resolution of key over, browser listener: the GET-SERVICE requests waiting for it are replied
+static void
+s_resolved (fty_mdns_sd_server_t *self, const std::string& key)
+{
+    std::vector<s_waiting_get_t *> done;
+    for (void *it = zlist_first (self->waiting_gets); it; it = zlist_next (self->waiting_gets))
+        if (key == ((s_waiting_get_t *) it)->key)
+            done.push_back ((s_waiting_get_t *) it);
+    for (s_waiting_get_t *waiting : done)
+        s_waiting_get_reply (self, waiting);
+}
+
+//  resolve_wait over, the instance is replied as cached
+static int
+s_waiting_get_timeout (zloop_t *loop, int timer_id, void *arg)
+{
+    s_waiting_get_t *waiting = (s_waiting_get_t *) arg;
+    waiting->timer = -1;    // one shot timer, already gone
+    log_debug ("fty-mdns-sd-server: service '%s' not resolved in time", waiting->key);
+    s_waiting_get_reply (waiting->server, waiting);
+    return 0;
+}
+
+//  GET-SERVICE/uuid/key or GET-SERVICE/uuid/name/type[/domain]
+//  reply uuid/SERVICE/definition/txt, NULL when the instance is being resolved:
+//  the request is then held until it is, or for resolve_wait at most
+static zmsg_t *
+s_get_service (fty_mdns_sd_server_t *self, zmsg_t *request, const char *uuid)
+{
+    char *first  = zmsg_popstr (request);
+    char *type   = zmsg_popstr (request);
+    char *domain = zmsg_popstr (request);
+
+    const DiscoveredService *service = NULL;
+    if (first && type)
+        service = self->discovered->find (first, type, domain ? domain : "local");
+    else if (first)
+        service = self->discovered->find (first);
+
+    zmsg_t *reply = NULL;
+    if (!first) {
+        reply = zmsg_new ();
+        zmsg_addstr (reply, "ERROR");
+        zmsg_addstr (reply, "BAD-REQUEST");
+    }
+    else
+    if (service && self->browser->demand (service->key (), zclock_mono ())
+     && !service->resolved && self->resolve_wait > 0) {
+        // a stale resolved entry is served at once, refreshed for the next request
+        s_waiting_get_t *waiting = (s_waiting_get_t *) zmalloc (sizeof (s_waiting_get_t));
+        waiting->server = self;
+        waiting->sender = strdup (mlm_client_sender (self->client));
+        waiting->subject = strdup (mlm_client_subject (self->client));
+        waiting->uuid = strdup (uuid);
+        waiting->key = strdup (service->key ().c_str ());
+        waiting->timer = zloop_timer (self->loop, size_t (self->resolve_wait), 1, s_waiting_get_timeout, waiting);
+        zlist_append (self->waiting_gets, waiting);
+    }
+    else
+        reply = s_service_reply (service);
+    zstr_free (&first);
+    zstr_free (&type);
+    zstr_free (&domain);
+    return reply;
+}
+
+//  SNAPSHOT/uuid[/seq]
+//  reply uuid/DELTAS/seq/count/(change/seq/definition/txt)*count when the changes after seq are known,
+//  else uuid/SNAPSHOT/seq/count/(definition/txt)*count, the state at sequence seq
+static zmsg_t *
+s_snapshot (fty_mdns_sd_server_t *self, zmsg_t *request)
+{
+    char *since = zmsg_popstr (request);
+    zmsg_t *reply = zmsg_new ();
+    std::vector<const DiscoveryJournal::Entry*> changes;
+    if (since && self->journal->since (strtoull (since, NULL, 10), changes)) {
+        zmsg_addstr (reply, "DELTAS");
+        zmsg_addstr (reply, std::to_string (self->journal->seq ()).c_str ());
+        zmsg_addstr (reply, std::to_string (changes.size ()).c_str ());
+        for (const auto *entry : changes) {
+            zmsg_addstr (reply, DiscoveryCache::changeName (entry->change));
+            zmsg_addstr (reply, std::to_string (entry->seq).c_str ());
+            s_pack_discovered (reply, &entry->service);
+        }
+    }
+    else {
+        DiscoveryCache::result_t result = self->discovered->all ();
+        zmsg_addstr (reply, "SNAPSHOT");
+        zmsg_addstr (reply, std::to_string (self->journal->seq ()).c_str ());
+        zmsg_addstr (reply, std::to_string (result.size ()).c_str ());
+        for (const auto *service : result)
+            s_pack_discovered (reply, service);
+    }
+    zstr_free (&since);
+    return reply;
+}
+
+void static
+s_handle_mailbox(fty_mdns_sd_server_t* self,zmsg_t **message_p)
+{
+    zmsg_t *message = *message_p;
+    {
+        // replies of fty-info start with the UUID of the request
+        MsgView fields (message);
+        if (self->info_uuid && fields.is (0, self->info_uuid)) {
+            s_handle_info_reply (self, fields);
+            zmsg_destroy (message_p);
+            return;
+        }
+    }
+    char *command = zmsg_popstr (message);
+    if (streq (mlm_client_sender (self->client), "fty-info")) {
+        // ERROR, or reply of an older request
+        log_warning ("%s:\tIgnoring message from fty-info (%s)", self->name, command);
+        zstr_free (&command);
+        zmsg_destroy (message_p);
+        return;
+    }
+
+    char *uuid = zmsg_popstr (message);
+    if (!command || !uuid) {
+        log_warning ("%s:\tMalformed mailbox request from %s", self->name, mlm_client_sender (self->client));
+        zstr_free (&command);
+        zstr_free (&uuid);
+        zmsg_destroy (message_p);
+        return;
+    }
+    log_debug ("fty-mdns-sd-server: mailbox %s from %s", command, mlm_client_sender (self->client));
+
+    zmsg_t *reply;
+    if (streq (command, "LIST-SERVICES"))
+        reply = s_list_services (self, message);
+    else
+    if (streq (command, "GET-SERVICE")) {
+        reply = s_get_service (self, message, uuid);
+        if (!reply) {
+            // held, replied once the instance is resolved
+            zstr_free (&command);
+            zstr_free (&uuid);
+            zmsg_destroy (message_p);
+            return;
+        }
+    }
+    else
+    if (streq (command, "SNAPSHOT"))
+        reply = s_snapshot (self, message);
+    else
+    if (streq (command, "STATS")) {
+        // uuid/STATS/packed zhash of all metrics
+        reply = zmsg_new ();
+        zmsg_addstr (reply, "STATS");
+        zhash_t *snapshot = s_metrics_snapshot (self);
+        zframe_t *frame = zhash_pack (snapshot);
+        zmsg_append (reply, &frame);
+        zhash_destroy (&snapshot);
+    }
+    else {
+        log_warning ("%s:\tUnknown mailbox command=%s, ignoring", self->name, command);
+        reply = zmsg_new ();
+        zmsg_addstr (reply, "ERROR");
+        zmsg_addstr (reply, "UNKNOWN-COMMAND");
+    }
+    // a single multipart reply, whatever the number of services
+    s_mailbox_reply (self, mlm_client_sender (self->client), mlm_client_subject (self->client),
+        uuid, command, &reply);
+    zstr_free (&command);
+    zstr_free (&uuid);
+    zmsg_destroy (message_p);
+}
+
+//  --------------------------------------------------------------------------
+//  zloop handlers
+
+static int
+s_pipe_event (zloop_t *loop, zsock_t *pipe, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    zmsg_t *message = zmsg_recv (pipe);
+    if (! s_handle_pipe (self, pipe, &message))
+        return -1; // TERM
+    return 0;
+}
+
+static int
+s_mlm_event (zloop_t *loop, zsock_t *reader, void *arg)
+{
+    fty_mdns_sd_server_t *self = (fty_mdns_sd_server_t *) arg;
+    zmsg_t *message = mlm_client_recv (self->client);
+    if (!message)
+        return 0;
+    const char *command = mlm_client_command (self->client);
+    if (streq (command, "STREAM DELIVER")) {
+        if (streq (mlm_client_address (self->client), FTY_PROTO_STREAM_ASSETS))
+            s_handle_assets (self, &message);
+        else
+            s_handle_stream (self, &message);
+    }
+    else
+    if (streq (command, "MAILBOX DELIVER")) {
+        s_handle_mailbox (self, &message);
+    }
+    zmsg_destroy (&message);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Create a new fty_mdns_sd_server
+
+void
+fty_mdns_sd_server (zsock_t *pipe, void *args)
+{
+    char*name=(char*) args;
+    fty_mdns_sd_server_t *self = fty_mdns_sd_server_new(name);
+    assert (self);
+
+    // pipe, malamute and avahi events are all handled by the same loop
+    zloop_reader (self->loop, pipe, s_pipe_event, self);
+    zloop_reader (self->loop, mlm_client_msgpipe (self->client), s_mlm_event, self);
 
     // do not forget to send a signal to actor :)
     zsock_signal (pipe, 0);
 
     log_info ("fty-mdns-sd-server: Started with name '%s'",self->name);
 
+    zloop_start (self->loop);
+
+    self->service->stop();
+    fty_mdns_sd_server_destroy (&self);
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  Build an INFO message as published by fty-info
+static zmsg_t *
+s_test_info_msg (const char *txtvers)
+{
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, "INFO");
+    zmsg_addstr (msg, "IPC (12345678)");
+    zmsg_addstr (msg, "_https._tcp.");
+    zmsg_addstr (msg, "_powerservice._sub._https._tcp.");
+    zmsg_addstr (msg, "443");
+    zhash_t *infos = zhash_new ();
+    zhash_insert (infos, "uuid", (void *) "12345678-0000-0000-0000-000000000000");
+    zhash_insert (infos, "txtvers", (void *) txtvers);
+    zframe_t *frame = zhash_pack (infos);
+    zmsg_append (msg, &frame);
+    zhash_destroy (&infos);
+    return msg;
+}
+
+//  Fake fty-info agent answering INFO requests on its mailbox
+static void
+s_test_fty_info (zsock_t *pipe, void *args)
+{
+    mlm_client_t *client = mlm_client_new ();
+    int r = mlm_client_connect (client, (const char *) args, 1000, "fty-info");
+    assert (r == 0);
+    zpoller_t *poller = zpoller_new (pipe, mlm_client_msgpipe (client), NULL);
+    zsock_signal (pipe, 0);
+
     while (!zsys_interrupted) {
         void *which = zpoller_wait (poller, -1);
-
-        if (which == pipe) {
-            zmsg_t *message = zmsg_recv (pipe);
-            if(! s_handle_pipe (self, &message)) {
-                break; // TERM
-            }
-            // end of command pipe processing
-        }
-        else if (which == mlm_client_msgpipe (self->client)) {
-            zmsg_t *message = mlm_client_recv (self->client);
-            const char *command = mlm_client_command (self->client);
-            if (streq (command, "STREAM DELIVER")) {
-                s_handle_stream (self, &message);
-            }
-            else
-            if (streq (command, "MAILBOX DELIVER")) {
-                s_handle_mailbox (self, &message);
-            }
+        if (which != mlm_client_msgpipe (client))
+            break; // $TERM or interrupted
+        zmsg_t *request = mlm_client_recv (client);
+        char *command = zmsg_popstr (request);
+        char *uuid = zmsg_popstr (request);
+        if (command && uuid && streq (command, "INFO")) {
+            zmsg_t *reply = s_test_info_msg ("1.0.0");
+            zmsg_pushstr (reply, uuid);
+            mlm_client_sendto (client, mlm_client_sender (client), "info", NULL, 1000, &reply);
         }
+        zstr_free (&uuid);
+        zstr_free (&command);
+        zmsg_destroy (&request);
     }
 
-    self->service->stop();
-    fty_mdns_sd_server_destroy (&self);
     zpoller_destroy (&poller);
+    mlm_client_destroy (&client);
+}
 
+//  Count records of the given kind (and service key) in a GET-RECORDS reply
+static size_t
+s_test_count_records (zactor_t *server, const char *kind, const char *key = NULL)
+{
+    zstr_sendx (server, "GET-RECORDS", NULL);
+    zmsg_t *reply = zmsg_recv (server);
+    assert (reply);
+    char *header = zmsg_popstr (reply);
+    assert (header && streq (header, "RECORDS"));
+    zstr_free (&header);
+    size_t count = 0;
+    while (zmsg_size (reply) >= 4) {
+        char *record_kind = zmsg_popstr (reply);
+        char *usec = zmsg_popstr (reply);
+        char *record_key = zmsg_popstr (reply);
+        zframe_t *txt = zmsg_pop (reply);
+        if (streq (record_kind, kind) && (!key || streq (record_key, key)))
+            count++;
+        zframe_destroy (&txt);
+        zstr_free (&record_key);
+        zstr_free (&usec);
+        zstr_free (&record_kind);
+    }
+    zmsg_destroy (&reply);
+    return count;
+}
+
+//  Span (usec) between the first and the last record of the given kind
+//  whose service key starts with prefix, 0 if there are less than two
+static int64_t
+s_test_records_span (zactor_t *server, const char *kind, const char *prefix)
+{
+    zstr_sendx (server, "GET-RECORDS", NULL);
+    zmsg_t *reply = zmsg_recv (server);
+    assert (reply);
+    char *header = zmsg_popstr (reply);
+    assert (header && streq (header, "RECORDS"));
+    zstr_free (&header);
+    int64_t first = -1, last = -1;
+    while (zmsg_size (reply) >= 4) {
+        char *record_kind = zmsg_popstr (reply);
+        char *usec = zmsg_popstr (reply);
+        char *record_key = zmsg_popstr (reply);
+        zframe_t *txt = zmsg_pop (reply);
+        if (streq (record_kind, kind) && strncmp (record_key, prefix, strlen (prefix)) == 0) {
+            int64_t at = atoll (usec);
+            if (first < 0) first = at;
+            last = at;
+        }
+        zframe_destroy (&txt);
+        zstr_free (&record_key);
+        zstr_free (&usec);
+        zstr_free (&record_kind);
+    }
+    zmsg_destroy (&reply);
+    return first < 0 ? 0 : last - first;
+}
+
+//  Publish an asset on the ASSETS stream, as fty-asset does
+static void
+s_test_send_asset (mlm_client_t *producer, const char *name, const char *operation,
+    const char *subtype, const char *address)
+{
+    zhash_t *aux = zhash_new ();
+    zhash_insert (aux, "type", (void *) "device");
+    zhash_insert (aux, "subtype", (void *) subtype);
+    zhash_insert (aux, "status", (void *) "active");
+    zhash_t *ext = zhash_new ();
+    zhash_insert (ext, "name", (void *) name);
+    zhash_insert (ext, "manufacturer", (void *) "Eaton");
+    if (address)
+        zhash_insert (ext, "ip.1", (void *) address);
+    zmsg_t *msg = fty_proto_encode_asset (aux, name, operation, ext);
+    int r = mlm_client_send (producer, name, &msg);
+    assert (r == 0);
+    zhash_destroy (&aux);
+    zhash_destroy (&ext);
+}
+
+//  Wait until the server proxies count devices, none of them queued
+static bool
+s_test_wait_proxies (zactor_t *server, size_t count)
+{
+    for (int i = 0; i < 200; i++) {
+        zstr_sendx (server, "GET-PROXIES", NULL);
+        char *header = NULL, *proxies = NULL, *queued = NULL;
+        zstr_recvx (server, &header, &proxies, &queued, NULL);
+        assert (header && streq (header, "PROXIES"));
+        bool done = size_t (atoi (proxies)) == count && streq (queued, "0");
+        zstr_free (&header);
+        zstr_free (&proxies);
+        zstr_free (&queued);
+        if (done)
+            return true;
+        zclock_sleep (20);
+    }
+    return false;
+}
+
+//  Server on the recording backend, connected to the broker at endpoint if not NULL
+static zactor_t *
+s_test_server (const char *endpoint)
+{
+    zactor_t *server = zactor_new (fty_mdns_sd_server, (void*)"fty-mdns-sd-test");
+    assert (server);
+    // no avahi-daemon needed, the announce path ends in the recording backend
+    zstr_sendx (server, "SET-PUBLISHER", "RECORDING", NULL);
+    if (endpoint)
+        zstr_sendx (server, "CONNECT", endpoint, NULL);
+    return server;
+}
+
+//  Malamute client of the test, connected to endpoint
+static mlm_client_t *
+s_test_client (const char *endpoint, const char *address)
+{
+    mlm_client_t *client = mlm_client_new ();
+    int r = mlm_client_connect (client, endpoint, 1000, address);
+    assert (r == 0);
+    return client;
+}
+
+//  State file of a default service announced with txtvers
+static void
+s_test_save_state (const char *state_file, const char *txtvers)
+{
+    zhash_t *txt = zhash_new ();
+    zhash_insert (txt, "uuid", (void *) "12345678-0000-0000-0000-000000000000");
+    zhash_insert (txt, "txtvers", (void *) txtvers);
+    announce_state_save (state_file, "IPC (12345678)", "_https._tcp.",
+        "_powerservice._sub._https._tcp.", "443", txt, NULL);
+    zhash_destroy (&txt);
+}
+
+//  Register the default service at once from a state file holding txtvers
+static void
+s_test_start_default (zactor_t *server, const char *state_file, const char *txtvers)
+{
+    s_test_save_state (state_file, txtvers);
+    zstr_sendx (server, "SET-STATE-FILE", state_file, NULL);
+    assert (s_test_count_records (server, "COMMIT", DEFAULT_SERVICE_KEY) == 1);
+}
+
+//  Wait until the server has count records of the given kind (and service
+//  key), 4 s at most; return the count then
+static size_t
+s_test_wait_records (zactor_t *server, size_t count, const char *kind, const char *key = NULL)
+{
+    size_t n = s_test_count_records (server, kind, key);
+    for (int i = 0; i < 200 && n < count; i++) {
+        zclock_sleep (20);
+        n = s_test_count_records (server, kind, key);
+    }
+    return n;
+}
+
+//  Announcement counters of GET-COUNTERS
+typedef struct {
+    size_t applied;
+    size_t suppressed;
+    size_t coalesced;
+} s_test_counters_t;
+
+static s_test_counters_t
+s_test_counters (zactor_t *server)
+{
+    zstr_sendx (server, "GET-COUNTERS", NULL);
+    char *header = NULL, *applied = NULL, *suppressed = NULL, *coalesced = NULL;
+    zstr_recvx (server, &header, &applied, &suppressed, &coalesced, NULL);
+    assert (header && streq (header, "COUNTERS"));
+    s_test_counters_t counters = { size_t (atol (applied)), size_t (atol (suppressed)), size_t (atol (coalesced)) };
+    zstr_free (&header);
+    zstr_free (&applied);
+    zstr_free (&suppressed);
+    zstr_free (&coalesced);
+    return counters;
+}
+
+//  Mailbox request COMMAND/uuid/args... (NULL terminated) to the server;
+//  the reply is returned without its uuid, checked against the request one
+static zmsg_t *
+s_test_request (mlm_client_t *requester, const char *command, ...)
+{
+    static int sequence = 0;
+    std::string uuid = "uuid-" + std::to_string (++sequence);
+    zmsg_t *request = zmsg_new ();
+    zmsg_addstr (request, command);
+    zmsg_addstr (request, uuid.c_str ());
+    va_list args;
+    va_start (args, command);
+    for (const char *arg = va_arg (args, const char *); arg; arg = va_arg (args, const char *))
+        zmsg_addstr (request, arg);
+    va_end (args);
+    int r = mlm_client_sendto (requester, "fty-mdns-sd-test", "test", NULL, 1000, &request);
+    assert (r == 0);
+    zmsg_t *reply = mlm_client_recv (requester);
+    assert (reply);
+    char *reply_uuid = zmsg_popstr (reply);
+    assert (reply_uuid && uuid == reply_uuid);
+    zstr_free (&reply_uuid);
+    return reply;
+}
+
+//  Metrics of the STATS mailbox request, caller destroys the hash
+static zhash_t *
+s_test_stats (mlm_client_t *requester)
+{
+    zmsg_t *reply = s_test_request (requester, "STATS", NULL);
+    char *header = zmsg_popstr (reply);
+    assert (header && streq (header, "STATS"));
+    zstr_free (&header);
+    zframe_t *frame = zmsg_pop (reply);
+    zhash_t *stats = zhash_unpack (frame);
+    assert (stats);
+    zframe_destroy (&frame);
+    zmsg_destroy (&reply);
+    return stats;
+}
+
+//  Value of a metric, 0 if it is missing
+static long
+s_test_stat (zhash_t *stats, const char *name)
+{
+    const char *value = (const char *) zhash_lookup (stats, name);
+    return value ? atol (value) : 0;
+}
+
+//  Header, then numeric fields of a reply, popped; count of them given
+static std::vector<long>
+s_test_reply_fields (zmsg_t *reply, const char *header, size_t count)
+{
+    char *got = zmsg_popstr (reply);
+    assert (got && streq (got, header));
+    zstr_free (&got);
+    std::vector<long> fields;
+    for (size_t i = 0; i < count; i++) {
+        char *field = zmsg_popstr (reply);
+        assert (field);
+        fields.push_back (atol (field));
+        zstr_free (&field);
+    }
+    return fields;
 }
-//  --------------------------------------------------------------------------
-//  Self test of this class
 
 void
 fty_mdns_sd_server_test (bool verbose)
 {
     printf (" * fty_mdns_sd_server: \n");
 
-    //  Simple create/destroy test
+    // each section runs its own server on a fresh recording backend
+    static const char *endpoint = "inproc://fty-mdns-sd-server-test";
+    const char *state_file = SELFTEST_DIR_RW "/fty-mdns-sd-server-state.zpl";
 
-    zactor_t *server = zactor_new (fty_mdns_sd_server, (void*)"fty-mdns-sd-test");
-    assert (server);
+    zactor_t *broker = zactor_new (mlm_server, (void*) "Malamute");
+    zstr_sendx (broker, "BIND", endpoint, NULL);
+    if (verbose)
+        zstr_send (broker, "VERBOSE");
+
+    //default announcement: asked to fty-info without blocking, then kept in the state file
+    {
+        remove (state_file);
+        zactor_t *server = s_test_server (endpoint);
+        zstr_sendx (server, "SET-DEFAULT-SERVICE",
+                "IPC (12345678)","_https._tcp.","_powerservice._sub._https._tcp.","443", NULL);
+        zstr_sendx (server, "SET-DEFAULT-TXT", "txtvers", "0.0.1", NULL);
+        zstr_sendx (server, "SET-STATE-FILE", state_file, NULL);
+
+        // fty-info is not there yet: the actor is not blocked while waiting
+        int64_t start = zclock_mono ();
+        zstr_sendx (server, "DO-DEFAULT-ANNOUNCE", "INFO", NULL);
+        assert (s_test_count_records (server, "COMMIT") == 0);
+        assert (zclock_mono () - start < 500);
+
+        zactor_t *fty_info = zactor_new (s_test_fty_info, (void*) endpoint);
+        assert (fty_info);
+        assert (s_test_wait_records (server, 1, "COMMIT") == 1);
+        if (verbose)
+            printf ("   default service announced after %" PRIi64 " ms\n", zclock_mono () - start);
+
+        mlm_client_t *requester = s_test_client (endpoint, "fty-mdns-sd-test-requester");
+        zhash_t *stats = s_test_stats (requester);
+        assert (s_test_stat (stats, "info_rtt.count") == 1);
+        assert (s_test_stat (stats, "commit_latency.count") == 1);
+        assert (s_test_stat (stats, "info_requests") >= 1);
+        if (verbose)
+            printf ("   fty-info round trip %s us\n", (char *) zhash_lookup (stats, "info_rtt.max"));
+        zhash_destroy (&stats);
+        mlm_client_destroy (&requester);
+
+        zactor_destroy (&server);
+        zactor_destroy (&fty_info);
+        // the announcement of fty-info was saved
+        char *name = NULL, *type = NULL, *stype = NULL, *port = NULL, *published = NULL;
+        zhash_t *txt = NULL;
+        assert (announce_state_load (state_file, &name, &type, &stype, &port, &txt, &published) == 0);
+        assert (streq ((char *) zhash_lookup (txt, "txtvers"), "1.0.0"));
+        zstr_free (&name);
+        zstr_free (&type);
+        zstr_free (&stype);
+        zstr_free (&port);
+        zstr_free (&published);
+        zhash_destroy (&txt);
+        remove (state_file);
+    }
 
-    zstr_sendx (server, "CONNECT", "ipc://@/malamute", NULL);
+    //updates from the ANNOUNCE stream: applied, suppressed when unchanged, coalesced in bursts
+    {
+        zactor_t *server = s_test_server (endpoint);
+        zstr_sendx (server, "CONSUMER", "ANNOUNCE", ".*", NULL);
+        s_test_start_default (server, state_file, "1.0.0");
+        mlm_client_t *producer = s_test_client (endpoint, "fty-mdns-sd-test-producer");
+        int r = mlm_client_set_producer (producer, "ANNOUNCE");
+        assert (r == 0);
+
+        size_t updates = s_test_count_records (server, "UPDATE");
+        zmsg_t *msg = s_test_info_msg ("1.0.1");
+        mlm_client_send (producer, "INFO", &msg);
+        assert (s_test_wait_records (server, updates + 1, "UPDATE") == updates + 1);
+
+        //same content again: suppressed before reaching the publisher
+        s_test_counters_t before = s_test_counters (server);
+        msg = s_test_info_msg ("1.0.1");
+        mlm_client_send (producer, "INFO", &msg);
+        s_test_counters_t after = before;
+        for (int i = 0; i < 200 && after.suppressed == before.suppressed; i++) {
+            zclock_sleep (20);
+            after = s_test_counters (server);
+        }
+        assert (after.suppressed == before.suppressed + 1);
+        assert (after.applied == before.applied);
+        assert (s_test_count_records (server, "UPDATE") == updates + 1);
+
+        //burst of updates: only the latest one is published, once
+        zstr_sendx (server, "SET-COALESCE", "200", "2000", NULL);
+        before = s_test_counters (server);
+        updates = s_test_count_records (server, "UPDATE");
+        const char *burst[] = { "1.0.2", "1.0.3", "1.0.4", "1.0.5", "1.0.6" };
+        for (const char *txtvers : burst) {
+            msg = s_test_info_msg (txtvers);
+            mlm_client_send (producer, "INFO", &msg);
+        }
+        assert (s_test_wait_records (server, updates + 1, "UPDATE") == updates + 1);
+        // nothing more once the window is over
+        zclock_sleep (400);
+        assert (s_test_count_records (server, "UPDATE") == updates + 1);
+        after = s_test_counters (server);
+        assert (after.applied == before.applied + 1);
+        assert (after.coalesced == before.coalesced + 4);
+
+        mlm_client_destroy (&producer);
+        zactor_destroy (&server);
+        remove (state_file);
+    }
+
+    //more services, each one in its own group
+    {
+        zactor_t *server = s_test_server (endpoint);
+        // the publisher starts with the default service
+        s_test_start_default (server, state_file, "1.0.0");
+        zstr_sendx (server, "CONSUMER", "ANNOUNCE", ".*", NULL);
+        mlm_client_t *producer = s_test_client (endpoint, "fty-mdns-sd-test-producer");
+        int r = mlm_client_set_producer (producer, "ANNOUNCE");
+        assert (r == 0);
+
+        zstr_sendx (server, "ADD-SERVICE", "mqtt",
+                "IPC (12345678)", "_mqtt._tcp.", "_powerservice._sub._mqtt._tcp.", "1883", "txtvers=1.0.0", NULL);
+        zstr_sendx (server, "ADD-SERVICE", "snmp",
+                "IPC (12345678)", "_snmp._udp.", "_powerservice._sub._snmp._udp.", "161", NULL);
+        assert (s_test_count_records (server, "COMMIT", "mqtt") == 1);
+        assert (s_test_count_records (server, "COMMIT", "snmp") == 1);
+        size_t commits = s_test_count_records (server, "COMMIT");
+
+        zmsg_t *msg = zmsg_new ();
+        zmsg_addstr (msg, "SERVICE-UPDATE");
+        zmsg_addstr (msg, "mqtt");
+        zmsg_addstr (msg, "IPC (12345678)");
+        zmsg_addstr (msg, "_mqtt._tcp.");
+        zmsg_addstr (msg, "_powerservice._sub._mqtt._tcp.");
+        zmsg_addstr (msg, "1883");
+        zhash_t *infos = zhash_new ();
+        zhash_insert (infos, "txtvers", (void *) "1.0.7");
+        zframe_t *frame = zhash_pack (infos);
+        zmsg_append (msg, &frame);
+        zhash_destroy (&infos);
+        mlm_client_send (producer, "SERVICE-UPDATE", &msg);
+        assert (s_test_wait_records (server, 1, "UPDATE", "mqtt") == 1);
+        // the other service was neither updated nor registered again
+        assert (s_test_count_records (server, "COMMIT") == commits);
+        assert (s_test_count_records (server, "UPDATE", "snmp") == 0);
+
+        zstr_sendx (server, "REMOVE-SERVICE", "snmp", NULL);
+        assert (s_test_count_records (server, "REMOVE", "snmp") == 1);
+        assert (s_test_count_records (server, "REMOVE", "mqtt") == 0);
+
+        mlm_client_destroy (&producer);
+        zactor_destroy (&server);
+        remove (state_file);
+    }
+
+    //queries answered from the discovery cache, changes on the DISCOVERY stream
+    {
+        zactor_t *server = s_test_server (endpoint);
+        zstr_sendx (server, "PRODUCER", "DISCOVERY-TEST", NULL);
+        zstr_sendx (server, "SET-DISCOVERY-RESOLVE", "lazy", "4", "60000", NULL);
+        const size_t https = 25;
+        char name[32];
+        for (size_t i = 0; i < https; i++) {
+            snprintf (name, sizeof (name), "IPC (%04zu)", i);
+            zstr_sendx (server, "ADD-DISCOVERED", name, "_https._tcp", "local",
+                "ipc.local", "10.0.0.1", "443", "_powerservice._sub._https._tcp", "txtvers=1.0.0", NULL);
+        }
+        zstr_sendx (server, "ADD-DISCOVERED", "IPC (0000)", "_mqtt._tcp", "local",
+            "ipc.local", "10.0.0.1", "1883", "", NULL);
+        mlm_client_t *requester = s_test_client (endpoint, "fty-mdns-sd-test-requester");
+
+        // last page of the subtype listing
+        zmsg_t *reply = s_test_request (requester, "LIST-SERVICES",
+            "SUBTYPE", "_powerservice._sub._https._tcp.", "20", "10", NULL);
+        std::vector<long> page = s_test_reply_fields (reply, "SERVICES", 3);
+        assert (page[0] == long (https) && page[1] == 20 && page[2] == long (https) - 20);
+        assert (zmsg_size (reply) == 2 * size_t (page[2]));
+        zframe_t *frame = zmsg_pop (reply);
+        zhash_t *definition = zhash_unpack (frame);
+        assert (streq ((char *) zhash_lookup (definition, "name"), "IPC (0020)"));
+        assert (streq ((char *) zhash_lookup (definition, "port"), "443"));
+        assert (streq ((char *) zhash_lookup (definition, "resolved"), "1"));
+        zhash_destroy (&definition);
+        zframe_destroy (&frame);
+        zmsg_destroy (&reply);
+
+        // one instance, by name and type, then by key once removed
+        zstr_sendx (server, "REMOVE-DISCOVERED", "IPC (0001)._https._tcp.local", NULL);
+        reply = s_test_request (requester, "GET-SERVICE", "IPC (0000)", "_mqtt._tcp", NULL);
+        s_test_reply_fields (reply, "SERVICE", 0);
+        assert (zmsg_size (reply) == 2);
+        zmsg_destroy (&reply);
+        reply = s_test_request (requester, "GET-SERVICE", "IPC (0001)._https._tcp.local", NULL);
+        s_test_reply_fields (reply, "ERROR", 0);
+        char *reason = zmsg_popstr (reply);
+        assert (streq (reason, "NOT-FOUND"));
+        zstr_free (&reason);
+        zmsg_destroy (&reply);
+
+        // sequence number and size of the cache so far
+        reply = s_test_request (requester, "SNAPSHOT", NULL);
+        std::vector<long> snapshot = s_test_reply_fields (reply, "SNAPSHOT", 2);
+        assert (snapshot[1] == long (https));
+        zmsg_destroy (&reply);
+        long seq = snapshot[0];
+
+        //deltas on the discovery stream
+        mlm_client_t *listener = s_test_client (endpoint, "fty-mdns-sd-test-listener");
+        int r = mlm_client_set_consumer (listener, "DISCOVERY-TEST", ".*");
+        assert (r == 0);
+        zstr_sendx (server, "ADD-DISCOVERED", "IPC (0000)", "_mqtt._tcp", "local",
+            "ipc.local", "10.0.0.1", "1883", "", NULL);     // unchanged, no delta
+        zstr_sendx (server, "ADD-DISCOVERED", "IPC (0000)", "_mqtt._tcp", "local",
+            "ipc.local", "10.0.0.1", "8883", "", NULL);
+        zstr_sendx (server, "REMOVE-DISCOVERED", "IPC (0000)._mqtt._tcp.local", NULL);
+        const char *expected[] = { "UPDATED", "REMOVED" };
+        for (size_t i = 0; i < 2; i++) {
+            reply = mlm_client_recv (listener);
+            assert (reply);
+            assert (streq (mlm_client_subject (listener), expected[i]));
+            std::vector<long> delta = s_test_reply_fields (reply, expected[i], 1);
+            assert (delta[0] == seq + long (i) + 1);
+            assert (zmsg_size (reply) == 2);
+            zmsg_destroy (&reply);
+        }
+        mlm_client_destroy (&listener);
+
+        // resynchronisation: missed deltas, then full state
+        reply = s_test_request (requester, "SNAPSHOT", std::to_string (seq).c_str (), NULL);
+        std::vector<long> deltas = s_test_reply_fields (reply, "DELTAS", 2);
+        assert (deltas[0] == seq + 2 && deltas[1] == 2);
+        assert (zmsg_size (reply) == 4 * 2);
+        zmsg_destroy (&reply);
+        reply = s_test_request (requester, "SNAPSHOT", NULL);
+        snapshot = s_test_reply_fields (reply, "SNAPSHOT", 2);
+        assert (snapshot[0] == seq + 2 && snapshot[1] == long (https) - 1);
+        assert (zmsg_size (reply) == 2 * size_t (snapshot[1]));
+        zmsg_destroy (&reply);
+
+        // nothing browsed, nothing to resolve
+        zhash_t *stats = s_test_stats (requester);
+        assert (s_test_stat (stats, "resolver_queue_depth") == 0);
+        assert (s_test_stat (stats, "resolver_misses") == 0);
+        assert (s_test_stat (stats, "resolver_joined") == 0);
+        assert (s_test_stat (stats, "resolver_hit_ratio") == 0);
+        zhash_destroy (&stats);
+
+        mlm_client_destroy (&requester);
+        zactor_destroy (&server);
+    }
+
+    //avahi-daemon restart: services registered again from memory, fty-info is not asked again
+    {
+        zactor_t *server = s_test_server (endpoint);
+        s_test_start_default (server, state_file, "1.0.0");
+        zstr_sendx (server, "ADD-SERVICE", "mqtt",
+                "IPC (12345678)", "_mqtt._tcp.", "_powerservice._sub._mqtt._tcp.", "1883", "txtvers=1.0.0", NULL);
+        mlm_client_t *requester = s_test_client (endpoint, "fty-mdns-sd-test-requester");
+        zhash_t *before = s_test_stats (requester);
+
+        size_t commits = s_test_count_records (server, "COMMIT");
+        int64_t start = zclock_mono ();
+        zstr_sendx (server, "SIMULATE-DAEMON-RESTART", "100", NULL);
+        assert (s_test_count_records (server, "LOST") == 1);
+        // default and mqtt
+        assert (s_test_wait_records (server, commits + 2, "COMMIT") == commits + 2);
+        if (verbose)
+            printf ("   services back %" PRIi64 " ms after the daemon loss\n", zclock_mono () - start);
+
+        zhash_t *after = s_test_stats (requester);
+        assert (s_test_stat (after, "client_reconnects") == s_test_stat (before, "client_reconnects") + 1);
+        assert (s_test_stat (after, "recovery.count") == s_test_stat (before, "recovery.count") + 1);
+        assert (s_test_stat (after, "info_requests") == s_test_stat (before, "info_requests"));
+        zhash_destroy (&before);
+        zhash_destroy (&after);
+
+        mlm_client_destroy (&requester);
+        zactor_destroy (&server);
+        remove (state_file);
+    }
+
+    //publishing policy: only the service it names is registered again
+    {
+        zactor_t *server = s_test_server (NULL);
+        s_test_start_default (server, state_file, "1.0.0");
+        zstr_sendx (server, "ADD-SERVICE", "mqtt",
+                "IPC (12345678)", "_mqtt._tcp.", "_powerservice._sub._mqtt._tcp.", "1883", "txtvers=1.0.0", NULL);
+        size_t commits = s_test_count_records (server, "COMMIT", "mqtt");
+        size_t defaults = s_test_count_records (server, "COMMIT", DEFAULT_SERVICE_KEY);
+        zstr_sendx (server, "SET-PUBLISH-POLICY", "mqtt", "lo", "ipv4", NULL);
+        assert (s_test_count_records (server, "COMMIT", "mqtt") == commits + 1);
+        assert (s_test_count_records (server, "COMMIT", DEFAULT_SERVICE_KEY) == defaults);
+        // same policy again, nothing to do
+        zstr_sendx (server, "SET-PUBLISH-POLICY", "mqtt", "lo", "ipv4", NULL);
+        zstr_sendx (server, "SET-PUBLISH-POLICY", "*", "", "ipx", NULL);
+        assert (s_test_count_records (server, "COMMIT", "mqtt") == commits + 1);
+        zactor_destroy (&server);
+        remove (state_file);
+    }
+
+    //several subtypes: diffed, only a withdrawn one registers the service again
+    {
+        zactor_t *server = s_test_server (NULL);
+        // the publisher starts with the default service
+        s_test_start_default (server, state_file, "1.0.0");
+        zstr_sendx (server, "ADD-SERVICE", "ups", "IPC (12345678)", "_https._tcp.",
+            "ups,_powerservice._sub._https._tcp.", "443", "txtvers=1.0.0", NULL);
+        assert (s_test_count_records (server, "COMMIT", "ups") == 1);
+        size_t defines = s_test_count_records (server, "DEFINE", "ups");
+        // same list in another order, suppressed
+        zstr_sendx (server, "UPDATE-SERVICE", "ups", "IPC (12345678)", "_https._tcp.",
+            "_powerservice._sub._https._tcp., _ups._sub._https._tcp.", "443", "txtvers=1.0.0", NULL);
+        assert (s_test_count_records (server, "DEFINE", "ups") == defines);
+        assert (s_test_count_records (server, "UPDATE", "ups") == 0);
+        // one more, added to the registered service
+        zstr_sendx (server, "UPDATE-SERVICE", "ups", "IPC (12345678)", "_https._tcp.",
+            "ups,powerservice,pdu", "443", "txtvers=1.0.0", NULL);
+        assert (s_test_count_records (server, "SUBTYPE", "ups") == 1);
+        assert (s_test_count_records (server, "COMMIT", "ups") == 1);
+        // one less
+        zstr_sendx (server, "UPDATE-SERVICE", "ups", "IPC (12345678)", "_https._tcp.",
+            "ups,pdu", "443", "txtvers=1.0.0", NULL);
+        assert (s_test_count_records (server, "COMMIT", "ups") == 2);
+        zactor_destroy (&server);
+        remove (state_file);
+    }
+
+    //TXT over the budget: low priority keys go to a secondary instance
+    {
+        zactor_t *server = s_test_server (NULL);
+        // the publisher starts with the default service
+        s_test_start_default (server, state_file, "1.0.0");
+        zstr_sendx (server, "SET-TXT-BUDGET", "40", "txtvers,uuid", "move", NULL);
+        zstr_sendx (server, "ADD-SERVICE", "big", "IPC (12345678)", "_https._tcp.", "", "443",
+            "txtvers=1.0.0", "uuid=12345678", "contact=admin", "description=rack 4", NULL);
+        assert (s_test_count_records (server, "COMMIT", "big") == 1);
+        assert (s_test_count_records (server, "COMMIT", "big" TXT_MORE_SUFFIX) == 1);
+        // within the budget again: the secondary instance is withdrawn
+        zstr_sendx (server, "UPDATE-SERVICE", "big", "IPC (12345678)", "_https._tcp.", "", "443",
+            "txtvers=1.0.1", "uuid=12345678", NULL);
+        assert (s_test_count_records (server, "REMOVE", "big" TXT_MORE_SUFFIX) == 1);
+        assert (s_test_count_records (server, "UPDATE", "big") == 1);
+        zactor_destroy (&server);
+        remove (state_file);
+    }
+
+    //devices of the ASSETS stream: announced on their behalf, a few at a time
+    {
+        zactor_t *server = s_test_server (endpoint);
+        // the publisher starts with the default service
+        s_test_start_default (server, state_file, "1.0.0");
+        zstr_sendx (server, "SET-PROXY-RATE", "20", "2", NULL);
+        zstr_sendx (server, "SET-PROXY", "ups,epdu", "_https._tcp.", "443", NULL);
+        mlm_client_t *assets = s_test_client (endpoint, "fty-mdns-sd-test-assets");
+        int r = mlm_client_set_producer (assets, FTY_PROTO_STREAM_ASSETS);
+        assert (r == 0);
+        for (int i = 0; i < 6; i++) {
+            std::string name = "ups-" + std::to_string (i);
+            std::string address = "10.0.0." + std::to_string (10 + i);
+            s_test_send_asset (assets, name.c_str (), FTY_PROTO_ASSET_OP_CREATE, "ups", address.c_str ());
+        }
+        // not proxied: another subtype, no address
+        s_test_send_asset (assets, "sensor-1", FTY_PROTO_ASSET_OP_CREATE, "sensor", "10.0.0.30");
+        s_test_send_asset (assets, "epdu-1", FTY_PROTO_ASSET_OP_CREATE, "epdu", NULL);
+        assert (s_test_wait_proxies (server, 6));
+        assert (s_test_count_records (server, "COMMIT", "proxy/ups-0") == 1);
+        assert (s_test_count_records (server, "COMMIT", "proxy/sensor-1") == 0);
+        assert (s_test_count_records (server, "DEFINE", "proxy/epdu-1") == 0);
+        // 2 at once, then one every 50 ms
+        int64_t span = s_test_records_span (server, "COMMIT", "proxy/");
+        assert (span >= 150000);
+        if (verbose)
+            printf ("   6 proxied devices committed over %" PRIi64 " ms\n", span / 1000);
+
+        // same asset again: nothing to publish; moved: registered again
+        s_test_send_asset (assets, "ups-1", FTY_PROTO_ASSET_OP_UPDATE, "ups", "10.0.0.11");
+        s_test_send_asset (assets, "ups-0", FTY_PROTO_ASSET_OP_UPDATE, "ups", "10.0.1.10");
+        assert (s_test_wait_records (server, 2, "COMMIT", "proxy/ups-0") == 2);
+        assert (s_test_count_records (server, "COMMIT", "proxy/ups-1") == 1);
+        assert (s_test_count_records (server, "UPDATE", "proxy/ups-1") == 0);
+
+        // gone from the inventory, or no longer a proxied subtype
+        s_test_send_asset (assets, "ups-2", FTY_PROTO_ASSET_OP_DELETE, "ups", "10.0.0.12");
+        assert (s_test_wait_records (server, 1, "REMOVE", "proxy/ups-2") == 1);
+        assert (s_test_wait_proxies (server, 5));
+        zstr_sendx (server, "SET-PROXY", "epdu", "_https._tcp.", "443", NULL);
+        assert (s_test_wait_proxies (server, 0));
+        assert (s_test_count_records (server, "REMOVE", "proxy/ups-5") == 1);
+        mlm_client_destroy (&assets);
+        zactor_destroy (&server);
+        remove (state_file);
+    }
 
-    zclock_sleep (1000);
+    //metrics published periodically on the METRICS stream
+    {
+        zactor_t *server = s_test_server (endpoint);
+        mlm_client_t *metrics = s_test_client (endpoint, "fty-mdns-sd-test-metrics");
+        int r = mlm_client_set_consumer (metrics, FTY_PROTO_STREAM_METRICS, "mdns-sd.updates_applied@.*");
+        assert (r == 0);
+        zstr_sendx (server, "SET-METRICS", "50", NULL);
+        zmsg_t *reply = mlm_client_recv (metrics);
+        assert (reply);
+        assert (streq (mlm_client_subject (metrics), "mdns-sd.updates_applied@fty-mdns-sd-test"));
+        zmsg_destroy (&reply);
+        zstr_sendx (server, "SET-METRICS", "0", NULL);
+        mlm_client_destroy (&metrics);
+        zactor_destroy (&server);
+    }
+
+    //restart: the last published announcement is back before fty-info answers
+    {
+        s_test_save_state (state_file, "1.0.6");
+        zactor_t *restarted = s_test_server (endpoint);
+        int64_t start = zclock_mono ();
+        zstr_sendx (restarted, "SET-STATE-FILE", state_file, NULL);
+        zstr_sendx (restarted, "DO-DEFAULT-ANNOUNCE", "INFO", NULL);
+        assert (s_test_count_records (restarted, "COMMIT") == 1);
+        if (verbose)
+            printf ("   default service announced from state after %" PRIi64 " ms\n", zclock_mono () - start);
+
+        // fty-info answers txtvers 1.0.0, the saved one is 1.0.6: one update
+        zactor_t *fty_info = zactor_new (s_test_fty_info, (void*) endpoint);
+        assert (s_test_wait_records (restarted, 1, "UPDATE", DEFAULT_SERVICE_KEY) == 1);
+        assert (s_test_count_records (restarted, "COMMIT") == 1);
+
+        zactor_destroy (&restarted);
+        zactor_destroy (&fty_info);
+        remove (state_file);
+    }
+
+    //restart after collisions: the name found free last time is registered again
+    {
+        zhash_t *txt = zhash_new ();
+        zhash_insert (txt, "txtvers", (void *) "1.0.0");
+        announce_state_save (state_file, "IPC (12345678)", "_https._tcp.",
+            "_powerservice._sub._https._tcp.", "443", txt, "IPC (12345678) #3");
+        zhash_destroy (&txt);
+
+        zactor_t *restarted = s_test_server (NULL);
+        zstr_sendx (restarted, "SET-STATE-FILE", state_file, NULL);
+        assert (s_test_count_records (restarted, "COMMIT") == 1);
+        // established under the saved name, which is kept
+        char *name = NULL, *type = NULL, *stype = NULL, *port = NULL, *published = NULL;
+        assert (announce_state_load (state_file, &name, &type, &stype, &port, &txt, &published) == 0);
+        assert (published && streq (published, "IPC (12345678) #3"));
+        zstr_free (&name);
+        zstr_free (&type);
+        zstr_free (&stype);
+        zstr_free (&port);
+        zstr_free (&published);
+        zhash_destroy (&txt);
+
+        zactor_destroy (&restarted);
+        remove (state_file);
+    }
 
-    zstr_sendx (server, "SET-DEFAULT-SERVICE",
-            "IPC (12345678)","_https._tcp.","_powerservice._sub._https._tcp.","443", NULL);
-    zstr_sendx (server, "SET-DEFAULT-TXT",
-            "txtvers","1.0.0",NULL);
+    //jitter: the first registration waits its delay, a large TXT update too
+    {
+        zhash_t *txt = zhash_new ();
+        zhash_insert (txt, "txtvers", (void *) "1.0.0");
+        announce_state_save (state_file, "IPC (12345678)", "_https._tcp.", "", "443", txt, NULL);
+        zhash_destroy (&txt);
+        // same generator as the actor: the delays of this uid are known
+        AnnounceJitter expected (400, "ipc-6");
+        int64_t first = expected.next ();
+        int64_t second = expected.next ();
+        assert (first > 200 && second > 200);
+
+        zactor_t *jittered = s_test_server (NULL);
+        zstr_sendx (jittered, "SET-JITTER", "400", "100", "ipc-6", NULL);
+        int64_t start = zclock_mono ();
+        zstr_sendx (jittered, "SET-STATE-FILE", state_file, NULL);
+        assert (s_test_count_records (jittered, "COMMIT") == 0);
+        assert (s_test_wait_records (jittered, 1, "COMMIT") == 1);
+        assert (zclock_mono () - start >= first);
 
-    //do first announcement
-    //this test needs avahi-deamon running
-    //zstr_sendx (server, "DO-DEFAULT-ANNOUNCE", "INFO",NULL);
+        // small update: at once
+        zstr_sendx (jittered, "UPDATE-SERVICE", DEFAULT_SERVICE_KEY, "IPC (12345678)", "_https._tcp.", "", "443",
+            "txtvers=1.0.1", NULL);
+        assert (s_test_count_records (jittered, "UPDATE") == 1);
+        // large one: after the next delay
+        std::string description (120, 'x');
+        start = zclock_mono ();
+        zstr_sendx (jittered, "UPDATE-SERVICE", DEFAULT_SERVICE_KEY, "IPC (12345678)", "_https._tcp.", "", "443",
+            "txtvers=1.0.2", ("description=" + description).c_str (), NULL);
+        assert (s_test_count_records (jittered, "UPDATE") == 1);
+        assert (s_test_wait_records (jittered, 2, "UPDATE") == 2);
+        assert (zclock_mono () - start >= second);
+        if (verbose)
+            printf ("   first registration after %" PRIi64 " ms, large update after %" PRIi64 " ms\n", first, second);
+
+        zactor_destroy (&jittered);
+        remove (state_file);
+    }
 
-    zactor_destroy (&server);
+    zactor_destroy (&broker);
 
     printf (" * fty_mdns_sd_server: OK\n");
 }
@@ -0,0 +1,122 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   link_monitor.cc
+ *
+ */
+
+#include "link_monitor.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fty_log.h>
+
+LinkMonitor::~LinkMonitor()
+{
+    close();
+}
+
+int LinkMonitor::open()
+{
+    if (_fd >= 0)
+        return 0;
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        log_error("Cannot open netlink socket: %s", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        log_error("Cannot subscribe to link notifications: %s", strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+    _fd = fd;
+    return 0;
+}
+
+void LinkMonitor::close()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+}
+
+bool LinkMonitor::drain()
+{
+    if (_fd < 0)
+        return false;
+    bool changed = false;
+    char buffer[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+    for (;;) {
+        ssize_t size = recv(_fd, buffer, sizeof(buffer), 0);
+        if (size < 0) {
+            // ENOBUFS: notifications were lost, assume something changed
+            if (errno == ENOBUFS)
+                changed = true;
+            else if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (size == 0)
+            break;
+        for (struct nlmsghdr *h = (struct nlmsghdr *) buffer; NLMSG_OK(h, (size_t) size); h = NLMSG_NEXT(h, size)) {
+            if (h->nlmsg_type == RTM_NEWLINK || h->nlmsg_type == RTM_DELLINK)
+                changed = true;
+        }
+    }
+    return changed;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void link_monitor_test (bool verbose)
+{
+    printf (" * Link monitor test\n");
+
+    LinkMonitor monitor;
+    assert (monitor.fd () == -1);
+    assert (!monitor.drain ());
+    if (monitor.open () == 0) {
+        assert (monitor.fd () >= 0);
+        assert (monitor.open () == 0);
+        // nothing pending, does not block
+        monitor.drain ();
+        monitor.close ();
+        assert (monitor.fd () == -1);
+    }
+    else
+        printf ("   netlink not available, skipped\n");
+    (void) verbose;
+
+    printf (" * Link monitor test: OK\n");
+}
@@ -0,0 +1,58 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   link_monitor.h
+ *
+ * Notifications of network interfaces coming, going or being renamed, read
+ * from a non-blocking rtnetlink socket which the caller polls (e.g. with
+ * zloop_poller), so that interface names can be resolved again.
+ */
+
+#ifndef LINK_MONITOR_H
+#define LINK_MONITOR_H
+
+class LinkMonitor {
+public:
+    LinkMonitor() = default;
+    ~LinkMonitor();
+
+    LinkMonitor(const LinkMonitor&) = delete;
+    LinkMonitor& operator=(const LinkMonitor&) = delete;
+
+    // subscribe to link notifications, return 0 or -1
+    int open();
+    void close();
+
+    // socket to poll for input, -1 if not open
+    int fd() const { return _fd; }
+
+    // read all pending notifications, return true if a link was added,
+    // removed or changed
+    bool drain();
+
+private:
+    int _fd = -1;
+};
+
+//  Self test of this class.
+void link_monitor_test (bool verbose);
+
+#endif
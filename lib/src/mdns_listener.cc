@@ -0,0 +1,925 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_listener.cc
+ *
+ */
+
+#include "mdns_listener.h"
+#include "mdns_socket.h"
+#include "avahi_browser.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <strings.h>
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <unistd.h>
+
+#include <avahi-common/address.h>
+#include <fty_log.h>
+
+// datagrams read at once from a socket before going back to the loop
+#define RECEIVE_BATCH 32
+// ms between two sweeps of the records not seen for their TTL
+#define SWEEP_INTERVAL 1000
+// bounds of the tables, against a network flooding us with names
+#define MAX_INSTANCES 65536
+#define MAX_HOSTS 65536
+
+static inline char
+s_lower (char c)
+{
+    return (c >= 'A' && c <= 'Z') ? char (c - 'A' + 'a') : c;
+}
+
+//  append labels [from, to) of name, dot separated, in lower case
+static void
+s_append_labels (std::string& out, const MdnsName& name, size_t from, size_t to)
+{
+    if (from >= to)
+        return;
+    size_t start = out.size ();
+    size_t len = to - from - 1;
+    for (size_t i = from; i < to; i++)
+        len += name.len[i];
+    out.resize (start + len);
+    char *p = &out[start];
+    for (size_t i = from; i < to; i++) {
+        if (i > from)
+            *p++ = '.';
+        for (size_t j = 0; j < name.len[i]; j++)
+            *p++ = s_lower (name.label[i][j]);
+    }
+}
+
+//  labels of a from index ia on equal to the ones of b from ib on, ignoring case
+static bool
+s_suffix_equals (const MdnsName& a, size_t ia, const MdnsName& b, size_t ib)
+{
+    if (a.count - ia != b.count - ib)
+        return false;
+    for (; ia < a.count; ia++, ib++) {
+        if (a.len[ia] != b.len[ib])
+            return false;
+        for (size_t j = 0; j < a.len[ia]; j++)
+            if (s_lower (a.label[ia][j]) != s_lower (b.label[ib][j]))
+                return false;
+    }
+    return true;
+}
+
+static inline void
+s_extend (int64_t& expires, int64_t now, uint32_t ttl)
+{
+    expires = std::max (expires, now + int64_t (ttl) * 1000);
+}
+
+MdnsListener::MdnsListener(zloop_t *loop, DiscoveryCache *cache) :
+    MdnsListener(loop, cache, Options())
+{
+}
+
+MdnsListener::MdnsListener(zloop_t *loop, DiscoveryCache *cache, const Options& options) :
+    _loop(loop),
+    _cache(cache),
+    _options(options)
+{
+    _touched.reserve (16);
+    _changedHosts.reserve (16);
+    _key.reserve (MDNS_MAX_NAME);
+    _name.reserve (MDNS_MAX_NAME);
+}
+
+MdnsListener::~MdnsListener()
+{
+    stop ();
+}
+
+void MdnsListener::addType(const std::string& type)
+{
+    std::string value = DiscoveryCache::normalize (type);
+    std::transform (value.begin (), value.end (), value.begin (), s_lower);
+    _types.insert (value);
+    _baseTypes.insert (AvahiBrowser::baseType (value));
+}
+
+bool MdnsListener::kept(const std::string& type) const
+{
+    return _types.empty () || _baseTypes.count (type);
+}
+
+bool MdnsListener::accepted(const Instance& instance) const
+{
+    if (_types.empty () || _types.count (instance.type))
+        return true;
+    for (const auto& subtype : instance.subtypes)
+        if (_types.count (subtype))
+            return true;
+    return false;
+}
+
+//  --------------------------------------------------------------------------
+//  Sockets
+
+int MdnsListener::start()
+{
+    if (running ())
+        return 0;
+    _sock4 = mdns_socket_open (AF_INET, _options.port);
+    if (_sock4 < 0) {
+        int error = _sock4;
+        log_error ("Failed to open mDNS listener on port %d: %s", _options.port, strerror (-error));
+        _sock4 = -1;
+        return error;
+    }
+    if (_options.ipv6) {
+        _sock6 = mdns_socket_open (AF_INET6, _options.port);
+        if (_sock6 < 0) {
+            log_warning ("No IPv6 mDNS listener (%s), IPv4 only", strerror (-_sock6));
+            _sock6 = -1;
+        }
+    }
+    for (int fd : { _sock4, _sock6 }) {
+        if (fd < 0) continue;
+        zmq_pollitem_t item = { NULL, fd, ZMQ_POLLIN, 0 };
+        zloop_poller (_loop, &item, MdnsListener::onReadable, this);
+    }
+    refreshInterfaces ();
+    _sweepTimer = zloop_timer (_loop, SWEEP_INTERVAL, 0, MdnsListener::onSweep, this);
+    log_info ("Listening to mDNS responses on port %d", _options.port);
+    return 0;
+}
+
+void MdnsListener::stop()
+{
+    for (int *fd : { &_sock4, &_sock6 }) {
+        if (*fd < 0) continue;
+        zmq_pollitem_t item = { NULL, *fd, ZMQ_POLLIN, 0 };
+        zloop_poller_end (_loop, &item);
+        close (*fd);
+        *fd = -1;
+    }
+    if (_sweepTimer != -1) {
+        zloop_timer_end (_loop, _sweepTimer);
+        _sweepTimer = -1;
+    }
+    _joined4.clear ();
+    _joined6.clear ();
+}
+
+/**
+ * Join the group on the interfaces up, the loopback included: services of
+ * this host answered there are seen as well. Memberships of the interfaces
+ * gone went with them.
+ */
+void MdnsListener::refreshInterfaces()
+{
+    if (!running ())
+        return;
+    struct ifaddrs *list = NULL;
+    if (getifaddrs (&list) != 0) {
+        log_error ("getifaddrs failed: %s", strerror (errno));
+        return;
+    }
+    std::set<int> up4, up6;
+    for (struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_name || !ifa->ifa_addr || !(ifa->ifa_flags & IFF_UP)
+         || !(ifa->ifa_flags & (IFF_MULTICAST | IFF_LOOPBACK)))
+            continue;
+        int index = int (if_nametoindex (ifa->ifa_name));
+        if (index <= 0)
+            continue;
+        if (ifa->ifa_addr->sa_family == AF_INET)
+            up4.insert (index);
+        else
+        if (ifa->ifa_addr->sa_family == AF_INET6)
+            up6.insert (index);
+    }
+    freeifaddrs (list);
+
+    for (int index : up4)
+        if (!_joined4.count (index) && mdns_socket_join (_sock4, AF_INET, index))
+            _joined4.insert (index);
+    if (_sock6 >= 0)
+        for (int index : up6)
+            if (!_joined6.count (index) && mdns_socket_join (_sock6, AF_INET6, index))
+                _joined6.insert (index);
+    // gone interfaces are joined again when they come back
+    for (auto it = _joined4.begin (); it != _joined4.end (); )
+        it = up4.count (*it) ? std::next (it) : _joined4.erase (it);
+    for (auto it = _joined6.begin (); it != _joined6.end (); )
+        it = up6.count (*it) ? std::next (it) : _joined6.erase (it);
+}
+
+int MdnsListener::onReadable(zloop_t *loop, zmq_pollitem_t *item, void *arg)
+{
+    (void) loop;
+    ((MdnsListener *) arg)->receive (item->fd);
+    return 0;
+}
+
+int MdnsListener::onSweep(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id;
+    ((MdnsListener *) arg)->sweep (zclock_mono ());
+    return 0;
+}
+
+void MdnsListener::receive(int fd)
+{
+    uint8_t buffer[MDNS_MAX_PACKET];
+    for (int i = 0; i < RECEIVE_BATCH; i++) {
+        struct sockaddr_storage from;
+        int index;
+        bool truncated;
+        ssize_t size = mdns_socket_recv (fd, buffer, sizeof (buffer), &from, &index, &truncated);
+        if (size < 0)
+            break;
+        if (truncated) {
+            _counters.packets++;
+            _counters.malformed++;
+            continue;
+        }
+        feed (buffer, size_t (size), index, zclock_mono ());
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Decoding
+
+void MdnsListener::feed(const uint8_t *data, size_t size, int ifindex, int64_t now)
+{
+    _counters.packets++;
+    MdnsReader packet (data, size);
+    if (!packet.valid ()) {
+        _counters.malformed++;
+        return;
+    }
+    // queries, and their known answers, are not authoritative
+    if (!packet.response ())
+        return;
+    _counters.responses++;
+    _touched.clear ();
+    _changedHosts.clear ();
+    _lastInstanceName = NULL;
+    _lastHostName = NULL;
+
+    // the records read before a fault are bounds-checked, and kept
+    MdnsReader::Record record;
+    while (packet.next (record)) {
+        _counters.records++;
+        if ((record.klass & ~MDNS_CLASS_FLUSH) != MDNS_CLASS_IN)
+            continue;
+        switch (record.type) {
+            case MDNS_TYPE_PTR:
+                onPtr (packet, record, ifindex, now);
+                break;
+            case MDNS_TYPE_SRV:
+                onSrv (packet, record, ifindex, now);
+                break;
+            case MDNS_TYPE_TXT:
+                onTxt (packet, record, ifindex, now);
+                break;
+            case MDNS_TYPE_A:
+            case MDNS_TYPE_AAAA:
+                onAddress (packet, record, now);
+                break;
+            default:
+                break;
+        }
+    }
+    if (packet.malformed ())
+        _counters.malformed++;
+
+    // a new address of a host goes to all of its services
+    for (auto *host : _changedHosts)
+        for (auto& it : _instances)
+            if (it.second.host == host->first) {
+                it.second.changed = true;
+                touch (&it);
+            }
+    for (auto *entry : _touched)
+        publish (entry->first, entry->second, now);
+}
+
+/**
+ * Instance named by labels: instance label, service and protocol labels,
+ * domain. Its key is built in _key as DiscoveredService::key() does it.
+ */
+MdnsListener::instances_t::value_type*
+MdnsListener::instance(const MdnsName& labels, int ifindex, int64_t now)
+{
+    // names of a packet are compressed: the records of an instance point
+    // at the same labels, which name it the same way
+    if (labels.count && labels.label[0] == _lastInstanceName) {
+        _lastInstance->second.ifindex = ifindex;
+        return _lastInstance;
+    }
+    if (labels.count < 4 || labels.protocolLabel () != 2)
+        return NULL;
+    _key.clear ();
+    for (size_t i = 0; i < labels.len[0]; i++) {
+        char c = labels.label[0][i];
+        if (c == '.' || c == '\\')
+            _key += '\\';
+        _key += c;
+    }
+    _key += '.';
+    s_append_labels (_key, labels, 1, labels.count);
+    auto it = _instances.find (_key);
+    if (it == _instances.end ()) {
+        _name.clear ();
+        s_append_labels (_name, labels, 1, 3);
+        if (!kept (_name) || _instances.size () >= MAX_INSTANCES)
+            return NULL;
+        Instance instance;
+        instance.name.assign (labels.at (0));
+        instance.type = _name;
+        s_append_labels (instance.domain, labels, 3, labels.count);
+        instance.expires = now;
+        it = _instances.emplace (_key, std::move (instance)).first;
+    }
+    it->second.ifindex = ifindex;
+    _lastInstanceName = labels.label[0];
+    _lastInstance = &*it;
+    return &*it;
+}
+
+void MdnsListener::touch(instances_t::value_type* instance)
+{
+    if (std::find (_touched.begin (), _touched.end (), instance) == _touched.end ())
+        _touched.push_back (instance);
+}
+
+/**
+ * PTR of a type to one of its instances, or of a subtype
+ * (_powerservice._sub._https._tcp.local) to an instance it tags.
+ */
+void MdnsListener::onPtr(const MdnsReader& packet, const MdnsReader::Record& record, int ifindex, int64_t now)
+{
+    size_t target;
+    if (!packet.labels (record.name, _owner) || !packet.ptr (record, target) || !packet.labels (target, _target))
+        return;
+    int protocol = _owner.protocolLabel ();
+    bool subtype = protocol == 3 && _owner.len[1] == 4 && strncasecmp (_owner.label[1], "_sub", 4) == 0;
+    if ((protocol != 1 && !subtype) || !s_suffix_equals (_owner, subtype ? 2 : 0, _target, 1))
+        return;
+    auto *entry = instance (_target, ifindex, now);
+    if (!entry)
+        return;
+    Instance& instance = entry->second;
+    if (subtype) {
+        _name.clear ();
+        s_append_labels (_name, _owner, 0, 4);
+    }
+    if (record.ttl == 0) {
+        if (!subtype)
+            goodbye (entry);
+        else
+        if (instance.subtypes.erase (_name))
+            _cache->removeSubtype (entry->first, _name);
+        return;
+    }
+    s_extend (instance.expires, now, record.ttl);
+    if (subtype && !instance.subtypes.count (_name)) {
+        instance.subtypes.insert (_name);
+        instance.changed = true;
+    }
+    touch (entry);
+}
+
+void MdnsListener::onSrv(const MdnsReader& packet, const MdnsReader::Record& record, int ifindex, int64_t now)
+{
+    uint16_t port;
+    size_t target;
+    if (!packet.labels (record.name, _owner))
+        return;
+    auto *entry = instance (_owner, ifindex, now);
+    if (!entry)
+        return;
+    if (record.ttl == 0) {
+        goodbye (entry);
+        return;
+    }
+    if (!packet.srv (record, port, target) || !packet.labels (target, _target) || _target.count == 0)
+        return;
+    Instance& instance = entry->second;
+    _name.clear ();
+    s_append_labels (_name, _target, 0, _target.count);
+    if (instance.port != port || instance.host != _name) {
+        instance.port = port;
+        instance.host = _name;
+        instance.changed = true;
+    }
+    s_extend (instance.expires, now, record.ttl);
+    touch (entry);
+}
+
+void MdnsListener::onTxt(const MdnsReader& packet, const MdnsReader::Record& record, int ifindex, int64_t now)
+{
+    // a TXT goodbye goes with the SRV one
+    if (record.ttl == 0 || !packet.txt (record, [](const char *, size_t) {}) || !packet.labels (record.name, _owner))
+        return;
+    auto *entry = instance (_owner, ifindex, now);
+    if (!entry)
+        return;
+    Instance& instance = entry->second;
+    std::string_view rdata ((const char *) packet.data () + record.rdata, record.rdlength);
+    if (instance.txt != rdata) {
+        instance.txt.assign (rdata);
+        instance.changed = true;
+    }
+    s_extend (instance.expires, now, record.ttl);
+    touch (entry);
+}
+
+void MdnsListener::onAddress(const MdnsReader& packet, const MdnsReader::Record& record, int64_t now)
+{
+    const uint8_t *bytes;
+    size_t len;
+    char text[INET6_ADDRSTRLEN];
+    if (record.ttl == 0 || !packet.address (record, bytes, len) || !packet.labels (record.name, _owner)
+     || !inet_ntop (len == 4 ? AF_INET : AF_INET6, bytes, text, sizeof (text)))
+        return;
+    hosts_t::value_type *entry = _lastHost;
+    if (_owner.count == 0 || _owner.label[0] != _lastHostName) {
+        _name.clear ();
+        s_append_labels (_name, _owner, 0, _owner.count);
+        auto it = _hosts.find (_name);
+        if (it == _hosts.end ()) {
+            if (_hosts.size () >= MAX_HOSTS)
+                return;
+            it = _hosts.emplace (_name, Host ()).first;
+        }
+        entry = &*it;
+        _lastHostName = _owner.count ? _owner.label[0] : NULL;
+        _lastHost = entry;
+    }
+    Host& host = entry->second;
+    std::string& address = len == 4 ? host.ipv4 : host.ipv6;
+    int64_t& expires = len == 4 ? host.expires4 : host.expires6;
+    if (address == text)
+        s_extend (expires, now, record.ttl);
+    else
+    if (address.empty () || expires < now) {
+        address = text;
+        expires = now + int64_t (record.ttl) * 1000;
+        if (std::find (_changedHosts.begin (), _changedHosts.end (), entry) == _changedHosts.end ())
+            _changedHosts.push_back (entry);
+    }
+}
+
+void MdnsListener::goodbye(instances_t::value_type* entry)
+{
+    if (_cache->remove (entry->first))
+        _counters.goodbyes++;
+    _touched.erase (std::remove (_touched.begin (), _touched.end (), entry), _touched.end ());
+    if (entry == _lastInstance)
+        _lastInstanceName = NULL;
+    _instances.erase (_instances.find (entry->first));
+}
+
+/**
+ * Put a complete instance in the cache: once new or changed, then only
+ * pushing back its expiry, a quarter of the cache TTL apart at most.
+ */
+void MdnsListener::publish(const std::string& key, Instance& instance, int64_t now)
+{
+    if (instance.host.empty () || !accepted (instance))
+        return;
+    auto host = _hosts.find (instance.host);
+    if (host == _hosts.end ())
+        return;
+    bool v4 = !host->second.ipv4.empty ();
+    const std::string& address = v4 ? host->second.ipv4 : host->second.ipv6;
+    if (address.empty ())
+        return;
+    int64_t expires = std::max (now + _cache->ttl (), instance.expires);
+    if (!instance.changed && instance.refreshed && _cache->find (key)) {
+        if (now - instance.refreshed >= _cache->ttl () / 4) {
+            _cache->touch (key, expires);
+            instance.refreshed = now;
+        }
+        return;
+    }
+
+    DiscoveredService service;
+    service.name = instance.name;
+    service.type = instance.type;
+    service.domain = instance.domain;
+    service.host = instance.host;
+    service.address = address;
+    service.port = instance.port;
+    service.ifindex = instance.ifindex;
+    service.protocol = v4 ? AVAHI_PROTO_INET : AVAHI_PROTO_INET6;
+    service.subtypes = instance.subtypes;
+    const uint8_t *txt = (const uint8_t *) instance.txt.data ();
+    for (size_t offset = 0; offset < instance.txt.size (); offset += 1 + txt[offset]) {
+        std::string_view entry ((const char *) txt + offset + 1, txt[offset]);
+        if (entry.empty ())
+            continue;
+        size_t eq = entry.find ('=');
+        if (eq == std::string_view::npos)
+            service.txt[std::string (entry)] = "";
+        else
+            service.txt[std::string (entry.substr (0, eq))] = std::string (entry.substr (eq + 1));
+    }
+    _cache->upsert (service, now);
+    if (expires > now + _cache->ttl ())
+        _cache->touch (key, expires);
+    instance.changed = false;
+    instance.refreshed = now;
+    _counters.published++;
+}
+
+void MdnsListener::sweep(int64_t now)
+{
+    for (auto it = _instances.begin (); it != _instances.end (); )
+        it = it->second.expires < now ? _instances.erase (it) : std::next (it);
+    for (auto it = _hosts.begin (); it != _hosts.end (); )
+        it = std::max (it->second.expires4, it->second.expires6) < now ? _hosts.erase (it) : std::next (it);
+    if (_options.expire)
+        _cache->expire (now);
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+#include <random>
+#include "alloc_counter.h"
+#include "mdns_responder.h"
+
+//  announcement of an instance of _https._tcp: PTRs of the type and the
+//  subtypes, SRV, TXT and A, any of them left out when empty (port 0 for SRV)
+static size_t
+s_test_response (uint8_t *buffer, size_t size, const std::string& name, const std::string& host,
+    uint16_t port, const char *address, const std::vector<std::string>& subtypes,
+    const std::string& txt, uint32_t ttl = 120)
+{
+    std::string instance = mdns_escape_label (name) + "._https._tcp.local";
+    MdnsWriter writer (buffer, size, 0, MDNS_FLAG_RESPONSE);
+    if (!subtypes.empty ()) {
+        assert (writer.ptr (MdnsWriter::ANSWER, "_https._tcp.local", ttl, instance));
+        for (const auto& subtype : subtypes)
+            assert (writer.ptr (MdnsWriter::ANSWER, subtype + "._sub._https._tcp.local", ttl, instance));
+    }
+    if (port)
+        assert (writer.srv (MdnsWriter::ANSWER, instance, ttl, true, port, host));
+    if (!txt.empty ())
+        assert (writer.txt (MdnsWriter::ANSWER, instance, ttl, true, txt));
+    if (address) {
+        uint8_t bytes[16];
+        bool v6 = strchr (address, ':') != NULL;
+        assert (inet_pton (v6 ? AF_INET6 : AF_INET, address, bytes) == 1);
+        assert (writer.address (MdnsWriter::ADDITIONAL, host, ttl, true, bytes, v6 ? 16 : 4));
+    }
+    return writer.size ();
+}
+
+typedef struct {
+    int added = 0;
+    int updated = 0;
+    int removed = 0;
+} s_test_changes_t;
+
+static void
+s_test_watch (DiscoveryCache& cache, s_test_changes_t& changes)
+{
+    cache.setListener ([&changes](DiscoveryCache::Change change, const DiscoveredService&) {
+        if (change == DiscoveryCache::ADDED) changes.added++;
+        if (change == DiscoveryCache::UPDATED) changes.updated++;
+        if (change == DiscoveryCache::REMOVED) changes.removed++;
+    });
+}
+
+//  every record of a packet through every decoder, as a fuzz target
+static size_t
+s_test_walk (const uint8_t *data, size_t size)
+{
+    MdnsReader packet (data, size);
+    if (!packet.valid ())
+        return 0;
+    size_t seen = 0;
+    char name[MDNS_MAX_NAME];
+    MdnsName labels;
+    MdnsReader::Question question;
+    while (packet.next (question))
+        seen += packet.name (question.name, name, sizeof (name));
+    MdnsReader::Record record;
+    while (packet.next (record)) {
+        size_t target;
+        uint16_t port;
+        const uint8_t *address;
+        size_t len;
+        seen += packet.name (record.name, name, sizeof (name));
+        if (packet.labels (record.name, labels) && labels.count)
+            seen += labels.len[labels.count - 1] + size_t (labels.protocolLabel () + 1);
+        if (packet.ptr (record, target) || packet.srv (record, port, target))
+            seen += packet.name (target, name, sizeof (name));
+        if (packet.address (record, address, len))
+            seen += address[len - 1];
+        packet.txt (record, [&seen](const char *data, size_t len) { seen += size_t (data[len - 1]); });
+    }
+    return seen;
+}
+
+typedef struct {
+    DiscoveryCache *cache;
+    const char *key;
+} s_test_wait_t;
+
+static int
+s_test_found_cb (zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id;
+    s_test_wait_t *wait = (s_test_wait_t *) arg;
+    return wait->cache->find (wait->key) ? -1 : 0;
+}
+
+static int
+s_test_timeout_cb (zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id; (void) arg;
+    return -1;
+}
+
+void mdns_listener_test (bool verbose)
+{
+    printf (" * mDNS listener test\n");
+
+    uint8_t buffer[MDNS_PACKET_SIZE];
+    const std::string txt = std::string ("\x0dtxtvers=1.0.0") + "\x0duuid=12345678" + "\x06secure";
+    const std::string key = "IPC\\.1 (12345678)._https._tcp.local";
+    int64_t now = 1000000;
+
+    //  one announcement, every record in one packet
+    {
+        DiscoveryCache cache;
+        s_test_changes_t changes;
+        s_test_watch (cache, changes);
+        MdnsListener listener (NULL, &cache);
+        size_t size = s_test_response (buffer, sizeof (buffer), "IPC.1 (12345678)", "IPC-3000.local",
+            443, "10.130.38.17", { "_powerservice", "_ups" }, txt);
+        listener.feed (buffer, size, 3, now);
+        assert (listener.counters ().responses == 1 && listener.counters ().records == 6);
+        assert (changes.added == 1 && cache.size () == 1);
+        const DiscoveredService *service = cache.find (key);
+        assert (service);
+        assert (service->name == "IPC.1 (12345678)" && service->type == "_https._tcp" && service->domain == "local");
+        assert (service->host == "ipc-3000.local" && service->address == "10.130.38.17" && service->port == 443);
+        assert (service->ifindex == 3 && service->protocol == AVAHI_PROTO_INET);
+        assert (service->subtypes.count ("_powerservice._sub._https._tcp") && service->subtypes.count ("_ups._sub._https._tcp"));
+        assert (service->txt.size () == 3 && service->txt.at ("uuid") == "12345678" && service->txt.at ("secure") == "");
+        assert (cache.bySubtype ("_ups._sub._https._tcp").size () == 1);
+
+        // the same again: nothing new, and nothing allocated
+        uint64_t allocs = alloc_count ();
+        for (int i = 0; i < 100; i++)
+            listener.feed (buffer, size, 3, now + i);
+        allocs = alloc_count () - allocs;
+        if (verbose && alloc_counting ())
+            printf ("   %" PRIu64 " allocations for 100 known packets\n", allocs);
+        if (alloc_counting ())
+            assert (allocs == 0);
+        assert (changes.added == 1 && changes.updated == 0 && listener.counters ().published == 1);
+
+        // expiry pushed back by the TTL of the records when refreshed
+        listener.feed (buffer, size, 3, now + cache.ttl ());
+        assert (service->expires == now + cache.ttl () + cache.ttl ());
+
+        // TXT changed
+        std::string txt2 = std::string ("\x0dtxtvers=1.0.0") + "\x0duuid=87654321";
+        size = s_test_response (buffer, sizeof (buffer), "IPC.1 (12345678)", "ipc-3000.local", 0, NULL, {}, txt2);
+        listener.feed (buffer, size, 3, now + 1);
+        assert (changes.updated == 1 && service->txt.at ("uuid") == "87654321" && !service->txt.count ("secure"));
+
+        // another address of the host, kept for the one known
+        size = s_test_response (buffer, sizeof (buffer), "IPC.1 (12345678)", "ipc-3000.local", 0, "10.0.0.1", {}, "");
+        listener.feed (buffer, size, 3, now + 2);
+        assert (service->address == "10.130.38.17" && changes.updated == 1);
+        // ... until the known one expires
+        listener.feed (buffer, size, 3, now + 2 * cache.ttl () + 1);
+        assert (service->address == "10.0.0.1" && changes.updated == 2);
+
+        // subtype goodbye, then service goodbye
+        MdnsWriter writer (buffer, sizeof (buffer), 0, MDNS_FLAG_RESPONSE);
+        assert (writer.ptr (MdnsWriter::ANSWER, "_ups._sub._https._tcp.local", 0, key));
+        listener.feed (writer.data (), writer.size (), 3, now + 3);
+        assert (!service->subtypes.count ("_ups._sub._https._tcp") && service->subtypes.size () == 1);
+        writer.reset (0, MDNS_FLAG_RESPONSE);
+        assert (writer.ptr (MdnsWriter::ANSWER, "_https._tcp.local", 0, key));
+        listener.feed (writer.data (), writer.size (), 3, now + 4);
+        assert (changes.removed == 1 && cache.size () == 0 && listener.instances () == 0);
+        assert (listener.counters ().goodbyes == 1);
+
+        // a query with the same records as known answers changes nothing
+        size = s_test_response (buffer, sizeof (buffer), "IPC.1 (12345678)", "ipc-3000.local",
+            443, "10.130.38.17", { "_ups" }, txt);
+        buffer[2] = 0;
+        listener.feed (buffer, size, 3, now + 5);
+        assert (cache.size () == 0 && listener.instances () == 0);
+    }
+
+    //  records over several packets, SRV goodbye, sweep of the stale ones
+    {
+        DiscoveryCache cache (10000);
+        s_test_changes_t changes;
+        s_test_watch (cache, changes);
+        MdnsListener listener (NULL, &cache);
+        size_t size = s_test_response (buffer, sizeof (buffer), "IPC 2", "ipc-2.local", 443, NULL, {}, txt);
+        listener.feed (buffer, size, 1, now);
+        assert (cache.size () == 0 && listener.instances () == 1);
+        size = s_test_response (buffer, sizeof (buffer), "IPC 2", "ipc-2.local", 0, "fe80::1", {}, "");
+        listener.feed (buffer, size, 1, now + 1);
+        const DiscoveredService *service = cache.find ("IPC 2._https._tcp.local");
+        assert (service && service->address == "fe80::1" && service->protocol == AVAHI_PROTO_INET6);
+        assert (service->txt.size () == 3);
+
+        MdnsWriter writer (buffer, sizeof (buffer), 0, MDNS_FLAG_RESPONSE);
+        assert (writer.srv (MdnsWriter::ANSWER, "IPC 2._https._tcp.local", 0, true, 443, "ipc-2.local"));
+        listener.feed (writer.data (), writer.size (), 1, now + 2);
+        assert (cache.size () == 0 && changes.removed == 1);
+
+        // seen once, then silent for longer than its records and the cache TTL
+        size = s_test_response (buffer, sizeof (buffer), "IPC 3", "ipc-3.local", 443, "10.0.0.3", { "_ups" }, txt, 5);
+        listener.feed (buffer, size, 1, now);
+        service = cache.find ("IPC 3._https._tcp.local");
+        assert (service && service->expires == now + 10000);
+        listener.sweep (now + 6000);
+        assert (listener.instances () == 0 && cache.size () == 1);
+        listener.sweep (now + 10001);
+        assert (cache.size () == 0);
+    }
+
+    //  types kept: the base type of a subtype is decoded, the instances
+    //  tagged with it are published
+    {
+        DiscoveryCache cache;
+        MdnsListener listener (NULL, &cache);
+        listener.addType ("_powerservice._sub._https._tcp.");
+        size_t size = s_test_response (buffer, sizeof (buffer), "IPC 4", "ipc-4.local", 443, "10.0.0.4", { "_ups" }, txt);
+        listener.feed (buffer, size, 1, now);
+        assert (cache.size () == 0 && listener.instances () == 1);
+        size = s_test_response (buffer, sizeof (buffer), "IPC 4", "ipc-4.local", 443, "10.0.0.4", { "_powerservice" }, txt);
+        listener.feed (buffer, size, 1, now + 1);
+        assert (cache.size () == 1 && cache.bySubtype ("_powerservice._sub._https._tcp").size () == 1);
+
+        MdnsWriter writer (buffer, sizeof (buffer), 0, MDNS_FLAG_RESPONSE);
+        assert (writer.ptr (MdnsWriter::ANSWER, "_ssh._tcp.local", 120, "other._ssh._tcp.local"));
+        assert (writer.srv (MdnsWriter::ANSWER, "other._ssh._tcp.local", 120, true, 22, "ipc-4.local"));
+        // PTRs of something else than a type are ignored
+        assert (writer.ptr (MdnsWriter::ANSWER, "_services._dns-sd._udp.local", 120, "_https._tcp.local"));
+        assert (writer.ptr (MdnsWriter::ANSWER, "4.0.0.10.in-addr.arpa", 120, "ipc-4.local"));
+        assert (writer.ptr (MdnsWriter::ANSWER, "_https._tcp.local", 120, "other._ssh._tcp.local"));
+        listener.feed (writer.data (), writer.size (), 1, now + 2);
+        assert (cache.size () == 1 && listener.instances () == 1);
+    }
+
+    //  over the network: announcements of the built-in responder on the loopback
+    {
+        uint16_t port = uint16_t (20000 + (getpid () + 13) % 20000);
+        zloop_t *loop = zloop_new ();
+        DiscoveryCache cache;
+        MdnsListener::Options options;
+        options.port = port;
+        options.ipv6 = false;
+        MdnsListener listener (loop, &cache, options);
+        listener.addType ("_https._tcp");
+        assert (listener.start () == 0 && listener.running ());
+
+        MdnsResponder::Options responder_options;
+        responder_options.port = port;
+        responder_options.ipv6 = false;
+        responder_options.hostname = "fty-listener-" + std::to_string (getpid ());
+        PublishPolicy loopback;
+        assert (PublishPolicy::parse ("lo", "ipv4", loopback));
+        MdnsResponder responder (loop, responder_options);
+        responder.setDefaultPolicy (loopback);
+        map_string_t map = { { "uuid", "12345678" } };
+        responder.setService ("https", "IPC (12345678)", "_https._tcp", "ups", "443");
+        responder.setTxtRecords ("https", map);
+        responder.start ();
+
+        s_test_wait_t wait = { &cache, "IPC (12345678)._https._tcp.local" };
+        int poll = zloop_timer (loop, 10, 0, s_test_found_cb, &wait);
+        int timeout = zloop_timer (loop, 5000, 1, s_test_timeout_cb, NULL);
+        zloop_start (loop);
+        zloop_timer_end (loop, poll);
+        zloop_timer_end (loop, timeout);
+
+        const DiscoveredService *service = cache.find (wait.key);
+        assert (service);
+        if (verbose)
+            printf ("   found %s at %s:%u after %" PRIu64 " packets\n", wait.key,
+                service->address.c_str (), service->port, listener.counters ().packets);
+        assert (service->host == responder_options.hostname + ".local");
+        assert (service->address == "127.0.0.1" && service->port == 443);
+        assert (service->ifindex == int (if_nametoindex ("lo")));
+        assert (service->subtypes.count ("_ups._sub._https._tcp") && service->txt.at ("uuid") == "12345678");
+
+        // goodbye on withdrawal
+        responder.removeService ("https");
+        timeout = zloop_timer (loop, 200, 1, s_test_timeout_cb, NULL);
+        zloop_start (loop);
+        zloop_timer_end (loop, timeout);
+        assert (cache.size () == 0);
+
+        responder.stop ();
+        listener.stop ();
+        assert (!listener.running ());
+        zloop_destroy (&loop);
+    }
+
+    //  robustness: a corpus of valid responses, hand-made faults, and
+    //  random mutations of both, through the listener and every decoder
+    {
+        std::vector<std::string> corpus;
+        auto add = [&corpus](const uint8_t *data, size_t size) {
+            corpus.push_back (std::string ((const char *) data, size));
+        };
+        for (int i = 0; i < 8; i++) {
+            size_t size = s_test_response (buffer, sizeof (buffer), "IPC " + std::to_string (i),
+                "ipc-" + std::to_string (i) + ".local", uint16_t (443 + i),
+                i % 2 ? "10.0.0.1" : "fe80::1", { "_ups", "_powerservice" }, txt, i % 3 ? 120 : 0);
+            add (buffer, size);
+        }
+        const uint8_t faults[][32] = {
+            // PTR whose name points at itself
+            { 0, 0, 0x84, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0xc0, 12, 0, 12, 0, 1, 0, 0, 0, 120, 0, 2, 0xc0, 12 },
+            // label longer than the packet
+            { 0, 0, 0x84, 0, 0, 0, 0, 1, 0, 0, 0, 0, 63, 'a', 'b', 0 },
+            // SRV with rdlength beyond the end
+            { 0, 0, 0x84, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 'a', 0, 0, 33, 0, 1, 0, 0, 0, 120, 0xff, 0xff, 0, 0 },
+            // A record of 5 bytes
+            { 0, 0, 0x84, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 'a', 0, 0, 1, 0, 1, 0, 0, 0, 120, 0, 5, 1, 2, 3, 4, 5 },
+            // TXT string longer than its rdata
+            { 0, 0, 0x84, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 'a', 0, 0, 16, 0, 1, 0, 0, 0, 120, 0, 3, 9, 'a', 'b' },
+            // counts far over the data
+            { 0, 0, 0x84, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+            // PTR target pointing forward
+            { 0, 0, 0x84, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 'a', 0, 0, 12, 0, 1, 0, 0, 0, 120, 0, 2, 0xc0, 30 },
+        };
+        for (const auto& fault : faults)
+            add (fault, sizeof (fault));
+
+        DiscoveryCache cache;
+        MdnsListener listener (NULL, &cache);
+        std::mt19937 random (0x6d646e73);
+        const int rounds = 20000;
+        size_t seen = 0;
+        for (int i = 0; i < rounds; i++) {
+            std::string packet = corpus[random () % corpus.size ()];
+            for (int n = 1 + int (random () % 4); n > 0; n--) {
+                size_t at = random () % packet.size ();
+                switch (random () % 6) {
+                    case 0: packet[at] = char (packet[at] ^ (1 << (random () % 8))); break;
+                    case 1: packet[at] = char (random ()); break;
+                    case 2: packet.resize (std::max (at, size_t (1))); break;
+                    // compression pointer anywhere
+                    case 3: packet[at] = char (0xc0); if (at + 1 < packet.size ()) packet[at + 1] = char (random ()); break;
+                    // a count or a length maxed out
+                    case 4: packet[at] = char (0xff); break;
+                    case 5: packet.insert (at, packet.substr (random () % packet.size (), 8)); break;
+                }
+            }
+            // exact size, so that ASan sees any read past the end
+            std::vector<uint8_t> exact (packet.begin (), packet.end ());
+            seen += s_test_walk (exact.data (), exact.size ());
+            listener.feed (exact.data (), exact.size (), 1, now + i);
+        }
+        const MdnsListener::Counters& counters = listener.counters ();
+        if (verbose)
+            printf ("   %d mutated packets: %" PRIu64 " decoded, %" PRIu64 " malformed, %zu services (%zu)\n",
+                rounds, counters.responses, counters.malformed, cache.size (), seen);
+        assert (counters.packets == uint64_t (rounds) && counters.malformed > 0 && counters.responses > 0);
+        for (const DiscoveredService *service : cache.all ()) {
+            assert (!service->host.empty () && !service->address.empty ());
+            assert (cache.find (service->key ()) == service);
+        }
+    }
+
+    printf (" * mDNS listener test: OK\n");
+}
@@ -0,0 +1,186 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_listener.h
+ *
+ * Passive DNS-SD discovery: listens to the mDNS traffic of the links and
+ * fills a DiscoveryCache from the responses other hosts multicast anyway
+ * (announcements, answers to their peers), without sending a query or
+ * running an avahi resolver. A service appears once its SRV record and an
+ * address of its target host have been seen, in one packet or several;
+ * PTR records tag it with its subtypes, TXT records give its attributes,
+ * and a goodbye (TTL 0) removes it.
+ *
+ * Packets are decoded in place by MdnsReader: names are compared and split
+ * as labels of the packet, so that the records already known (the bulk of
+ * the traffic, refreshed every few minutes) cost no allocation.
+ */
+
+#ifndef MDNS_LISTENER_H
+#define MDNS_LISTENER_H
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <czmq.h>
+
+#include "discovery_cache.h"
+#include "mdns_message.h"
+
+class MdnsListener {
+public:
+    struct Options {
+        uint16_t port = MDNS_PORT;
+        bool ipv6 = true;           // also over IPv6, when the system has it
+        bool expire = true;         // drop cache entries past their TTL (no other engine does)
+    };
+
+    struct Counters {
+        uint64_t packets = 0;       // received
+        uint64_t responses = 0;     // packets decoded
+        uint64_t records = 0;       // in the responses
+        uint64_t malformed = 0;     // packets, decoding stopped at the fault
+        uint64_t published = 0;     // new or changed services put in the cache
+        uint64_t goodbyes = 0;      // services removed by a goodbye
+    };
+
+    explicit MdnsListener(zloop_t *loop, DiscoveryCache *cache);
+    MdnsListener(zloop_t *loop, DiscoveryCache *cache, const Options& options);
+    ~MdnsListener();
+
+    MdnsListener(const MdnsListener&) = delete;
+    MdnsListener& operator=(const MdnsListener&) = delete;
+
+    /**
+     * Keep the services of a type, e.g. "_https._tcp", or only the ones
+     * tagged with a subtype, e.g. "_powerservice._sub._https._tcp".
+     * Without any type, every service seen is kept.
+     */
+    void addType(const std::string& type);
+    const std::set<std::string>& types() const { return _types; }
+
+    /**
+     * Open the sockets and join the mDNS group on every interface up.
+     * Return 0 or -errno.
+     */
+    int start();
+    void stop();
+    bool running() const { return _sock4 >= 0; }
+
+    // join the group on the interfaces up since start
+    void refreshInterfaces();
+
+    /**
+     * Decode a packet received on interface ifindex at time now (ms),
+     * and update the cache with its records.
+     */
+    void feed(const uint8_t *data, size_t size, int ifindex, int64_t now);
+
+    /**
+     * Forget the records not seen for a TTL period, and drop the expired
+     * cache entries if options.expire. Called periodically while running.
+     */
+    void sweep(int64_t now);
+
+    const Counters& counters() const { return _counters; }
+    // instances seen, with or without a cache entry
+    size_t instances() const { return _instances.size (); }
+
+private:
+    struct Instance {
+        std::string name;           // instance label, unescaped
+        std::string type;           // e.g. _https._tcp
+        std::string domain;
+        std::string host;           // SRV target, empty until seen
+        uint16_t port = 0;
+        std::string txt;            // TXT rdata as received
+        std::set<std::string> subtypes;
+        int ifindex = -1;
+        int64_t expires = 0;        // by the TTL of its records
+        int64_t refreshed = 0;      // cache entry last upserted or touched, 0 if none
+        bool changed = true;        // since the cache entry
+    };
+    typedef std::unordered_map<std::string, Instance> instances_t;
+
+    // an address is kept until its record expires, so that the several
+    // addresses of a multihomed host do not replace each other
+    struct Host {
+        std::string ipv4;
+        std::string ipv6;
+        int64_t expires4 = 0;
+        int64_t expires6 = 0;
+    };
+    typedef std::unordered_map<std::string, Host> hosts_t;
+
+    void onPtr(const MdnsReader& packet, const MdnsReader::Record& record, int ifindex, int64_t now);
+    void onSrv(const MdnsReader& packet, const MdnsReader::Record& record, int ifindex, int64_t now);
+    void onTxt(const MdnsReader& packet, const MdnsReader::Record& record, int ifindex, int64_t now);
+    void onAddress(const MdnsReader& packet, const MdnsReader::Record& record, int64_t now);
+
+    // instance of the name in labels, created if its type is kept (else NULL)
+    instances_t::value_type* instance(const MdnsName& labels, int ifindex, int64_t now);
+    void touch(instances_t::value_type* instance);
+    bool kept(const std::string& type) const;
+    bool accepted(const Instance& instance) const;
+    void goodbye(instances_t::value_type* instance);
+    void publish(const std::string& key, Instance& instance, int64_t now);
+
+    static int onReadable(zloop_t *loop, zmq_pollitem_t *item, void *arg);
+    static int onSweep(zloop_t *loop, int timer_id, void *arg);
+    void receive(int fd);
+
+    zloop_t *_loop;
+    DiscoveryCache *_cache;
+    Options _options;
+    Counters _counters;
+    std::set<std::string> _types;
+    std::set<std::string> _baseTypes;
+    int _sock4 = -1;
+    int _sock6 = -1;
+    int _sweepTimer = -1;
+    std::set<int> _joined4;
+    std::set<int> _joined6;
+
+    // instance key (as in the cache) -> records seen
+    instances_t _instances;
+    // host name, lower case -> addresses
+    hosts_t _hosts;
+    // touched by the packet being decoded
+    std::vector<instances_t::value_type*> _touched;
+    std::vector<hosts_t::value_type*> _changedHosts;
+    // reused for the names of each record, so that lookups do not allocate
+    std::string _key;
+    std::string _name;
+    MdnsName _owner;
+    MdnsName _target;
+    // last instance and host of the packet, by the address of their first label
+    const char *_lastInstanceName = nullptr;
+    instances_t::value_type *_lastInstance = nullptr;
+    const char *_lastHostName = nullptr;
+    hosts_t::value_type *_lastHost = nullptr;
+};
+
+//  Self test of this class.
+void mdns_listener_test (bool verbose);
+
+#endif
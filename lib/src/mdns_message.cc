@@ -0,0 +1,634 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_message.cc
+ *
+ */
+
+#include "mdns_message.h"
+
+#include <cstring>
+#include <cinttypes>
+#include <czmq.h>
+
+static inline char
+s_lower (char c)
+{
+    return (c >= 'A' && c <= 'Z') ? char (c - 'A' + 'a') : c;
+}
+
+static bool
+s_label_equals (const char *a, const uint8_t *b, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (s_lower (a[i]) != s_lower (char (b[i])))
+            return false;
+    return true;
+}
+
+//  next label of a name in text form, unescaped into label (63 bytes):
+//  1 and its length, 0 at the end of the name, -1 if the name is invalid
+static int
+s_next_label (std::string_view text, size_t& pos, uint8_t *label, size_t& len)
+{
+    if (pos >= text.size () || (pos == 0 && text == "."))
+        return 0;
+    len = 0;
+    while (pos < text.size () && text[pos] != '.') {
+        uint8_t c = uint8_t (text[pos++]);
+        if (c == '\\') {
+            if (pos >= text.size ())
+                return -1;
+            if (isdigit ((unsigned char) text[pos])) {
+                if (pos + 3 > text.size ()
+                 || !isdigit ((unsigned char) text[pos + 1]) || !isdigit ((unsigned char) text[pos + 2]))
+                    return -1;
+                int value = (text[pos] - '0') * 100 + (text[pos + 1] - '0') * 10 + (text[pos + 2] - '0');
+                if (value > 255)
+                    return -1;
+                c = uint8_t (value);
+                pos += 3;
+            }
+            else
+                c = uint8_t (text[pos++]);
+        }
+        if (len == 63)
+            return -1;
+        label[len++] = c;
+    }
+    if (len == 0)
+        return -1;      // empty label inside the name
+    if (pos < text.size ())
+        pos++;          // dot, a trailing one ends the name
+    return 1;
+}
+
+std::string mdns_escape_label(std::string_view label)
+{
+    std::string escaped;
+    escaped.reserve (label.size ());
+    for (char c : label) {
+        if (c == '.' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+//  --------------------------------------------------------------------------
+//  Writer
+
+MdnsWriter::MdnsWriter(uint8_t *buffer, size_t size, uint16_t id, uint16_t flags) :
+    _buffer(buffer),
+    _capacity(size)
+{
+    reset (id, flags);
+}
+
+void MdnsWriter::reset(uint16_t id, uint16_t flags)
+{
+    assert (_capacity >= 12);
+    memset (_buffer, 0, 12);
+    _buffer[0] = uint8_t (id >> 8);
+    _buffer[1] = uint8_t (id);
+    _buffer[2] = uint8_t (flags >> 8);
+    _buffer[3] = uint8_t (flags);
+    _size = 12;
+    _nlabels = 0;
+    memset (_counts, 0, sizeof (_counts));
+}
+
+bool MdnsWriter::put(const void *data, size_t len)
+{
+    if (_size + len > _capacity)
+        return false;
+    memcpy (_buffer + _size, data, len);
+    _size += len;
+    return true;
+}
+
+bool MdnsWriter::put16(uint16_t value)
+{
+    uint8_t bytes[2] = { uint8_t (value >> 8), uint8_t (value) };
+    return put (bytes, 2);
+}
+
+bool MdnsWriter::put32(uint32_t value)
+{
+    return put16 (uint16_t (value >> 16)) && put16 (uint16_t (value));
+}
+
+void MdnsWriter::setCount(int counter, uint16_t value)
+{
+    _counts[counter] = value;
+    _buffer[4 + 2 * counter] = uint8_t (value >> 8);
+    _buffer[5 + 2 * counter] = uint8_t (value);
+}
+
+void MdnsWriter::commit(int counter)
+{
+    setCount (counter, uint16_t (_counts[counter] + 1));
+}
+
+bool MdnsWriter::rollback(size_t start)
+{
+    _size = start;
+    while (_nlabels > 0 && _labels[_nlabels - 1] >= start)
+        _nlabels--;
+    return false;
+}
+
+/**
+ * Write a name: its labels up to the longest suffix already in the
+ * message, then a pointer to that suffix.
+ */
+bool MdnsWriter::name(std::string_view text)
+{
+    uint8_t wire[256];
+    size_t starts[128];
+    size_t nstarts = 0;
+    size_t wsize = 0;
+    size_t pos = 0;
+    size_t len;
+    int rv;
+    while ((rv = s_next_label (text, pos, wire + wsize + 1, len)) == 1) {
+        if (wsize + 1 + len > 254)
+            return false;
+        wire[wsize] = uint8_t (len);
+        starts[nstarts++] = wsize;
+        wsize += 1 + len;
+    }
+    if (rv < 0)
+        return false;
+    wire[wsize] = 0;
+
+    // longest suffix written before: the first one matching from the left
+    MdnsReader written (_buffer, _size);
+    size_t match = nstarts;
+    uint16_t pointer = 0;
+    for (size_t i = 0; i < nstarts && match == nstarts; i++) {
+        for (int l = 0; l < _nlabels; l++) {
+            const uint8_t *suffix = wire + starts[i];
+            bool equal = written.walkName (_labels[l], [&suffix](const char *label, size_t llen) {
+                if (*suffix != llen || !s_label_equals (label, suffix + 1, llen))
+                    return false;
+                suffix += 1 + llen;
+                return true;
+            }) != 0 && *suffix == 0;
+            if (equal) {
+                match = i;
+                pointer = _labels[l];
+                break;
+            }
+        }
+    }
+    size_t start = _size;
+    for (size_t i = 0; i < match; i++) {
+        if (start + starts[i] < 0x4000 && _nlabels < MAX_LABELS)
+            _labels[_nlabels++] = uint16_t (start + starts[i]);
+    }
+    size_t literal = match < nstarts ? starts[match] : wsize + 1;
+    if (!put (wire, literal))
+        return false;
+    if (match < nstarts)
+        return put16 (uint16_t (0xc000 | pointer));
+    return true;
+}
+
+bool MdnsWriter::question(std::string_view qname, uint16_t type, uint16_t klass)
+{
+    if (_counts[1] || _counts[2] || _counts[3])
+        return false;
+    size_t start = _size;
+    if (!name (qname) || !put16 (type) || !put16 (klass))
+        return rollback (start);
+    commit (0);
+    return true;
+}
+
+//  record header up to the ttl, rdlength and rdata follow
+bool MdnsWriter::record(Section section, std::string_view rname, uint16_t type, uint16_t klass, uint32_t ttl)
+{
+    for (int later = section + 2; later < 4; later++)
+        if (_counts[later])
+            return false;
+    return name (rname) && put16 (type) && put16 (klass) && put32 (ttl);
+}
+
+bool MdnsWriter::ptr(Section section, std::string_view rname, uint32_t ttl, std::string_view target)
+{
+    size_t start = _size;
+    if (!record (section, rname, MDNS_TYPE_PTR, MDNS_CLASS_IN, ttl) || !put16 (0))
+        return rollback (start);
+    size_t rdata = _size;
+    if (!name (target))
+        return rollback (start);
+    _buffer[rdata - 2] = uint8_t ((_size - rdata) >> 8);
+    _buffer[rdata - 1] = uint8_t (_size - rdata);
+    commit (section + 1);
+    return true;
+}
+
+bool MdnsWriter::srv(Section section, std::string_view rname, uint32_t ttl, bool flush,
+    uint16_t port, std::string_view target)
+{
+    size_t start = _size;
+    uint16_t klass = flush ? MDNS_CLASS_IN | MDNS_CLASS_FLUSH : MDNS_CLASS_IN;
+    if (!record (section, rname, MDNS_TYPE_SRV, klass, ttl) || !put16 (0))
+        return rollback (start);
+    size_t rdata = _size;
+    // priority, weight, port, then the target, compressed as mDNS allows (RFC 6762 section 18.14)
+    if (!put16 (0) || !put16 (0) || !put16 (port) || !name (target))
+        return rollback (start);
+    _buffer[rdata - 2] = uint8_t ((_size - rdata) >> 8);
+    _buffer[rdata - 1] = uint8_t (_size - rdata);
+    commit (section + 1);
+    return true;
+}
+
+bool MdnsWriter::txt(Section section, std::string_view rname, uint32_t ttl, bool flush, std::string_view rdata)
+{
+    size_t start = _size;
+    uint16_t klass = flush ? MDNS_CLASS_IN | MDNS_CLASS_FLUSH : MDNS_CLASS_IN;
+    // an empty TXT record is one empty string (RFC 6763 section 6.1)
+    uint8_t empty = 0;
+    const void *bytes = rdata.empty () ? (const void *) &empty : (const void *) rdata.data ();
+    size_t len = rdata.empty () ? 1 : rdata.size ();
+    if (len > 0xffff
+     || !record (section, rname, MDNS_TYPE_TXT, klass, ttl) || !put16 (uint16_t (len)) || !put (bytes, len))
+        return rollback (start);
+    commit (section + 1);
+    return true;
+}
+
+bool MdnsWriter::address(Section section, std::string_view rname, uint32_t ttl, bool flush,
+    const void *addr, size_t len)
+{
+    if (len != 4 && len != 16)
+        return false;
+    size_t start = _size;
+    uint16_t klass = flush ? MDNS_CLASS_IN | MDNS_CLASS_FLUSH : MDNS_CLASS_IN;
+    if (!record (section, rname, len == 4 ? MDNS_TYPE_A : MDNS_TYPE_AAAA, klass, ttl)
+     || !put16 (uint16_t (len)) || !put (addr, len))
+        return rollback (start);
+    commit (section + 1);
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Reader
+
+MdnsReader::MdnsReader(const void *data, size_t size) :
+    _data((const uint8_t *) data),
+    _size(size)
+{
+}
+
+static size_t
+s_skip_name (const MdnsReader& reader, size_t offset)
+{
+    return reader.walkName (offset, [](const char *, size_t) { return true; });
+}
+
+bool MdnsReader::next(Question& question)
+{
+    if (!valid () || _malformed || _questions >= questions ())
+        return false;
+    size_t end = s_skip_name (*this, _offset);
+    if (!end || end + 4 > _size) {
+        _malformed = true;
+        return false;
+    }
+    question.name = _offset;
+    question.type = u16 (end);
+    question.klass = u16 (end + 2);
+    _offset = end + 4;
+    _questions++;
+    return true;
+}
+
+bool MdnsReader::next(Record& record)
+{
+    if (!valid () || _malformed)
+        return false;
+    // questions not read by the caller are skipped
+    Question question;
+    while (_questions < questions ())
+        if (!next (question))
+            return false;
+    uint32_t counts[3] = { u16 (6), u16 (8), u16 (10) };
+    uint32_t index = _records;
+    int section = 0;
+    while (section < 3 && index >= counts[section])
+        index -= counts[section++];
+    if (section == 3)
+        return false;
+    size_t end = s_skip_name (*this, _offset);
+    if (!end || end + 10 > _size) {
+        _malformed = true;
+        return false;
+    }
+    record.section = MdnsWriter::Section (section);
+    record.name = _offset;
+    record.type = u16 (end);
+    record.klass = u16 (end + 2);
+    record.ttl = u32 (end + 4);
+    record.rdlength = u16 (end + 8);
+    record.rdata = end + 10;
+    if (record.rdata + record.rdlength > _size) {
+        _malformed = true;
+        return false;
+    }
+    _offset = record.rdata + record.rdlength;
+    _records++;
+    return true;
+}
+
+size_t MdnsReader::name(size_t offset, char *out, size_t size) const
+{
+    if (!out || size < 2)
+        return 0;
+    size_t len = 0;
+    bool fits = true;
+    auto add = [&](const char *text, size_t n) {
+        if (len + n >= size) {
+            fits = false;
+            return;
+        }
+        memcpy (out + len, text, n);
+        len += n;
+    };
+    size_t end = walkName (offset, [&](const char *label, size_t llen) {
+        if (len)
+            add (".", 1);
+        for (size_t i = 0; i < llen && fits; i++) {
+            unsigned char c = (unsigned char) label[i];
+            if (c == '.' || c == '\\') {
+                char escaped[2] = { '\\', char (c) };
+                add (escaped, 2);
+            }
+            else if (c < 0x20 || c == 0x7f) {
+                char escaped[5];
+                snprintf (escaped, sizeof (escaped), "\\%03u", c);
+                add (escaped, 4);
+            }
+            else
+                add (label + i, 1);
+        }
+        return fits;
+    });
+    if (!end)
+        return 0;
+    if (len == 0)
+        add (".", 1);
+    out[len] = 0;
+    return len;
+}
+
+bool MdnsReader::nameEquals(size_t offset, std::string_view text) const
+{
+    size_t pos = 0;
+    bool more = true;
+    size_t end = walkName (offset, [&](const char *label, size_t llen) {
+        uint8_t expected[63];
+        size_t elen;
+        if (s_next_label (text, pos, expected, elen) != 1 || elen != llen)
+            return more = false;
+        return s_label_equals (label, expected, llen);
+    });
+    uint8_t rest[63];
+    size_t rlen;
+    return end && more && s_next_label (text, pos, rest, rlen) == 0;
+}
+
+int MdnsName::protocolLabel() const
+{
+    for (size_t i = count; i-- > 0; ) {
+        if (len[i] == 4 && label[i][0] == '_'
+         && (s_label_equals ("_tcp", (const uint8_t *) label[i], 4) || s_label_equals ("_udp", (const uint8_t *) label[i], 4)))
+            return int (i);
+    }
+    return -1;
+}
+
+bool MdnsReader::labels(size_t offset, MdnsName& name) const
+{
+    name.count = 0;
+    return walkName (offset, [&name](const char *label, size_t len) {
+        if (name.count == MdnsName::MAX_LABELS)
+            return false;
+        name.label[name.count] = label;
+        name.len[name.count++] = uint8_t (len);
+        return true;
+    }) != 0;
+}
+
+bool MdnsReader::ptr(const Record& record, size_t& target) const
+{
+    if (record.type != MDNS_TYPE_PTR || record.rdlength < 1)
+        return false;
+    size_t end = s_skip_name (*this, record.rdata);
+    if (!end || end > record.rdata + record.rdlength)
+        return false;
+    target = record.rdata;
+    return true;
+}
+
+bool MdnsReader::address(const Record& record, const uint8_t*& addr, size_t& len) const
+{
+    if ((record.type == MDNS_TYPE_A && record.rdlength == 4)
+     || (record.type == MDNS_TYPE_AAAA && record.rdlength == 16)) {
+        addr = _data + record.rdata;
+        len = record.rdlength;
+        return true;
+    }
+    return false;
+}
+
+bool MdnsReader::srv(const Record& record, uint16_t& port, size_t& target) const
+{
+    if (record.type != MDNS_TYPE_SRV || record.rdlength < 7)
+        return false;
+    size_t end = s_skip_name (*this, record.rdata + 6);
+    if (!end || end > record.rdata + record.rdlength)
+        return false;
+    port = u16 (record.rdata + 4);
+    target = record.rdata + 6;
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void mdns_message_test (bool verbose)
+{
+    printf (" * mDNS message test\n");
+
+    assert (mdns_escape_label ("IPC.1 \\ x") == "IPC\\.1 \\\\ x");
+
+    uint8_t buffer[MDNS_PACKET_SIZE];
+    const char *instance = "IPC\\.1 (12345678)._https._tcp.local";
+    uint8_t addr[4] = { 10, 130, 38, 17 };
+    std::string txt = std::string ("\x0dtxtvers=1.0.0") + "\x0cuuid=1234567";
+
+    // a response with every record kind, names compressed
+    MdnsWriter writer (buffer, sizeof (buffer), 0, MDNS_FLAG_RESPONSE);
+    assert (writer.ptr (MdnsWriter::ANSWER, "_https._tcp.local", MDNS_TTL_OTHER, instance));
+    assert (writer.ptr (MdnsWriter::ANSWER, "_ups._sub._https._tcp.local", MDNS_TTL_OTHER, instance));
+    assert (writer.srv (MdnsWriter::ADDITIONAL, instance, MDNS_TTL_HOST, true, 443, "ipc-3000.local"));
+    assert (writer.txt (MdnsWriter::ADDITIONAL, instance, MDNS_TTL_OTHER, true, txt));
+    assert (writer.address (MdnsWriter::ADDITIONAL, "IPC-3000.local.", MDNS_TTL_HOST, true, addr, 4));
+    // sections are written in order
+    assert (!writer.question ("_https._tcp.local", MDNS_TYPE_PTR));
+    assert (!writer.ptr (MdnsWriter::ANSWER, "_https._tcp.local", MDNS_TTL_OTHER, instance));
+    // invalid names
+    assert (!writer.address (MdnsWriter::ADDITIONAL, "a..local", 0, false, addr, 4));
+    assert (!writer.address (MdnsWriter::ADDITIONAL, std::string (64, 'a') + ".local", 0, false, addr, 4));
+    assert (writer.count () == 5);
+    // the second PTR and the records of the instance take a pointer
+    size_t uncompressed = 12 + (19 + 10 + 2 + 20 + 32) + (29 + 10 + 2 + 51) + (51 + 10 + 6 + 16)
+        + (51 + 10 + txt.size ()) + (16 + 10 + 4);
+    if (verbose)
+        printf ("   response %zu bytes, %zu uncompressed\n", writer.size (), uncompressed);
+    assert (writer.size () < uncompressed / 2);
+
+    MdnsReader reader (writer.data (), writer.size ());
+    assert (reader.valid () && reader.response () && reader.questions () == 0);
+    MdnsReader::Record record;
+    char name[MDNS_MAX_NAME];
+    uint16_t port_unused;
+    int count = 0;
+    while (reader.next (record)) {
+        switch (count++) {
+            case 0: {
+                size_t target;
+                MdnsName labels;
+                assert (record.type == MDNS_TYPE_PTR && record.section == MdnsWriter::ANSWER);
+                assert (reader.ptr (record, target) && target == record.rdata);
+                assert (!reader.srv (record, port_unused, target));
+                assert (reader.labels (target, labels) && labels.count == 4);
+                assert (labels.at (0) == "IPC.1 (12345678)" && labels.at (3) == "local");
+                assert (labels.protocolLabel () == 2);
+                assert (reader.nameEquals (record.name, "_HTTPS._tcp.local."));
+                assert (reader.nameEquals (record.rdata, instance));
+                assert (reader.name (record.rdata, name, sizeof (name)) == strlen (instance));
+                assert (streq (name, instance));
+                break;
+            }
+            case 1:
+                assert (reader.nameEquals (record.name, "_ups._sub._https._tcp.local"));
+                assert (!reader.nameEquals (record.name, "_sub._https._tcp.local"));
+                assert (!reader.nameEquals (record.name, "_ups._sub._https._tcp.local.x"));
+                break;
+            case 2: {
+                uint16_t port;
+                size_t target;
+                assert (record.section == MdnsWriter::ADDITIONAL && record.ttl == MDNS_TTL_HOST);
+                assert (record.klass == (MDNS_CLASS_IN | MDNS_CLASS_FLUSH));
+                assert (reader.srv (record, port, target) && port == 443);
+                assert (reader.nameEquals (target, "ipc-3000.local"));
+                break;
+            }
+            case 3: {
+                std::string entries;
+                assert (record.type == MDNS_TYPE_TXT && record.rdlength == txt.size ());
+                assert (memcmp (reader.data () + record.rdata, txt.data (), txt.size ()) == 0);
+                assert (reader.txt (record, [&entries](const char *data, size_t len) {
+                    entries.append (data, len).append (";");
+                }));
+                assert (entries == "txtvers=1.0.0;uuid=1234567;");
+                break;
+            }
+            case 4: {
+                const uint8_t *bytes;
+                size_t len;
+                assert (record.type == MDNS_TYPE_A && record.rdlength == 4);
+                assert (reader.nameEquals (record.name, "ipc-3000.local"));
+                assert (reader.address (record, bytes, len) && len == 4 && memcmp (bytes, addr, 4) == 0);
+                break;
+            }
+        }
+    }
+    assert (count == 5 && !reader.malformed ());
+
+    // a record that does not fit leaves the message as it was
+    {
+        uint8_t small[64];
+        MdnsWriter w (small, sizeof (small), 0, MDNS_FLAG_RESPONSE);
+        assert (w.address (MdnsWriter::ANSWER, "ipc.local", 120, true, addr, 4));
+        size_t size = w.size ();
+        assert (!w.txt (MdnsWriter::ANSWER, "ipc.local", 120, true, std::string (100, 'x')));
+        assert (w.size () == size && w.count () == 1);
+        assert (w.address (MdnsWriter::ANSWER, "ipc.local", 120, true, addr, 4));
+        assert (w.size () == size + 2 + 10 + 4);
+    }
+
+    // query with a question per type and a known answer
+    {
+        MdnsWriter w (buffer, sizeof (buffer), 0x1234, 0);
+        assert (w.question ("_https._tcp.local", MDNS_TYPE_PTR, MDNS_CLASS_IN | MDNS_CLASS_QU));
+        assert (w.question ("ipc-3000.local", MDNS_TYPE_A));
+        assert (w.ptr (MdnsWriter::ANSWER, "_https._tcp.local", 4000, instance));
+        MdnsReader r (w.data (), w.size ());
+        assert (!r.response () && r.id () == 0x1234 && r.questions () == 2);
+        MdnsReader::Question q;
+        assert (r.next (q) && q.type == MDNS_TYPE_PTR && (q.klass & MDNS_CLASS_QU));
+        // the second question is skipped by the first record read
+        assert (r.next (record) && record.ttl == 4000 && r.nameEquals (record.rdata, instance));
+        assert (!r.next (record) && !r.malformed ());
+    }
+
+    // malformed packets end the walk
+    {
+        // pointer to itself, then forward
+        uint8_t loop[] = { 0,0, 0,0, 0,1, 0,0, 0,0, 0,0, 0xc0, 12, 0, 1, 0, 1 };
+        MdnsReader r (loop, sizeof (loop));
+        MdnsReader::Question q;
+        assert (!r.next (q) && r.malformed ());
+        loop[13] = 16;
+        MdnsReader r2 (loop, sizeof (loop));
+        assert (!r2.next (q) && r2.malformed ());
+        // label past the end
+        uint8_t truncated[] = { 0,0, 0,0, 0,1, 0,0, 0,0, 0,0, 10, 'a', 'b' };
+        MdnsReader r3 (truncated, sizeof (truncated));
+        assert (!r3.next (q) && r3.malformed ());
+        // rdata past the end
+        MdnsWriter w (buffer, sizeof (buffer), 0, MDNS_FLAG_RESPONSE);
+        assert (w.address (MdnsWriter::ANSWER, "ipc.local", 120, true, addr, 4));
+        MdnsReader r4 (w.data (), w.size () - 1);
+        assert (!r4.next (record) && r4.malformed ());
+        // more records announced than present
+        MdnsReader r5 (w.data (), w.size ());
+        buffer[7] = 2;
+        assert (r5.next (record) && !r5.next (record) && r5.malformed ());
+        // TXT string longer than its rdata
+        MdnsWriter wt (buffer, sizeof (buffer), 0, MDNS_FLAG_RESPONSE);
+        assert (wt.txt (MdnsWriter::ANSWER, "ipc.local", 120, true, std::string ("\x05" "ab")));
+        MdnsReader rt (wt.data (), wt.size ());
+        assert (rt.next (record) && !rt.txt (record, [](const char *, size_t) { assert (false); }));
+        // shorter than a header
+        MdnsReader r6 (w.data (), 11);
+        assert (!r6.valid () && !r6.next (record));
+        assert (r6.name (12, name, sizeof (name)) == 0);
+    }
+
+    printf (" * mDNS message test: OK\n");
+}
@@ -0,0 +1,274 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_message.h
+ *
+ * Wire format of mDNS messages (RFC 1035 section 4, RFC 6762). MdnsWriter
+ * builds queries and responses in a caller buffer, compressing names
+ * against the ones already written; MdnsReader walks the questions and
+ * records of a received packet in place, every read bounds-checked and
+ * compression pointers only allowed backwards, so that a malformed packet
+ * ends the walk instead of looping or reading out of the buffer.
+ *
+ * Names are given in text form: labels separated by dots, a dot or a
+ * backslash inside a label escaped by a backslash ("IPC\.1._https._tcp.local"),
+ * as instance names may contain any character.
+ */
+
+#ifndef MDNS_MESSAGE_H
+#define MDNS_MESSAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#define MDNS_PORT           5353
+#define MDNS_GROUP_IPV4     "224.0.0.251"
+#define MDNS_GROUP_IPV6     "ff02::fb"
+
+// largest packet sent, fits an Ethernet MTU over IPv6 (RFC 6762 section 17)
+#define MDNS_PACKET_SIZE    1440
+// largest packet received
+#define MDNS_MAX_PACKET     9000
+// room for a name in text form, every character escaped
+#define MDNS_MAX_NAME       1024
+
+#define MDNS_TYPE_A         1
+#define MDNS_TYPE_PTR       12
+#define MDNS_TYPE_TXT       16
+#define MDNS_TYPE_AAAA      28
+#define MDNS_TYPE_SRV       33
+#define MDNS_TYPE_ANY       255
+
+#define MDNS_CLASS_IN       1
+// top bit of the class: cache flush in a record, unicast response wanted in a question
+#define MDNS_CLASS_FLUSH    0x8000
+#define MDNS_CLASS_QU       0x8000
+
+#define MDNS_FLAG_RESPONSE  0x8400  // QR and AA
+#define MDNS_FLAG_TC        0x0200
+
+// TTLs of RFC 6762 section 10: records naming a host, the others
+#define MDNS_TTL_HOST       120
+#define MDNS_TTL_OTHER      4500
+
+// escape a label (instance name) for the text form of a name
+std::string mdns_escape_label(std::string_view label);
+
+// labels of a name, pointing into the packet
+struct MdnsName {
+    static const size_t MAX_LABELS = 128;
+    const char *label[MAX_LABELS];
+    uint8_t len[MAX_LABELS];
+    size_t count = 0;
+
+    std::string_view at(size_t i) const { return std::string_view (label[i], len[i]); }
+    // index of the last _tcp or _udp label, -1 if none
+    int protocolLabel() const;
+};
+
+class MdnsWriter {
+public:
+    enum Section { ANSWER, AUTHORITY, ADDITIONAL };
+
+    MdnsWriter(uint8_t *buffer, size_t size, uint16_t id = 0, uint16_t flags = 0);
+
+    /**
+     * Append a question or a record, sections in order (questions, answers,
+     * authority, additional). Return false if it does not fit or a name is
+     * invalid: the message is left as it was before the call.
+     */
+    bool question(std::string_view name, uint16_t type, uint16_t klass = MDNS_CLASS_IN);
+    bool ptr(Section section, std::string_view name, uint32_t ttl, std::string_view target);
+    bool srv(Section section, std::string_view name, uint32_t ttl, bool flush,
+        uint16_t port, std::string_view target);
+    // rdata: TXT strings already in wire format (length byte, bytes)
+    bool txt(Section section, std::string_view name, uint32_t ttl, bool flush, std::string_view rdata);
+    // len 4 (A) or 16 (AAAA)
+    bool address(Section section, std::string_view name, uint32_t ttl, bool flush,
+        const void *address, size_t len);
+
+    size_t size() const { return _size; }
+    const uint8_t *data() const { return _buffer; }
+    // questions and records written
+    size_t count() const { return _counts[0] + _counts[1] + _counts[2] + _counts[3]; }
+    bool empty() const { return count() == 0; }
+
+    // start a new message in the same buffer
+    void reset(uint16_t id, uint16_t flags);
+
+private:
+    bool name(std::string_view text);
+    bool record(Section section, std::string_view name, uint16_t type, uint16_t klass, uint32_t ttl);
+    bool put(const void *data, size_t len);
+    bool put16(uint16_t value);
+    bool put32(uint32_t value);
+    void commit(int counter);
+    bool rollback(size_t start);
+    void setCount(int counter, uint16_t value);
+
+    // label offsets of the names written, targets of compression pointers
+    static const int MAX_LABELS = 128;
+    uint16_t _labels[MAX_LABELS];
+    int _nlabels = 0;
+
+    uint8_t *_buffer;
+    size_t _capacity;
+    size_t _size = 0;
+    uint16_t _counts[4] = { 0, 0, 0, 0 };   // questions, answers, authority, additional
+};
+
+class MdnsReader {
+public:
+    struct Question {
+        size_t name;        // offset of the name in the packet
+        uint16_t type;
+        uint16_t klass;     // MDNS_CLASS_QU bit included
+    };
+
+    struct Record {
+        MdnsWriter::Section section;
+        size_t name;
+        uint16_t type;
+        uint16_t klass;     // MDNS_CLASS_FLUSH bit included
+        uint32_t ttl;
+        size_t rdata;       // offset of the rdata in the packet
+        uint16_t rdlength;
+    };
+
+    MdnsReader(const void *data, size_t size);
+
+    // header present
+    bool valid() const { return _size >= 12; }
+    uint16_t id() const { return valid() ? u16(0) : 0; }
+    uint16_t flags() const { return valid() ? u16(2) : 0; }
+    bool response() const { return flags() & 0x8000; }
+    uint16_t questions() const { return valid() ? u16(4) : 0; }
+
+    /**
+     * Next question, then next record across the three record sections.
+     * Return false at the end or on a malformed entry (see malformed()),
+     * all questions must be read before the first record.
+     */
+    bool next(Question& question);
+    bool next(Record& record);
+    bool malformed() const { return _malformed; }
+
+    /**
+     * Name at offset in text form into out, nul terminated. Return its
+     * length, 0 if it is malformed or does not fit (the root name is ".").
+     */
+    size_t name(size_t offset, char *out, size_t size) const;
+
+    // name at offset equal to text, ignoring case (RFC 6762 section 16)
+    bool nameEquals(size_t offset, std::string_view text) const;
+
+    // labels of the name at offset, false if it is malformed
+    bool labels(size_t offset, MdnsName& name) const;
+
+    /**
+     * Rdata of record, checked against its type and rdlength: PTR target
+     * name, SRV port and target name, A or AAAA address, TXT strings
+     * (entry is called with each one, the whole rdata is checked first).
+     */
+    bool ptr(const Record& record, size_t& target) const;
+    bool srv(const Record& record, uint16_t& port, size_t& target) const;
+    bool address(const Record& record, const uint8_t*& address, size_t& len) const;
+    template <typename F>
+    bool txt(const Record& record, F entry) const;
+
+    const uint8_t *data() const { return _data; }
+    size_t size() const { return _size; }
+
+    uint16_t u16(size_t offset) const { return uint16_t(_data[offset] << 8 | _data[offset + 1]); }
+    uint32_t u32(size_t offset) const { return uint32_t(u16(offset)) << 16 | u16(offset + 2); }
+
+    /**
+     * Walk the labels of the name at offset: calls label(data, len) for
+     * each one, following compression pointers. Return the offset right
+     * after the name where it starts (not where pointers lead), 0 if it is
+     * malformed or label returned false.
+     */
+    template <typename F>
+    size_t walkName(size_t offset, F label) const;
+
+private:
+    const uint8_t *_data;
+    size_t _size;
+    size_t _offset = 12;
+    uint16_t _questions = 0;    // read so far
+    uint32_t _records = 0;
+    bool _malformed = false;
+};
+
+template <typename F>
+size_t MdnsReader::walkName(size_t offset, F label) const
+{
+    size_t end = 0;             // after the name in place
+    size_t limit = offset;      // pointers must go strictly before this
+    size_t total = 0;
+    while (true) {
+        if (offset >= _size)
+            return 0;
+        uint8_t len = _data[offset];
+        if ((len & 0xc0) == 0xc0) {
+            if (offset + 1 >= _size)
+                return 0;
+            size_t target = size_t(len & 0x3f) << 8 | _data[offset + 1];
+            if (!end)
+                end = offset + 2;
+            if (target >= limit)
+                return 0;       // forward or looping pointer
+            limit = offset = target;
+            continue;
+        }
+        if (len & 0xc0)
+            return 0;           // extended label types are not used
+        if (len == 0)
+            return end ? end : offset + 1;
+        if (offset + 1 + len > _size || (total += 1 + len) > 254)
+            return 0;
+        if (!label((const char *) _data + offset + 1, size_t(len)))
+            return 0;
+        offset += 1 + len;
+    }
+}
+
+template <typename F>
+bool MdnsReader::txt(const Record& record, F entry) const
+{
+    if (record.type != MDNS_TYPE_TXT)
+        return false;
+    size_t end = record.rdata + record.rdlength;
+    for (size_t offset = record.rdata; offset < end; offset += 1 + _data[offset])
+        if (offset + 1 + _data[offset] > end)
+            return false;
+    for (size_t offset = record.rdata; offset < end; offset += 1 + _data[offset])
+        if (_data[offset])
+            entry ((const char *) _data + offset + 1, size_t (_data[offset]));
+    return true;
+}
+
+//  Self test of this class.
+void mdns_message_test (bool verbose);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_publisher.h
+ *
+ * Interface of the mDNS-SD publishing backends used by fty_mdns_sd_server.
+ * A backend manages a registry of services, each identified by a key and
+ * published independently (one avahi entry group per service), so that
+ * changing one service never resets or re-probes the others.
+ */
+
+#ifndef MDNS_PUBLISHER_H
+#define MDNS_PUBLISHER_H
+
+#include <map>
+#include <string>
+
+#include <czmq.h>
+
+#include "publish_policy.h"
+#include "service_subtypes.h"
+#include "txt_frame.h"
+
+#define SERVICE_NAME_KEY      "name"
+#define SERVICE_TYPE_KEY      "type"
+#define SERVICE_SUBTYPE_KEY   "subType"
+#define SERVICE_PORT_KEY      "port"
+
+// key of the service announced from fty-info INFO
+#define DEFAULT_SERVICE_KEY   "default"
+
+typedef std::map<std::string, std::string> map_string_t;
+
+class MdnsPublisher {
+public:
+    /**
+     * Events of the backend, reported for metrics and persistence.
+     * Called from the thread driving the backend, must not block.
+     */
+    class Observer {
+    public:
+        virtual ~Observer() = default;
+        // service committed then established under name after latency_us,
+        // name differs from the requested one after collisions
+        virtual void onEstablished(const std::string& key, const std::string& name, int64_t latency_us) = 0;
+        virtual void onCollision(const std::string& key) = 0;
+        // connection to the daemon back after a loss
+        virtual void onReconnect() = 0;
+        // all services established again latency_us after the reconnection
+        virtual void onRecovered(int64_t latency_us) = 0;
+    };
+
+    virtual ~MdnsPublisher() = default;
+
+    void setObserver(Observer* observer) { _observer = observer; }
+
+    /**
+     * Create or redefine the service registered under key. A changed
+     * definition is applied on the next update() of this service.
+     * service_stype is a comma separated list of subtypes (see
+     * ServiceSubtypes); subtypes only added are registered in place,
+     * without a new commit of the service.
+     */
+    virtual void setService(
+        const std::string& key,
+        const std::string& service_name,
+        const std::string& service_type,
+        const std::string& service_stype,
+        const std::string& port) = 0;
+
+    /**
+     * Register the service under name instead of the requested one, e.g. the
+     * name it was established under before a restart. Forgotten as soon as
+     * the requested name changes.
+     */
+    virtual void setPublishedName(const std::string& key, const std::string& name) = 0;
+
+    /**
+     * Publish the service on behalf of another device (proxy): its SRV
+     * record points to host, which is published in the same group with an
+     * A or AAAA record of address (no reverse record, several devices may
+     * share an address). Empty host for a service of this host.
+     */
+    virtual void setServiceHost(const std::string& key, const std::string& host, const std::string& address) = 0;
+
+    virtual void setTxtRecords(const std::string& key, map_string_t &map) = 0;
+    virtual void setTxtRecords(const std::string& key, zhash_t *map) = 0;
+    // from a packed zhash, without unpacking it
+    virtual void setTxtRecords(const std::string& key, const TxtFrame& txt) = 0;
+
+    /**
+     * Restrict the interfaces and protocol services are published on. The
+     * default policy applies to the services without their own one. A
+     * registered service is moved at once when its resolved policy changes.
+     */
+    virtual void setDefaultPolicy(const PublishPolicy& policy) = 0;
+    virtual void setPolicy(const std::string& key, const PublishPolicy& policy) = 0;
+
+    /**
+     * Network interfaces changed: resolve interface names again.
+     */
+    virtual void refreshInterfaces() = 0;
+
+    /**
+     * Withdraw the service and forget it.
+     */
+    virtual void removeService(const std::string& key) = 0;
+
+    virtual bool hasService(const std::string& key) const = 0;
+
+    /**
+     * Start the backend and register all known services,
+     * return 0 or an error code.
+     */
+    virtual int start() = 0;
+
+    virtual void stop() = 0;
+
+    /**
+     * Publish the current state of one service: register it if needed
+     * (new or redefined), else only push its TXT records.
+     */
+    virtual void update(const std::string& key) = 0;
+
+protected:
+    Observer* _observer = nullptr;
+};
+
+#endif
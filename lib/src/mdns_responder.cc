@@ -0,0 +1,1571 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_responder.cc
+ *
+ */
+
+#include "mdns_responder.h"
+#include "mdns_socket.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <fty_log.h>
+
+// alternative names tried after conflicts before giving up on a service
+#define MAX_RENAMES 16
+
+// RFC 6762 section 8.1: three probes 250 ms apart, the first one delayed
+// by up to 250 ms; section 8.3: two announcements one second apart
+#define PROBES              3
+#define PROBE_INTERVAL      250
+#define ANNOUNCEMENTS       2
+#define ANNOUNCE_INTERVAL   1000
+// section 8.2: probing again after losing a simultaneous probe tie-break
+#define PROBE_DEFER         1000
+// section 6.7: TTL of the answers to legacy unicast queries
+#define LEGACY_TTL          10
+
+#define SERVICES_NAME "_services._dns-sd._udp.local"
+
+// datagrams read at once from a socket before going back to the loop
+#define RECEIVE_BATCH 32
+
+//  name without the trailing dot of a fully qualified one
+static std::string
+s_strip_dot (const std::string& name)
+{
+    return !name.empty () && name.back () == '.' ? name.substr (0, name.size () - 1) : name;
+}
+
+//  next alternative after a conflict: "name #2", "name #3"...
+static std::string
+s_alternative_name (const std::string& name)
+{
+    size_t hash = name.rfind (" #");
+    if (hash != std::string::npos && hash + 2 < name.size ()
+     && name.find_first_not_of ("0123456789", hash + 2) == std::string::npos) {
+        long n = strtol (name.c_str () + hash + 2, NULL, 10);
+        return name.substr (0, hash) + " #" + std::to_string (n + 1);
+    }
+    return name + " #2";
+}
+
+//  TXT string "key=value" in wire format, the ones over 255 bytes are skipped
+static void
+s_txt_add (std::string& rdata, std::string_view key, std::string_view value)
+{
+    size_t len = key.size () + 1 + value.size ();
+    if (len > 255) {
+        log_warning ("TXT record %.*s too long (%zu bytes), not published", int (key.size ()), key.data (), len);
+        return;
+    }
+    rdata += char (len);
+    rdata.append (key.data (), key.size ());
+    rdata += '=';
+    rdata.append (value.data (), value.size ());
+}
+
+//  SRV rdata without name compression, as compared by the tie-break of
+//  simultaneous probes (RFC 6762 section 8.2): priority, weight and port
+//  (fixed, 6 bytes), then the target as length prefixed labels. Return its size.
+static const size_t SRV_RDATA_MAX = 6 + 256;
+
+static size_t
+s_srv_rdata (uint8_t *out, const uint8_t *fixed, const MdnsName& target)
+{
+    memcpy (out, fixed, 6);
+    size_t size = 6;
+    for (size_t i = 0; i < target.count && size + 1 + target.len[i] < SRV_RDATA_MAX; i++) {
+        out[size++] = target.len[i];
+        memcpy (out + size, target.label[i], target.len[i]);
+        size += target.len[i];
+    }
+    out[size++] = 0;
+    return size;
+}
+
+//  ours: priority and weight 0, target host name in text form
+static size_t
+s_srv_rdata (uint8_t *out, uint16_t port, const std::string& host)
+{
+    const uint8_t fixed[6] = { 0, 0, 0, 0, uint8_t (port >> 8), uint8_t (port) };
+    MdnsName target;
+    size_t start = 0;
+    while (start < host.size () && target.count < MdnsName::MAX_LABELS) {
+        size_t dot = host.find ('.', start);
+        size_t end = dot == std::string::npos ? host.size () : dot;
+        if (end > start && end - start <= 63) {
+            target.label[target.count] = host.data () + start;
+            target.len[target.count++] = uint8_t (end - start);
+        }
+        start = end + 1;
+    }
+    return s_srv_rdata (out, fixed, target);
+}
+
+static uint16_t
+s_port (const struct sockaddr_storage& address)
+{
+    if (address.ss_family == AF_INET6)
+        return ntohs (((const struct sockaddr_in6 *) &address)->sin6_port);
+    return ntohs (((const struct sockaddr_in *) &address)->sin_port);
+}
+
+void MdnsResponder::Records::finalize(const std::string& localHost)
+{
+    typeName = type + ".local";
+    instanceName = mdns_escape_label (name) + "." + typeName;
+    hostName = host.empty () ? localHost : s_strip_dot (host);
+    subtypeNames.clear ();
+    for (const auto& subtype : subtypes.names)
+        subtypeNames.push_back (s_strip_dot (subtype) + ".local");
+    hostAddressLen = 0;
+    if (!host.empty ()) {
+        if (inet_pton (AF_INET, address.c_str (), hostAddress) == 1)
+            hostAddressLen = 4;
+        else
+        if (inet_pton (AF_INET6, address.c_str (), hostAddress) == 1)
+            hostAddressLen = 16;
+        else
+            log_error ("Invalid address '%s' of host %s", address.c_str (), host.c_str ());
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Message under construction for one link, sent as soon as it is full
+
+class MdnsResponder::Outgoing {
+public:
+    Outgoing(MdnsResponder& owner, const Link& link, bool v6, uint16_t id, uint16_t flags,
+        const struct sockaddr *to = nullptr) :
+        _owner(owner), _link(link), _v6(v6), _id(id), _flags(flags), _to(to),
+        _writer(_buffer, sizeof (_buffer), id, flags)
+    {
+    }
+
+    ~Outgoing() { flush (); }
+
+    // question repeated at the top of each packet (legacy unicast answers)
+    void echo(const std::string& name, uint16_t type, uint16_t klass)
+    {
+        _echo = name;
+        _echoType = type;
+        _echoClass = klass;
+        _writer.question (_echo, _echoType, _echoClass);
+    }
+
+    void question(const std::string& name, uint16_t type, uint16_t klass)
+    {
+        if (!_writer.question (name, type, klass)) {
+            flush ();
+            if (!_writer.question (name, type, klass))
+                log_warning ("Question %s does not fit in a packet", name.c_str ());
+        }
+    }
+
+    void add(MdnsWriter::Section section, const Item& item, uint32_t ttl_max, bool flush_bit)
+    {
+        if (_owner.write (_writer, section, item, _link, ttl_max, flush_bit))
+            return;
+        flush ();
+        if (!_owner.write (_writer, section, item, _link, ttl_max, flush_bit))
+            log_warning ("Record of %s does not fit in a packet", item.records->instanceName.c_str ());
+    }
+
+    void flush()
+    {
+        if (_writer.count () > (_echo.empty () ? 0 : 1))
+            _owner.send (_link, _v6, _writer.data (), _writer.size (), _to);
+        _writer.reset (_id, _flags);
+        if (!_echo.empty ())
+            _writer.question (_echo, _echoType, _echoClass);
+    }
+
+private:
+    MdnsResponder& _owner;
+    const Link& _link;
+    bool _v6;
+    uint16_t _id;
+    uint16_t _flags;
+    const struct sockaddr *_to;
+    std::string _echo;
+    uint16_t _echoType = 0;
+    uint16_t _echoClass = 0;
+    uint8_t _buffer[MDNS_PACKET_SIZE];
+    MdnsWriter _writer;
+};
+
+//  --------------------------------------------------------------------------
+//  Registry
+
+MdnsResponder::MdnsResponder(zloop_t *loop) :
+    MdnsResponder(loop, Options())
+{
+}
+
+MdnsResponder::MdnsResponder(zloop_t *loop, const Options& options) :
+    _loop(loop),
+    _options(options),
+    _random(uint32_t (zclock_usecs () ^ getpid ()))
+{
+    std::string host = options.hostname;
+    if (host.empty ()) {
+        char name[256] = "";
+        if (gethostname (name, sizeof (name) - 1) != 0 || !*name)
+            strcpy (name, "localhost");
+        host = name;
+    }
+    // a single label, in the .local domain
+    host = host.substr (0, host.find ('.'));
+    _hostname = host + ".local";
+}
+
+MdnsResponder::~MdnsResponder()
+{
+    stop ();
+}
+
+MdnsResponder::Service* MdnsResponder::findService(const std::string& key)
+{
+    auto it = _services.find (key);
+    return it == _services.end () ? nullptr : &it->second;
+}
+
+const MdnsResponder::Service* MdnsResponder::findService(const std::string& key) const
+{
+    auto it = _services.find (key);
+    return it == _services.end () ? nullptr : &it->second;
+}
+
+void MdnsResponder::setService(
+    const std::string& key,
+    const std::string& service_name,
+    const std::string& service_type,
+    const std::string& service_stype,
+    const std::string& port)
+{
+    Service* service = findService (key);
+    if (!service) {
+        service = &_services[key];
+        service->key = key;
+        resolvePolicy (*service);
+    }
+    std::string type = s_strip_dot (service_type);
+    uint16_t number = uint16_t (strtoul (port.c_str (), NULL, 10));
+    // subtypes alone are diffed by update(), announced without probing
+    service->want.subtypes = ServiceSubtypes::parse (service_stype, type);
+    if (service->requested == service_name && service->want.type == type && service->want.port == number)
+        return;
+    if (service->requested != service_name) {
+        service->requested = service_name;
+        service->want.name = service_name;
+        service->renames = 0;
+    }
+    service->want.type = type;
+    service->want.port = number;
+    service->dirty = true;
+}
+
+void MdnsResponder::setPublishedName(const std::string& key, const std::string& name)
+{
+    Service* service = findService (key);
+    if (!service || name.empty () || service->want.name == name)
+        return;
+    log_info ("Service '%s' published as '%s'", service->requested.c_str (), name.c_str ());
+    service->want.name = name;
+    service->dirty = true;
+}
+
+void MdnsResponder::setServiceHost(const std::string& key, const std::string& host, const std::string& address)
+{
+    Service* service = findService (key);
+    if (!service || (service->want.host == host && service->want.address == address))
+        return;
+    service->want.host = host;
+    service->want.address = host.empty () ? "" : address;
+    service->dirty = true;
+}
+
+void MdnsResponder::setTxtRecords(const std::string& key, map_string_t &map)
+{
+    Service* service = findService (key);
+    if (!service) {
+        log_warning ("setTxtRecords: unknown service '%s'", key.c_str ());
+        return;
+    }
+    service->want.txt.clear ();
+    for (const auto &it : map)
+        s_txt_add (service->want.txt, it.first, it.second);
+}
+
+void MdnsResponder::setTxtRecords(const std::string& key, zhash_t *map)
+{
+    if (!map) return;
+    Service* service = findService (key);
+    if (!service) {
+        log_warning ("setTxtRecords: unknown service '%s'", key.c_str ());
+        return;
+    }
+    service->want.txt.clear ();
+    for (char *value = (char *) zhash_first (map); value; value = (char *) zhash_next (map))
+        s_txt_add (service->want.txt, zhash_cursor (map), value);
+}
+
+void MdnsResponder::setTxtRecords(const std::string& key, const TxtFrame& txt)
+{
+    Service* service = findService (key);
+    if (!service) {
+        log_warning ("setTxtRecords: unknown service '%s'", key.c_str ());
+        return;
+    }
+    service->want.txt.clear ();
+    for (const auto& entry : txt)
+        s_txt_add (service->want.txt, entry.key, entry.value);
+}
+
+/**
+ * Resolve the policy of a service to interface indices and protocol,
+ * return true if they changed.
+ */
+bool MdnsResponder::resolvePolicy(Service& service)
+{
+    auto it = _policies.find (service.key);
+    const PublishPolicy& policy = it != _policies.end () ? it->second : _defaultPolicy;
+    std::vector<int> interfaces = policy.all () ? std::vector<int> () : policy.resolve ();
+    Records& want = service.want;
+    if (want.all == policy.all () && want.interfaces == interfaces && want.protocol == policy.protocol)
+        return false;
+    log_info ("Service '%s' published on %s (%zu interfaces)",
+        service.key.c_str (), policy.toString ().c_str (), interfaces.size ());
+    want.all = policy.all ();
+    want.interfaces = interfaces;
+    want.protocol = policy.protocol;
+    return true;
+}
+
+//  services whose resolved policy changed are probed again where they go
+void MdnsResponder::applyPolicies()
+{
+    for (auto &it : _services) {
+        Service& service = it.second;
+        if (!resolvePolicy (service))
+            continue;
+        service.dirty = true;
+        if (_started && service.state != IDLE)
+            restart (service);
+    }
+    schedule ();
+}
+
+void MdnsResponder::setDefaultPolicy(const PublishPolicy& policy)
+{
+    _defaultPolicy = policy;
+    applyPolicies ();
+}
+
+void MdnsResponder::setPolicy(const std::string& key, const PublishPolicy& policy)
+{
+    _policies[key] = policy;
+    applyPolicies ();
+}
+
+void MdnsResponder::refreshInterfaces()
+{
+    std::vector<int> before;
+    for (const auto& it : _links)
+        if (it.second.multicast) before.push_back (it.first);
+    if (_started)
+        refreshLinks ();
+    std::vector<int> after;
+    for (const auto& it : _links)
+        if (it.second.multicast) after.push_back (it.first);
+    if (before != after) {
+        // published on all interfaces: probed on the new ones too
+        for (auto &it : _services) {
+            Service& service = it.second;
+            if (service.live.all && service.state != IDLE && service.state != FAILED)
+                restart (service);
+        }
+    }
+    applyPolicies ();
+}
+
+void MdnsResponder::removeService(const std::string& key)
+{
+    Service* service = findService (key);
+    if (!service) return;
+    if (service->state == ANNOUNCING || service->state == ESTABLISHED)
+        goodbye (service->live);
+    _services.erase (key);
+    log_info ("Service '%s' removed", key.c_str ());
+}
+
+bool MdnsResponder::hasService(const std::string& key) const
+{
+    return findService (key) != nullptr;
+}
+
+bool MdnsResponder::established(const std::string& key, std::string *name) const
+{
+    const Service* service = findService (key);
+    if (!service || (service->state != ANNOUNCING && service->state != ESTABLISHED))
+        return false;
+    if (name)
+        *name = service->live.name;
+    return true;
+}
+
+//  --------------------------------------------------------------------------
+//  Sockets and interfaces
+
+int MdnsResponder::open()
+{
+    _sock4 = mdns_socket_open (AF_INET, _options.port);
+    if (_sock4 < 0) {
+        int error = _sock4;
+        log_error ("Failed to open mDNS socket on port %d: %s", _options.port, strerror (-error));
+        _sock4 = -1;
+        return error;
+    }
+    if (_options.ipv6) {
+        _sock6 = mdns_socket_open (AF_INET6, _options.port);
+        if (_sock6 < 0) {
+            log_warning ("No IPv6 mDNS socket (%s), IPv4 only", strerror (-_sock6));
+            _sock6 = -1;
+        }
+    }
+    for (int fd : { _sock4, _sock6 }) {
+        if (fd < 0) continue;
+        zmq_pollitem_t item = { NULL, fd, ZMQ_POLLIN, 0 };
+        zloop_poller (_loop, &item, MdnsResponder::onReadable, this);
+    }
+    return 0;
+}
+
+void MdnsResponder::close()
+{
+    for (int *fd : { &_sock4, &_sock6 }) {
+        if (*fd < 0) continue;
+        zmq_pollitem_t item = { NULL, *fd, ZMQ_POLLIN, 0 };
+        zloop_poller_end (_loop, &item);
+        ::close (*fd);
+        *fd = -1;
+    }
+    _links.clear ();
+}
+
+/**
+ * Read the interfaces and their addresses again, and join the mDNS group
+ * on the new ones. Memberships of the interfaces gone went with them.
+ */
+void MdnsResponder::refreshLinks()
+{
+    struct ifaddrs *list = NULL;
+    if (getifaddrs (&list) != 0) {
+        log_error ("getifaddrs failed: %s", strerror (errno));
+        return;
+    }
+    std::map<int, Link> links;
+    for (struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_name || !(ifa->ifa_flags & IFF_UP))
+            continue;
+        int index = int (if_nametoindex (ifa->ifa_name));
+        if (index <= 0)
+            continue;
+        Link& link = links[index];
+        link.index = index;
+        link.name = ifa->ifa_name;
+        link.multicast = (ifa->ifa_flags & IFF_MULTICAST) && !(ifa->ifa_flags & IFF_LOOPBACK);
+        if (!ifa->ifa_addr)
+            continue;
+        if (ifa->ifa_addr->sa_family == AF_INET)
+            link.ipv4.push_back (((struct sockaddr_in *) ifa->ifa_addr)->sin_addr);
+        else
+        if (ifa->ifa_addr->sa_family == AF_INET6)
+            link.ipv6.push_back (((struct sockaddr_in6 *) ifa->ifa_addr)->sin6_addr);
+    }
+    freeifaddrs (list);
+
+    // joined on every interface up, the loopback too when a policy names it
+    for (auto& it : links) {
+        Link& link = it.second;
+        auto old = _links.find (it.first);
+        if (old != _links.end ()) {
+            link.joined4 = old->second.joined4;
+            link.joined6 = old->second.joined6;
+        }
+        if (_sock4 >= 0 && !link.joined4) {
+            link.joined4 = mdns_socket_join (_sock4, AF_INET, link.index);
+            if (!link.joined4)
+                log_debug ("Cannot join %s on %s: %s", MDNS_GROUP_IPV4, link.name.c_str (), strerror (errno));
+        }
+        if (_sock6 >= 0 && !link.joined6 && !link.ipv6.empty ()) {
+            link.joined6 = mdns_socket_join (_sock6, AF_INET6, link.index);
+            if (!link.joined6)
+                log_debug ("Cannot join %s on %s: %s", MDNS_GROUP_IPV6, link.name.c_str (), strerror (errno));
+        }
+    }
+    _links.swap (links);
+}
+
+bool MdnsResponder::onLink(const Records& records, const Link& link) const
+{
+    if (records.all)
+        return link.multicast;
+    return std::find (records.interfaces.begin (), records.interfaces.end (), link.index) != records.interfaces.end ();
+}
+
+bool MdnsResponder::family(const Records& records, bool v6) const
+{
+    if (v6)
+        return _sock6 >= 0 && records.protocol != PublishPolicy::IPV4;
+    return _sock4 >= 0 && records.protocol != PublishPolicy::IPV6;
+}
+
+size_t MdnsResponder::addressCount(const Records& records, const Link& link) const
+{
+    if (!records.host.empty ())
+        return records.hostAddressLen ? 1 : 0;
+    return (records.protocol != PublishPolicy::IPV6 ? link.ipv4.size () : 0)
+         + (records.protocol != PublishPolicy::IPV4 ? link.ipv6.size () : 0);
+}
+
+const uint8_t* MdnsResponder::addressAt(const Records& records, const Link& link, size_t index, size_t& len) const
+{
+    if (!records.host.empty ()) {
+        len = records.hostAddressLen;
+        return records.hostAddress;
+    }
+    if (records.protocol != PublishPolicy::IPV6) {
+        if (index < link.ipv4.size ()) {
+            len = 4;
+            return (const uint8_t *) &link.ipv4[index];
+        }
+        index -= link.ipv4.size ();
+    }
+    len = 16;
+    return (const uint8_t *) &link.ipv6[index];
+}
+
+void MdnsResponder::send(const Link& link, bool v6, const uint8_t *data, size_t size, const struct sockaddr *to)
+{
+    int fd = v6 ? _sock6 : _sock4;
+    struct sockaddr_storage group;
+    memset (&group, 0, sizeof (group));
+    if (!to) {
+        // multicast on the interface of link
+        if (v6) {
+            struct sockaddr_in6 *address = (struct sockaddr_in6 *) &group;
+            address->sin6_family = AF_INET6;
+            address->sin6_port = htons (_options.port);
+            inet_pton (AF_INET6, MDNS_GROUP_IPV6, &address->sin6_addr);
+            int index = link.index;
+            setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof (index));
+        }
+        else {
+            struct sockaddr_in *address = (struct sockaddr_in *) &group;
+            address->sin_family = AF_INET;
+            address->sin_port = htons (_options.port);
+            inet_pton (AF_INET, MDNS_GROUP_IPV4, &address->sin_addr);
+            struct ip_mreqn request;
+            memset (&request, 0, sizeof (request));
+            request.imr_ifindex = link.index;
+            setsockopt (fd, IPPROTO_IP, IP_MULTICAST_IF, &request, sizeof (request));
+        }
+        to = (const struct sockaddr *) &group;
+    }
+    socklen_t tolen = to->sa_family == AF_INET6 ? sizeof (struct sockaddr_in6) : sizeof (struct sockaddr_in);
+    if (sendto (fd, data, size, 0, to, tolen) < 0)
+        log_debug ("mDNS send on %s failed: %s", link.name.c_str (), strerror (errno));
+}
+
+//  --------------------------------------------------------------------------
+//  Probing, announcing, goodbye
+
+bool MdnsResponder::write(MdnsWriter& writer, MdnsWriter::Section section, const Item& item,
+    const Link& link, uint32_t ttl_max, bool flush) const
+{
+    const Records& r = *item.records;
+    uint32_t other = std::min<uint32_t> (MDNS_TTL_OTHER, ttl_max);
+    uint32_t host = std::min<uint32_t> (MDNS_TTL_HOST, ttl_max);
+    switch (item.kind) {
+        case PTR_TYPE:
+            return writer.ptr (section, r.typeName, other, r.instanceName);
+        case PTR_SUBTYPE:
+            return writer.ptr (section, r.subtypeNames[item.index], other, r.instanceName);
+        case PTR_ENUM:
+            return writer.ptr (section, SERVICES_NAME, other, r.typeName);
+        case SRV:
+            return writer.srv (section, r.instanceName, host, flush, r.port, r.hostName);
+        case TXT:
+            return writer.txt (section, r.instanceName, other, flush, r.txt);
+        case ADDRESS: {
+            size_t len;
+            const uint8_t *address = addressAt (r, link, item.index, len);
+            return writer.address (section, r.hostName, host, flush, address, len);
+        }
+    }
+    return false;
+}
+
+//  same record: addresses of this host and type enumerations are shared by services
+bool MdnsResponder::sameItem(const Item& a, const Item& b, const Link& link) const
+{
+    if (a.kind != b.kind)
+        return false;
+    if (a.records == b.records && a.index == b.index)
+        return true;
+    if (a.kind == PTR_ENUM)
+        return a.records->typeName == b.records->typeName;
+    if (a.kind == ADDRESS) {
+        size_t alen, blen;
+        const uint8_t *aa = addressAt (*a.records, link, a.index, alen);
+        const uint8_t *ba = addressAt (*b.records, link, b.index, blen);
+        return alen == blen && memcmp (aa, ba, alen) == 0 && a.records->hostName == b.records->hostName;
+    }
+    return false;
+}
+
+void MdnsResponder::probe(Service& service)
+{
+    const Records& r = service.live;
+    for (const auto& it : _links) {
+        const Link& link = it.second;
+        if (!onLink (r, link))
+            continue;
+        for (bool v6 : { false, true }) {
+            if (!family (r, v6) || !(v6 ? link.joined6 : link.joined4))
+                continue;
+            // the first probe asks for unicast answers (RFC 6762 section 8.1)
+            uint16_t klass = service.step == 0 ? MDNS_CLASS_IN | MDNS_CLASS_QU : MDNS_CLASS_IN;
+            Outgoing out (*this, link, v6, 0, 0);
+            out.question (r.instanceName, MDNS_TYPE_ANY, klass);
+            if (!r.host.empty ())
+                out.question (r.hostName, MDNS_TYPE_ANY, klass);
+            // records proposed, for the tie-break of simultaneous probes
+            out.add (MdnsWriter::AUTHORITY, { SRV, &r, 0 }, UINT32_MAX, false);
+            out.add (MdnsWriter::AUTHORITY, { TXT, &r, 0 }, UINT32_MAX, false);
+            if (!r.host.empty ())
+                for (size_t i = 0; i < addressCount (r, link); i++)
+                    out.add (MdnsWriter::AUTHORITY, { ADDRESS, &r, i }, UINT32_MAX, false);
+        }
+    }
+    _counters.probes++;
+}
+
+void MdnsResponder::announce(Service& service)
+{
+    const Records& r = service.live;
+    for (const auto& it : _links) {
+        const Link& link = it.second;
+        if (!onLink (r, link))
+            continue;
+        for (bool v6 : { false, true }) {
+            if (!family (r, v6) || !(v6 ? link.joined6 : link.joined4))
+                continue;
+            Outgoing out (*this, link, v6, 0, MDNS_FLAG_RESPONSE);
+            out.add (MdnsWriter::ANSWER, { PTR_TYPE, &r, 0 }, UINT32_MAX, false);
+            for (size_t i = 0; i < r.subtypeNames.size (); i++)
+                out.add (MdnsWriter::ANSWER, { PTR_SUBTYPE, &r, i }, UINT32_MAX, false);
+            out.add (MdnsWriter::ANSWER, { PTR_ENUM, &r, 0 }, UINT32_MAX, false);
+            out.add (MdnsWriter::ANSWER, { SRV, &r, 0 }, UINT32_MAX, true);
+            out.add (MdnsWriter::ANSWER, { TXT, &r, 0 }, UINT32_MAX, true);
+            for (size_t i = 0; i < addressCount (r, link); i++)
+                out.add (MdnsWriter::ANSWER, { ADDRESS, &r, i }, UINT32_MAX, true);
+        }
+    }
+    _counters.announcements++;
+}
+
+/**
+ * Records of a service withdrawn, TTL 0 (RFC 6762 section 10.1). The
+ * addresses of this host and the type enumeration stay, other services
+ * may use them.
+ */
+void MdnsResponder::goodbye(const Records& r, bool subtypes_only)
+{
+    if (!_started)
+        return;
+    for (const auto& it : _links) {
+        const Link& link = it.second;
+        if (!onLink (r, link))
+            continue;
+        for (bool v6 : { false, true }) {
+            if (!family (r, v6) || !(v6 ? link.joined6 : link.joined4))
+                continue;
+            Outgoing out (*this, link, v6, 0, MDNS_FLAG_RESPONSE);
+            for (size_t i = 0; i < r.subtypeNames.size (); i++)
+                out.add (MdnsWriter::ANSWER, { PTR_SUBTYPE, &r, i }, 0, false);
+            if (subtypes_only)
+                continue;
+            out.add (MdnsWriter::ANSWER, { PTR_TYPE, &r, 0 }, 0, false);
+            out.add (MdnsWriter::ANSWER, { SRV, &r, 0 }, 0, false);
+            out.add (MdnsWriter::ANSWER, { TXT, &r, 0 }, 0, false);
+            if (!r.host.empty ())
+                for (size_t i = 0; i < addressCount (r, link); i++)
+                    out.add (MdnsWriter::ANSWER, { ADDRESS, &r, i }, 0, false);
+        }
+    }
+    _counters.goodbyes++;
+}
+
+//  probe the current definition, after a goodbye of the records on the network
+void MdnsResponder::restart(Service& service)
+{
+    if (service.state == ANNOUNCING || service.state == ESTABLISHED)
+        goodbye (service.live);
+    service.live = service.want;
+    service.live.finalize (_hostname);
+    service.dirty = false;
+    service.state = PROBING;
+    service.step = 0;
+    service.due = zclock_mono () + int64_t (_random () % PROBE_INTERVAL);
+    service.commitUsec = zclock_usecs ();
+    log_info ("Probing service '%s' as '%s'", service.key.c_str (), service.live.name.c_str ());
+}
+
+/**
+ * Name taken by another host: probe again under the next alternative,
+ * at most MAX_RENAMES times, then the service is left unpublished until
+ * its definition changes.
+ */
+void MdnsResponder::rename(Service& service)
+{
+    _counters.conflicts++;
+    if (_observer)
+        _observer->onCollision (service.key);
+    if (service.renames >= MAX_RENAMES) {
+        log_error ("Service '%s': %d names collided, not published", service.requested.c_str (), service.renames);
+        if (service.state == ANNOUNCING || service.state == ESTABLISHED)
+            goodbye (service.live);
+        service.state = FAILED;
+        service.due = 0;
+        return;
+    }
+    std::string name = s_alternative_name (service.live.name);
+    log_warning ("Service name collision, renaming service from:%s to:%s", service.live.name.c_str (), name.c_str ());
+    service.want.name = name;
+    service.renames++;
+    restart (service);
+}
+
+void MdnsResponder::step(Service& service, int64_t now)
+{
+    switch (service.state) {
+        case PROBING:
+            if (service.step < PROBES) {
+                probe (service);
+                service.step++;
+                service.due = now + PROBE_INTERVAL;
+                return;
+            }
+            // nobody claimed the name
+            service.state = ANNOUNCING;
+            service.step = 0;
+            service.renames = 0;
+            log_info ("Service:'%s' successfully established.", service.live.name.c_str ());
+            if (_observer)
+                _observer->onEstablished (service.key, service.live.name, zclock_usecs () - service.commitUsec);
+            [[fallthrough]];
+        case ANNOUNCING:
+            announce (service);
+            service.step++;
+            if (service.step < ANNOUNCEMENTS)
+                service.due = now + ANNOUNCE_INTERVAL;
+            else {
+                service.state = ESTABLISHED;
+                service.due = 0;
+            }
+            return;
+        default:
+            service.due = 0;
+    }
+}
+
+void MdnsResponder::tick()
+{
+    int64_t now = zclock_mono ();
+    for (auto &it : _services) {
+        Service& service = it.second;
+        if (service.due && service.due <= now)
+            step (service, now);
+    }
+    schedule ();
+}
+
+//  one timer, armed for the next step due
+void MdnsResponder::schedule()
+{
+    int64_t next = 0;
+    for (const auto &it : _services) {
+        int64_t due = it.second.due;
+        if (due && (!next || due < next))
+            next = due;
+    }
+    if (_timer != -1) {
+        zloop_timer_end (_loop, _timer);
+        _timer = -1;
+    }
+    if (!next || !_started)
+        return;
+    int64_t delay = std::max<int64_t> (next - zclock_mono (), 1);
+    _timer = zloop_timer (_loop, size_t (delay), 1, MdnsResponder::onTimer, this);
+}
+
+int MdnsResponder::onTimer(zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id;
+    MdnsResponder *self = (MdnsResponder *) arg;
+    self->_timer = -1;
+    self->tick ();
+    return 0;
+}
+
+int MdnsResponder::start()
+{
+    if (_started)
+        return 0;
+    int rv = open ();
+    if (rv)
+        return rv;
+    refreshLinks ();
+    _started = true;
+    for (auto &it : _services) {
+        resolvePolicy (it.second);
+        restart (it.second);
+    }
+    schedule ();
+    return 0;
+}
+
+void MdnsResponder::stop()
+{
+    for (auto &it : _services) {
+        Service& service = it.second;
+        if (service.state == ANNOUNCING || service.state == ESTABLISHED)
+            goodbye (service.live);
+        service.state = IDLE;
+        service.due = 0;
+        service.dirty = true;
+    }
+    if (_timer != -1)
+        zloop_timer_end (_loop, _timer);
+    _timer = -1;
+    close ();
+    _started = false;
+}
+
+void MdnsResponder::update(const std::string& key)
+{
+    Service* service = findService (key);
+    if (!service) {
+        log_warning ("Update called for unknown service '%s'", key.c_str ());
+        return;
+    }
+    if (!_started)
+        return;
+    if (service->dirty || service->state == IDLE) {
+        // new or redefined: its unique records are probed again
+        restart (*service);
+        schedule ();
+        return;
+    }
+    Records& live = service->live;
+    if (service->state == FAILED
+     || (live.subtypes == service->want.subtypes && live.txt == service->want.txt))
+        return;
+    // TXT and subtypes are updated in place: withdrawn subtypes say
+    // goodbye, then the records are announced again (RFC 6762 section 8.4)
+    std::vector<std::string> withdrawn = live.subtypes.missingFrom (service->want.subtypes);
+    if (!withdrawn.empty () && service->state != PROBING) {
+        Records gone = live;
+        gone.subtypes.names = std::set<std::string> (withdrawn.begin (), withdrawn.end ());
+        gone.finalize (_hostname);
+        goodbye (gone, true);
+    }
+    live.subtypes = service->want.subtypes;
+    live.txt = service->want.txt;
+    live.finalize (_hostname);
+    if (service->state == PROBING)
+        return;
+    service->state = ANNOUNCING;
+    service->step = 0;
+    service->due = zclock_mono ();
+    schedule ();
+}
+
+//  --------------------------------------------------------------------------
+//  Received packets
+
+int MdnsResponder::onReadable(zloop_t *loop, zmq_pollitem_t *item, void *arg)
+{
+    (void) loop;
+    MdnsResponder *self = (MdnsResponder *) arg;
+    self->receive (item->fd, item->fd == self->_sock6);
+    return 0;
+}
+
+void MdnsResponder::receive(int fd, bool v6)
+{
+    uint8_t buffer[MDNS_MAX_PACKET];
+    for (int i = 0; i < RECEIVE_BATCH; i++) {
+        struct sockaddr_storage from;
+        int index;
+        bool truncated;
+        ssize_t size = mdns_socket_recv (fd, buffer, sizeof (buffer), &from, &index, &truncated);
+        if (size < 0)
+            break;
+        auto link = _links.find (index);
+        if (link == _links.end ())
+            continue;
+        if (truncated) {
+            _counters.malformed++;
+            continue;
+        }
+        handle (buffer, size_t (size), link->second, v6, from);
+    }
+}
+
+void MdnsResponder::handle(const uint8_t *data, size_t size, const Link& link, bool v6,
+    const struct sockaddr_storage& from)
+{
+    MdnsReader packet (data, size);
+    if (!packet.valid ()) {
+        _counters.malformed++;
+        return;
+    }
+    checkConflicts (data, size);
+    if (!packet.response ())
+        answer (packet, link, v6, from);
+}
+
+/**
+ * Records of another host for the name of one of our services (RFC 6762
+ * section 9), or a probe for it losing our tie-break (section 8.2). Our own
+ * packets, looped back, carry the same records and are no conflict.
+ */
+void MdnsResponder::checkConflicts(const uint8_t *data, size_t size)
+{
+    MdnsReader packet (data, size);
+    bool response = packet.response ();
+    std::vector<Service*> conflicts;
+    std::vector<Service*> deferred;
+    MdnsReader::Record record;
+    uint8_t theirs[SRV_RDATA_MAX];
+    while (packet.next (record)) {
+        if (record.type != MDNS_TYPE_SRV && record.type != MDNS_TYPE_TXT)
+            continue;
+        // a probe only tells its proposed records in its authority section
+        if (!response && (record.section != MdnsWriter::AUTHORITY || record.type != MDNS_TYPE_SRV))
+            continue;
+        for (auto &it : _services) {
+            Service& service = it.second;
+            const Records& r = service.live;
+            if (service.state == IDLE || service.state == FAILED
+             || (!response && service.state != PROBING)
+             || !packet.nameEquals (record.name, r.instanceName))
+                continue;
+            if (record.type == MDNS_TYPE_TXT) {
+                std::string_view theirs ((const char *) data + record.rdata, record.rdlength);
+                if (theirs == r.txt || (r.txt.empty () && theirs == std::string_view ("\0", 1)))
+                    continue;
+                // a goodbye of a former TXT record is no conflict
+                if (record.ttl == 0)
+                    continue;
+            }
+            else {
+                uint16_t port;
+                size_t offset;
+                if (!packet.srv (record, port, offset))
+                    continue;
+                if (port == r.port && packet.nameEquals (offset, r.hostName)
+                 && packet.u16 (record.rdata) == 0 && packet.u16 (record.rdata + 2) == 0)
+                    continue;
+                if (!response) {
+                    // lexicographically later rdata wins, compared byte by byte uncompressed
+                    MdnsName labels;
+                    if (!packet.labels (offset, labels))
+                        continue;
+                    uint8_t mine[SRV_RDATA_MAX];
+                    size_t theirsSize = s_srv_rdata (theirs, data + record.rdata, labels);
+                    size_t mineSize = s_srv_rdata (mine, r.port, r.hostName);
+                    int cmp = memcmp (theirs, mine, std::min (theirsSize, mineSize));
+                    if (cmp == 0)
+                        cmp = int (theirsSize) - int (mineSize);
+                    if (cmp > 0 && std::find (deferred.begin (), deferred.end (), &service) == deferred.end ())
+                        deferred.push_back (&service);
+                    continue;
+                }
+            }
+            if (record.ttl == 0)
+                continue;
+            if (std::find (conflicts.begin (), conflicts.end (), &service) == conflicts.end ())
+                conflicts.push_back (&service);
+        }
+    }
+    if (packet.malformed ())
+        _counters.malformed++;
+    for (Service* service : deferred) {
+        log_info ("Service '%s': simultaneous probe lost, probing again", service->live.name.c_str ());
+        service->step = 0;
+        service->due = zclock_mono () + PROBE_DEFER;
+    }
+    for (Service* service : conflicts)
+        rename (*service);
+    if (!deferred.empty () || !conflicts.empty ())
+        schedule ();
+}
+
+/**
+ * Answer the questions about the records of established services: PTR
+ * answers come with the SRV, TXT and addresses as additional records, the
+ * PTR answers the querier already knows are suppressed (RFC 6762 section
+ * 7.1). Legacy queries (not from the mDNS port) get a unicast reply with
+ * short TTLs, queries asking only for unicast answers get one too.
+ */
+void MdnsResponder::answer(const MdnsReader& query, const Link& link, bool v6, const struct sockaddr_storage& from)
+{
+    MdnsReader packet (query.data (), query.size ());
+    std::vector<Item> answers;
+    std::vector<Item> additionals;
+    auto add = [this, &link](std::vector<Item>& items, const Item& item) {
+        for (const auto& existing : items)
+            if (sameItem (existing, item, link))
+                return;
+        items.push_back (item);
+    };
+
+    _counters.queries++;
+    size_t questions = 0;
+    size_t unicast = 0;
+    MdnsReader::Question question;
+    MdnsReader::Question first = { 0, 0, 0 };
+    while (packet.next (question)) {
+        if (!questions++)
+            first = question;
+        if (question.klass & MDNS_CLASS_QU)
+            unicast++;
+        uint16_t type = question.type;
+        bool ptr = type == MDNS_TYPE_PTR || type == MDNS_TYPE_ANY;
+        for (const auto &it : _services) {
+            const Service& service = it.second;
+            const Records& r = service.live;
+            if ((service.state != ANNOUNCING && service.state != ESTABLISHED)
+             || !onLink (r, link) || !family (r, v6))
+                continue;
+            bool instance = false;
+            if (ptr && packet.nameEquals (question.name, SERVICES_NAME))
+                add (answers, { PTR_ENUM, &r, 0 });
+            if (ptr && packet.nameEquals (question.name, r.typeName)) {
+                add (answers, { PTR_TYPE, &r, 0 });
+                instance = true;
+            }
+            for (size_t i = 0; ptr && i < r.subtypeNames.size (); i++) {
+                if (packet.nameEquals (question.name, r.subtypeNames[i])) {
+                    add (answers, { PTR_SUBTYPE, &r, i });
+                    instance = true;
+                }
+            }
+            bool srv = false;
+            if (packet.nameEquals (question.name, r.instanceName)) {
+                if (type == MDNS_TYPE_SRV || type == MDNS_TYPE_ANY) {
+                    add (answers, { SRV, &r, 0 });
+                    srv = true;
+                }
+                if (type == MDNS_TYPE_TXT || type == MDNS_TYPE_ANY)
+                    add (answers, { TXT, &r, 0 });
+            }
+            if ((type == MDNS_TYPE_A || type == MDNS_TYPE_AAAA || type == MDNS_TYPE_ANY)
+             && packet.nameEquals (question.name, r.hostName)) {
+                for (size_t i = 0; i < addressCount (r, link); i++) {
+                    size_t len;
+                    addressAt (r, link, i, len);
+                    if (type == MDNS_TYPE_ANY || (type == MDNS_TYPE_A) == (len == 4))
+                        add (answers, { ADDRESS, &r, i });
+                }
+            }
+            if (instance) {
+                add (additionals, { SRV, &r, 0 });
+                add (additionals, { TXT, &r, 0 });
+            }
+            if (instance || srv)
+                for (size_t i = 0; i < addressCount (r, link); i++)
+                    add (additionals, { ADDRESS, &r, i });
+        }
+    }
+    if (packet.malformed ()) {
+        _counters.malformed++;
+        return;
+    }
+
+    // known answers, with at least half of their TTL left
+    MdnsReader::Record known;
+    while (packet.next (known)) {
+        if (known.section != MdnsWriter::ANSWER || known.type != MDNS_TYPE_PTR || known.ttl < MDNS_TTL_OTHER / 2)
+            continue;
+        for (auto it = answers.begin (); it != answers.end (); ) {
+            const Records& r = *it->records;
+            bool same = false;
+            if (it->kind == PTR_TYPE)
+                same = packet.nameEquals (known.name, r.typeName) && packet.nameEquals (known.rdata, r.instanceName);
+            else
+            if (it->kind == PTR_SUBTYPE)
+                same = packet.nameEquals (known.name, r.subtypeNames[it->index])
+                    && packet.nameEquals (known.rdata, r.instanceName);
+            else
+            if (it->kind == PTR_ENUM)
+                same = packet.nameEquals (known.name, SERVICES_NAME) && packet.nameEquals (known.rdata, r.typeName);
+            if (same) {
+                it = answers.erase (it);
+                _counters.suppressed++;
+            }
+            else
+                ++it;
+        }
+    }
+    if (answers.empty ())
+        return;
+    // additional records already in the answers are not repeated
+    additionals.erase (std::remove_if (additionals.begin (), additionals.end (), [&](const Item& item) {
+        for (const auto& existing : answers)
+            if (sameItem (existing, item, link))
+                return true;
+        return false;
+    }), additionals.end ());
+
+    bool legacy = s_port (from) != _options.port;
+    const struct sockaddr *to = (legacy || unicast == questions) ? (const struct sockaddr *) &from : nullptr;
+    uint32_t ttl_max = legacy ? LEGACY_TTL : UINT32_MAX;
+    Outgoing out (*this, link, v6, legacy ? packet.id () : 0, MDNS_FLAG_RESPONSE, to);
+    if (legacy) {
+        char name[MDNS_MAX_NAME];
+        if (packet.name (first.name, name, sizeof (name)))
+            out.echo (name, first.type, first.klass);
+    }
+    for (const auto& item : answers)
+        out.add (MdnsWriter::ANSWER, item, ttl_max, !legacy && item.kind >= SRV);
+    for (const auto& item : additionals)
+        out.add (MdnsWriter::ADDITIONAL, item, ttl_max, !legacy && item.kind >= SRV);
+    out.flush ();
+    _counters.answered++;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  names the services were established under
+class s_responder_observer_t : public MdnsPublisher::Observer {
+public:
+    void onEstablished(const std::string& key, const std::string& name, int64_t latency_us) override
+    {
+        established[key] = name;
+        latency = latency_us;
+    }
+    void onCollision(const std::string&) override { collisions++; }
+    void onReconnect() override {}
+    void onRecovered(int64_t) override {}
+
+    map_string_t established;
+    int collisions = 0;
+    int64_t latency = 0;
+};
+
+//  packets seen by a plain socket joined to the group on the loopback
+typedef struct {
+    int fd;
+    std::vector<std::string> packets;
+} s_test_capture_t;
+
+static int
+s_test_capture_cb (zloop_t *loop, zmq_pollitem_t *item, void *arg)
+{
+    (void) loop; (void) item;
+    s_test_capture_t *capture = (s_test_capture_t *) arg;
+    char buffer[MDNS_MAX_PACKET];
+    ssize_t size;
+    while ((size = recv (capture->fd, buffer, sizeof (buffer), MSG_DONTWAIT)) > 0)
+        capture->packets.push_back (std::string (buffer, size_t (size)));
+    return 0;
+}
+
+//  socket sending on the loopback, bound to port (0 for any) and joined to the group
+static int
+s_test_socket (uint16_t port)
+{
+    int fd = socket (AF_INET, SOCK_DGRAM, 0);
+    assert (fd >= 0);
+    int one = 1;
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one));
+    struct sockaddr_in any;
+    memset (&any, 0, sizeof (any));
+    any.sin_family = AF_INET;
+    any.sin_port = htons (port);
+    assert (bind (fd, (struct sockaddr *) &any, sizeof (any)) == 0);
+    struct ip_mreqn request;
+    memset (&request, 0, sizeof (request));
+    inet_pton (AF_INET, MDNS_GROUP_IPV4, &request.imr_multiaddr);
+    request.imr_ifindex = int (if_nametoindex ("lo"));
+    if (port)
+        assert (setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof (request)) == 0);
+    assert (setsockopt (fd, IPPROTO_IP, IP_MULTICAST_IF, &request, sizeof (request)) == 0);
+    return fd;
+}
+
+static void
+s_test_send (int fd, uint16_t port, const MdnsWriter& writer)
+{
+    struct sockaddr_in group;
+    memset (&group, 0, sizeof (group));
+    group.sin_family = AF_INET;
+    group.sin_port = htons (port);
+    inet_pton (AF_INET, MDNS_GROUP_IPV4, &group.sin_addr);
+    assert (sendto (fd, writer.data (), writer.size (), 0, (struct sockaddr *) &group, sizeof (group)) > 0);
+}
+
+static int
+s_test_timeout_cb (zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id; (void) arg;
+    return -1;
+}
+
+//  run loop for ms
+static void
+s_test_run (zloop_t *loop, int ms)
+{
+    int timeout = zloop_timer (loop, size_t (ms), 1, s_test_timeout_cb, NULL);
+    zloop_start (loop);
+    zloop_timer_end (loop, timeout);
+}
+
+typedef struct {
+    s_responder_observer_t *observer;
+    const char *key;
+} s_test_wait_t;
+
+static int
+s_test_established_cb (zloop_t *loop, int timer_id, void *arg)
+{
+    (void) loop; (void) timer_id;
+    s_test_wait_t *wait = (s_test_wait_t *) arg;
+    return wait->observer->established.count (wait->key) ? -1 : 0;
+}
+
+//  run loop until key is established or timeout (ms) elapsed
+static bool
+s_test_wait_established (zloop_t *loop, s_responder_observer_t *observer, const char *key, int timeout_ms = 5000)
+{
+    s_test_wait_t wait = { observer, key };
+    int poll = zloop_timer (loop, 10, 0, s_test_established_cb, &wait);
+    int timeout = zloop_timer (loop, size_t (timeout_ms), 1, s_test_timeout_cb, NULL);
+    zloop_start (loop);
+    zloop_timer_end (loop, poll);
+    zloop_timer_end (loop, timeout);
+    return observer->established.count (key) != 0;
+}
+
+//  records named name of type in the captured responses (or queries),
+//  with ttl if not -1
+static size_t
+s_test_records (const std::vector<std::string>& packets, bool responses, const std::string& name,
+    uint16_t type, int64_t ttl = -1)
+{
+    size_t count = 0;
+    for (const auto& data : packets) {
+        MdnsReader packet (data.data (), data.size ());
+        if (packet.response () != responses)
+            continue;
+        MdnsReader::Record record;
+        while (packet.next (record))
+            if (record.type == type && packet.nameEquals (record.name, name) && (ttl < 0 || record.ttl == ttl))
+                count++;
+    }
+    return count;
+}
+
+//  questions for name of type in the captured queries
+static size_t
+s_test_questions (const std::vector<std::string>& packets, const std::string& name, uint16_t type)
+{
+    size_t count = 0;
+    for (const auto& data : packets) {
+        MdnsReader packet (data.data (), data.size ());
+        MdnsReader::Question question;
+        while (!packet.response () && packet.next (question))
+            if (question.type == type && packet.nameEquals (question.name, name))
+                count++;
+    }
+    return count;
+}
+
+static size_t
+s_test_responses (const std::vector<std::string>& packets)
+{
+    size_t count = 0;
+    for (const auto& data : packets)
+        count += MdnsReader (data.data (), data.size ()).response ();
+    return count;
+}
+
+void mdns_responder_test (bool verbose)
+{
+    printf (" * mDNS responder test\n");
+
+    // registry without sockets: services are only recorded
+    {
+        zloop_t *loop = zloop_new ();
+        MdnsResponder responder (loop);
+        map_string_t txt = { { "txtvers", "1.0.0" } };
+        responder.setService ("https", "IPC (12345678)", "_https._tcp.", "ups", "443");
+        responder.setTxtRecords ("https", txt);
+        responder.setTxtRecords ("unknown", txt);
+        responder.update ("https");
+        assert (responder.hasService ("https"));
+        assert (!responder.established ("https"));
+        assert (responder.hostName ().find (".local") != std::string::npos);
+        responder.removeService ("https");
+        assert (!responder.hasService ("https"));
+        zloop_destroy (&loop);
+    }
+
+    // tie-break of simultaneous probes on the uncompressed SRV rdata: label
+    // lengths and bytes as they are, not the names in text form ignoring case
+    {
+        uint8_t buffer[MDNS_PACKET_SIZE];
+        uint8_t theirs[SRV_RDATA_MAX];
+        uint8_t mine[SRV_RDATA_MAX];
+        auto later = [&](uint16_t port, const char *target, uint16_t myPort, const char *myTarget) {
+            MdnsWriter probe (buffer, sizeof (buffer));
+            assert (probe.question ("name._https._tcp.local", MDNS_TYPE_ANY));
+            assert (probe.srv (MdnsWriter::AUTHORITY, "name._https._tcp.local", 120, false, port, target));
+            MdnsReader packet (probe.data (), probe.size ());
+            MdnsReader::Question question;
+            MdnsReader::Record record;
+            MdnsName labels;
+            uint16_t srvPort;
+            size_t offset;
+            assert (packet.next (question) && packet.next (record));
+            assert (packet.srv (record, srvPort, offset) && packet.labels (offset, labels));
+            size_t theirsSize = s_srv_rdata (theirs, packet.data () + record.rdata, labels);
+            size_t mineSize = s_srv_rdata (mine, myPort, myTarget);
+            int cmp = memcmp (theirs, mine, std::min (theirsSize, mineSize));
+            return cmp > 0 || (cmp == 0 && theirsSize > mineSize);
+        };
+        // same records, compressed or not
+        assert (!later (443, "host.local", 443, "host.local"));
+        assert (later (444, "host.local", 443, "host.local"));
+        // the longer first label is later, whatever its bytes
+        assert (later (443, "aa.local", 443, "b.local"));
+        assert (!later (443, "b.local", 443, "aa.local"));
+        // case matters: 'a' (0x61) is later than 'B' (0x42)
+        assert (later (443, "a.local", 443, "B.local"));
+        assert (!later (443, "B.local", 443, "a.local"));
+    }
+
+    // on the loopback, on a port of its own
+    uint16_t port = uint16_t (20000 + getpid () % 20000);
+    MdnsResponder::Options options;
+    options.port = port;
+    options.ipv6 = false;
+    options.hostname = "fty-selftest-" + std::to_string (getpid ());
+    PublishPolicy loopback;
+    assert (PublishPolicy::parse ("lo", "ipv4", loopback));
+
+    zloop_t *loop = zloop_new ();
+    s_test_capture_t capture;
+    capture.fd = s_test_socket (port);
+    zmq_pollitem_t item = { NULL, capture.fd, ZMQ_POLLIN, 0 };
+    zloop_poller (loop, &item, s_test_capture_cb, &capture);
+
+    s_responder_observer_t observer;
+    MdnsResponder *first = new MdnsResponder (loop, options);
+    first->setObserver (&observer);
+    first->setDefaultPolicy (loopback);
+    const std::string name = "IPC (12345678)";
+    const std::string instance = name + "._https._tcp.local";
+    const std::string host = first->hostName ();
+    map_string_t txt = { { "txtvers", "1.0.0" }, { "uuid", "12345678" } };
+    first->setService ("https", name, "_https._tcp.", "ups", "443");
+    first->setTxtRecords ("https", txt);
+
+    // probed three times 250 ms apart, then announced twice one second apart
+    int64_t start = zclock_mono ();
+    assert (first->start () == 0);
+    first->update ("https");
+    assert (s_test_wait_established (loop, &observer, "https"));
+    int64_t probing = zclock_mono () - start;
+    assert (probing >= 2 * PROBE_INTERVAL);
+    s_test_run (loop, ANNOUNCE_INTERVAL + 200);
+    if (verbose)
+        printf ("   established after %" PRIi64 " ms, %zu packets\n", probing, capture.packets.size ());
+    assert (observer.established["https"] == name);
+    assert (s_test_questions (capture.packets, instance, MDNS_TYPE_ANY) == PROBES);
+    assert (s_test_records (capture.packets, false, instance, MDNS_TYPE_SRV) == PROBES);
+    assert (s_test_records (capture.packets, true, "_https._tcp.local", MDNS_TYPE_PTR, MDNS_TTL_OTHER) == ANNOUNCEMENTS);
+    assert (s_test_records (capture.packets, true, "_ups._sub._https._tcp.local", MDNS_TYPE_PTR) == ANNOUNCEMENTS);
+    assert (s_test_records (capture.packets, true, SERVICES_NAME, MDNS_TYPE_PTR) == ANNOUNCEMENTS);
+    assert (s_test_records (capture.packets, true, instance, MDNS_TYPE_SRV, MDNS_TTL_HOST) == ANNOUNCEMENTS);
+    assert (s_test_records (capture.packets, true, instance, MDNS_TYPE_TXT) == ANNOUNCEMENTS);
+    assert (s_test_records (capture.packets, true, host, MDNS_TYPE_A) == ANNOUNCEMENTS);
+    assert (first->counters ().conflicts == 0);
+
+    uint8_t buffer[MDNS_PACKET_SIZE];
+
+    // browse: PTR answer, SRV, TXT and address as additional records
+    {
+        capture.packets.clear ();
+        MdnsWriter query (buffer, sizeof (buffer));
+        assert (query.question ("_https._tcp.local", MDNS_TYPE_PTR));
+        s_test_send (capture.fd, port, query);
+        s_test_run (loop, 200);
+        assert (s_test_responses (capture.packets) == 1);
+        assert (s_test_records (capture.packets, true, "_https._tcp.local", MDNS_TYPE_PTR) == 1);
+        assert (s_test_records (capture.packets, true, instance, MDNS_TYPE_SRV) == 1);
+        assert (s_test_records (capture.packets, true, instance, MDNS_TYPE_TXT) == 1);
+        assert (s_test_records (capture.packets, true, host, MDNS_TYPE_A) == 1);
+        // the subtype does not answer the type
+        assert (s_test_records (capture.packets, true, "_ups._sub._https._tcp.local", MDNS_TYPE_PTR) == 0);
+
+        // by subtype, then the address alone, names in another case
+        capture.packets.clear ();
+        query.reset (0, 0);
+        assert (query.question ("_UPS._sub._https._tcp.local", MDNS_TYPE_PTR));
+        s_test_send (capture.fd, port, query);
+        query.reset (0, 0);
+        assert (query.question (host, MDNS_TYPE_A));
+        s_test_send (capture.fd, port, query);
+        s_test_run (loop, 200);
+        assert (s_test_responses (capture.packets) == 2);
+        assert (s_test_records (capture.packets, true, "_ups._sub._https._tcp.local", MDNS_TYPE_PTR) == 1);
+        assert (s_test_records (capture.packets, true, host, MDNS_TYPE_A) == 2);
+        assert (s_test_records (capture.packets, true, instance, MDNS_TYPE_SRV) == 1);
+    }
+
+    // known answer: nothing to say
+    {
+        capture.packets.clear ();
+        MdnsWriter query (buffer, sizeof (buffer));
+        assert (query.question ("_https._tcp.local", MDNS_TYPE_PTR));
+        assert (query.ptr (MdnsWriter::ANSWER, "_https._tcp.local", MDNS_TTL_OTHER, instance));
+        s_test_send (capture.fd, port, query);
+        s_test_run (loop, 200);
+        assert (s_test_responses (capture.packets) == 0);
+        assert (first->counters ().suppressed == 1);
+    }
+
+    // legacy unicast query, from another port: unicast reply, same id, short TTLs
+    {
+        int fd = s_test_socket (0);
+        MdnsWriter query (buffer, sizeof (buffer), 0x4242, 0);
+        assert (query.question ("_https._tcp.local", MDNS_TYPE_PTR));
+        s_test_send (fd, port, query);
+        s_test_run (loop, 200);
+        char reply[MDNS_MAX_PACKET];
+        ssize_t size = recv (fd, reply, sizeof (reply), MSG_DONTWAIT);
+        assert (size > 0);
+        MdnsReader packet (reply, size_t (size));
+        assert (packet.response () && packet.id () == 0x4242 && packet.questions () == 1);
+        MdnsReader::Record record;
+        size_t records = 0;
+        while (packet.next (record)) {
+            assert (record.ttl <= LEGACY_TTL && !(record.klass & MDNS_CLASS_FLUSH));
+            records++;
+        }
+        assert (records == 4 && !packet.malformed ());
+        ::close (fd);
+    }
+
+    // same name from another host: the newcomer loses and is renamed
+    MdnsResponder::Options other = options;
+    other.hostname += "-b";
+    MdnsResponder *second = new MdnsResponder (loop, other);
+    second->setObserver (&observer);
+    second->setDefaultPolicy (loopback);
+    second->setService ("https", name, "_https._tcp", "", "4443");
+    assert (second->start () == 0);
+    second->update ("https");
+    observer.established.erase ("https");
+    assert (s_test_wait_established (loop, &observer, "https"));
+    std::string established;
+    assert (second->established ("https", &established));
+    assert (established == name + " #2");
+    assert (observer.established["https"] == name + " #2");
+    assert (observer.collisions == 1 && second->counters ().conflicts == 1);
+    assert (first->established ("https", &established) && established == name);
+
+    // TXT and new subtype announced in place, without probing
+    {
+        s_test_run (loop, ANNOUNCE_INTERVAL + 200);
+        capture.packets.clear ();
+        txt["txtvers"] = "1.0.1";
+        first->setService ("https", name, "_https._tcp.", "ups,pdu", "443");
+        first->setTxtRecords ("https", txt);
+        first->update ("https");
+        s_test_run (loop, 200);
+        assert (s_test_questions (capture.packets, instance, MDNS_TYPE_ANY) == 0);
+        assert (s_test_records (capture.packets, true, instance, MDNS_TYPE_TXT) == 1);
+        assert (s_test_records (capture.packets, true, "_pdu._sub._https._tcp.local", MDNS_TYPE_PTR) == 1);
+        // the new TXT is no conflict with the former one of a cache
+        assert (first->counters ().conflicts == 0);
+
+        // subtype withdrawn: goodbye of its PTR alone
+        capture.packets.clear ();
+        first->setService ("https", name, "_https._tcp.", "pdu", "443");
+        first->update ("https");
+        s_test_run (loop, 200);
+        assert (s_test_records (capture.packets, true, "_ups._sub._https._tcp.local", MDNS_TYPE_PTR, 0) == 1);
+        assert (s_test_records (capture.packets, true, instance, MDNS_TYPE_SRV, 0) == 0);
+        assert (s_test_questions (capture.packets, instance, MDNS_TYPE_ANY) == 0);
+    }
+
+    // withdrawn: goodbye packets
+    {
+        capture.packets.clear ();
+        first->removeService ("https");
+        second->stop ();
+        s_test_run (loop, 100);
+        assert (s_test_records (capture.packets, true, instance, MDNS_TYPE_SRV, 0) == 1);
+        assert (s_test_records (capture.packets, true, name + " #2._https._tcp.local", MDNS_TYPE_SRV, 0) == 1);
+        assert (s_test_records (capture.packets, true, "_https._tcp.local", MDNS_TYPE_PTR, 0) == 2);
+        // addresses of this host stay
+        assert (s_test_records (capture.packets, true, host, MDNS_TYPE_A) == 0);
+        assert (!second->established ("https"));
+    }
+
+    delete second;
+    delete first;
+    zloop_poller_end (loop, &item);
+    ::close (capture.fd);
+    zloop_destroy (&loop);
+
+    printf (" * mDNS responder test: OK\n");
+}
@@ -0,0 +1,223 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_responder.h
+ *
+ * Built-in mDNS responder, publishing backend for systems without
+ * avahi-daemon (constrained containers): it speaks mDNS (RFC 6762, 6763)
+ * on its own UDP multicast sockets, driven by the actor zloop. Each service
+ * is probed (three queries 250 ms apart), announced (two responses one
+ * second apart), answers the PTR, SRV, TXT, A and AAAA queries for its
+ * records, and says goodbye (TTL 0) when withdrawn or redefined. A TXT or
+ * subtype change is announced in place, without probing again.
+ *
+ * Only the services it manages are published: the host name is the system
+ * one in .local, taken as unique and not probed, with the addresses of the
+ * interface a query came from. Shared records are answered at once, without
+ * the random aggregation delay of RFC 6762 section 6.
+ */
+
+#ifndef MDNS_RESPONDER_H
+#define MDNS_RESPONDER_H
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <czmq.h>
+
+#include "mdns_message.h"
+#include "mdns_publisher.h"
+
+class MdnsResponder : public MdnsPublisher {
+public:
+    struct Options {
+        uint16_t port = MDNS_PORT;
+        std::string hostname;       // without domain, empty for the system one
+        bool ipv6 = true;           // also over IPv6, when the system has it
+    };
+
+    struct Counters {
+        uint64_t queries = 0;       // received
+        uint64_t answered = 0;      // queries answered
+        uint64_t suppressed = 0;    // answers known by the querier (known-answer suppression)
+        uint64_t probes = 0;        // sent
+        uint64_t announcements = 0; // sent
+        uint64_t goodbyes = 0;      // sent
+        uint64_t conflicts = 0;
+        uint64_t malformed = 0;     // packets received
+    };
+
+    explicit MdnsResponder(zloop_t *loop);
+    MdnsResponder(zloop_t *loop, const Options& options);
+    ~MdnsResponder() override;
+
+    MdnsResponder(const MdnsResponder&) = delete;
+    MdnsResponder& operator=(const MdnsResponder&) = delete;
+
+    void setService(
+        const std::string& key,
+        const std::string& service_name,
+        const std::string& service_type,
+        const std::string& service_stype,
+        const std::string& port) override;
+
+    void setPublishedName(const std::string& key, const std::string& name) override;
+    void setServiceHost(const std::string& key, const std::string& host, const std::string& address) override;
+
+    void setDefaultPolicy(const PublishPolicy& policy) override;
+    void setPolicy(const std::string& key, const PublishPolicy& policy) override;
+    void refreshInterfaces() override;
+
+    void setTxtRecords(const std::string& key, map_string_t &map) override;
+    void setTxtRecords(const std::string& key, zhash_t *map) override;
+    void setTxtRecords(const std::string& key, const TxtFrame& txt) override;
+
+    void removeService(const std::string& key) override;
+    bool hasService(const std::string& key) const override;
+
+    int start() override;
+    void stop() override;
+    void update(const std::string& key) override;
+
+    // host name of the services of this host, e.g. ipc-3000.local
+    const std::string& hostName() const { return _hostname; }
+    const Counters& counters() const { return _counters; }
+    // probed and announced, under name
+    bool established(const std::string& key, std::string *name = nullptr) const;
+
+protected:
+    // everything the records of a service are built from
+    struct Records {
+        std::string name;           // instance name
+        std::string type;           // e.g. _https._tcp, without trailing dot
+        std::string host;           // SRV target, empty for this host
+        std::string address;        // of host
+        uint16_t port = 0;
+        ServiceSubtypes subtypes;
+        std::string txt;            // rdata in wire format
+        bool all = true;            // on all multicast interfaces
+        std::vector<int> interfaces;    // else on these ones
+        PublishPolicy::Protocol protocol = PublishPolicy::ANY;
+
+        // names in text form, built by finalize()
+        std::string typeName;       // _https._tcp.local
+        std::string instanceName;   // <escaped name>.<typeName>
+        std::string hostName;       // SRV target
+        std::vector<std::string> subtypeNames;
+        uint8_t hostAddress[16];    // parsed address, hostAddressLen 0 for this host
+        size_t hostAddressLen = 0;
+
+        void finalize(const std::string& localHost);
+    };
+
+    enum State { IDLE, PROBING, ANNOUNCING, ESTABLISHED, FAILED };
+
+    struct Service {
+        std::string key;
+        std::string requested;      // name given by setService()
+        Records want;               // current definition
+        Records live;               // probed or on the network, unless IDLE
+        State state = IDLE;
+        int step = 0;               // probes or announcements sent in this state
+        int64_t due = 0;            // zclock_mono() of the next step, 0 if none
+        int renames = 0;            // alternatives tried since the last establishment
+        bool dirty = true;          // definition changed since the last probe
+        int64_t commitUsec = 0;     // zclock_usecs() the probing started
+    };
+
+    struct Link {
+        int index = 0;
+        std::string name;
+        bool multicast = false;     // up, multicast capable, not loopback
+        std::vector<in_addr> ipv4;
+        std::vector<in6_addr> ipv6;
+        bool joined4 = false;
+        bool joined6 = false;
+    };
+
+    // one entry of an outgoing message
+    enum Kind { PTR_TYPE, PTR_SUBTYPE, PTR_ENUM, SRV, TXT, ADDRESS };
+    struct Item {
+        Kind kind;
+        const Records *records;
+        size_t index;               // subtype or address of records
+    };
+    class Outgoing;
+
+    Service* findService(const std::string& key);
+    const Service* findService(const std::string& key) const;
+    bool resolvePolicy(Service& service);
+    void applyPolicies();
+
+    int open();
+    void close();
+    void refreshLinks();
+    bool onLink(const Records& records, const Link& link) const;
+    bool family(const Records& records, bool v6) const;
+    // addresses of the SRV target of records on link
+    size_t addressCount(const Records& records, const Link& link) const;
+    const uint8_t* addressAt(const Records& records, const Link& link, size_t index, size_t& len) const;
+
+    void restart(Service& service);
+    void rename(Service& service);
+    void goodbye(const Records& records, bool subtypes_only = false);
+    void probe(Service& service);
+    void announce(Service& service);
+    void step(Service& service, int64_t now);
+    void schedule();
+    void tick();
+
+    bool write(MdnsWriter& writer, MdnsWriter::Section section, const Item& item,
+        const Link& link, uint32_t ttl_max, bool flush) const;
+    bool sameItem(const Item& a, const Item& b, const Link& link) const;
+    void send(const Link& link, bool v6, const uint8_t *data, size_t size, const struct sockaddr *to = nullptr);
+
+    void receive(int fd, bool v6);
+    void handle(const uint8_t *data, size_t size, const Link& link, bool v6,
+        const struct sockaddr_storage& from);
+    void checkConflicts(const uint8_t *data, size_t size);
+    void answer(const MdnsReader& packet, const Link& link, bool v6, const struct sockaddr_storage& from);
+
+    static int onReadable(zloop_t *loop, zmq_pollitem_t *item, void *arg);
+    static int onTimer(zloop_t *loop, int timer_id, void *arg);
+
+    zloop_t *_loop;
+    Options _options;
+    std::string _hostname;          // fqdn
+    std::map<std::string, Service> _services;
+    PublishPolicy _defaultPolicy;
+    std::map<std::string, PublishPolicy> _policies;     // own policies, by service key
+    std::map<int, Link> _links;     // by interface index
+    int _sock4 = -1;
+    int _sock6 = -1;
+    int _timer = -1;
+    bool _started = false;
+    Counters _counters;
+    std::minstd_rand _random;
+};
+
+//  Self test of this class.
+void mdns_responder_test (bool verbose);
+
+#endif
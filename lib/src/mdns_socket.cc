@@ -0,0 +1,196 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_socket.cc
+ *
+ */
+
+#include "mdns_socket.h"
+#include "mdns_message.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <czmq.h>
+
+int mdns_socket_open(int family, uint16_t port)
+{
+    int fd = socket (family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+    int one = 1;
+    int hops = 255;
+    unsigned char ttl = 255;
+    unsigned char loop = 1;
+    // shared with other responders of this host, e.g. avahi-daemon
+    bool ok = setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one)) == 0;
+#ifdef SO_REUSEPORT
+    ok = ok && setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one)) == 0;
+#endif
+    if (family == AF_INET) {
+        struct sockaddr_in any;
+        memset (&any, 0, sizeof (any));
+        any.sin_family = AF_INET;
+        any.sin_port = htons (port);
+        any.sin_addr.s_addr = htonl (INADDR_ANY);
+        ok = ok
+          && setsockopt (fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof (one)) == 0
+          && setsockopt (fd, IPPROTO_IP, IP_TTL, &hops, sizeof (hops)) == 0
+          && setsockopt (fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof (ttl)) == 0
+          && setsockopt (fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof (loop)) == 0
+          && bind (fd, (struct sockaddr *) &any, sizeof (any)) == 0;
+    }
+    else {
+        struct sockaddr_in6 any;
+        memset (&any, 0, sizeof (any));
+        any.sin6_family = AF_INET6;
+        any.sin6_port = htons (port);
+        any.sin6_addr = in6addr_any;
+        int loop6 = 1;
+        ok = ok
+          && setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof (one)) == 0
+          && setsockopt (fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &one, sizeof (one)) == 0
+          && setsockopt (fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &hops, sizeof (hops)) == 0
+          && setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof (hops)) == 0
+          && setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop6, sizeof (loop6)) == 0
+          && bind (fd, (struct sockaddr *) &any, sizeof (any)) == 0;
+    }
+    if (!ok) {
+        int error = errno;
+        close (fd);
+        return -error;
+    }
+    return fd;
+}
+
+bool mdns_socket_join(int fd, int family, int ifindex)
+{
+    if (family == AF_INET) {
+        struct ip_mreqn request;
+        memset (&request, 0, sizeof (request));
+        inet_pton (AF_INET, MDNS_GROUP_IPV4, &request.imr_multiaddr);
+        request.imr_ifindex = ifindex;
+        return setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof (request)) == 0
+            || errno == EADDRINUSE;
+    }
+    struct ipv6_mreq request;
+    memset (&request, 0, sizeof (request));
+    inet_pton (AF_INET6, MDNS_GROUP_IPV6, &request.ipv6mr_multiaddr);
+    request.ipv6mr_interface = unsigned (ifindex);
+    return setsockopt (fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &request, sizeof (request)) == 0
+        || errno == EADDRINUSE;
+}
+
+ssize_t mdns_socket_recv(int fd, void *buffer, size_t size,
+    struct sockaddr_storage *from, int *ifindex, bool *truncated)
+{
+    char control[CMSG_SPACE (sizeof (struct in6_pktinfo)) + CMSG_SPACE (sizeof (struct in_pktinfo))];
+    struct iovec iov = { buffer, size };
+    struct msghdr msg;
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_name = from;
+    msg.msg_namelen = sizeof (*from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+    ssize_t received = recvmsg (fd, &msg, MSG_DONTWAIT);
+    if (received < 0)
+        return -1;
+    *ifindex = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+            *ifindex = ((struct in_pktinfo *) CMSG_DATA (cmsg))->ipi_ifindex;
+        else
+        if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO)
+            *ifindex = int (((struct in6_pktinfo *) CMSG_DATA (cmsg))->ipi6_ifindex);
+    }
+    *truncated = (msg.msg_flags & MSG_TRUNC) != 0;
+    return received;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void mdns_socket_test (bool verbose)
+{
+    printf (" * mDNS socket test\n");
+
+    // two sockets share a port, both get the datagrams sent to the group
+    uint16_t port = uint16_t (20000 + (getpid () + 7) % 20000);
+    int lo = int (if_nametoindex ("lo"));
+    int a = mdns_socket_open (AF_INET, port);
+    int b = mdns_socket_open (AF_INET, port);
+    assert (a >= 0 && b >= 0);
+    assert (mdns_socket_join (a, AF_INET, lo));
+    assert (mdns_socket_join (a, AF_INET, lo));
+    assert (mdns_socket_join (b, AF_INET, lo));
+
+    struct ip_mreqn request;
+    memset (&request, 0, sizeof (request));
+    request.imr_ifindex = lo;
+    assert (setsockopt (a, IPPROTO_IP, IP_MULTICAST_IF, &request, sizeof (request)) == 0);
+    struct sockaddr_in group;
+    memset (&group, 0, sizeof (group));
+    group.sin_family = AF_INET;
+    group.sin_port = htons (port);
+    inet_pton (AF_INET, MDNS_GROUP_IPV4, &group.sin_addr);
+    uint8_t packet[64] = { 0 };
+    assert (sendto (a, packet, sizeof (packet), 0, (struct sockaddr *) &group, sizeof (group)) == sizeof (packet));
+
+    // then a datagram longer than the buffer: truncated
+    for (size_t length : { sizeof (packet), size_t (16) }) {
+        if (length != sizeof (packet))
+            assert (sendto (a, packet, sizeof (packet), 0, (struct sockaddr *) &group, sizeof (group)) == sizeof (packet));
+        for (int fd : { a, b }) {
+            uint8_t buffer[MDNS_MAX_PACKET];
+            struct sockaddr_storage from;
+            int ifindex = -1;
+            bool truncated = true;
+            ssize_t size = -1;
+            for (int i = 0; i < 100 && size < 0; i++) {
+                size = mdns_socket_recv (fd, buffer, length, &from, &ifindex, &truncated);
+                if (size < 0)
+                    zclock_sleep (10);
+            }
+            if (verbose)
+                printf ("   received %zd bytes on interface %d\n", size, ifindex);
+            assert (size == ssize_t (length) && ifindex == lo && from.ss_family == AF_INET);
+            assert (truncated == (length < sizeof (packet)));
+        }
+    }
+    // nothing more
+    uint8_t buffer[16];
+    struct sockaddr_storage from;
+    int ifindex;
+    bool truncated;
+    assert (mdns_socket_recv (b, buffer, sizeof (buffer), &from, &ifindex, &truncated) < 0);
+    close (a);
+    close (b);
+
+    printf (" * mDNS socket test: OK\n");
+}
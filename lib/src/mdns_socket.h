@@ -0,0 +1,56 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   mdns_socket.h
+ *
+ * UDP sockets of the mDNS port, shared by the built-in responder and the
+ * passive listener: bound with address reuse, so that they live next to
+ * each other and to avahi-daemon, multicast looped back, and the receiving
+ * interface reported with each datagram.
+ */
+
+#ifndef MDNS_SOCKET_H
+#define MDNS_SOCKET_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// non-blocking socket of family (AF_INET or AF_INET6) bound to port: fd, or -errno
+int mdns_socket_open(int family, uint16_t port);
+
+// join the mDNS group of family on interface index, true if it is (or already was) joined
+bool mdns_socket_join(int fd, int family, int ifindex);
+
+/**
+ * Receive one datagram without blocking: its size, -1 when none is waiting.
+ * The index of the interface it came from goes to ifindex, truncated tells
+ * it did not fit in size.
+ */
+ssize_t mdns_socket_recv(int fd, void *buffer, size_t size,
+    struct sockaddr_storage *from, int *ifindex, bool *truncated);
+
+//  Self test of this class.
+void mdns_socket_test (bool verbose);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   msg_view.cc
+ *
+ */
+
+#include "msg_view.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "alloc_counter.h"
+
+MsgView::MsgView(zmsg_t* msg)
+{
+    if (!msg)
+        return;
+    for (zframe_t* frame = zmsg_first(msg); frame; frame = zmsg_next(msg)) {
+        if (_size < INLINE)
+            _inline[_size] = frame;
+        else
+            _more.push_back(frame);
+        _size++;
+    }
+}
+
+zframe_t* MsgView::frame(size_t i) const
+{
+    if (i >= _size)
+        return nullptr;
+    return i < INLINE ? _inline[i] : _more[i - INLINE];
+}
+
+std::string_view MsgView::str(size_t i) const
+{
+    zframe_t* f = frame(i);
+    if (!f)
+        return std::string_view();
+    return std::string_view(reinterpret_cast<const char*>(zframe_data(f)), zframe_size(f));
+}
+
+const char* MsgView::cstr(size_t i, char* buffer, size_t size) const
+{
+    if (i >= _size)
+        return nullptr;
+    std::string_view value = str(i);
+    if (value.size() >= size)
+        return nullptr;
+    memcpy(buffer, value.data(), value.size());
+    buffer[value.size()] = 0;
+    return buffer;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void msg_view_test (bool verbose)
+{
+    printf (" * Message view test\n");
+
+    MsgView none (NULL);
+    assert (none.size () == 0);
+    assert (!none.has (1));
+    assert (none.str (0).empty ());
+
+    zmsg_t *msg = zmsg_new ();
+    zmsg_addstr (msg, "SERVICE-UPDATE");
+    zmsg_addstr (msg, "mqtt");
+    zmsg_addstr (msg, "");
+    zmsg_addmem (msg, "a\0b", 3);
+    {
+        MsgView fields (msg);
+        assert (fields.size () == 4);
+        assert (fields.has (4) && !fields.has (5));
+        assert (fields.is (0, "SERVICE-UPDATE"));
+        assert (!fields.is (1, "mqt"));
+        assert (fields.str (1) == "mqtt");
+        assert (fields.str (2).empty () && fields.frame (2));
+        assert (fields.str (3).size () == 3);
+        assert (!fields.frame (4) && fields.str (4).empty ());
+
+        char key [5];
+        assert (streq (fields.cstr (1, key, sizeof (key)), "mqtt"));
+        assert (!fields.cstr (0, key, sizeof (key)));    // too long
+        assert (!fields.cstr (4, key, sizeof (key)));
+    }
+    // the message is left as is
+    assert (zmsg_size (msg) == 4);
+
+    // viewing and reading allocate nothing
+    uint64_t allocs = alloc_count ();
+    size_t length = 0;
+    for (int i = 0; i < 1000; i++) {
+        MsgView fields (msg);
+        if (fields.has (4) && fields.is (0, "SERVICE-UPDATE"))
+            length += fields.str (1).size ();
+    }
+    allocs = alloc_count () - allocs;
+    assert (length == 4000);
+    if (alloc_counting ())
+        assert (allocs == 0);
+
+    // past the inline frames
+    for (size_t i = 4; i < MsgView::INLINE + 4; i++)
+        zmsg_addstrf (msg, "%zu", i);
+    {
+        MsgView fields (msg);
+        assert (fields.size () == MsgView::INLINE + 4);
+        assert (fields.str (MsgView::INLINE) == std::to_string (MsgView::INLINE));
+        assert (fields.str (MsgView::INLINE + 3) == std::to_string (MsgView::INLINE + 3));
+        if (verbose)
+            printf ("   %zu fields\n", fields.size ());
+    }
+    zmsg_destroy (&msg);
+
+    printf (" * Message view test: OK\n");
+}
@@ -0,0 +1,71 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   msg_view.h
+ *
+ * Read-only view of the frames of a message: fields are string views into
+ * the frames, nothing is popped, copied nor allocated (up to INLINE frames).
+ * The number of fields is known at once, so that a malformed message is
+ * rejected before anything is decoded. The message must outlive the view
+ * and must not be changed while it is viewed.
+ */
+
+#ifndef MSG_VIEW_H
+#define MSG_VIEW_H
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include <czmq.h>
+
+class MsgView {
+public:
+    static const size_t INLINE = 16;    // frames indexed without allocation
+
+    explicit MsgView(zmsg_t* msg);
+
+    size_t size() const { return _size; }
+    // at least count fields
+    bool has(size_t count) const { return _size >= count; }
+
+    // frame i, NULL if out of range
+    zframe_t* frame(size_t i) const;
+    // content of frame i, empty if out of range
+    std::string_view str(size_t i) const;
+    bool is(size_t i, std::string_view value) const { return i < _size && str(i) == value; }
+
+    /**
+     * Copy field i into buffer as a C string, e.g. a hash key.
+     * Return NULL if out of range or longer than size - 1.
+     */
+    const char* cstr(size_t i, char* buffer, size_t size) const;
+
+private:
+    zframe_t* _inline[INLINE];
+    std::vector<zframe_t*> _more;   // frames past INLINE, long messages only
+    size_t _size = 0;
+};
+
+//  Self test of this class.
+void msg_view_test (bool verbose);
+
+#endif
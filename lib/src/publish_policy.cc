@@ -0,0 +1,121 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   publish_policy.cc
+ *
+ */
+
+#include "publish_policy.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <net/if.h>
+
+bool PublishPolicy::parse(const std::string& interfaces, const std::string& protocol, PublishPolicy& policy)
+{
+    PublishPolicy parsed;
+    if (protocol.empty() || protocol == "any")
+        parsed.protocol = ANY;
+    else if (protocol == "ipv4")
+        parsed.protocol = IPV4;
+    else if (protocol == "ipv6")
+        parsed.protocol = IPV6;
+    else
+        return false;
+
+    size_t start = 0;
+    while (start <= interfaces.size()) {
+        size_t end = interfaces.find(',', start);
+        if (end == std::string::npos) end = interfaces.size();
+        std::string name = interfaces.substr(start, end - start);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (!name.empty() && std::find(parsed.interfaces.begin(), parsed.interfaces.end(), name) == parsed.interfaces.end())
+            parsed.interfaces.push_back(name);
+        start = end + 1;
+    }
+    policy = parsed;
+    return true;
+}
+
+std::vector<int> PublishPolicy::resolve() const
+{
+    std::vector<int> indices;
+    for (const auto& name : interfaces) {
+        unsigned index = if_nametoindex(name.c_str());
+        if (index != 0)
+            indices.push_back(int(index));
+    }
+    return indices;
+}
+
+std::string PublishPolicy::toString() const
+{
+    std::string out;
+    for (const auto& name : interfaces) {
+        if (!out.empty()) out += ",";
+        out += name;
+    }
+    if (out.empty()) out = "*";
+    out += protocol == IPV4 ? "/ipv4" : protocol == IPV6 ? "/ipv6" : "/any";
+    return out;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void publish_policy_test (bool verbose)
+{
+    printf (" * Publish policy test\n");
+
+    PublishPolicy policy;
+    assert (policy.all ());
+    assert (PublishPolicy::parse ("", "", policy));
+    assert (policy.all () && policy.protocol == PublishPolicy::ANY);
+    assert (policy.toString () == "*/any");
+
+    assert (PublishPolicy::parse (" eth0, LAN1,,eth0 ", "ipv4", policy));
+    assert (policy.interfaces.size () == 2);
+    assert (policy.interfaces[0] == "eth0" && policy.interfaces[1] == "LAN1");
+    assert (policy.protocol == PublishPolicy::IPV4);
+    assert (policy.toString () == "eth0,LAN1/ipv4");
+
+    // unknown protocol, policy left as is
+    assert (!PublishPolicy::parse ("eth1", "ipx", policy));
+    assert (policy.interfaces.size () == 2);
+
+    PublishPolicy other;
+    assert (PublishPolicy::parse ("eth0,LAN1", "ipv4", other));
+    assert (other == policy);
+    assert (PublishPolicy::parse ("eth0,LAN1", "ipv6", other));
+    assert (other != policy);
+
+    // the loopback interface is there, a made up one is skipped
+    assert (PublishPolicy::parse ("lo,fty-no-such-if0", "", policy));
+    std::vector<int> indices = policy.resolve ();
+    assert (indices.size () == 1);
+    assert (indices[0] == int (if_nametoindex ("lo")));
+    if (verbose)
+        printf ("   lo is interface %d\n", indices[0]);
+
+    printf (" * Publish policy test: OK\n");
+}
@@ -0,0 +1,65 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   publish_policy.h
+ *
+ * Where a service is published: on all interfaces or only on the named
+ * ones, over IPv4, IPv6 or both. Names are resolved to interface indices
+ * when the service is registered, and again when links change.
+ */
+
+#ifndef PUBLISH_POLICY_H
+#define PUBLISH_POLICY_H
+
+#include <string>
+#include <vector>
+
+struct PublishPolicy {
+    enum Protocol { ANY, IPV4, IPV6 };
+
+    std::vector<std::string> interfaces;    // interface names, empty = all
+    Protocol protocol = ANY;
+
+    /**
+     * Build a policy from a comma separated list of interfaces and a
+     * protocol (any, ipv4 or ipv6, empty = any). Return false if the
+     * protocol is unknown.
+     */
+    static bool parse(const std::string& interfaces, const std::string& protocol, PublishPolicy& policy);
+
+    bool all() const { return interfaces.empty(); }
+
+    // indices of the listed interfaces present now, missing ones are skipped
+    std::vector<int> resolve() const;
+
+    std::string toString() const;
+
+    bool operator==(const PublishPolicy& other) const
+    {
+        return interfaces == other.interfaces && protocol == other.protocol;
+    }
+    bool operator!=(const PublishPolicy& other) const { return !(*this == other); }
+};
+
+//  Self test of this class.
+void publish_policy_test (bool verbose);
+
+#endif
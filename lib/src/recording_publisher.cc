@@ -0,0 +1,449 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   recording_publisher.cc
+ *
+ */
+
+#include "recording_publisher.h"
+
+#include <cinttypes>
+#include <fty_log.h>
+
+void RecordingPublisher::record(Kind kind, const std::string& key)
+{
+    Record r;
+    r.kind = kind;
+    r.usec = zclock_usecs();
+    r.key = key;
+    auto it = _services.find(key);
+    if (it != _services.end()) {
+        r.name = it->second.published.empty() ? it->second.definition[SERVICE_NAME_KEY] : it->second.published;
+        if (kind == COMMIT || kind == UPDATE)
+            r.txt = it->second.txt;
+    }
+    _records.push_back(std::move(r));
+}
+
+void RecordingPublisher::setService(
+    const std::string& key,
+    const std::string& service_name,
+    const std::string& service_type,
+    const std::string& service_stype,
+    const std::string& port)
+{
+    ServiceSubtypes subtypes = ServiceSubtypes::parse(service_stype, service_type);
+    map_string_t definition = {
+        { SERVICE_NAME_KEY,    service_name },
+        { SERVICE_TYPE_KEY,    service_type },
+        { SERVICE_SUBTYPE_KEY, subtypes.toString() },
+        { SERVICE_PORT_KEY,    port } };
+    bool known = _services.count(key) != 0;
+    Service& service = _services[key];
+    if (!known)
+        resolvePolicy(key, service);
+    if (service.definition == definition)
+        return;
+    if (service.definition[SERVICE_NAME_KEY] != service_name)
+        service.published.clear();
+    // as in the avahi backend, subtypes alone are diffed by update()
+    definition[SERVICE_SUBTYPE_KEY] = service.definition[SERVICE_SUBTYPE_KEY];
+    if (service.definition != definition)
+        service.dirty = true;
+    definition[SERVICE_SUBTYPE_KEY] = subtypes.toString();
+    service.definition = definition;
+    service.subtypes = subtypes;
+    record(DEFINE, key);
+}
+
+void RecordingPublisher::setTxtRecords(const std::string& key, map_string_t &map)
+{
+    auto it = _services.find(key);
+    if (it == _services.end()) return;
+    it->second.txt = map;
+    record(TXT, key);
+}
+
+void RecordingPublisher::setTxtRecords(const std::string& key, zhash_t *map)
+{
+    if (!map) return;
+    auto it = _services.find(key);
+    if (it == _services.end()) return;
+    it->second.txt.clear ();
+    for (char *value = (char *) zhash_first (map); value; value = (char *) zhash_next (map))
+        it->second.txt[zhash_cursor (map)] = value;
+    record(TXT, key);
+}
+
+void RecordingPublisher::setTxtRecords(const std::string& key, const TxtFrame& txt)
+{
+    auto it = _services.find(key);
+    if (it == _services.end()) return;
+    it->second.txt.clear ();
+    for (const auto &entry : txt)
+        it->second.txt[std::string (entry.key)] = std::string (entry.value);
+    record(TXT, key);
+}
+
+void RecordingPublisher::removeService(const std::string& key)
+{
+    if (_services.erase(key))
+        record(REMOVE, key);
+}
+
+void RecordingPublisher::setPublishedName(const std::string& key, const std::string& name)
+{
+    auto it = _services.find(key);
+    if (it == _services.end() || name.empty() || it->second.published == name)
+        return;
+    it->second.published = name;
+    it->second.dirty = true;
+    record(DEFINE, key);
+}
+
+void RecordingPublisher::setServiceHost(const std::string& key, const std::string& host, const std::string& address)
+{
+    auto it = _services.find(key);
+    if (it == _services.end() || (it->second.host == host && it->second.address == address))
+        return;
+    it->second.host = host;
+    it->second.address = host.empty() ? "" : address;
+    it->second.dirty = true;
+    record(DEFINE, key);
+}
+
+//  same contract as the avahi backend: return true if the resolved policy changed
+bool RecordingPublisher::resolvePolicy(const std::string& key, Service& service)
+{
+    auto it = _policies.find(key);
+    const PublishPolicy& policy = it != _policies.end() ? it->second : _defaultPolicy;
+    std::vector<int> interfaces = policy.resolve();
+    if (interfaces == service.interfaces && policy.protocol == service.protocol)
+        return false;
+    service.interfaces = interfaces;
+    service.protocol = policy.protocol;
+    return true;
+}
+
+void RecordingPublisher::applyPolicies()
+{
+    for (auto &it : _services) {
+        if (!resolvePolicy(it.first, it.second))
+            continue;
+        it.second.dirty = true;
+        record(DEFINE, it.first);
+        if (it.second.registered)
+            commit(it.first, it.second);
+    }
+}
+
+void RecordingPublisher::setDefaultPolicy(const PublishPolicy& policy)
+{
+    _defaultPolicy = policy;
+    applyPolicies();
+}
+
+void RecordingPublisher::setPolicy(const std::string& key, const PublishPolicy& policy)
+{
+    _policies[key] = policy;
+    applyPolicies();
+}
+
+void RecordingPublisher::refreshInterfaces()
+{
+    applyPolicies();
+}
+
+bool RecordingPublisher::hasService(const std::string& key) const
+{
+    return _services.count(key) != 0;
+}
+
+void RecordingPublisher::commit(const std::string& key, Service& service)
+{
+    service.registered = true;
+    service.dirty = false;
+    service.registered_subtypes = service.subtypes;
+    record(COMMIT, key);
+    // nothing goes on the network, established at once
+    if (_observer)
+        _observer->onEstablished(key,
+            service.published.empty() ? service.definition[SERVICE_NAME_KEY] : service.published, 0);
+}
+
+void RecordingPublisher::daemonLost()
+{
+    if (!_daemon) return;
+    _daemon = false;
+    for (auto &it : _services)
+        it.second.registered = false;
+    record(LOST, "");
+}
+
+void RecordingPublisher::daemonBack()
+{
+    if (_daemon) return;
+    _daemon = true;
+    if (!_started) return;
+    int64_t start = zclock_usecs();
+    if (_observer) _observer->onReconnect();
+    for (auto &it : _services)
+        commit(it.first, it.second);
+    if (_observer) _observer->onRecovered(zclock_usecs() - start);
+}
+
+int RecordingPublisher::start()
+{
+    _started = true;
+    if (!_daemon)
+        return 0;   // as with no-fail mode: waits for the daemon
+    for (auto &it : _services)
+        commit(it.first, it.second);
+    return 0;
+}
+
+void RecordingPublisher::stop()
+{
+    if (!_started) return;
+    _started = false;
+    for (auto &it : _services)
+        it.second.registered = false;
+    record(STOP, "");
+}
+
+void RecordingPublisher::update(const std::string& key)
+{
+    auto it = _services.find(key);
+    if (it == _services.end()) {
+        log_warning ("Update called for unknown service '%s'", key.c_str());
+        return;
+    }
+    if (!_started || !_daemon)
+        return; // registered on start() or when the daemon is back
+    Service& service = it->second;
+    if (!service.registered || service.dirty
+     || !service.registered_subtypes.missingFrom(service.subtypes).empty()) {
+        commit(key, service);
+        return;
+    }
+    if (!service.subtypes.missingFrom(service.registered_subtypes).empty()) {
+        service.registered_subtypes = service.subtypes;
+        record(SUBTYPE, key);
+    }
+    record(UPDATE, key);
+}
+
+size_t RecordingPublisher::count(Kind kind, const std::string& key) const
+{
+    size_t n = 0;
+    for (const auto &r : _records)
+        if (r.kind == kind && r.key == key) n++;
+    return n;
+}
+
+size_t RecordingPublisher::count(Kind kind) const
+{
+    size_t n = 0;
+    for (const auto &r : _records)
+        if (r.kind == kind) n++;
+    return n;
+}
+
+const char* RecordingPublisher::kindName(Kind kind)
+{
+    switch (kind) {
+        case DEFINE: return "DEFINE";
+        case TXT:    return "TXT";
+        case COMMIT: return "COMMIT";
+        case UPDATE: return "UPDATE";
+        case REMOVE: return "REMOVE";
+        case STOP:   return "STOP";
+        case LOST:   return "LOST";
+        case SUBTYPE: return "SUBTYPE";
+    }
+    return "UNKNOWN";
+}
+
+void RecordingPublisher::pack(zmsg_t *msg) const
+{
+    for (const auto &r : _records) {
+        zmsg_addstr (msg, kindName (r.kind));
+        zmsg_addstrf (msg, "%" PRIi64, r.usec);
+        zmsg_addstr (msg, r.key.c_str ());
+        zhash_t *txt = zhash_new ();
+        for (const auto &it : r.txt)
+            zhash_insert (txt, it.first.c_str (), (void *) it.second.c_str ());
+        zframe_t *frame = zhash_pack (txt);
+        zmsg_append (msg, &frame);
+        zhash_destroy (&txt);
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void recording_publisher_test (bool verbose)
+{
+    printf (" * Recording publisher test\n");
+
+    RecordingPublisher rp;
+    MdnsPublisher *publisher = &rp;
+
+    publisher->update (DEFAULT_SERVICE_KEY);   // unknown, ignored
+    assert (rp.records ().empty ());
+
+    publisher->setService (DEFAULT_SERVICE_KEY, "IPC (12345678)", "_https._tcp.", "_powerservice._sub._https._tcp.", "443");
+    zhash_t *txt = zhash_new ();
+    zhash_insert (txt, "txtvers", (void *) "1.0.0");
+    zhash_insert (txt, "uuid", (void *) "12345678-0000-0000-0000-000000000000");
+    publisher->setTxtRecords (DEFAULT_SERVICE_KEY, txt);
+    assert (publisher->start () == 0);
+
+    zhash_update (txt, "txtvers", (void *) "1.0.1");
+    publisher->setTxtRecords (DEFAULT_SERVICE_KEY, txt);
+    publisher->update (DEFAULT_SERVICE_KEY);
+
+    // a second service: its own commit, the default one is untouched
+    map_string_t mqtt_txt = { { "txtvers", "1.0.0" } };
+    publisher->setService ("mqtt", "IPC (12345678)", "_mqtt._tcp.", "", "1883");
+    publisher->setTxtRecords ("mqtt", mqtt_txt);
+    publisher->update ("mqtt");
+    publisher->update ("mqtt");
+    publisher->removeService ("mqtt");
+    assert (!publisher->hasService ("mqtt"));
+
+    publisher->stop ();
+    zhash_destroy (&txt);
+
+    // policy: a registered service is moved at once, the others are not touched
+    {
+        RecordingPublisher moved;
+        moved.setService ("https", "IPC", "_https._tcp.", "", "443");
+        moved.setService ("mqtt", "IPC", "_mqtt._tcp.", "", "1883");
+        moved.start ();
+        PublishPolicy policy;
+        assert (PublishPolicy::parse ("lo", "ipv4", policy));
+        moved.setPolicy ("https", policy);
+        assert (moved.count (RecordingPublisher::COMMIT, "https") == 2);
+        assert (moved.count (RecordingPublisher::COMMIT, "mqtt") == 1);
+        assert (moved.services ().at ("https").interfaces.size () == 1);
+        assert (moved.services ().at ("https").protocol == PublishPolicy::IPV4);
+        // nothing changed on the interfaces
+        moved.refreshInterfaces ();
+        assert (moved.count (RecordingPublisher::COMMIT) == 3);
+    }
+
+    // subtypes: reordered is unchanged, added ones join the registered
+    // service, a withdrawn one needs a new commit
+    {
+        RecordingPublisher typed;
+        typed.setService ("https", "IPC", "_https._tcp.", "ups,_powerservice._sub._https._tcp.", "443");
+        typed.start ();
+        assert (typed.services ().at ("https").definition.at (SERVICE_SUBTYPE_KEY)
+            == "_powerservice._sub._https._tcp.,_ups._sub._https._tcp.");
+        typed.setService ("https", "IPC", "_https._tcp.", "_ups._sub._https._tcp.,powerservice", "443");
+        typed.update ("https");
+        assert (typed.count (RecordingPublisher::DEFINE, "https") == 1);
+        assert (typed.count (RecordingPublisher::UPDATE, "https") == 1);
+        typed.setService ("https", "IPC", "_https._tcp.", "ups,powerservice,pdu", "443");
+        typed.update ("https");
+        assert (typed.count (RecordingPublisher::SUBTYPE, "https") == 1);
+        assert (typed.count (RecordingPublisher::COMMIT, "https") == 1);
+        typed.setService ("https", "IPC", "_https._tcp.", "ups,pdu", "443");
+        typed.update ("https");
+        assert (typed.count (RecordingPublisher::COMMIT, "https") == 2);
+        assert (typed.count (RecordingPublisher::SUBTYPE, "https") == 1);
+        assert (typed.services ().at ("https").registered_subtypes.names.size () == 2);
+    }
+
+    // daemon restart: everything registered again from memory, once back
+    {
+        RecordingPublisher restarted;
+        restarted.setService ("https", "IPC", "_https._tcp.", "", "443");
+        restarted.setService ("mqtt", "IPC", "_mqtt._tcp.", "", "1883");
+        restarted.start ();
+        restarted.daemonLost ();
+        restarted.update ("https");
+        assert (restarted.count (RecordingPublisher::COMMIT) == 2);
+        assert (restarted.count (RecordingPublisher::LOST) == 1);
+        restarted.daemonBack ();
+        assert (restarted.count (RecordingPublisher::COMMIT, "https") == 2);
+        assert (restarted.count (RecordingPublisher::COMMIT, "mqtt") == 2);
+        restarted.update ("https");
+        assert (restarted.count (RecordingPublisher::UPDATE, "https") == 1);
+    }
+
+    // a name chosen after collisions sticks until the requested one changes
+    {
+        RecordingPublisher named;
+        named.setService ("https", "IPC", "_https._tcp.", "", "443");
+        named.setPublishedName ("https", "IPC #2");
+        named.start ();
+        assert (named.records ().back ().kind == RecordingPublisher::COMMIT);
+        assert (named.records ().back ().name == "IPC #2");
+        named.setService ("https", "IPC", "_https._tcp.", "", "8443");
+        named.update ("https");
+        assert (named.records ().back ().name == "IPC #2");
+        named.setService ("https", "NEW", "_https._tcp.", "", "8443");
+        named.update ("https");
+        assert (named.records ().back ().name == "NEW");
+    }
+
+    // proxied device: host and address are part of the registration
+    {
+        RecordingPublisher proxy;
+        proxy.setService ("proxy/ups-1", "UPS 1", "_https._tcp.", "ups", "443");
+        proxy.setServiceHost ("proxy/ups-1", "ups-1.local", "10.0.0.11");
+        proxy.start ();
+        proxy.setServiceHost ("proxy/ups-1", "ups-1.local", "10.0.0.11");
+        proxy.update ("proxy/ups-1");
+        assert (proxy.count (RecordingPublisher::COMMIT) == 1);
+        proxy.setServiceHost ("proxy/ups-1", "ups-1.local", "10.0.0.12");
+        proxy.update ("proxy/ups-1");
+        assert (proxy.count (RecordingPublisher::COMMIT) == 2);
+        assert (proxy.services ().at ("proxy/ups-1").address == "10.0.0.12");
+    }
+
+    const auto &records = rp.records ();
+    assert (records.size () == 11);
+    assert (rp.count (RecordingPublisher::COMMIT) == 2);
+    assert (rp.count (RecordingPublisher::COMMIT, DEFAULT_SERVICE_KEY) == 1);
+    assert (rp.count (RecordingPublisher::UPDATE, DEFAULT_SERVICE_KEY) == 1);
+    assert (rp.count (RecordingPublisher::UPDATE, "mqtt") == 1);
+    assert (rp.count (RecordingPublisher::REMOVE, "mqtt") == 1);
+    assert (records[2].kind == RecordingPublisher::COMMIT);
+    assert (records[2].name == "IPC (12345678)");
+    assert (records[2].txt.at ("txtvers") == "1.0.0");
+    assert (records[4].kind == RecordingPublisher::UPDATE);
+    assert (records[4].txt.at ("txtvers") == "1.0.1");
+    for (size_t i = 1; i < records.size (); i++)
+        assert (records[i].usec >= records[i - 1].usec);
+
+    zmsg_t *msg = zmsg_new ();
+    rp.pack (msg);
+    assert (zmsg_size (msg) == 4 * records.size ());
+    zmsg_destroy (&msg);
+
+    if (verbose)
+        printf ("   %zu records captured\n", records.size ());
+
+    printf (" * Recording publisher test: OK\n");
+}
@@ -0,0 +1,139 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   recording_publisher.h
+ *
+ * In-memory publisher backend: nothing goes on the network, every call is
+ * recorded with a timestamp. Used by selftests and benchmarks to exercise
+ * the announce path without avahi-daemon nor D-Bus.
+ */
+
+#ifndef RECORDING_PUBLISHER_H
+#define RECORDING_PUBLISHER_H
+
+#include <vector>
+
+#include "mdns_publisher.h"
+
+class RecordingPublisher : public MdnsPublisher {
+public:
+    enum Kind {
+        DEFINE,     // setService() with a new or changed definition
+        TXT,        // setTxtRecords()
+        COMMIT,     // service (re)registered
+        UPDATE,     // TXT records pushed to a registered service
+        REMOVE,     // removeService()
+        STOP,       // stop(): all services withdrawn
+        LOST,       // daemonLost(): all services gone with the daemon
+        SUBTYPE     // subtypes added to a registered service, without commit
+    };
+
+    struct Record {
+        Kind kind;
+        int64_t usec;               // zclock_usecs() at call time
+        std::string key;            // service key
+        std::string name;           // service name at call time
+        map_string_t txt;           // TXT records at call time (COMMIT/UPDATE)
+    };
+
+    struct Service {
+        map_string_t definition;    // name, type, canonical subtypes and port
+        ServiceSubtypes subtypes;   // wanted
+        ServiceSubtypes registered_subtypes;    // at the last commit or SUBTYPE
+        map_string_t txt;
+        std::string published;      // setPublishedName(), empty if none
+        std::string host;           // setServiceHost(), empty for this host
+        std::string address;
+        std::vector<int> interfaces;    // resolved policy, empty for all interfaces
+        PublishPolicy::Protocol protocol = PublishPolicy::ANY;
+        bool registered = false;
+        bool dirty = true;
+    };
+
+    void setService(
+        const std::string& key,
+        const std::string& service_name,
+        const std::string& service_type,
+        const std::string& service_stype,
+        const std::string& port) override;
+
+    void setPublishedName(const std::string& key, const std::string& name) override;
+    void setServiceHost(const std::string& key, const std::string& host, const std::string& address) override;
+
+    void setDefaultPolicy(const PublishPolicy& policy) override;
+    void setPolicy(const std::string& key, const PublishPolicy& policy) override;
+    void refreshInterfaces() override;
+
+    void setTxtRecords(const std::string& key, map_string_t &map) override;
+    void setTxtRecords(const std::string& key, zhash_t *map) override;
+    void setTxtRecords(const std::string& key, const TxtFrame& txt) override;
+
+    void removeService(const std::string& key) override;
+    bool hasService(const std::string& key) const override;
+
+    int start() override;
+    void stop() override;
+    void update(const std::string& key) override;
+
+    /**
+     * Stand-in for an avahi-daemon restart: daemonLost() drops the
+     * registrations, daemonBack() registers every service again from
+     * memory, as AvahiWrapper does when its client runs again.
+     */
+    void daemonLost();
+    void daemonBack();
+    bool daemonRunning() const { return _daemon; }
+
+    const std::vector<Record>& records() const { return _records; }
+    size_t count(Kind kind) const;
+    size_t count(Kind kind, const std::string& key) const;
+    void clear() { _records.clear(); _records.shrink_to_fit(); }
+
+    // current published state
+    const std::map<std::string, Service>& services() const { return _services; }
+    bool started() const { return _started; }
+
+    static const char* kindName(Kind kind);
+
+    /**
+     * Append all records to msg, four frames per record:
+     * kind, timestamp (usec), service key and TXT records as a packed zhash.
+     */
+    void pack(zmsg_t *msg) const;
+
+private:
+    void record(Kind kind, const std::string& key);
+    void commit(const std::string& key, Service& service);
+    bool resolvePolicy(const std::string& key, Service& service);
+    void applyPolicies();
+
+    std::vector<Record> _records;
+    std::map<std::string, Service> _services;
+    bool _started = false;
+    bool _daemon = true;
+    PublishPolicy _defaultPolicy;
+    std::map<std::string, PublishPolicy> _policies;
+};
+
+//  Self test of this class.
+void recording_publisher_test (bool verbose);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   resolver_pool.cc
+ *
+ */
+
+#include "resolver_pool.h"
+
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+ResolverPool::ResolverPool(size_t maxInFlight, int64_t resultTtl) :
+    _maxInFlight(maxInFlight ? maxInFlight : 1),
+    _resultTtl(resultTtl)
+{
+}
+
+void ResolverPool::configure(size_t maxInFlight, int64_t resultTtl)
+{
+    _maxInFlight = maxInFlight ? maxInFlight : 1;
+    _resultTtl = resultTtl;
+    pump();
+}
+
+bool ResolverPool::fresh(const std::string& key, int64_t now) const
+{
+    auto it = _resolvedAt.find(key);
+    return it != _resolvedAt.end() && now - it->second < _resultTtl;
+}
+
+ResolverPool::Outcome ResolverPool::request(const std::string& key, int64_t now)
+{
+    if (fresh(key, now)) {
+        _stats.hits++;
+        return HIT;
+    }
+    if (_inFlight.count(key)) {
+        _stats.joined++;
+        return IN_FLIGHT;
+    }
+    if (!_waiting.insert(key).second) {
+        _stats.joined++;
+        return QUEUED;
+    }
+    _stats.misses++;
+    _queue.push_back(key);
+    if (_queue.size() > _stats.queueMax)
+        _stats.queueMax = _queue.size();
+    pump();
+    return _inFlight.count(key) ? IN_FLIGHT : QUEUED;
+}
+
+void ResolverPool::finished(const std::string& key, bool ok, int64_t now)
+{
+    _inFlight.erase(key);
+    if (ok) {
+        _stats.completed++;
+        _resolvedAt[key] = now;
+    }
+    else {
+        _stats.failed++;
+        _resolvedAt.erase(key);
+    }
+    pump();
+}
+
+void ResolverPool::forget(const std::string& key)
+{
+    _resolvedAt.erase(key);
+    if (!_waiting.erase(key))
+        return;
+    for (auto it = _queue.begin(); it != _queue.end(); ++it) {
+        if (*it == key) {
+            _queue.erase(it);
+            break;
+        }
+    }
+}
+
+void ResolverPool::reset()
+{
+    _queue.clear();
+    _waiting.clear();
+    _inFlight.clear();
+}
+
+unsigned ResolverPool::hitRatio() const
+{
+    uint64_t total = _stats.hits + _stats.misses;
+    return total ? unsigned(_stats.hits * 100 / total) : 0;
+}
+
+void ResolverPool::pump()
+{
+    // the starter may report a resolver finished at once, which pumps again
+    while (_starter && _inFlight.size() < _maxInFlight && !_queue.empty()) {
+        std::string key = _queue.front();
+        _queue.pop_front();
+        _waiting.erase(key);
+        _inFlight.insert(key);
+        if (!_starter(key) && _inFlight.erase(key))
+            _stats.failed++;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void resolver_pool_test (bool verbose)
+{
+    printf (" * Resolver pool test\n");
+
+    std::vector<std::string> started;
+    ResolverPool pool(2, 1000);
+    pool.setStarter([&started](const std::string& key) {
+        if (key == "broken") return false;
+        started.push_back(key);
+        return true;
+    });
+
+    //  at most two resolvers at once, the others wait in order, each once
+    assert(pool.request("a", 0) == ResolverPool::IN_FLIGHT);
+    assert(pool.request("b", 0) == ResolverPool::IN_FLIGHT);
+    assert(pool.request("c", 0) == ResolverPool::QUEUED);
+    assert(pool.request("d", 0) == ResolverPool::QUEUED);
+    assert(pool.request("c", 0) == ResolverPool::QUEUED);
+    assert(pool.request("a", 0) == ResolverPool::IN_FLIGHT);
+    assert(started.size() == 2 && started[0] == "a" && started[1] == "b");
+    assert(pool.inFlight() == 2 && pool.queued() == 2);
+    assert(pool.stats().queueMax == 2);
+    //  repeated requests join the pending resolutions, they are no misses
+    assert(pool.stats().misses == 4 && pool.stats().joined == 2 && pool.stats().hits == 0);
+    assert(pool.hitRatio() == 0);
+
+    //  a finished resolver gives its slot to the oldest queued request
+    pool.finished("a", true, 100);
+    assert(started.size() == 3 && started[2] == "c");
+    assert(pool.inFlight() == 2 && pool.queued() == 1);
+    pool.finished("b", false, 100);
+    assert(started.size() == 4 && started[3] == "d");
+    assert(pool.queued() == 0);
+    assert(pool.stats().completed == 1 && pool.stats().failed == 1);
+
+    //  results are fresh for the result TTL
+    assert(pool.fresh("a", 1099));
+    assert(!pool.fresh("b", 100));
+    assert(pool.request("a", 500) == ResolverPool::HIT);
+    assert(pool.request("a", 1099) == ResolverPool::HIT);
+    assert(pool.stats().hits == 2);
+    assert(pool.hitRatio() == 33);
+    pool.finished("c", true, 200);
+    pool.finished("d", true, 200);
+    assert(pool.inFlight() == 0);
+    assert(pool.request("a", 1100) == ResolverPool::IN_FLIGHT);
+    assert(started.size() == 5 && started[4] == "a");
+    pool.finished("a", true, 1200);
+
+    //  forgotten instances leave the queue and lose their result
+    assert(pool.request("e", 1200) == ResolverPool::IN_FLIGHT);
+    assert(pool.request("f", 1200) == ResolverPool::IN_FLIGHT);
+    assert(pool.request("g", 1200) == ResolverPool::QUEUED);
+    pool.forget("g");
+    pool.forget("c");
+    assert(pool.queued() == 0);
+    assert(!pool.fresh("c", 1200));
+    assert(pool.fresh("d", 1199));
+    pool.finished("e", true, 1300);
+    assert(started.back() == "f");
+
+    //  a resolver which cannot start is counted and skipped
+    uint64_t failed = pool.stats().failed;
+    assert(pool.request("broken", 1300) == ResolverPool::QUEUED);
+    assert(pool.inFlight() == 1 && pool.queued() == 0);
+    assert(pool.stats().failed == failed + 1);
+
+    //  reset frees the slots and empties the queue, results are kept
+    assert(pool.request("h", 1300) == ResolverPool::IN_FLIGHT);
+    assert(pool.request("i", 1300) == ResolverPool::QUEUED);
+    pool.reset();
+    assert(pool.inFlight() == 0 && pool.queued() == 0);
+    assert(pool.fresh("e", 1300));
+    assert(pool.request("i", 1300) == ResolverPool::IN_FLIGHT);
+
+    //  a larger maximum starts the waiting requests at once
+    ResolverPool wide(1, 1000);
+    size_t count = 0;
+    wide.setStarter([&count](const std::string&) { count++; return true; });
+    for (int i = 0; i < 10; i++)
+        wide.request(std::to_string(i), 0);
+    assert(count == 1 && wide.queued() == 9);
+    wide.configure(4, 1000);
+    assert(count == 4 && wide.inFlight() == 4 && wide.queued() == 6);
+    // a lower one lets the running resolvers finish
+    wide.configure(2, 1000);
+    wide.finished("0", true, 10);
+    assert(count == 4 && wide.inFlight() == 3);
+    wide.finished("1", true, 10);
+    wide.finished("2", true, 10);
+    assert(count == 5 && wide.inFlight() == 2);
+
+    //  a starter may report its resolver finished before returning
+    ResolverPool sync(2, 1000);
+    size_t done = 0;
+    sync.setStarter([&sync, &done](const std::string& key) {
+        done++;
+        sync.finished(key, true, 0);
+        return true;
+    });
+    for (int i = 0; i < 100; i++)
+        sync.request(std::to_string(i), 0);
+    assert(done == 100 && sync.inFlight() == 0 && sync.queued() == 0);
+    assert(sync.results() == 100);
+
+    if (verbose)
+        printf ("   hits %u%%, queue high-water mark %zu\n", pool.hitRatio(), pool.stats().queueMax);
+
+    printf (" * Resolver pool test: OK\n");
+}
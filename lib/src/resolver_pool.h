@@ -0,0 +1,111 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   resolver_pool.h
+ *
+ * Bounded queue of the service resolutions of the discovery engine. At most
+ * maxInFlight resolvers run at once, the other requests wait in order,
+ * each instance once. Results are remembered for resultTtl, so asking again
+ * for a freshly resolved instance costs nothing.
+ */
+
+#ifndef RESOLVER_POOL_H
+#define RESOLVER_POOL_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+class ResolverPool {
+public:
+    enum Outcome { HIT, QUEUED, IN_FLIGHT };
+
+    // start the resolver of an instance, false if it cannot be started
+    typedef std::function<bool(const std::string& key)> starter_t;
+
+    struct Stats {
+        uint64_t hits = 0;          // requests answered by a fresh result
+        uint64_t misses = 0;        // requests starting a resolution
+        uint64_t joined = 0;        // requests for an instance already queued or being resolved
+        uint64_t completed = 0;     // resolutions done
+        uint64_t failed = 0;        // resolutions which failed or could not start
+        size_t queueMax = 0;        // queue depth high-water mark
+    };
+
+    explicit ResolverPool(size_t maxInFlight = 8, int64_t resultTtl = 120000);
+
+    ResolverPool(const ResolverPool&) = delete;
+    ResolverPool& operator=(const ResolverPool&) = delete;
+
+    void setStarter(starter_t starter) { _starter = starter; }
+
+    // a lower maximum lets the running resolvers finish
+    void configure(size_t maxInFlight, int64_t resultTtl);
+    size_t maxInFlight() const { return _maxInFlight; }
+    int64_t resultTtl() const { return _resultTtl; }
+
+    /**
+     * Ask for the resolution of an instance. A result younger than resultTtl
+     * is a HIT, otherwise the instance is queued, unless it already is: the
+     * request then joins the pending resolution.
+     */
+    Outcome request(const std::string& key, int64_t now);
+
+    // the resolver of key is over, its slot goes to the next queued instance
+    void finished(const std::string& key, bool ok, int64_t now);
+
+    // drop the result and the queued request of an instance
+    void forget(const std::string& key);
+
+    // resolvers were freed all at once: empty the queue and the slots, keep the results
+    void reset();
+
+    bool fresh(const std::string& key, int64_t now) const;
+
+    size_t queued() const { return _queue.size(); }
+    size_t inFlight() const { return _inFlight.size(); }
+    size_t results() const { return _resolvedAt.size(); }
+    const Stats& stats() const { return _stats; }
+
+    // percentage of hits among the hits and misses, the joined requests
+    // neither cost a resolution nor are answered at once; 0 without requests
+    unsigned hitRatio() const;
+
+private:
+    void pump();
+
+    size_t _maxInFlight;
+    int64_t _resultTtl;
+    starter_t _starter;
+    std::deque<std::string> _queue;
+    std::unordered_set<std::string> _waiting;   // keys of _queue
+    std::unordered_set<std::string> _inFlight;
+    std::unordered_map<std::string, int64_t> _resolvedAt;
+    Stats _stats;
+};
+
+//  Self test of this class.
+void resolver_pool_test (bool verbose);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   service_subtypes.cc
+ *
+ */
+
+#include "service_subtypes.h"
+
+#include <cassert>
+#include <cstdio>
+
+ServiceSubtypes ServiceSubtypes::parse(const std::string& list, const std::string& type)
+{
+    ServiceSubtypes parsed;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(start, end - start);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (!name.empty() && name.find("._sub.") == std::string::npos && !type.empty()) {
+            if (name[0] != '_')
+                name.insert(0, "_");
+            name += "._sub." + type;
+        }
+        if (!name.empty())
+            parsed.names.insert(name);
+        start = end + 1;
+    }
+    return parsed;
+}
+
+std::vector<std::string> ServiceSubtypes::missingFrom(const ServiceSubtypes& other) const
+{
+    std::vector<std::string> missing;
+    for (const auto& name : names) {
+        if (!other.names.count(name))
+            missing.push_back(name);
+    }
+    return missing;
+}
+
+std::string ServiceSubtypes::toString() const
+{
+    std::string out;
+    for (const auto& name : names) {
+        if (!out.empty()) out += ",";
+        out += name;
+    }
+    return out;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void service_subtypes_test (bool verbose)
+{
+    printf (" * Service subtypes test\n");
+
+    ServiceSubtypes none = ServiceSubtypes::parse ("", "_https._tcp.");
+    assert (none.empty ());
+    assert (none.toString () == "");
+
+    // the single subtype of older announcements is a list of one
+    ServiceSubtypes one = ServiceSubtypes::parse ("_powerservice._sub._https._tcp.", "_https._tcp.");
+    assert (one.names.size () == 1);
+    assert (one.toString () == "_powerservice._sub._https._tcp.");
+
+    // short names expanded, order and duplicates do not matter
+    ServiceSubtypes list = ServiceSubtypes::parse (" ups, _pdu ,,_powerservice._sub._https._tcp.,ups", "_https._tcp.");
+    assert (list.names.size () == 3);
+    assert (list.toString () == "_pdu._sub._https._tcp.,_powerservice._sub._https._tcp.,_ups._sub._https._tcp.");
+    if (verbose)
+        printf ("   %s\n", list.toString ().c_str ());
+    ServiceSubtypes same = ServiceSubtypes::parse (list.toString (), "_https._tcp.");
+    assert (same == list);
+    assert (ServiceSubtypes::parse ("pdu,ups,powerservice", "_https._tcp.") == list);
+
+    // diff
+    assert (one.missingFrom (list).empty ());
+    std::vector<std::string> added = list.missingFrom (one);
+    assert (added.size () == 2);
+    assert (added[0] == "_pdu._sub._https._tcp." && added[1] == "_ups._sub._https._tcp.");
+
+    ServiceSubtypes merged = one;
+    merged.merge (ServiceSubtypes::parse ("ups", "_https._tcp."));
+    assert (merged.names.size () == 2);
+    assert (merged != list);
+
+    printf (" * Service subtypes test: OK\n");
+}
@@ -0,0 +1,63 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   service_subtypes.h
+ *
+ * Subtypes a service is announced under, so that clients can browse for
+ * e.g. _ups._sub._https._tcp only. Kept as a sorted set: the same list in
+ * another order or with duplicates is the same announcement.
+ */
+
+#ifndef SERVICE_SUBTYPES_H
+#define SERVICE_SUBTYPES_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+struct ServiceSubtypes {
+    std::set<std::string> names;    // full names, e.g. _ups._sub._https._tcp.
+
+    /**
+     * Build the subtypes of a service of type from a comma separated list.
+     * A short name (ups or _ups) stands for _ups._sub.<type>, empty entries
+     * are skipped.
+     */
+    static ServiceSubtypes parse(const std::string& list, const std::string& type);
+
+    void merge(const ServiceSubtypes& other) { names.insert(other.names.begin(), other.names.end()); }
+
+    // subtypes of this set missing from other
+    std::vector<std::string> missingFrom(const ServiceSubtypes& other) const;
+
+    bool empty() const { return names.empty(); }
+
+    // canonical list: sorted, comma separated
+    std::string toString() const;
+
+    bool operator==(const ServiceSubtypes& other) const { return names == other.names; }
+    bool operator!=(const ServiceSubtypes& other) const { return !(*this == other); }
+};
+
+//  Self test of this class.
+void service_subtypes_test (bool verbose);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   txt_arena.cc
+ *
+ */
+
+#include "txt_arena.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "alloc_counter.h"
+
+//  words taken by the node of a record of size bytes, text is 0 terminated
+//  as avahi does
+static size_t
+s_node_words (size_t size)
+{
+    size_t bytes = offsetof (AvahiStringList, text) + size + 1;
+    return (bytes + sizeof (uint64_t) - 1) / sizeof (uint64_t);
+}
+
+void TxtArena::reset()
+{
+    _used = 0;
+    _count = 0;
+    _linked = true;
+}
+
+void TxtArena::add(std::string_view key, std::string_view value)
+{
+    size_t size = key.size() + 1 + value.size();
+    size_t words = s_node_words(size);
+    if (_used + words > _words.size()) {
+        // nodes are linked by list(), growing does not break them
+        _words.resize(std::max(_used + words, _words.size() * 2));
+    }
+    AvahiStringList* node = reinterpret_cast<AvahiStringList*>(&_words[_used]);
+    node->next = nullptr;
+    node->size = size;
+    memcpy(node->text, key.data(), key.size());
+    node->text[key.size()] = '=';
+    memcpy(node->text + key.size() + 1, value.data(), value.size());
+    node->text[size] = 0;
+    _used += words;
+    _count++;
+    _linked = false;
+}
+
+void TxtArena::assign(const TxtFrame& txt)
+{
+    reset();
+    for (const auto& entry : txt)
+        add(entry.key, entry.value);
+}
+
+void TxtArena::assign(zhash_t* map)
+{
+    reset();
+    if (!map) return;
+    for (char* value = (char*) zhash_first(map); value; value = (char*) zhash_next(map))
+        add(zhash_cursor(map), value);
+}
+
+AvahiStringList* TxtArena::list()
+{
+    if (_count == 0) return nullptr;
+    if (!_linked) {
+        AvahiStringList* previous = nullptr;
+        for (size_t offset = 0; offset < _used;) {
+            AvahiStringList* node = reinterpret_cast<AvahiStringList*>(&_words[offset]);
+            if (previous) previous->next = node;
+            previous = node;
+            offset += s_node_words(node->size);
+        }
+        previous->next = nullptr;
+        _linked = true;
+    }
+    return reinterpret_cast<AvahiStringList*>(&_words[0]);
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void txt_arena_test (bool verbose)
+{
+    printf (" * TXT arena test\n");
+
+    {
+        TxtArena arena;
+        assert (arena.list () == nullptr);
+        arena.add ("txtvers", "1.0.0");
+        arena.add ("uuid", "12345678");
+        arena.add ("empty", "");
+        assert (arena.size () == 3);
+        // avahi reads the list as one of its own
+        AvahiStringList *list = arena.list ();
+        assert (avahi_string_list_length (list) == 3);
+        assert (std::string ((char *) list->text, list->size) == "txtvers=1.0.0");
+        assert (std::string ((char *) list->next->text) == "uuid=12345678");
+        AvahiStringList *empty = avahi_string_list_find (list, "empty");
+        assert (empty && empty->size == 6);
+        assert (avahi_string_list_find (list, "missing") == nullptr);
+
+        // growing the buffer relinks the nodes
+        for (int i = 0; i < 100; i++)
+            arena.add ("key", std::string (size_t (i), 'x'));
+        assert (avahi_string_list_length (arena.list ()) == 103);
+        assert (avahi_string_list_find (arena.list (), "uuid"));
+
+        arena.reset ();
+        assert (arena.size () == 0 && arena.list () == nullptr);
+        assert (arena.capacity () > 0);
+    }
+
+    // assign from a zhash and from its packed frame gives the same records
+    {
+        zhash_t *map = zhash_new ();
+        zhash_insert (map, "txtvers", (void *) "1.0.0");
+        zhash_insert (map, "hostname", (void *) "ipc");
+        zframe_t *frame = zhash_pack (map);
+        TxtArena a, b;
+        a.assign (map);
+        b.assign (TxtFrame (frame));
+        assert (a.size () == 2 && b.size () == 2);
+        assert (a.used () == b.used ());
+        assert (avahi_string_list_find (a.list (), "hostname"));
+        assert (avahi_string_list_find (b.list (), "hostname"));
+        assert (avahi_string_list_find (b.list (), "txtvers"));
+        zframe_destroy (&frame);
+        zhash_destroy (&map);
+    }
+
+    // steady state: once the largest set has been seen, updates do not allocate
+    {
+        zhash_t *map = zhash_new ();
+        zhash_autofree (map);
+        char key [32], value [64];
+        for (int i = 0; i < 16; i++) {
+            snprintf (key, sizeof (key), "key-%02d", i);
+            snprintf (value, sizeof (value), "value of the TXT entry number %d", i);
+            zhash_insert (map, key, value);
+        }
+        zframe_t *large = zhash_pack (map);
+        zhash_update (map, "key-00", (void *) "changed");
+        zhash_delete (map, "key-15");
+        zframe_t *small = zhash_pack (map);
+        zhash_destroy (&map);
+
+        TxtArena arena;
+        arena.assign (TxtFrame (large));
+        arena.list ();
+        size_t capacity = arena.capacity ();
+
+        const int loops = 10000;
+        uint64_t allocs = alloc_count ();
+        for (int i = 0; i < loops; i++) {
+            arena.assign (TxtFrame (i % 2 ? small : large));
+            assert (arena.list ());
+        }
+        allocs = alloc_count () - allocs;
+        if (verbose)
+            printf ("   %d updates: %" PRIu64 " allocations, %zu bytes reserved\n", loops, allocs, capacity);
+        assert (arena.capacity () == capacity);
+        if (alloc_counting ())
+            assert (allocs == 0);
+        zframe_destroy (&small);
+        zframe_destroy (&large);
+    }
+
+    printf (" * TXT arena test: OK\n");
+}
@@ -0,0 +1,83 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   txt_arena.h
+ *
+ * TXT records of one service, laid out as an AvahiStringList inside a
+ * buffer owned by the arena. An update resets the arena instead of freeing
+ * the list, so once the buffer has grown to the largest TXT set seen,
+ * rebuilding the records does not allocate anymore.
+ *
+ * Avahi copies the list when a service is added or updated, the arena may
+ * then be rebuilt at any time. The list must never be given to
+ * avahi_string_list_free().
+ */
+
+#ifndef TXT_ARENA_H
+#define TXT_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <avahi-common/strlst.h>
+#include <czmq.h>
+
+#include "txt_frame.h"
+
+class TxtArena {
+public:
+    TxtArena() = default;
+
+    TxtArena(const TxtArena&) = delete;
+    TxtArena& operator=(const TxtArena&) = delete;
+
+    // forget the records, the buffer is kept for the next ones
+    void reset();
+
+    // append the record key=value
+    void add(std::string_view key, std::string_view value);
+
+    // replace all records
+    void assign(const TxtFrame& txt);
+    void assign(zhash_t* map);
+
+    // records in insertion order, nullptr if there is none
+    AvahiStringList* list();
+
+    size_t size() const { return _count; }
+    // bytes used, and reserved, by the records
+    size_t used() const { return _used * sizeof(uint64_t); }
+    size_t capacity() const { return _words.size() * sizeof(uint64_t); }
+
+private:
+    // 64 bit words keep every node aligned for AvahiStringList
+    std::vector<uint64_t> _words;
+    size_t _used = 0;           // words used
+    size_t _count = 0;          // records
+    bool _linked = true;        // next pointers are up to date
+};
+
+//  Self test of this class.
+void txt_arena_test (bool verbose);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   txt_budget.cc
+ *
+ */
+
+#include "txt_budget.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+bool TxtBudget::parse(const std::string& bytes, const std::string& priority, TxtBudget& budget)
+{
+    TxtBudget parsed;
+    if (!bytes.empty()) {
+        char *end = nullptr;
+        long value = strtol(bytes.c_str(), &end, 10);
+        if (*end != 0 || value < 0)
+            return false;
+        parsed.bytes = size_t(value);
+    }
+    size_t start = 0;
+    while (start <= priority.size()) {
+        size_t end = priority.find(',', start);
+        if (end == std::string::npos) end = priority.size();
+        std::string key = priority.substr(start, end - start);
+        key.erase(0, key.find_first_not_of(" \t"));
+        key.erase(key.find_last_not_of(" \t") + 1);
+        if (!key.empty() && std::find(parsed.priority.begin(), parsed.priority.end(), key) == parsed.priority.end())
+            parsed.priority.push_back(key);
+        start = end + 1;
+    }
+    parsed.overflow = budget.overflow;
+    budget = parsed;
+    return true;
+}
+
+size_t TxtBudget::wireSize(const TxtFrame& txt)
+{
+    size_t size = 0;
+    for (const auto& entry : txt)
+        size += entrySize(entry.key.size(), entry.value.size());
+    return size ? size : 1;
+}
+
+size_t TxtBudget::wireSize(const std::map<std::string, std::string>& txt)
+{
+    size_t size = 0;
+    for (const auto& entry : txt)
+        size += entrySize(entry.first.size(), entry.second.size());
+    return size ? size : 1;
+}
+
+bool TxtBudget::fits(const TxtFrame& txt) const
+{
+    size_t size = 0;
+    for (const auto& entry : txt) {
+        if (!encodable(entry.key.size(), entry.value.size()))
+            return false;
+        size += entrySize(entry.key.size(), entry.value.size());
+    }
+    return bytes == 0 || std::max<size_t>(size, 1) <= bytes;
+}
+
+size_t TxtBudget::split(const TxtFrame& txt,
+    std::map<std::string, std::string>& primary,
+    std::map<std::string, std::string>& secondary) const
+{
+    primary.clear();
+    secondary.clear();
+
+    // configured keys by their rank, then the others by name
+    std::vector<std::pair<size_t, TxtFrame::Entry>> entries;
+    entries.reserve(txt.size());
+    for (const auto& entry : txt) {
+        size_t rank = std::find(priority.begin(), priority.end(), entry.key) - priority.begin();
+        entries.emplace_back(rank, entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first < b.first : a.second.key < b.second.key;
+    });
+
+    // strict order: once a key does not fit, the next ones do not go there either
+    size_t dropped = 0;
+    size_t used[2] = { 0, 0 };
+    int target = 0;
+    for (const auto& it : entries) {
+        if (!encodable(it.second.key.size(), it.second.value.size())) {
+            dropped++;
+            continue;
+        }
+        size_t size = entrySize(it.second.key.size(), it.second.value.size());
+        if (target == 0 && bytes && used[0] + size > bytes)
+            target = 1;
+        if (target == 1 && (!overflow || (bytes && used[1] + size > bytes)))
+            target = 2;
+        if (target == 2) {
+            dropped++;
+            continue;
+        }
+        used[target] += size;
+        (target == 0 ? primary : secondary)[std::string(it.second.key)] = std::string(it.second.value);
+    }
+    return dropped;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void txt_budget_test (bool verbose)
+{
+    printf (" * TXT budget test\n");
+
+    TxtBudget budget;
+    assert (TxtBudget::parse ("", "", budget));
+    assert (budget.bytes == 0 && budget.priority.empty ());
+    assert (!TxtBudget::parse ("12x", "", budget));
+    assert (TxtBudget::parse ("40", " txtvers, uuid,,txtvers", budget));
+    assert (budget.bytes == 40);
+    assert (budget.priority.size () == 2);
+    assert (budget.priority[0] == "txtvers" && budget.priority[1] == "uuid");
+
+    zhash_t *map = zhash_new ();
+    zframe_t *frame = zhash_pack (map);
+    assert (TxtBudget::wireSize (TxtFrame (frame)) == 1);
+    zframe_destroy (&frame);
+
+    zhash_insert (map, "txtvers", (void *) "1.0.0");        // 14 bytes
+    zhash_insert (map, "uuid", (void *) "12345678");        // 14 bytes
+    zhash_insert (map, "contact", (void *) "admin");        // 14 bytes
+    zhash_insert (map, "description", (void *) "rack 4");   // 19 bytes
+    zhash_insert (map, "a", (void *) "b");                  // 4 bytes
+    frame = zhash_pack (map);
+    TxtFrame txt (frame);
+    assert (TxtBudget::wireSize (txt) == 65);
+    assert (!budget.fits (txt));
+
+    // txtvers, uuid, then a, contact, description by name
+    std::map<std::string, std::string> primary, secondary;
+    assert (budget.split (txt, primary, secondary) == 0);
+    assert (primary.size () == 3);
+    assert (primary.count ("txtvers") && primary.count ("uuid") && primary.count ("a"));
+    assert (TxtBudget::wireSize (primary) <= 40);
+    assert (secondary.size () == 2);
+    assert (TxtBudget::wireSize (secondary) == 33);
+
+    // smaller budget: what the secondary cannot hold is dropped
+    assert (TxtBudget::parse ("30", "txtvers,uuid", budget));
+    assert (budget.split (txt, primary, secondary) == 1);
+    assert (primary.size () == 2);
+    assert (secondary.size () == 2);
+    assert (secondary.count ("a") && secondary.count ("contact"));
+
+    // no secondary instance
+    budget.overflow = false;
+    assert (budget.split (txt, primary, secondary) == 3);
+    assert (primary.size () == 2 && secondary.empty ());
+
+    // no limit
+    assert (TxtBudget::parse ("0", "", budget));
+    assert (budget.fits (txt));
+    if (verbose)
+        printf ("   %zu keys, %zu bytes\n", txt.size (), TxtBudget::wireSize (txt));
+    zframe_destroy (&frame);
+
+    // a string over 255 bytes cannot be encoded, dropped even without limit
+    std::string longest (TxtBudget::MAX_ENTRY - strlen ("long="), 'x');
+    zhash_insert (map, "long", (void *) longest.c_str ());
+    frame = zhash_pack (map);
+    assert (budget.fits (TxtFrame (frame)));
+    zframe_destroy (&frame);
+    longest += "x";
+    zhash_update (map, "long", (void *) longest.c_str ());
+    frame = zhash_pack (map);
+    assert (!budget.fits (TxtFrame (frame)));
+    assert (budget.split (TxtFrame (frame), primary, secondary) == 1);
+    assert (primary.size () == 5 && !primary.count ("long") && secondary.empty ());
+    budget.overflow = true;
+    assert (TxtBudget::parse ("30", "long,txtvers,uuid", budget));
+    assert (budget.split (TxtFrame (frame), primary, secondary) == 2);
+    assert (primary.size () == 2 && primary.count ("txtvers") && primary.count ("uuid"));
+
+    zframe_destroy (&frame);
+    zhash_destroy (&map);
+
+    printf (" * TXT budget test: OK\n");
+}
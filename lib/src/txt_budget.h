@@ -0,0 +1,84 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   txt_budget.h
+ *
+ * Size budget of the TXT record of a service, in wire format bytes (RFC
+ * 6763: each "key=value" string preceded by its length byte). A TXT set
+ * over the budget is split by key priority: the configured keys first in
+ * their order, then the others by name. The first keys that fit are kept,
+ * the rest go to a secondary instance within the same budget, or are dropped.
+ * A string longer than 255 bytes cannot be encoded at all and is dropped.
+ */
+
+#ifndef TXT_BUDGET_H
+#define TXT_BUDGET_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "txt_frame.h"
+
+// secondary instance of a service, holding the TXT keys over the budget
+#define TXT_MORE_SUFFIX "/more"     // appended to the service key
+#define TXT_MORE_NAME   " (more)"   // appended to the service name
+
+struct TxtBudget {
+    size_t bytes = 0;                   // max TXT RDATA size, 0 = no limit
+    std::vector<std::string> priority;  // keys kept first, in this order
+    bool overflow = true;               // keys beyond the budget go to a secondary instance
+
+    /**
+     * Build a budget from a size in bytes (0 or empty = no limit) and a comma
+     * separated list of keys by decreasing priority. Return false if the
+     * size is not a number.
+     */
+    static bool parse(const std::string& bytes, const std::string& priority, TxtBudget& budget);
+
+    // longest "key=value" string, its length is given in one byte
+    static const size_t MAX_ENTRY = 255;
+
+    // wire size of one "key=value" string, with its length byte
+    static size_t entrySize(size_t key, size_t value) { return 1 + key + 1 + value; }
+    static bool encodable(size_t key, size_t value) { return key + 1 + value <= MAX_ENTRY; }
+    // TXT RDATA size, an empty set is one empty string
+    static size_t wireSize(const TxtFrame& txt);
+    static size_t wireSize(const std::map<std::string, std::string>& txt);
+
+    // within the budget, every string encodable
+    bool fits(const TxtFrame& txt) const;
+
+    /**
+     * Split txt: primary gets the keys by priority as long as they fit,
+     * secondary the following ones as long as they fit (none if overflow
+     * is off). Strings which cannot be encoded are skipped. Return the
+     * number of keys dropped.
+     */
+    size_t split(const TxtFrame& txt,
+        std::map<std::string, std::string>& primary,
+        std::map<std::string, std::string>& secondary) const;
+};
+
+//  Self test of this class.
+void txt_budget_test (bool verbose);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   txt_frame.cc
+ *
+ */
+
+#include "txt_frame.h"
+
+#include <cinttypes>
+#include <string>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/strlst.h>
+
+#include "alloc_counter.h"
+
+static inline uint32_t
+s_get_uint32 (const uint8_t* p)
+{
+    return (uint32_t (p[0]) << 24) | (uint32_t (p[1]) << 16) | (uint32_t (p[2]) << 8) | uint32_t (p[3]);
+}
+
+void TxtFrame::const_iterator::decode()
+{
+    if (!_remaining) return;
+    size_t keySize = _cursor[0];
+    _entry.key = std::string_view((const char*) _cursor + 1, keySize);
+    const uint8_t* p = _cursor + 1 + keySize;
+    size_t valueSize = s_get_uint32(p);
+    _entry.value = std::string_view((const char*) p + 4, valueSize);
+    _cursor = p + 4 + valueSize;
+}
+
+TxtFrame::TxtFrame(const void* data, size_t size) :
+    _data((const uint8_t*) data)
+{
+    check(size);
+}
+
+TxtFrame::TxtFrame(zframe_t* frame) :
+    _data(frame ? zframe_data(frame) : nullptr)
+{
+    check(frame ? zframe_size(frame) : 0);
+}
+
+void TxtFrame::check(size_t size)
+{
+    _count = 0;
+    _valid = false;
+    if (!_data || size < 4)
+        return;
+    const uint8_t* p = _data + 4;
+    const uint8_t* limit = _data + size;
+    size_t count = s_get_uint32(_data);
+    for (size_t i = 0; i < count; i++) {
+        if (limit - p < 1 || size_t(limit - p) < 1 + size_t(p[0]) + 4)
+            return;
+        p += 1 + p[0];
+        size_t valueSize = s_get_uint32(p);
+        p += 4;
+        if (size_t(limit - p) < valueSize)
+            return;
+        p += valueSize;
+    }
+    _count = count;
+    _valid = true;
+}
+
+bool TxtFrame::find(std::string_view key, std::string_view& value) const
+{
+    for (const auto &entry : *this) {
+        if (entry.key == key) {
+            value = entry.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+//  TXT string list as built before: unpacked hash, then key=value strings
+static AvahiStringList *
+s_bench_unpack (zframe_t *frame)
+{
+    AvahiStringList *list = NULL;
+    zhash_t *hash = zhash_unpack (frame);
+    for (char *value = (char *) zhash_first (hash); value; value = (char *) zhash_next (hash)) {
+        std::string key = zhash_cursor (hash);
+        std::string val = value;
+        list = avahi_string_list_add (list, (key + "=" + val).c_str ());
+    }
+    zhash_destroy (&hash);
+    return list;
+}
+
+//  TXT string list built from the frame view through a reused buffer
+static AvahiStringList *
+s_bench_view (zframe_t *frame, std::string &buffer)
+{
+    AvahiStringList *list = NULL;
+    TxtFrame txt (frame);
+    for (const auto &entry : txt) {
+        buffer.assign (entry.key);
+        buffer += '=';
+        buffer.append (entry.value);
+        list = avahi_string_list_add_arbitrary (list, (const uint8_t *) buffer.data (), buffer.size ());
+    }
+    return list;
+}
+
+void txt_frame_test (bool verbose)
+{
+    printf (" * TXT frame test\n");
+
+    zhash_t *hash = zhash_new ();
+    zhash_insert (hash, "txtvers", (void *) "1.0.0");
+    zhash_insert (hash, "uuid", (void *) "12345678-0000-0000-0000-000000000000");
+    zhash_insert (hash, "empty", (void *) "");
+    zframe_t *frame = zhash_pack (hash);
+
+    TxtFrame txt (frame);
+    assert (txt.valid ());
+    assert (txt.size () == 3);
+    size_t n = 0;
+    for (const auto &entry : txt) {
+        const char *expected = (const char *) zhash_lookup (hash, std::string (entry.key).c_str ());
+        assert (expected);
+        assert (entry.value == expected);
+        n++;
+    }
+    assert (n == 3);
+    std::string_view value;
+    assert (txt.find ("uuid", value) && value == "12345678-0000-0000-0000-000000000000");
+    assert (txt.find ("empty", value) && value.empty ());
+    assert (!txt.find ("missing", value));
+
+    // truncated or garbage frames are rejected as a whole
+    for (size_t size = 0; size < zframe_size (frame); size++) {
+        TxtFrame truncated (zframe_data (frame), size);
+        assert (!truncated.valid ());
+        assert (truncated.size () == 0);
+        assert (truncated.begin () == truncated.end ());
+    }
+    const uint8_t garbage[] = { 0xff, 0xff, 0xff, 0xff, 3, 'k', 'e', 'y' };
+    assert (!TxtFrame (garbage, sizeof (garbage)).valid ());
+    TxtFrame none ((zframe_t *) NULL);
+    assert (!none.valid ());
+
+    zframe_destroy (&frame);
+    zhash_destroy (&hash);
+
+    //  micro-benchmark: a typical IPC TXT set of 16 keys
+    {
+        zhash_t *infos = zhash_new ();
+        char key[32], val[64];
+        for (int i = 0; i < 16; i++) {
+            snprintf (key, sizeof (key), "key-%02d", i);
+            snprintf (val, sizeof (val), "value of the TXT entry number %d", i);
+            zhash_insert (infos, key, val);
+        }
+        zframe_t *packed = zhash_pack (infos);
+        const int loops = 20000;
+        std::string buffer;
+        buffer.reserve (256);
+
+        uint64_t allocs = alloc_count ();
+        int64_t start = zclock_usecs ();
+        for (int i = 0; i < loops; i++)
+            avahi_string_list_free (s_bench_unpack (packed));
+        int64_t unpack_us = zclock_usecs () - start;
+        uint64_t unpack_allocs = alloc_count () - allocs;
+
+        allocs = alloc_count ();
+        start = zclock_usecs ();
+        for (int i = 0; i < loops; i++)
+            avahi_string_list_free (s_bench_view (packed, buffer));
+        int64_t view_us = zclock_usecs () - start;
+        uint64_t view_allocs = alloc_count () - allocs;
+
+        // one string list node per key is left
+        if (alloc_counting ())
+            assert (view_allocs == uint64_t (loops) * 16);
+        if (verbose) {
+            printf ("   unpack: %.1f ns/key, %.1f allocations/message\n",
+                unpack_us * 1000.0 / (loops * 16.0), double (unpack_allocs) / loops);
+            printf ("   view:   %.1f ns/key, %.1f allocations/message\n",
+                view_us * 1000.0 / (loops * 16.0), double (view_allocs) / loops);
+        }
+        zframe_destroy (&packed);
+        zhash_destroy (&infos);
+    }
+
+    printf (" * TXT frame test: OK\n");
+}
@@ -0,0 +1,100 @@
+/*
+ *   =========================================================================
+ *    Copyright (C) 2014 - 2020 Eaton
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *   =========================================================================
+ */
+
+/*
+ * File:   txt_frame.h
+ *
+ * Read-only view of a TXT set packed by zhash_pack(), walked in place:
+ * keys and values are string views into the frame, nothing is copied nor
+ * allocated. The frame must outlive the view.
+ *
+ * zhash_pack() format, integers in network order:
+ *      4 bytes     number of entries
+ *      per entry   1 byte key length, key, 4 bytes value length, value
+ */
+
+#ifndef TXT_FRAME_H
+#define TXT_FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+#include <czmq.h>
+
+class TxtFrame {
+public:
+    struct Entry {
+        std::string_view key;
+        std::string_view value;
+    };
+
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Entry value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Entry* pointer;
+        typedef const Entry& reference;
+
+        const Entry& operator*() const { return _entry; }
+        const Entry* operator->() const { return &_entry; }
+        const_iterator& operator++() { _remaining--; decode(); return *this; }
+        bool operator==(const const_iterator& other) const { return _remaining == other._remaining; }
+        bool operator!=(const const_iterator& other) const { return _remaining != other._remaining; }
+
+    private:
+        friend class TxtFrame;
+        const_iterator(const uint8_t* cursor, size_t remaining) : _cursor(cursor), _remaining(remaining) { decode(); }
+        void decode();
+
+        const uint8_t* _cursor;
+        size_t _remaining;
+        Entry _entry;
+    };
+
+    TxtFrame(const void* data, size_t size);
+    explicit TxtFrame(zframe_t* frame);
+
+    // the whole frame is checked once on construction
+    bool valid() const { return _valid; }
+    // number of entries, 0 if not valid
+    size_t size() const { return _count; }
+    bool empty() const { return _count == 0; }
+
+    const_iterator begin() const { return const_iterator(_valid ? _data + 4 : nullptr, _count); }
+    const_iterator end() const { return const_iterator(nullptr, 0); }
+
+    // linear lookup, TXT sets are small
+    bool find(std::string_view key, std::string_view& value) const;
+
+private:
+    void check(size_t size);
+
+    const uint8_t* _data;
+    size_t _count = 0;
+    bool _valid = false;
+};
+
+//  Self test of this class.
+void txt_frame_test (bool verbose);
+
+#endif
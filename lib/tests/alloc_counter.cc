@@ -0,0 +1,70 @@
+/*  ========================================================================
+    Copyright (C) 2020 Eaton
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    ========================================================================
+*/
+
+//  malloc interposer of the test binary: counts heap allocations for the
+//  allocation checks of the selftests, then hands over to glibc
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "../src/alloc_counter.h"
+
+extern "C" {
+void *__libc_malloc (size_t size);
+void *__libc_calloc (size_t nmemb, size_t size);
+void *__libc_realloc (void *ptr, size_t size);
+void __libc_free (void *ptr);
+}
+
+static std::atomic<uint64_t> s_allocations (0);
+
+extern "C" void *
+malloc (size_t size)
+{
+    s_allocations.fetch_add (1, std::memory_order_relaxed);
+    return __libc_malloc (size);
+}
+
+extern "C" void *
+calloc (size_t nmemb, size_t size)
+{
+    s_allocations.fetch_add (1, std::memory_order_relaxed);
+    return __libc_calloc (nmemb, size);
+}
+
+extern "C" void *
+realloc (void *ptr, size_t size)
+{
+    s_allocations.fetch_add (1, std::memory_order_relaxed);
+    return __libc_realloc (ptr, size);
+}
+
+extern "C" void
+free (void *ptr)
+{
+    __libc_free (ptr);
+}
+
+uint64_t alloc_count ()
+{
+    return s_allocations.load (std::memory_order_relaxed);
+}
+
+bool alloc_counting ()
+{
+    return true;
+}
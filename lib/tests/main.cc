@@ -27,7 +27,29 @@ typedef struct {
 
 static test_item_t
 all_tests [] = {
+    { "publish_policy", publish_policy_test },
+    { "service_subtypes", service_subtypes_test },
+    { "link_monitor", link_monitor_test },
     { "avahi_wrapper", avahi_wrapper_test },
+    { "avahi_zloop_poll", avahi_zloop_poll_test },
+    { "recording_publisher", recording_publisher_test },
+    { "mdns_message", mdns_message_test },
+    { "mdns_socket", mdns_socket_test },
+    { "mdns_responder", mdns_responder_test },
+    { "txt_frame", txt_frame_test },
+    { "txt_arena", txt_arena_test },
+    { "txt_budget", txt_budget_test },
+    { "msg_view", msg_view_test },
+    { "announce_fingerprint", announce_fingerprint_test },
+    { "announce_state", announce_state_test },
+    { "announce_metrics", announce_metrics_test },
+    { "commit_scheduler", commit_scheduler_test },
+    { "announce_jitter", announce_jitter_test },
+    { "discovery_cache", discovery_cache_test },
+    { "discovery_journal", discovery_journal_test },
+    { "resolver_pool", resolver_pool_test },
+    { "avahi_browser", avahi_browser_test },
+    { "mdns_listener", mdns_listener_test },
     { "fty_mdns_sd_server", fty_mdns_sd_server_test },
     {NULL, NULL}          //  Sentinel
 };